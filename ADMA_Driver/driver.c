@@ -87,6 +87,30 @@ static NTSTATUS GetPollModeParameter(IN PULONG pollMode) {
     return status;
 }
 
+// Get an optional ULONG driver parameter from the Windows registry, falls back to defaultValue
+static ULONG GetDriverParameter(IN PCUNICODE_STRING valueName, IN ULONG defaultValue) {
+    WDFDRIVER driver = WdfGetDriver();
+    WDFKEY key;
+    ULONG value = defaultValue;
+    NTSTATUS status = WdfDriverOpenParametersRegistryKey(driver, STANDARD_RIGHTS_ALL,
+                                                         WDF_NO_OBJECT_ATTRIBUTES, &key);
+    if (!NT_SUCCESS(status)) {
+        TraceWarning(DBG_INIT, "WdfDriverOpenParametersRegistryKey failed: %!STATUS!", status);
+        return defaultValue;
+    }
+
+    status = WdfRegistryQueryULong(key, valueName, &value);
+    if (!NT_SUCCESS(status)) {
+        TraceInfo(DBG_INIT, "%wZ not set, using default %u", valueName, defaultValue);
+        value = defaultValue;
+    }
+
+    TraceVerbose(DBG_INIT, "%wZ=%u", valueName, value);
+
+    WdfRegistryClose(key);
+    return value;
+}
+
 // main entry point - Called when driver is installed
 NTSTATUS DriverEntry(IN PDRIVER_OBJECT driverObject, IN PUNICODE_STRING registryPath) {
     NTSTATUS			status = STATUS_SUCCESS;
@@ -173,6 +197,15 @@ NTSTATUS EvtDeviceAdd(IN WDFDRIVER Driver, IN PWDFDEVICE_INIT DeviceInit) {
         return status;
     }
 
+    WDF_OBJECT_ATTRIBUTES lockAttributes;
+    WDF_OBJECT_ATTRIBUTES_INIT(&lockAttributes);
+    lockAttributes.ParentObject = device;
+    status = WdfWaitLockCreate(&lockAttributes, &(GetDeviceContext(device)->descModeLock));
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "WdfWaitLockCreate failed: %!STATUS!", status);
+        return status;
+    }
+
     // Create a user-space device interface
     status = WdfDeviceCreateDeviceInterface(device, (LPGUID)&GUID_DEVINTERFACE_ADMA, NULL);
     if (!NT_SUCCESS(status)) {
@@ -218,12 +251,69 @@ NTSTATUS EvtDevicePrepareHardware(IN WDFDEVICE device, IN WDFCMRESLIST Resources
     DeviceContext* ctx = GetDeviceContext(device);
 	PADMA_DEVICE adma = &(ctx->adma);
 
-	status = ADMA_DeviceOpen(device, adma, Resources, ResourcesTranslated);
+	// the dma ips cannot be probed for further channels, NUM_CHANNELS says how many there are
+	// and CHANNEL_STRIDE how far apart the modular sgdma dispatchers are
+	DECLARE_CONST_UNICODE_STRING(numChannelsName, L"NUM_CHANNELS");
+	DECLARE_CONST_UNICODE_STRING(channelStrideName, L"CHANNEL_STRIDE");
+	ULONG numChannels = GetDriverParameter(&numChannelsName, 1);
+	ULONG channelStride = GetDriverParameter(&channelStrideName, MODULAR_SGDMA_CHANNEL_OFFSET);
+
+	status = ADMA_DeviceOpen(device, adma, numChannels, channelStride, Resources,
+							 ResourcesTranslated);
 	if (!NT_SUCCESS(status)) {
 		TraceError(DBG_INIT, "ADMA_DeviceOpen failed: %!STATUS!", status);
 		return status;
 	}
 
+	// engines stay interrupt driven unless the optional POLL_MODE parameter says otherwise,
+	// IOCTL_ADMA_POLLMODE_SET switches them at run time
+	ULONG pollMode = 0;
+	if (!NT_SUCCESS(GetPollModeParameter(&pollMode))) {
+		pollMode = 0;
+	}
+	for (UINT dir = H2C; dir < 2; dir++) { // 0=H2C, 1=C2H
+		for (ULONG ch = 0; ch < ADMA_MAX_NUM_CHANNELS; ch++) {
+			ADMA_EngineSetPollMode(&(adma->engines[ch][dir]), (BOOLEAN)pollMode);
+		}
+	}
+
+	// transfers up to LITE_THRESHOLD bytes are copied through the engines' lite buffers, the
+	// modular sgdma has none and stays on the full descriptor path
+	DECLARE_CONST_UNICODE_STRING(liteThresholdName, L"LITE_THRESHOLD");
+	ULONG liteThreshold = GetDriverParameter(&liteThresholdName, ADMA_LITE_DEFAULT_THRESHOLD);
+	for (UINT dir = H2C; dir < 2; dir++) { // 0=H2C, 1=C2H
+		for (ULONG ch = 0; ch < ADMA_MAX_NUM_CHANNELS; ch++) {
+			if (adma->engines[ch][dir].enabled == TRUE) {
+				(void)ADMA_EngineSetLiteThreshold(&(adma->engines[ch][dir]), liteThreshold);
+			}
+		}
+	}
+
+	// C2H engines in the optional C2H_STREAM channel mask capture continuously into a ring, all
+	// of them read their stream from card address C2H_STREAM_ADDR
+	DECLARE_CONST_UNICODE_STRING(streamName, L"C2H_STREAM");
+	ULONG streamMask = GetDriverParameter(&streamName, 0);
+#if defined(ALTERA_ARRIA10)
+	DECLARE_CONST_UNICODE_STRING(streamAddrName, L"C2H_STREAM_ADDR");
+	ULONG streamAddr = GetDriverParameter(&streamAddrName, 0);
+	for (ULONG ch = 0; ch < ADMA_MAX_NUM_CHANNELS; ch++) {
+		ADMA_ENGINE* engine = &(adma->engines[ch][C2H]);
+		if ((streamMask & BIT_N(ch)) && (engine->enabled == TRUE)) {
+			status = ADMA_EngineSetStream(engine, streamAddr);
+			if (!NT_SUCCESS(status)) {
+				TraceError(DBG_INIT, "ADMA_EngineSetStream() failed: %!STATUS!", status);
+				return status;
+			}
+		}
+	}
+#else
+	// the modular sgdma has no streaming ring, its C2H engines keep transferring per read
+	if (streamMask != 0) {
+		TraceWarning(DBG_INIT, "C2H_STREAM=0x%x ignored, streaming needs the Arria10 descriptor controller",
+			streamMask);
+	}
+#endif
+
 	// create a queue for each engine
 	for (UINT dir = H2C; dir < 2; dir++) { // 0=H2C, 1=C2H
 		for (ULONG ch = 0; ch < ADMA_MAX_NUM_CHANNELS; ch++) {
@@ -268,8 +358,20 @@ NTSTATUS EngineCreateQueue(WDFDEVICE device, ADMA_ENGINE* engine, WDFQUEUE* queu
 
 	PAGED_CODE();
 
+#if defined(ALTERA_ARRIA10)
+	if (engine->type == EngineType_ST) {
+		// readers of the streaming ring take turns
+		WDF_IO_QUEUE_CONFIG_INIT(&config, WdfIoQueueDispatchSequential);
+	}
+	else {
+		// engine queue presents as many requests as the descriptor ring keeps in flight
+		WDF_IO_QUEUE_CONFIG_INIT(&config, WdfIoQueueDispatchParallel);
+		config.Settings.Parallel.NumberOfPresentedRequests = ADMA_DESC_RING_MAX_REQUESTS;
+	}
+#else
 	// engine queue is sequential
 	WDF_IO_QUEUE_CONFIG_INIT(&config, WdfIoQueueDispatchSequential);
+#endif
 
 	ASSERTMSG("direction is neither H2C nor C2H!", (engine->dir == C2H) || (engine->dir == H2C));
 	if (engine->dir == H2C) { // callback handler for write requests
@@ -277,8 +379,14 @@ NTSTATUS EngineCreateQueue(WDFDEVICE device, ADMA_ENGINE* engine, WDFQUEUE* queu
 		TraceInfo(DBG_INIT, "EvtIoWrite=EvtIoWriteDma");
 	}
 	else if (engine->dir == C2H) { // callback handler for read requests
-		config.EvtIoRead = EvtIoReadDma;
-		TraceInfo(DBG_INIT, "EvtIoRead=EvtIoReadDma");
+		if (engine->type == EngineType_ST) {
+			config.EvtIoRead = EvtIoReadEngineRing;
+			TraceInfo(DBG_INIT, "EvtIoRead=EvtIoReadEngineRing");
+		}
+		else {
+			config.EvtIoRead = EvtIoReadDma;
+			TraceInfo(DBG_INIT, "EvtIoRead=EvtIoReadDma");
+		}
 	}
 
 	// serialize all callbacks related to this queue. see ref [2]
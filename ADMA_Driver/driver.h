@@ -34,6 +34,7 @@ typedef enum {//add by zhuce
 typedef struct DeviceContext_t {
     //XDMA_DEVICE xdma;
     WDFQUEUE engineQueue[2][ADMA_MAX_NUM_CHANNELS];
+    WDFWAITLOCK descModeLock; // serializes descriptor mode switches, see IoctlSetDescMode()
     KEVENT eventSignals[ADMA_MAX_USER_IRQ];
 
 	XADMA_TYPE xadmaType;
@@ -50,6 +50,12 @@ const static struct {
 } FileNameLUT[] = {
 	{ DEVNODE_TYPE_AH2C,         ADMA_FILE_H2C_0,        0 },
 	{ DEVNODE_TYPE_AC2H,         ADMA_FILE_C2H_0,        0 },
+	{ DEVNODE_TYPE_AH2C,         ADMA_FILE_H2C_1,        1 },
+	{ DEVNODE_TYPE_AC2H,         ADMA_FILE_C2H_1,        1 },
+	{ DEVNODE_TYPE_AH2C,         ADMA_FILE_H2C_2,        2 },
+	{ DEVNODE_TYPE_AC2H,         ADMA_FILE_C2H_2,        2 },
+	{ DEVNODE_TYPE_AH2C,         ADMA_FILE_H2C_3,        3 },
+	{ DEVNODE_TYPE_AC2H,         ADMA_FILE_C2H_3,        3 },
 	{ DEVNODE_TYPE_USER,         ADMA_FILE_USER,         0 },
 	{ DEVNODE_TYPE_CONTROL,      ADMA_FILE_CONTROL,      0 },
 };
@@ -133,11 +139,7 @@ VOID EvtDeviceFileCreate(IN WDFDEVICE device, IN WDFREQUEST Request, IN WDFFILEO
         devNode->u.engine = engine;
         devNode->queue = ctx->engineQueue[dir][index];
         TraceVerbose(DBG_IO, "pollMode=%u", devNode->u.engine->poll);
-        if (devNode->u.engine->poll) {
-            EngineDisableInterrupt(devNode->u.engine);
-        } else {
-            EngineEnableInterrupt(devNode->u.engine);
-        }
+        EngineSetInterrupt(devNode->u.engine, !devNode->u.engine->poll);
         break;
     }
 	case DEVNODE_TYPE_AH2C:
@@ -153,6 +155,10 @@ VOID EvtDeviceFileCreate(IN WDFDEVICE device, IN WDFREQUEST Request, IN WDFFILEO
 			goto ErrExit;
 		}
 
+		if ((engine->type == EngineType_ST) && (dir == C2H)) {
+			EngineRingSetup(engine);
+		}
+
 		devNode->u.engine = engine;
 		devNode->queue = ctx->engineQueue[dir][index];
 #if 0//currently not support this feature
@@ -187,7 +193,7 @@ VOID EvtFileClose(IN WDFFILEOBJECT FileObject) {
 VOID EvtFileCleanup(IN WDFFILEOBJECT FileObject) {
     PUNICODE_STRING fileName = WdfFileObjectGetFileName(FileObject);
     PFILE_CONTEXT file = GetFileContext(FileObject);
-    if (file->devType == DEVNODE_TYPE_C2H) {
+    if ((file->devType == DEVNODE_TYPE_C2H) || (file->devType == DEVNODE_TYPE_AC2H)) {
         if (file->u.engine->type == EngineType_ST) {
             EngineRingTeardown(file->u.engine);
         }
@@ -427,7 +433,7 @@ VOID EvtIoWrite(IN WDFQUEUE queue, IN WDFREQUEST request, IN size_t length)
     return; // request has been either completed directly or forwarded to a queue
 }
 
-static NTSTATUS IoctlGetPerf(IN WDFREQUEST request, IN ADMA_ENGINE* engine) {
+static NTSTATUS IoctlGetPerf(IN WDFREQUEST request, IN ADMA_ENGINE* engine, OUT size_t* length) {
 
     ASSERT(engine != NULL);
     ADMA_PERF_DATA perfData = { 0 };
@@ -441,8 +447,203 @@ static NTSTATUS IoctlGetPerf(IN WDFREQUEST request, IN ADMA_ENGINE* engine) {
         return status;
     }
 
+    // older callers only pass the three time counters
+    size_t bufferSize;
+    WdfMemoryGetBuffer(requestMemory, &bufferSize);
+    if (bufferSize < FIELD_OFFSET(ADMA_PERF_DATA, bytes)) {
+        TraceError(DBG_IO, "output buffer of %llu bytes too small", bufferSize);
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+    *length = min(bufferSize, sizeof(perfData));
+
     // copy from perfData into request memory
-    status = WdfMemoryCopyFromBuffer(requestMemory, 0, &perfData, sizeof(perfData));
+    status = WdfMemoryCopyFromBuffer(requestMemory, 0, &perfData, *length);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfMemoryCopyFromBuffer failed: %!STATUS!", status);
+        return status;
+    }
+
+    return status;
+}
+
+static NTSTATUS IoctlGetA2p(IN WDFREQUEST request, IN ADMA_ENGINE* engine) {
+
+    ASSERT(engine != NULL);
+    ADMA_A2P_STATS stats = { 0 };
+    EngineGetA2pStats(engine, &stats);
+
+    // get handle to the IO request memory which will hold the read data
+    WDFMEMORY requestMemory;
+    NTSTATUS status = WdfRequestRetrieveOutputMemory(request, &requestMemory);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputMemory failed: %!STATUS!", status);
+        return status;
+    }
+
+    // copy from stats into request memory
+    status = WdfMemoryCopyFromBuffer(requestMemory, 0, &stats, sizeof(stats));
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfMemoryCopyFromBuffer failed: %!STATUS!", status);
+        return status;
+    }
+
+    return status;
+}
+
+static NTSTATUS IoctlGetProgram(IN WDFREQUEST request, IN ADMA_ENGINE* engine) {
+
+    ASSERT(engine != NULL);
+    ADMA_PROGRAM_STATS stats = { 0 };
+    EngineGetProgramStats(engine, &stats);
+
+    // get handle to the IO request memory which will hold the read data
+    WDFMEMORY requestMemory;
+    NTSTATUS status = WdfRequestRetrieveOutputMemory(request, &requestMemory);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputMemory failed: %!STATUS!", status);
+        return status;
+    }
+
+    // copy from stats into request memory
+    status = WdfMemoryCopyFromBuffer(requestMemory, 0, &stats, sizeof(stats));
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfMemoryCopyFromBuffer failed: %!STATUS!", status);
+        return status;
+    }
+
+    return status;
+}
+
+static NTSTATUS IoctlSetDescMode(IN WDFREQUEST request, IN WDFQUEUE engineQueue,
+                                 IN ADMA_ENGINE* engine) {
+
+    ASSERT(engine != NULL);
+
+    WDFMEMORY requestMemory;
+    NTSTATUS status = WdfRequestRetrieveInputMemory(request, &requestMemory);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputMemory failed: %!STATUS!", status);
+        return status;
+    }
+    ULONG descMode = 0;
+
+    status = WdfMemoryCopyToBuffer(requestMemory, 0, &descMode, sizeof(descMode));
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfMemoryCopyToBuffer failed: %!STATUS!", status);
+        return status;
+    }
+
+    // the mode is the channel's, H2C and C2H feed the same dispatcher. no transfer may start
+    // between the idle check and the switch: stop both engine queues, which waits for the
+    // requests in flight, and keep concurrent switches of other files out
+    DeviceContext* ctx = GetDeviceContext(WdfIoQueueGetDevice(engineQueue));
+    WdfWaitLockAcquire(ctx->descModeLock, NULL);
+    for (UINT dir = H2C; dir < ADMA_NUM_DIRECTIONS; dir++) {
+        if (ctx->engineQueue[dir][engine->channel] != NULL) {
+            WdfIoQueueStopSynchronously(ctx->engineQueue[dir][engine->channel]);
+        }
+    }
+    status = ADMA_EngineSetDescMode(engine, descMode);
+    for (UINT dir = H2C; dir < ADMA_NUM_DIRECTIONS; dir++) {
+        if (ctx->engineQueue[dir][engine->channel] != NULL) {
+            WdfIoQueueStart(ctx->engineQueue[dir][engine->channel]);
+        }
+    }
+    WdfWaitLockRelease(ctx->descModeLock);
+    TraceVerbose(DBG_IO, "descMode=%u: %!STATUS!", descMode, status);
+
+    return status;
+}
+
+static NTSTATUS IoctlSetPollMode(IN WDFREQUEST request, IN ADMA_ENGINE* engine) {
+
+    ASSERT(engine != NULL);
+
+    WDFMEMORY requestMemory;
+    NTSTATUS status = WdfRequestRetrieveInputMemory(request, &requestMemory);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputMemory failed: %!STATUS!", status);
+        return status;
+    }
+    ADMA_POLL_MODE pollMode = { 0 };
+
+    status = WdfMemoryCopyToBuffer(requestMemory, 0, &pollMode, sizeof(pollMode));
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfMemoryCopyToBuffer failed: %!STATUS!", status);
+        return status;
+    }
+
+    ADMA_EngineSetPollMode(engine, pollMode.enable != 0);
+    ADMA_EngineSetPollBudget(engine, pollMode.budgetUs);
+    TraceVerbose(DBG_IO, "pollMode=%u budget=%uus", pollMode.enable, engine->pollBudgetUs);
+
+    return status;
+}
+
+static NTSTATUS IoctlGetPoll(IN WDFREQUEST request, IN ADMA_ENGINE* engine) {
+
+    ASSERT(engine != NULL);
+    ADMA_POLL_STATS stats = { 0 };
+    EngineGetPollStats(engine, &stats);
+
+    // get handle to the IO request memory which will hold the read data
+    WDFMEMORY requestMemory;
+    NTSTATUS status = WdfRequestRetrieveOutputMemory(request, &requestMemory);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputMemory failed: %!STATUS!", status);
+        return status;
+    }
+
+    // copy from stats into request memory
+    status = WdfMemoryCopyFromBuffer(requestMemory, 0, &stats, sizeof(stats));
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfMemoryCopyFromBuffer failed: %!STATUS!", status);
+        return status;
+    }
+
+    return status;
+}
+
+static NTSTATUS IoctlSetLite(IN WDFREQUEST request, IN ADMA_ENGINE* engine) {
+
+    ASSERT(engine != NULL);
+
+    WDFMEMORY requestMemory;
+    NTSTATUS status = WdfRequestRetrieveInputMemory(request, &requestMemory);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputMemory failed: %!STATUS!", status);
+        return status;
+    }
+    ULONG threshold = 0;
+
+    status = WdfMemoryCopyToBuffer(requestMemory, 0, &threshold, sizeof(threshold));
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfMemoryCopyToBuffer failed: %!STATUS!", status);
+        return status;
+    }
+
+    status = ADMA_EngineSetLiteThreshold(engine, threshold);
+    TraceVerbose(DBG_IO, "liteThreshold=%u: %!STATUS!", threshold, status);
+
+    return status;
+}
+
+static NTSTATUS IoctlGetLite(IN WDFREQUEST request, IN ADMA_ENGINE* engine) {
+
+    ASSERT(engine != NULL);
+    ADMA_LITE_STATS stats = { 0 };
+    EngineGetLiteStats(engine, &stats);
+
+    // get handle to the IO request memory which will hold the read data
+    WDFMEMORY requestMemory;
+    NTSTATUS status = WdfRequestRetrieveOutputMemory(request, &requestMemory);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputMemory failed: %!STATUS!", status);
+        return status;
+    }
+
+    // copy from stats into request memory
+    status = WdfMemoryCopyFromBuffer(requestMemory, 0, &stats, sizeof(stats));
     if (!NT_SUCCESS(status)) {
         TraceError(DBG_IO, "WdfMemoryCopyFromBuffer failed: %!STATUS!", status);
         return status;
@@ -536,14 +737,24 @@ VOID EvtIoDeviceControl(IN WDFQUEUE Queue, IN WDFREQUEST request, IN size_t Outp
         status = STATUS_SUCCESS;
         WdfRequestComplete(request, status);
         break;
+    case IOCTL_ADMA_PERF_STOP:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_ADMA_PERF_STOP",
+                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
+        EngineStopPerf(queue->engine);
+        status = STATUS_SUCCESS;
+        WdfRequestComplete(request, status);
+        break;
     case IOCTL_ADMA_PERF_GET:
+    {
         TraceInfo(DBG_IO, "%s_%u IOCTL_ADMA_PERF_GET",
                   queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
-        status = IoctlGetPerf(request, queue->engine);
+        size_t length = 0;
+        status = IoctlGetPerf(request, queue->engine, &length);
         if (NT_SUCCESS(status)) {
-            WdfRequestCompleteWithInformation(request, status, sizeof(ADMA_PERF_DATA));
+            WdfRequestCompleteWithInformation(request, status, length);
         }
         break;
+    }
     case IOCTL_ADMA_ADDRMODE_GET:
         TraceInfo(DBG_IO, "%s_%u IOCTL_ADMA_ADDRMODE_GET",
                   queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
@@ -560,6 +771,62 @@ VOID EvtIoDeviceControl(IN WDFQUEUE Queue, IN WDFREQUEST request, IN size_t Outp
             WdfRequestComplete(request, STATUS_SUCCESS);
         }
         break;
+    case IOCTL_ADMA_A2P_GET:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_ADMA_A2P_GET",
+                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
+        status = IoctlGetA2p(request, queue->engine);
+        if (NT_SUCCESS(status)) {
+            WdfRequestCompleteWithInformation(request, status, sizeof(ADMA_A2P_STATS));
+        }
+        break;
+    case IOCTL_ADMA_DESCMODE_SET:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_ADMA_DESCMODE_SET",
+                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
+        status = IoctlSetDescMode(request, file->queue, queue->engine);
+        if (NT_SUCCESS(status)) {
+            WdfRequestComplete(request, STATUS_SUCCESS);
+        }
+        break;
+    case IOCTL_ADMA_PROGRAM_GET:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_ADMA_PROGRAM_GET",
+                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
+        status = IoctlGetProgram(request, queue->engine);
+        if (NT_SUCCESS(status)) {
+            WdfRequestCompleteWithInformation(request, status, sizeof(ADMA_PROGRAM_STATS));
+        }
+        break;
+    case IOCTL_ADMA_POLLMODE_SET:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_ADMA_POLLMODE_SET",
+                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
+        status = IoctlSetPollMode(request, queue->engine);
+        if (NT_SUCCESS(status)) {
+            WdfRequestComplete(request, STATUS_SUCCESS);
+        }
+        break;
+    case IOCTL_ADMA_POLL_GET:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_ADMA_POLL_GET",
+                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
+        status = IoctlGetPoll(request, queue->engine);
+        if (NT_SUCCESS(status)) {
+            WdfRequestCompleteWithInformation(request, status, sizeof(ADMA_POLL_STATS));
+        }
+        break;
+    case IOCTL_ADMA_LITE_SET:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_ADMA_LITE_SET",
+                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
+        status = IoctlSetLite(request, queue->engine);
+        if (NT_SUCCESS(status)) {
+            WdfRequestComplete(request, STATUS_SUCCESS);
+        }
+        break;
+    case IOCTL_ADMA_LITE_GET:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_ADMA_LITE_GET",
+                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
+        status = IoctlGetLite(request, queue->engine);
+        if (NT_SUCCESS(status)) {
+            WdfRequestCompleteWithInformation(request, status, sizeof(ADMA_LITE_STATS));
+        }
+        break;
     default:
         TraceError(DBG_IO, "Unknown IOCTL code!");
         status = STATUS_NOT_SUPPORTED;
@@ -573,6 +840,24 @@ exit:
     TraceVerbose(DBG_IO, "exit with status: %!STATUS!", status);
 }
 
+static WDFDMATRANSACTION DmaTransactionAcquire(IN ADMA_ENGINE* engine) {
+#if defined(ALTERA_ARRIA10)
+    // requests share the descriptor ring, each one in flight brings its own transaction
+    return EngineAcquireTransaction(engine);
+#else
+    return engine->dmaTransaction;
+#endif
+}
+
+static VOID DmaTransactionRelease(IN ADMA_ENGINE* engine, IN WDFDMATRANSACTION transaction) {
+#if defined(ALTERA_ARRIA10)
+    EngineReleaseTransaction(engine, transaction);
+#else
+    UNREFERENCED_PARAMETER(engine);
+    UNREFERENCED_PARAMETER(transaction);
+#endif
+}
+
 VOID EvtIoWriteDma(IN WDFQUEUE wdfQueue, IN WDFREQUEST Request, IN size_t length)
 // callback for when a write I/O request enters the SGDMA write queue
 {
@@ -587,22 +872,57 @@ VOID EvtIoWriteDma(IN WDFQUEUE wdfQueue, IN WDFREQUEST Request, IN size_t length
     TraceInfo(DBG_IO, "%s_%u writing %llu bytes to device",
               DirectionToString(engine->dir), engine->channel, length);
 
+#if defined(ALTERA_ARRIA10)
+    if ((length % sizeof(UINT32)) != 0) { // arria10 descriptors count dwords
+        status = STATUS_INVALID_PARAMETER;
+        TraceError(DBG_IO, "length %llu is not a dword multiple: %!STATUS!", length, status);
+        WdfRequestComplete(Request, status);
+        return;
+    }
+#endif
+
+    if (length <= engine->lite.stats.threshold) { // small transfer - bypass the dma transaction
+        status = EngineLiteTransfer(engine, Request, length);
+        if (NT_SUCCESS(status)) {
+            if (engine->poll) {
+                EnginePollTransfer(engine);
+            }
+            return;
+        }
+        // no free lite slot, take the full descriptor path
+    }
+
+    WDFDMATRANSACTION transaction = DmaTransactionAcquire(engine);
+    if (transaction == NULL) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        TraceError(DBG_IO, "no free dma transaction: %!STATUS!", status);
+        WdfRequestComplete(Request, status);
+        return;
+    }
+
     // initialize a DMA transaction from the request 
-    status = WdfDmaTransactionInitializeUsingRequest(queue->engine->dmaTransaction, Request,
+    status = WdfDmaTransactionInitializeUsingRequest(transaction, Request,
                                                      ADMA_EngineProgramDma,
                                                      WdfDmaDirectionWriteToDevice);
     if (!NT_SUCCESS(status)) {
         TraceError(DBG_IO, "WdfDmaTransactionInitializeUsingRequest failed: %!STATUS!", status);
         goto ErrExit;
     }
+#if !defined(ALTERA_ARRIA10) // descriptors handed to the arria10 ring cannot be withdrawn
     status = WdfRequestMarkCancelableEx(Request, EvtCancelDma);
     if (!NT_SUCCESS(status)) {
         TraceError(DBG_IO, "WdfRequestMarkCancelableEx failed: %!STATUS!", status);
         goto ErrExit;
     }
+#endif
 
     // supply the Queue as context for EvtProgramDma 
-    status = WdfDmaTransactionExecute(queue->engine->dmaTransaction, queue->engine);
+    status = WdfDmaTransactionExecute(transaction, queue->engine);
+#if !defined(ALTERA_ARRIA10)
+    if (EngineCompleteProgramError(engine)) {
+        return; // the dispatcher took no descriptors, the request failed
+    }
+#endif
     if (!NT_SUCCESS(status)) {
         TraceError(DBG_IO, "WdfDmaTransactionExecute failed: %!STATUS!", status);
         goto ErrExit;
@@ -618,7 +938,8 @@ VOID EvtIoWriteDma(IN WDFQUEUE wdfQueue, IN WDFREQUEST Request, IN size_t length
 
     return; // success
 ErrExit:
-    WdfDmaTransactionRelease(queue->engine->dmaTransaction);
+    WdfDmaTransactionRelease(transaction);
+    DmaTransactionRelease(engine, transaction);
     WdfRequestComplete(Request, status);
     TraceError(DBG_IO, "Error Request 0x%p: %!STATUS!", Request, status);
 }
@@ -636,8 +957,36 @@ VOID EvtIoReadDma(IN WDFQUEUE wdfQueue, IN WDFREQUEST Request, IN size_t length)
     TraceInfo(DBG_IO, "%s_%u reading %llu bytes from device",
               DirectionToString(engine->dir), engine->channel, length);
 
+#if defined(ALTERA_ARRIA10)
+    if ((length % sizeof(UINT32)) != 0) { // arria10 descriptors count dwords
+        status = STATUS_INVALID_PARAMETER;
+        TraceError(DBG_IO, "length %llu is not a dword multiple: %!STATUS!", length, status);
+        WdfRequestComplete(Request, status);
+        return;
+    }
+#endif
+
+    if (length <= engine->lite.stats.threshold) { // small transfer - bypass the dma transaction
+        status = EngineLiteTransfer(engine, Request, length);
+        if (NT_SUCCESS(status)) {
+            if (engine->poll) {
+                EnginePollTransfer(engine);
+            }
+            return;
+        }
+        // no free lite slot, take the full descriptor path
+    }
+
+    WDFDMATRANSACTION transaction = DmaTransactionAcquire(engine);
+    if (transaction == NULL) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        TraceError(DBG_IO, "no free dma transaction: %!STATUS!", status);
+        WdfRequestComplete(Request, status);
+        return;
+    }
+
     // initialize a DMA transaction from the request
-    status = WdfDmaTransactionInitializeUsingRequest(queue->engine->dmaTransaction, Request,
+    status = WdfDmaTransactionInitializeUsingRequest(transaction, Request,
                                                      ADMA_EngineProgramDma,
                                                      WdfDmaDirectionReadFromDevice);
     if (!NT_SUCCESS(status)) {
@@ -645,19 +994,26 @@ VOID EvtIoReadDma(IN WDFQUEUE wdfQueue, IN WDFREQUEST Request, IN size_t length)
                    status);
         goto ErrExit;
     }
+#if !defined(ALTERA_ARRIA10) // descriptors handed to the arria10 ring cannot be withdrawn
     status = WdfRequestMarkCancelableEx(Request, EvtCancelDma);
     if (!NT_SUCCESS(status)) {
         TraceError(DBG_IO, "WdfRequestMarkCancelableEx failed: %!STATUS!", status);
         goto ErrExit;
     }
+#endif
 
     // supply the Queue as context for EvtProgramDma
-    status = WdfDmaTransactionExecute(queue->engine->dmaTransaction, queue->engine);
+    status = WdfDmaTransactionExecute(transaction, queue->engine);
+#if !defined(ALTERA_ARRIA10)
+    if (EngineCompleteProgramError(engine)) {
+        return; // the dispatcher took no descriptors, the request failed
+    }
+#endif
     if (!NT_SUCCESS(status)) {
         TraceError(DBG_IO, "WdfDmaTransactionExecute failed: %!STATUS!", status);
         goto ErrExit;
     }
-#if 0//adma hasn't this feature
+
     if (queue->engine->poll) {
         status = EnginePollTransfer(queue->engine);
         if (!NT_SUCCESS(status)) {
@@ -665,10 +1021,11 @@ VOID EvtIoReadDma(IN WDFQUEUE wdfQueue, IN WDFREQUEST Request, IN size_t length)
             // EnginePollTransfer cleans-up/completes request on error, so no need for goto ErrExit
         }
     }
-#endif
+
     return; // success
 ErrExit:
-    WdfDmaTransactionRelease(queue->engine->dmaTransaction);
+    WdfDmaTransactionRelease(transaction);
+    DmaTransactionRelease(engine, transaction);
     WdfRequestComplete(Request, status);
     TraceError(DBG_IO, "Error Request 0x%p: %!STATUS!", Request, status);
 }
@@ -0,0 +1,123 @@
+/*
+* adma_ring_sim - Arria10 descriptor ring simulation
+* ==================================================
+*
+* Copyright 2018 Qinger Inc.
+*
+* Maintainer:
+* -----------
+* zhuce <qingermaker@sina.com>
+*
+* Description:
+* ------------
+* Runs the descriptor ring accounting of libadma (adma_desc_ring.c) against a simulated Arria10
+* descriptor controller on the host. The controller walks the table from its current position up
+* to the last pointer and writes the done bit of each descriptor's status word, a random number
+* of descriptors per step. Requests of random size are submitted whenever the ring has room.
+* The simulation checks that
+*  - no descriptor is handed to a new request while hw still owns it,
+*  - the controller never runs past the last pointer,
+*  - requests are retired exactly once and in submission order,
+*  - the status words of retired descriptors are cleared.
+*
+* Usage: adma_ring_sim [requests] [seed]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "adma_desc_ring.h"
+
+#define SIM_STEP_MAX_DESC   (8U)    // descriptors the controller completes per step at most
+
+typedef struct SIM_CONTROLLER_T {
+    ULONG current;                          // next descriptor to process
+    ULONG lastPtr;                          // last pointer register
+    BOOLEAN armed;                          // lastPtr has been written since reset
+    UINT32 status[ADMA_DESC_RING_SIZE];     // ADMA_RESULT.status
+    UINT64 owner[ADMA_DESC_RING_SIZE];      // request sequence number + 1 owning a descriptor, 0 = free
+} SIM_CONTROLLER;
+
+static unsigned long errors = 0;
+
+#define CHECK(cond, ...) do { if (!(cond)) { errors++; fprintf(stderr, __VA_ARGS__); } } while (0)
+
+static void ControllerStep(SIM_CONTROLLER* hw) {
+    const ULONG budget = (ULONG)(rand() % (SIM_STEP_MAX_DESC + 1));
+    for (ULONG i = 0; i < budget; i++) {
+        if (!hw->armed || (hw->current == (hw->lastPtr + 1) % ADMA_DESC_RING_SIZE)) {
+            return; // caught up with the last pointer
+        }
+        CHECK(hw->owner[hw->current] != 0, "descriptor %u processed but not submitted\n",
+              hw->current);
+        CHECK(hw->status[hw->current] == 0, "descriptor %u status not cleared before reuse\n",
+              hw->current);
+        hw->status[hw->current] = ADMA_DESC_RING_DONE;
+        hw->current = (hw->current + 1) % ADMA_DESC_RING_SIZE;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const UINT64 numRequests = (argc > 1) ? strtoull(argv[1], NULL, 0) : 1000000ULL;
+    const unsigned seed = (argc > 2) ? (unsigned)strtoul(argv[2], NULL, 0) : 1U;
+    srand(seed);
+
+    static SIM_CONTROLLER hw;
+    memset(&hw, 0, sizeof(hw));
+    hw.lastPtr = 0xFF; // reset value
+    hw.current = 0;
+
+    ADMA_DESC_RING ring;
+    AdmaDescRingInit(&ring, hw.lastPtr);
+
+    UINT64 submitted = 0;
+    UINT64 retired = 0;
+    UINT64 descriptors = 0;
+    while (retired < numRequests) {
+        // submit while there is room, sizes up to the per request budget of the driver
+        while (submitted < numRequests) {
+            ULONG count = 1 + (ULONG)(rand() % ADMA_DESC_RING_DESC_PER_REQUEST);
+            ULONG first;
+            if (!AdmaDescRingSubmit(&ring, count, (PVOID)(uintptr_t)(submitted + 1), &first)) {
+                break;
+            }
+            for (ULONG i = 0; i < count; i++) {
+                ULONG id = (first + i) % ADMA_DESC_RING_SIZE;
+                CHECK(hw.owner[id] == 0, "descriptor %u handed out twice\n", id);
+                hw.owner[id] = submitted + 1;
+            }
+            hw.lastPtr = AdmaDescRingLastPtr(&ring);
+            hw.armed = TRUE;
+            submitted++;
+            descriptors += count;
+            if (rand() % 2) {
+                break; // let the controller run between submissions as well
+            }
+        }
+
+        ControllerStep(&hw);
+
+        // the dpc: retire everything that is done
+        PVOID context;
+        while ((context = AdmaDescRingComplete(&ring, hw.status)) != NULL) {
+            const UINT64 sequence = (UINT64)(uintptr_t)context;
+            CHECK(sequence == retired + 1, "request %llu retired, expected %llu\n",
+                  (unsigned long long)sequence, (unsigned long long)(retired + 1));
+            for (ULONG id = 0; id < ADMA_DESC_RING_SIZE; id++) {
+                if (hw.owner[id] == sequence) {
+                    CHECK(hw.status[id] == 0, "descriptor %u status not cleared\n", id);
+                    hw.owner[id] = 0;
+                }
+            }
+            retired++;
+        }
+    }
+
+    CHECK(ring.pending == 0 && ring.used == 0, "ring not empty: %u requests, %u descriptors\n",
+          ring.pending, ring.used);
+    printf("requests %llu, descriptors %llu, max in flight %u requests / %u descriptors, "
+           "errors %lu\n", (unsigned long long)retired, (unsigned long long)descriptors,
+           ring.maxPending, ring.maxUsed, errors);
+    return errors ? 1 : 0;
+}
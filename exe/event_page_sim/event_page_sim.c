@@ -0,0 +1,126 @@
+/*
+* event_page_sim - user event notification page simulation
+* ========================================================
+*
+* Copyright 2017 Xilinx Inc.
+*
+* Maintainer:
+* -----------
+* Alexander Hornburg <alexander.hornburg@xilinx.com>
+*
+* Description:
+* ------------
+* Runs the DPC side of the user event notification page (xdma_event_page.h) against spinning
+* readers on the host. One thread plays the user interrupt DPC and publishes occurrences of random
+* events, each with a timestamp which encodes the event and the occurrence number. The reader
+* threads poll the page with xdma_event_page_read() like an application does. The simulation
+* checks that
+*  - a sequence number never goes backwards,
+*  - every timestamp a reader gets belongs to the occurrence it was returned with, or to the next
+*    one which the DPC is publishing at that moment,
+*  - the occurrences a reader accounts for add up to the number published, nothing is lost.
+*
+* Usage: event_page_sim [occurrences] [readers] [seed]
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xdma_event_page.h"
+
+#define SIM_MAX_READERS     (16U)
+
+// the timestamp published for occurrence n (counting from 1) of an event
+#define SIM_TIMESTAMP(eventId, n) ((((UINT64)(n)) << 8) | (UINT64)(eventId))
+
+typedef struct SIM_READER_T {
+    pthread_t thread;
+    unsigned long long reads;
+    unsigned long long seen[XDMA_MAX_USER_EVENTS]; // occurrences accounted for, per event
+} SIM_READER;
+
+static XDMA_EVENT_PAGE page;
+static volatile int dpcDone = 0;
+static unsigned long errors = 0; // updated with __sync builtins, readers run concurrently
+
+#define CHECK(cond, ...) do { if (!(cond)) { __sync_add_and_fetch(&errors, 1); fprintf(stderr, __VA_ARGS__); } } while (0)
+
+static void ReaderPoll(SIM_READER* reader, UINT32 last[XDMA_MAX_USER_EVENTS]) {
+    for (unsigned eventId = 0; eventId < XDMA_MAX_USER_EVENTS; eventId++) {
+        UINT64 timestamp;
+        const UINT32 sequence = xdma_event_page_read(&page, eventId, &timestamp);
+        reader->reads++;
+        CHECK((int32_t)(sequence - last[eventId]) >= 0, "event %u sequence went back from %u to %u\n",
+              eventId, last[eventId], sequence);
+        if (sequence != 0) {
+            CHECK((timestamp == SIM_TIMESTAMP(eventId, sequence)) ||
+                  (timestamp == SIM_TIMESTAMP(eventId, sequence + 1)),
+                  "event %u occurrence %u returned with timestamp 0x%llx\n", eventId, sequence,
+                  (unsigned long long)timestamp);
+        } else {
+            CHECK((timestamp == 0) || (timestamp == SIM_TIMESTAMP(eventId, 1)),
+                  "event %u returned timestamp 0x%llx before its first occurrence\n", eventId,
+                  (unsigned long long)timestamp);
+        }
+        reader->seen[eventId] += (UINT32)(sequence - last[eventId]);
+        last[eventId] = sequence;
+    }
+}
+
+static void* ReaderThread(void* arg) {
+    SIM_READER* reader = (SIM_READER*)arg;
+    UINT32 last[XDMA_MAX_USER_EVENTS];
+    memset(last, 0, sizeof(last));
+    while (!dpcDone) {
+        ReaderPoll(reader, last);
+    }
+    ReaderPoll(reader, last); // pick up what was published after the last poll
+    return NULL;
+}
+
+int main(int argc, char* argv[]) {
+    const unsigned long long numOccurrences = (argc > 1) ? strtoull(argv[1], NULL, 0) : 1000000ULL;
+    unsigned numReaders = (argc > 2) ? (unsigned)strtoul(argv[2], NULL, 0) : 2U;
+    const unsigned seed = (argc > 3) ? (unsigned)strtoul(argv[3], NULL, 0) : 1U;
+    srand(seed);
+    if ((numReaders == 0) || (numReaders > SIM_MAX_READERS)) {
+        numReaders = SIM_MAX_READERS;
+    }
+
+    static SIM_READER readers[SIM_MAX_READERS];
+    memset(&page, 0, sizeof(page));
+    for (unsigned i = 0; i < numReaders; i++) {
+        if (pthread_create(&readers[i].thread, NULL, ReaderThread, &readers[i]) != 0) {
+            fprintf(stderr, "failed to start reader %u\n", i);
+            return 1;
+        }
+    }
+
+    // the dpc - the only writer of the page
+    unsigned long long published[XDMA_MAX_USER_EVENTS];
+    memset(published, 0, sizeof(published));
+    for (unsigned long long i = 0; i < numOccurrences; i++) {
+        const unsigned eventId = (unsigned)(rand() % XDMA_MAX_USER_EVENTS);
+        published[eventId]++;
+        xdma_event_page_publish(&page, eventId, SIM_TIMESTAMP(eventId, (UINT32)published[eventId]));
+    }
+    __sync_synchronize();
+    dpcDone = 1;
+
+    unsigned long long reads = 0;
+    for (unsigned i = 0; i < numReaders; i++) {
+        pthread_join(readers[i].thread, NULL);
+        reads += readers[i].reads;
+        for (unsigned eventId = 0; eventId < XDMA_MAX_USER_EVENTS; eventId++) {
+            CHECK(readers[i].seen[eventId] == published[eventId],
+                  "reader %u accounted for %llu of %llu occurrences of event %u\n", i,
+                  readers[i].seen[eventId], published[eventId], eventId);
+        }
+    }
+
+    printf("%llu occurrences, %u readers, %llu page reads, %lu errors\n", numOccurrences,
+           numReaders, reads, errors);
+    return (errors == 0) ? 0 : 1;
+}
@@ -0,0 +1,315 @@
+/*
+* layout_bench - engine layout contention benchmark
+* =================================================
+*
+* Copyright 2017 Xilinx Inc.
+*
+* Maintainer:
+* -----------
+* Alexander Hornburg <alexander.hornburg@xilinx.com>
+*
+* Description:
+* ------------
+* Measures the false sharing which the hot/cold split of XDMA_ENGINE (libxdma/dma_engine.h)
+* removes, on the host with threads pinned to different cpus. XDMA_ENGINE needs the WDK, so the
+* benchmark mirrors the member order of the packed layout the driver used before and of the cache
+* line aligned layout it uses now; the sizes of the cold members follow the x64 driver build.
+*
+* engines: one thread per engine plays its dpc. Each iteration reads the read-mostly members
+* (regs, sgdma, parentDevice, irqBitMask, poll, work) and writes the per-transfer members
+* (numDescriptors, tracePending). In the packed array the per-transfer members at the end of one
+* engine share a cache line with the read-mostly members at the start of the next one.
+*
+* ring: per channel a producer thread advances the streaming ring tail like the dpc and a
+* consumer thread advances head like the reader, each reading the index of the other side. The
+* packed layout keeps both indices on one line.
+*
+* Usage: layout_bench [seconds per run] [threads]
+*/
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "xdma_os.h"
+
+#define BENCH_NUM_ENGINES       (8)     // XDMA_MAX_NUM_CHANNELS * XDMA_NUM_DIRECTIONS
+#define BENCH_MAX_THREADS       (8)
+#define BENCH_RING_NUM_BLOCKS   (258U)  // XDMA_RING_NUM_BLOCKS
+#define BENCH_TRANSFER_CONTEXT  (64 * sizeof(void*)) // DMA_TRANSFER_CONTEXT_SIZE_V1 on x64
+
+#define COMPILER_BARRIER()      __asm__ __volatile__("" ::: "memory")
+
+// ========================= mirrored layouts =====================================================
+
+typedef struct { PVOID handle; PVOID virt; UINT64 logical; size_t size; } BENCH_DMA_BUFFER;
+typedef struct { UINT64 words[6]; } BENCH_BOUNCE;
+typedef struct { UINT64 words[7]; } BENCH_PROGRAM;
+typedef struct { UINT64 words[3]; } BENCH_DIRECT;
+typedef struct { UINT64 words[3]; } BENCH_KEVENT;
+
+/// XDMA_ENGINE before the split, members in their former order
+typedef struct PACKED_ENGINE_T {
+    PVOID parentDevice;
+    volatile PVOID regs;
+    volatile PVOID sgdma;
+    UINT32 irqBitMask;
+    UINT32 alignment[3];
+    DWORD channel;
+    DWORD dir;
+    BOOLEAN enabled;
+    DWORD type;
+    DWORD addressMode;
+    BENCH_DMA_BUFFER descBuffer;
+    PVOID dmaTransaction;
+    PVOID work;
+    struct {
+        BENCH_DMA_BUFFER results;
+        PVOID mdl[BENCH_RING_NUM_BLOCKS];
+        CHAR dmaTransferContext[BENCH_TRANSFER_CONTEXT];
+        volatile ULONG head;
+        volatile ULONG tail;
+        XDMA_OS_LOCK lock;
+        BENCH_KEVENT completionSignal;
+    } ring;
+    BENCH_BOUNCE bounce;
+    BENCH_PROGRAM program;
+    BENCH_DIRECT direct;
+    UINT64 tracePending[2];
+    ULONG poll;
+    BENCH_DMA_BUFFER pollWbBuffer;
+    ULONG numDescriptors;
+} PACKED_ENGINE;
+
+/// XDMA_ENGINE now, one cache line aligned group per writer
+typedef struct ALIGNED_ENGINE_T {
+    XDMA_CACHE_ALIGN volatile PVOID regs;
+    volatile PVOID sgdma;
+    PVOID parentDevice;
+    PVOID work;
+    PVOID dmaTransaction;
+    UINT32 irqBitMask;
+    DWORD channel;
+    DWORD dir;
+    DWORD type;
+    DWORD addressMode;
+    ULONG poll;
+    BOOLEAN enabled;
+    UINT32 alignment[3];
+    BENCH_DMA_BUFFER descBuffer;
+    BENCH_DMA_BUFFER pollWbBuffer;
+
+    XDMA_CACHE_ALIGN ULONG numDescriptors;
+    UINT64 tracePending[2];
+    BENCH_BOUNCE bounce;
+
+    XDMA_CACHE_ALIGN BENCH_PROGRAM program;
+    BENCH_DIRECT direct;
+
+    struct {
+        XDMA_CACHE_ALIGN volatile ULONG tail;
+        XDMA_CACHE_ALIGN volatile ULONG head;
+        XDMA_CACHE_ALIGN XDMA_OS_LOCK lock;
+        BENCH_KEVENT completionSignal;
+        BENCH_DMA_BUFFER results;
+        XDMA_CACHE_ALIGN PVOID mdl[BENCH_RING_NUM_BLOCKS];
+        CHAR dmaTransferContext[BENCH_TRANSFER_CONTEXT];
+    } ring;
+} ALIGNED_ENGINE;
+
+_Static_assert((sizeof(ALIGNED_ENGINE) % XDMA_CACHE_LINE_SIZE) == 0, "engines must not share lines");
+
+// ========================= threads ==============================================================
+
+typedef enum BENCH_ROLE_T {
+    ROLE_DPC,
+    ROLE_PRODUCER,
+    ROLE_CONSUMER,
+} BENCH_ROLE;
+
+typedef struct BENCH_THREAD_T {
+    pthread_t thread;
+    unsigned cpu;
+    BENCH_ROLE role;
+    // members of the engine the thread works on, in one of the two layouts
+    volatile PVOID* regs;
+    volatile PVOID* sgdma;
+    PVOID* parentDevice;
+    PVOID* work;
+    UINT32* irqBitMask;
+    ULONG* poll;
+    ULONG* numDescriptors;
+    UINT64* tracePending;
+    volatile ULONG* ownIndex;   // ring index written by the thread
+    volatile ULONG* otherIndex; // ring index of the other side
+    int shared;                 // the cpu is shared with other threads
+    UINT64 iterations;
+    UINT64 checksum;
+} BENCH_THREAD;
+
+static volatile LONG start = 0;
+static volatile LONG stop = 0;
+
+static void* BenchThread(void* arg) {
+    BENCH_THREAD* t = (BENCH_THREAD*)arg;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(t->cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    while (!start) {
+        // all threads begin together
+    }
+
+    UINT64 iterations = 0;
+    UINT64 checksum = 0;
+    while (!stop) {
+        if (t->role == ROLE_DPC) {
+            checksum += (uintptr_t)*t->regs + (uintptr_t)*t->sgdma + (uintptr_t)*t->parentDevice +
+                (uintptr_t)*t->work + *t->irqBitMask + *t->poll;
+            *t->numDescriptors = (ULONG)iterations;
+            t->tracePending[0] = iterations;
+            COMPILER_BARRIER(); // reload and store the members on every iteration
+            iterations++;
+        } else {
+            // producer: one block stays empty, consumer: stop at the tail
+            const ULONG own = *t->ownIndex;
+            const ULONG other = XdmaOsLoadAcquire(t->otherIndex);
+            const ULONG next = (own + 1) % BENCH_RING_NUM_BLOCKS;
+            if ((t->role == ROLE_PRODUCER) ? (next != other) : (own != other)) {
+                XdmaOsStoreRelease(t->ownIndex, next);
+                iterations++;
+            } else if (t->shared) {
+                sched_yield(); // the other side needs the cpu to make progress
+            }
+        }
+    }
+    t->iterations = iterations;
+    t->checksum = checksum;
+    return NULL;
+}
+
+static void SetDpcMembers(BENCH_THREAD* t, int aligned, void* engine) {
+    t->role = ROLE_DPC;
+    if (aligned) {
+        ALIGNED_ENGINE* e = (ALIGNED_ENGINE*)engine;
+        t->regs = &e->regs; t->sgdma = &e->sgdma; t->parentDevice = &e->parentDevice;
+        t->work = &e->work; t->irqBitMask = &e->irqBitMask; t->poll = &e->poll;
+        t->numDescriptors = &e->numDescriptors; t->tracePending = e->tracePending;
+    } else {
+        PACKED_ENGINE* e = (PACKED_ENGINE*)engine;
+        t->regs = &e->regs; t->sgdma = &e->sgdma; t->parentDevice = &e->parentDevice;
+        t->work = &e->work; t->irqBitMask = &e->irqBitMask; t->poll = &e->poll;
+        t->numDescriptors = &e->numDescriptors; t->tracePending = e->tracePending;
+    }
+}
+
+static void SetRingMembers(BENCH_THREAD* t, int aligned, void* engine, BENCH_ROLE role) {
+    volatile ULONG* head;
+    volatile ULONG* tail;
+    if (aligned) {
+        head = &((ALIGNED_ENGINE*)engine)->ring.head;
+        tail = &((ALIGNED_ENGINE*)engine)->ring.tail;
+    } else {
+        head = &((PACKED_ENGINE*)engine)->ring.head;
+        tail = &((PACKED_ENGINE*)engine)->ring.tail;
+    }
+    t->role = role;
+    t->ownIndex = (role == ROLE_PRODUCER) ? tail : head;
+    t->otherIndex = (role == ROLE_PRODUCER) ? head : tail;
+}
+
+/// Run numThreads threads for the given time, returns the iterations of all threads
+static UINT64 Run(BENCH_THREAD* threads, unsigned numThreads, unsigned seconds) {
+    const unsigned numCpus = (unsigned)sysconf(_SC_NPROCESSORS_ONLN);
+    start = 0;
+    stop = 0;
+    for (unsigned i = 0; i < numThreads; ++i) {
+        threads[i].cpu = i % numCpus;
+        threads[i].shared = (numThreads > numCpus);
+        if (pthread_create(&threads[i].thread, NULL, BenchThread, &threads[i]) != 0) {
+            fprintf(stderr, "Error starting thread %u\n", i);
+            exit(1);
+        }
+    }
+    InterlockedExchange(&start, 1);
+    sleep(seconds);
+    InterlockedExchange(&stop, 1);
+    UINT64 iterations = 0;
+    for (unsigned i = 0; i < numThreads; ++i) {
+        pthread_join(threads[i].thread, NULL);
+        iterations += threads[i].iterations;
+    }
+    return iterations;
+}
+
+static void* AllocEngines(int aligned) {
+    const size_t size = BENCH_NUM_ENGINES *
+        (aligned ? sizeof(ALIGNED_ENGINE) : sizeof(PACKED_ENGINE));
+    // the packed engines lived in the device context, which only has the pool alignment
+    unsigned char* memory = aligned_alloc(XDMA_CACHE_LINE_SIZE, size + XDMA_CACHE_LINE_SIZE);
+    if (memory == NULL) {
+        fprintf(stderr, "Error allocating %zu bytes of memory\n", size);
+        exit(1);
+    }
+    memset(memory, 0, size + XDMA_CACHE_LINE_SIZE);
+    return aligned ? (void*)memory : (void*)(memory + 16);
+}
+
+static int SharesLine(size_t a, size_t b) {
+    return (a / XDMA_CACHE_LINE_SIZE) == (b / XDMA_CACHE_LINE_SIZE);
+}
+
+int main(int argc, char* argv[]) {
+    const unsigned seconds = (argc > 1) ? (unsigned)strtoul(argv[1], NULL, 0) : 1U;
+    unsigned numThreads = (argc > 2) ? (unsigned)strtoul(argv[2], NULL, 0) : BENCH_MAX_THREADS;
+    if ((numThreads < 2) || (numThreads > BENCH_MAX_THREADS)) {
+        numThreads = BENCH_MAX_THREADS;
+    }
+    const unsigned numChannels = numThreads / 2;
+    static BENCH_THREAD threads[BENCH_MAX_THREADS];
+
+    // where the packed layout puts the hot members of neighbouring engines
+    const size_t next = 16 + sizeof(PACKED_ENGINE); // start of engine 1, see AllocEngines()
+    printf("packed engine: %zu bytes, numDescriptors of engine 0 %s the line of regs of engine 1, "
+           "ring head and tail %s a line\n", sizeof(PACKED_ENGINE),
+           SharesLine(16 + offsetof(PACKED_ENGINE, numDescriptors), next + offsetof(PACKED_ENGINE, regs)) ?
+           "shares" : "does not share",
+           SharesLine(offsetof(PACKED_ENGINE, ring.head), offsetof(PACKED_ENGINE, ring.tail)) ?
+           "share" : "do not share");
+    printf("aligned engine: %zu bytes\n", sizeof(ALIGNED_ENGINE));
+    const long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (numCpus < (long)numThreads) {
+        printf("Warning: %ld cpus for %u threads, the threads share cpus and do not contend\n",
+               numCpus, numThreads);
+    }
+    printf("%-8s %-8s %8s %14s %12s\n", "test", "layout", "threads", "Mops/s", "ns/op");
+
+    for (int aligned = 0; aligned <= 1; ++aligned) {
+        unsigned char* engines = AllocEngines(aligned);
+        const size_t stride = aligned ? sizeof(ALIGNED_ENGINE) : sizeof(PACKED_ENGINE);
+        memset(threads, 0, sizeof(threads));
+        for (unsigned i = 0; i < numThreads; ++i) {
+            SetDpcMembers(&threads[i], aligned, engines + (i % BENCH_NUM_ENGINES) * stride);
+        }
+        UINT64 ops = Run(threads, numThreads, seconds);
+        printf("%-8s %-8s %8u %14.1f %12.2f\n", "engines", aligned ? "aligned" : "packed",
+               numThreads, (double)ops / seconds / 1e6,
+               (double)seconds * 1e9 * numThreads / (double)ops);
+
+        memset(threads, 0, sizeof(threads));
+        for (unsigned ch = 0; ch < numChannels; ++ch) {
+            SetRingMembers(&threads[2 * ch], aligned, engines + ch * stride, ROLE_PRODUCER);
+            SetRingMembers(&threads[2 * ch + 1], aligned, engines + ch * stride, ROLE_CONSUMER);
+        }
+        ops = Run(threads, 2 * numChannels, seconds);
+        printf("%-8s %-8s %8u %14.1f %12.2f\n", "ring", aligned ? "aligned" : "packed",
+               2 * numChannels, (double)ops / seconds / 1e6,
+               (double)seconds * 1e9 * 2 * numChannels / (double)ops);
+        free(aligned ? engines : engines - 16);
+    }
+    return 0;
+}
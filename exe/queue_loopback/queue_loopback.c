@@ -0,0 +1,456 @@
+/*
+* queue_loopback - shared submission queue loopback backend
+* =========================================================
+*
+* Copyright 2017 Xilinx Inc.
+*
+* Maintainer:
+* -----------
+* Alexander Hornburg <alexander.hornburg@xilinx.com>
+*
+* Description:
+* ------------
+* Runs the ring protocol of inc/xdma_queue.h between an application thread and a loopback backend
+* thread on the host. The backend plays the driver side of sys/shared_queue.c: it consumes new
+* submissions on each doorbell while a completion slot is guaranteed for every one of them,
+* executes register operations inline on a register file, queues H2C/C2H transfers per engine and
+* completes them later against a card memory, and parks event waits until one of their events
+* fires. The application uses xdma_queue_submit() and xdma_queue_reap() only. The test checks that
+*  - every submission is completed exactly once with the expected status and result,
+*  - data written by H2C arrives in the card memory and C2H returns the card memory contents,
+*  - the backend never posts more completions than the completion ring holds,
+*  - submissions are never consumed before they were published.
+*
+* Usage: queue_loopback [operations] [seed]
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xdma_queue.h"
+
+#define LB_STATUS_SUCCESS           (0x00000000)
+#define LB_STATUS_INVALID_PARAMETER ((INT32)0xC000000D)
+#define LB_STATUS_NOT_SUPPORTED     ((INT32)0xC00000BB)
+
+#define LB_REG_OP_READ      (0)
+#define LB_REG_OP_WRITE     (1)
+#define LB_REG_OP_RMW       (2)
+#define LB_REG_OP_POLL      (3)
+
+#define LB_NUM_CHANNELS     (4)
+#define LB_NUM_EVENTS       (16)
+#define LB_NUM_REGS         (64)
+#define LB_DMA_SLOT_SIZE    (XDMA_QUEUE_DATA_SIZE / XDMA_QUEUE_DEPTH) // data area share of one dma
+#define LB_MAX_WAITS        (8)     // event waits the application keeps in flight at most
+#define LB_NO_SLOT          (-1)
+
+#define LB_RING_MASK        (XDMA_QUEUE_DEPTH - 1)
+
+static unsigned long errors = 0; // updated with __sync builtins, both threads check
+
+#define CHECK(cond, ...) do { if (!(cond)) { __sync_add_and_fetch(&errors, 1); fprintf(stderr, __VA_ARGS__); } } while (0)
+
+// ========================= shared state =========================================================
+
+static void* base;                          // the mapped queue region
+static uint8_t card[XDMA_QUEUE_DATA_SIZE];    // AXI-MM card memory behind the engines
+static volatile UINT32 doorbell = 0;        // IOCTL_XDMA_QUEUE_ENTER count
+static volatile int stop = 0;
+
+// ========================= loopback backend - the driver side ===================================
+
+typedef struct LB_SLOT_T {
+    XDMA_QUEUE_SQE sqe;
+    int next;
+} LB_SLOT;
+
+typedef struct LB_BACKEND_T {
+    LB_SLOT slots[XDMA_QUEUE_DEPTH];
+    int freeSlots;
+    int engineHead[2][LB_NUM_CHANNELS];
+    int engineTail[2][LB_NUM_CHANNELS];
+    int waitSlots;
+    UINT32 regs[LB_NUM_REGS];
+    UINT32 sqHead;      // private copies - the application may write anything to the header
+    UINT32 cqTail;
+    UINT32 inflight;
+    UINT32 doorbellSeen;
+    unsigned long long consumed;
+} LB_BACKEND;
+
+static LB_BACKEND lb;
+
+static void PostCompletion(UINT64 userData, INT32 status, UINT32 result) {
+    XDMA_QUEUE_HEADER* header = xdma_queue_header(base);
+    CHECK(lb.cqTail - header->cqHead < XDMA_QUEUE_DEPTH, "completion ring overflow, tail %u head %u\n",
+          lb.cqTail, header->cqHead);
+    XDMA_QUEUE_CQE* cqe = &xdma_queue_cq(base)[lb.cqTail & LB_RING_MASK];
+    cqe->userData = userData;
+    cqe->status = status;
+    cqe->result = result;
+    __sync_synchronize(); // entry must be visible before the index
+    lb.cqTail++;
+    header->cqTail = lb.cqTail;
+}
+
+static int SlotAlloc(void) {
+    int i = lb.freeSlots;
+    CHECK(i != LB_NO_SLOT, "no free slot despite admission control\n");
+    lb.freeSlots = lb.slots[i].next;
+    lb.slots[i].next = LB_NO_SLOT;
+    lb.inflight++;
+    return i;
+}
+
+static void SlotFree(int i) {
+    lb.slots[i].next = lb.freeSlots;
+    lb.freeSlots = i;
+    lb.inflight--;
+}
+
+static void SubmitEntry(const XDMA_QUEUE_SQE* sqe) {
+    switch (sqe->opcode) {
+    case XDMA_QUEUE_OP_NOP:
+        PostCompletion(sqe->userData, LB_STATUS_SUCCESS, 0);
+        break;
+    case XDMA_QUEUE_OP_REG:
+    {
+        if ((sqe->index != 0) || (sqe->address >= LB_NUM_REGS * sizeof(UINT32)) ||
+            (sqe->address & 3) || (sqe->regOp > LB_REG_OP_POLL)) {
+            PostCompletion(sqe->userData, LB_STATUS_INVALID_PARAMETER, 0);
+            break;
+        }
+        if (sqe->regOp == LB_REG_OP_POLL) { // executed under the queue lock in the driver
+            PostCompletion(sqe->userData, LB_STATUS_NOT_SUPPORTED, 0);
+            break;
+        }
+        UINT32* reg = &lb.regs[sqe->address / sizeof(UINT32)];
+        UINT32 result = 0;
+        if (sqe->regOp == LB_REG_OP_READ) {
+            result = *reg;
+        } else if (sqe->regOp == LB_REG_OP_WRITE) {
+            *reg = sqe->data;
+        } else {
+            *reg = (*reg & ~sqe->mask) | (sqe->data & sqe->mask);
+            result = *reg;
+        }
+        PostCompletion(sqe->userData, LB_STATUS_SUCCESS, result);
+        break;
+    }
+    case XDMA_QUEUE_OP_H2C:
+    case XDMA_QUEUE_OP_C2H:
+    {
+        const int dir = (sqe->opcode == XDMA_QUEUE_OP_H2C) ? 0 : 1;
+        if ((sqe->index >= LB_NUM_CHANNELS) || (sqe->length == 0) ||
+            (sqe->length > XDMA_QUEUE_DATA_SIZE) ||
+            (sqe->dataOffset > XDMA_QUEUE_DATA_SIZE - sqe->length) ||
+            (sqe->address > XDMA_QUEUE_DATA_SIZE - sqe->length)) {
+            PostCompletion(sqe->userData, LB_STATUS_INVALID_PARAMETER, 0);
+            break;
+        }
+        int i = SlotAlloc();
+        lb.slots[i].sqe = *sqe;
+        if (lb.engineHead[dir][sqe->index] == LB_NO_SLOT) {
+            lb.engineHead[dir][sqe->index] = i;
+        } else {
+            lb.slots[lb.engineTail[dir][sqe->index]].next = i;
+        }
+        lb.engineTail[dir][sqe->index] = i;
+        break;
+    }
+    case XDMA_QUEUE_OP_EVENT_WAIT:
+    {
+        if ((sqe->index & ((1U << LB_NUM_EVENTS) - 1)) == 0) {
+            PostCompletion(sqe->userData, LB_STATUS_INVALID_PARAMETER, 0);
+            break;
+        }
+        int i = SlotAlloc();
+        lb.slots[i].sqe = *sqe;
+        lb.slots[i].sqe.index &= (1U << LB_NUM_EVENTS) - 1;
+        lb.slots[i].next = lb.waitSlots;
+        lb.waitSlots = i;
+        break;
+    }
+    default:
+        PostCompletion(sqe->userData, LB_STATUS_INVALID_PARAMETER, 0);
+        break;
+    }
+}
+
+static void QueueEnter(void)
+// the doorbell - consume submissions while a completion slot is guaranteed for each of them
+{
+    XDMA_QUEUE_HEADER* header = xdma_queue_header(base);
+    const UINT32 sqTail = header->sqTail;
+    __sync_synchronize(); // read entries only after observing the index
+    CHECK(sqTail - lb.sqHead <= XDMA_QUEUE_DEPTH, "submission tail %u runs ahead of head %u\n",
+          sqTail, lb.sqHead);
+    while ((lb.sqHead != sqTail) &&
+           (lb.inflight + (lb.cqTail - header->cqHead) < XDMA_QUEUE_DEPTH)) {
+        XDMA_QUEUE_SQE sqe = xdma_queue_sq(base)[lb.sqHead & LB_RING_MASK]; // copy - user may modify
+        lb.sqHead++;
+        lb.consumed++;
+        SubmitEntry(&sqe);
+    }
+    header->sqHead = lb.sqHead;
+}
+
+static void EngineStep(int dir, int ch)
+// the engine dpc - complete the head of the engine fifo
+{
+    int i = lb.engineHead[dir][ch];
+    if (i == LB_NO_SLOT) {
+        return;
+    }
+    const XDMA_QUEUE_SQE* sqe = &lb.slots[i].sqe;
+    uint8_t* data = (uint8_t*)xdma_queue_data(base) + sqe->dataOffset;
+    if (dir == 0) {
+        memcpy(&card[sqe->address], data, sqe->length);
+    } else {
+        memcpy(data, &card[sqe->address], sqe->length);
+    }
+    PostCompletion(sqe->userData, LB_STATUS_SUCCESS, sqe->length);
+    lb.engineHead[dir][ch] = lb.slots[i].next;
+    if (lb.engineHead[dir][ch] == LB_NO_SLOT) {
+        lb.engineTail[dir][ch] = LB_NO_SLOT;
+    }
+    SlotFree(i);
+}
+
+static void FireEvents(UINT32 fired)
+// the user dpc - complete the event waits matching the fired events
+{
+    int* link = &lb.waitSlots;
+    while (*link != LB_NO_SLOT) {
+        int i = *link;
+        const UINT32 match = lb.slots[i].sqe.index & fired;
+        if (match) {
+            PostCompletion(lb.slots[i].sqe.userData, LB_STATUS_SUCCESS, match);
+            *link = lb.slots[i].next;
+            SlotFree(i);
+        } else {
+            link = &lb.slots[i].next;
+        }
+    }
+}
+
+static void* BackendThread(void* arg) {
+    (void)arg;
+    unsigned seed = 7;
+    while (!stop) {
+        if (lb.doorbellSeen != doorbell) {
+            lb.doorbellSeen = doorbell;
+            QueueEnter();
+        }
+        const int dir = rand_r(&seed) & 1;
+        const int ch = rand_r(&seed) % LB_NUM_CHANNELS;
+        EngineStep(dir, ch);
+        if ((lb.waitSlots != LB_NO_SLOT) && ((rand_r(&seed) % 16) == 0)) {
+            FireEvents(1U << (rand_r(&seed) % LB_NUM_EVENTS));
+        }
+        if (lb.inflight == 0) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+// ========================= application ==========================================================
+
+typedef struct LB_EXPECT_T {
+    UINT32 opcode;
+    INT32 status;
+    UINT32 result;
+    UINT32 mask;        // event wait mask
+    int dmaSlot;        // data area and card slot of a transfer
+    uint8_t pattern;
+    uint8_t done;
+} LB_EXPECT;
+
+static void FillPattern(uint8_t* p, UINT32 length, uint8_t pattern) {
+    for (UINT32 i = 0; i < length; i++) {
+        p[i] = (uint8_t)(pattern + i);
+    }
+}
+
+static int CheckPattern(const uint8_t* p, UINT32 length, uint8_t pattern) {
+    for (UINT32 i = 0; i < length; i++) {
+        if (p[i] != (uint8_t)(pattern + i)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    const UINT64 numOps = (argc > 1) ? strtoull(argv[1], NULL, 0) : 1000000ULL;
+    const unsigned seed = (argc > 2) ? (unsigned)strtoul(argv[2], NULL, 0) : 1U;
+    srand(seed);
+
+    base = aligned_alloc(4096, XDMA_QUEUE_SIZE);
+    LB_EXPECT* expect = calloc((size_t)numOps, sizeof(LB_EXPECT));
+    if ((base == NULL) || (expect == NULL)) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    memset(base, 0, XDMA_QUEUE_SIZE);
+    memset(lb.engineHead, 0xFF, sizeof(lb.engineHead));
+    memset(lb.engineTail, 0xFF, sizeof(lb.engineTail));
+    memset(lb.regs, 0, sizeof(lb.regs));
+    lb.waitSlots = LB_NO_SLOT;
+    lb.freeSlots = LB_NO_SLOT;
+    lb.sqHead = lb.cqTail = lb.inflight = lb.doorbellSeen = 0;
+    lb.consumed = 0;
+    for (int i = XDMA_QUEUE_DEPTH - 1; i >= 0; i--) {
+        lb.slots[i].next = lb.freeSlots;
+        lb.freeSlots = i;
+    }
+
+    pthread_t backend;
+    if (pthread_create(&backend, NULL, BackendThread, NULL) != 0) {
+        fprintf(stderr, "failed to start the backend\n");
+        return 1;
+    }
+
+    UINT32 shadowRegs[LB_NUM_REGS];         // register file as seen in submission order
+    memset(shadowRegs, 0, sizeof(shadowRegs));
+    int dmaFree[XDMA_QUEUE_DEPTH];          // free data area slots
+    int numDmaFree = XDMA_QUEUE_DEPTH;
+    for (int i = 0; i < XDMA_QUEUE_DEPTH; i++) {
+        dmaFree[i] = i;
+    }
+    uint8_t* dataArea = (uint8_t*)xdma_queue_data(base);
+    unsigned waits = 0;
+    unsigned long long counts[5] = { 0 };
+    UINT64 issued = 0;
+    UINT64 completed = 0;
+    unsigned long long full = 0;
+
+    while (completed < numOps) {
+        // queue a batch of submissions and ring the doorbell
+        const unsigned batch = 1 + (unsigned)(rand() % 32);
+        for (unsigned b = 0; (b < batch) && (issued < numOps); b++) {
+            XDMA_QUEUE_HEADER* header = xdma_queue_header(base);
+            if (header->sqTail - header->sqHead >= XDMA_QUEUE_DEPTH) {
+                full++; // reap and retry
+                break;
+            }
+            XDMA_QUEUE_SQE sqe;
+            memset(&sqe, 0, sizeof(sqe));
+            LB_EXPECT* e = &expect[issued];
+            e->status = LB_STATUS_SUCCESS;
+            e->dmaSlot = -1;
+            const unsigned kind = (unsigned)(rand() % 100);
+            if ((kind < 40) && (numDmaFree > 0)) {
+                const int slot = dmaFree[--numDmaFree];
+                const UINT32 offset = (UINT32)slot * LB_DMA_SLOT_SIZE;
+                sqe.opcode = (rand() & 1) ? XDMA_QUEUE_OP_H2C : XDMA_QUEUE_OP_C2H;
+                sqe.index = (UINT32)(rand() % LB_NUM_CHANNELS);
+                sqe.dataOffset = offset;
+                sqe.address = offset;
+                sqe.length = 1 + (UINT32)(rand() % LB_DMA_SLOT_SIZE);
+                e->dmaSlot = slot;
+                e->pattern = (uint8_t)rand();
+                e->result = sqe.length;
+                if (sqe.opcode == XDMA_QUEUE_OP_H2C) {
+                    FillPattern(&dataArea[offset], sqe.length, e->pattern);
+                } else { // the slot is owned by this transfer, nothing else touches the card there
+                    FillPattern(&card[offset], sqe.length, e->pattern);
+                    memset(&dataArea[offset], 0, sqe.length);
+                }
+            } else if (kind < 75) {
+                const UINT32 reg = (UINT32)(rand() % LB_NUM_REGS);
+                sqe.opcode = XDMA_QUEUE_OP_REG;
+                sqe.address = reg * sizeof(UINT32);
+                sqe.regOp = (UINT32)(rand() % 4);
+                sqe.data = (UINT32)rand();
+                sqe.mask = (UINT32)rand();
+                if (sqe.regOp == LB_REG_OP_READ) {
+                    e->result = shadowRegs[reg];
+                } else if (sqe.regOp == LB_REG_OP_WRITE) {
+                    shadowRegs[reg] = sqe.data;
+                } else if (sqe.regOp == LB_REG_OP_RMW) {
+                    shadowRegs[reg] = (shadowRegs[reg] & ~sqe.mask) | (sqe.data & sqe.mask);
+                    e->result = shadowRegs[reg];
+                } else {
+                    e->status = LB_STATUS_NOT_SUPPORTED;
+                }
+            } else if ((kind < 85) && (waits < LB_MAX_WAITS)) {
+                sqe.opcode = XDMA_QUEUE_OP_EVENT_WAIT;
+                sqe.index = 1 + (UINT32)(rand() % ((1U << LB_NUM_EVENTS) - 1));
+                e->mask = sqe.index;
+                waits++;
+            } else if (kind < 95) {
+                sqe.opcode = XDMA_QUEUE_OP_NOP;
+            } else { // invalid submissions complete with an error and do not occupy a slot
+                sqe.opcode = (rand() & 1) ? 99 : XDMA_QUEUE_OP_H2C;
+                sqe.length = 0;
+                e->status = LB_STATUS_INVALID_PARAMETER;
+            }
+            e->opcode = sqe.opcode;
+            sqe.userData = issued;
+            CHECK(xdma_queue_submit(base, &sqe), "submission ring full after the space check\n");
+            issued++;
+        }
+        __sync_synchronize();
+        __sync_add_and_fetch(&doorbell, 1);
+
+        // reap whatever has completed
+        XDMA_QUEUE_CQE cqe;
+        int reaped = 0;
+        while (xdma_queue_reap(base, &cqe)) {
+            reaped++;
+            CHECK(cqe.userData < issued, "completion for submission %llu which was not issued\n",
+                  (unsigned long long)cqe.userData);
+            if (cqe.userData >= issued) {
+                continue;
+            }
+            LB_EXPECT* e = &expect[cqe.userData];
+            CHECK(!e->done, "submission %llu completed twice\n", (unsigned long long)cqe.userData);
+            e->done = 1;
+            completed++;
+            counts[(e->opcode <= XDMA_QUEUE_OP_EVENT_WAIT) ? e->opcode : 0]++;
+            CHECK(cqe.status == e->status, "submission %llu op %u status 0x%x expected 0x%x\n",
+                  (unsigned long long)cqe.userData, e->opcode, (unsigned)cqe.status,
+                  (unsigned)e->status);
+            if (e->opcode == XDMA_QUEUE_OP_EVENT_WAIT) {
+                CHECK((cqe.result != 0) && ((cqe.result & ~e->mask) == 0),
+                      "event wait %llu mask 0x%x returned 0x%x\n",
+                      (unsigned long long)cqe.userData, e->mask, cqe.result);
+                waits--;
+            } else if (cqe.status == LB_STATUS_SUCCESS) {
+                CHECK(cqe.result == e->result, "submission %llu op %u result 0x%x expected 0x%x\n",
+                      (unsigned long long)cqe.userData, e->opcode, cqe.result, e->result);
+            }
+            if (e->dmaSlot >= 0) {
+                const UINT32 offset = (UINT32)e->dmaSlot * LB_DMA_SLOT_SIZE;
+                const uint8_t* landed = (e->opcode == XDMA_QUEUE_OP_H2C) ? &card[offset] : &dataArea[offset];
+                CHECK(CheckPattern(landed, e->result, e->pattern), "%s %llu data mismatch\n",
+                      (e->opcode == XDMA_QUEUE_OP_H2C) ? "h2c" : "c2h",
+                      (unsigned long long)cqe.userData);
+                dmaFree[numDmaFree++] = e->dmaSlot;
+            }
+        }
+        if (reaped == 0) {
+            sched_yield();
+        }
+    }
+
+    stop = 1;
+    pthread_join(backend, NULL);
+    CHECK(lb.consumed == numOps, "backend consumed %llu of %llu submissions\n", lb.consumed,
+          (unsigned long long)numOps);
+    CHECK(lb.inflight == 0, "%u submissions left in flight\n", lb.inflight);
+
+    printf("%llu operations: %llu nop, %llu h2c, %llu c2h, %llu reg, %llu event wait, "
+           "%llu ring full, %lu errors\n", (unsigned long long)numOps, counts[XDMA_QUEUE_OP_NOP],
+           counts[XDMA_QUEUE_OP_H2C], counts[XDMA_QUEUE_OP_C2H], counts[XDMA_QUEUE_OP_REG],
+           counts[XDMA_QUEUE_OP_EVENT_WAIT], full, errors);
+    free(expect);
+    free(base);
+    return (errors == 0) ? 0 : 1;
+}
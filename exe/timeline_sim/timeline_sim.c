@@ -0,0 +1,346 @@
+/*
+* timeline_sim - event timeline ring and export test
+* ==================================================
+*
+* Copyright 2017 Xilinx Inc.
+*
+* Maintainer:
+* -----------
+* Alexander Hornburg <alexander.hornburg@xilinx.com>
+*
+* Description:
+* ------------
+* Runs the per-cpu event rings of libxdma/timeline.c and the Chrome trace event export of
+* exe/xdma_timeline on the host. The test checks that
+*  - a ring which was lapped by its producers drains the newest XDMA_TIMELINE_RING_ENTRIES events
+*    in order and reports the others as dropped,
+*  - partial drains continue where the previous drain stopped,
+*  - with producer threads racing a drain thread every event is either drained once or counted as
+*    dropped, and the events of a producer stay in order on each ring,
+*  - the export of a known event sequence contains the expected transfer, dpc and request slices
+*    and track names, and the export of the recorded events is well formed JSON.
+*
+* Usage: timeline_sim [events per producer] [producers]
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timeline.h"
+#include "timeline_export.h"
+
+#define SIM_MAX_PRODUCERS   (16U)
+#define SIM_NUM_CPUS        (4U)    // rings of the concurrent test, producers share them
+#define SIM_ARG(producer, i) ((((UINT64)(producer)) << 32) | (UINT64)(i))
+
+static unsigned long errors = 0;
+
+#define CHECK(cond, ...) do { if (!(cond)) { errors++; fprintf(stderr, __VA_ARGS__); } } while (0)
+
+static XDMA_TIMELINE_EVENT drained[XDMA_TIMELINE_MAX_CPUS * XDMA_TIMELINE_RING_ENTRIES];
+
+// ========================= helpers ==============================================================
+
+static XDMA_TIMELINE_RING* NewRings(XDMA_TIMELINE* timeline, ULONG numCpus) {
+    memset(timeline, 0, sizeof(*timeline));
+    XDMA_TIMELINE_RING* rings = (XDMA_TIMELINE_RING*)aligned_alloc(64, XdmaTimelineSize(numCpus));
+    if ((rings == NULL) || !XdmaTimelineInit(timeline, rings, numCpus)) {
+        fprintf(stderr, "failed to install %u rings\n", numCpus);
+        exit(1);
+    }
+    return rings;
+}
+
+static ULONG Drain(XDMA_TIMELINE* timeline, XDMA_TIMELINE_INFO* info, ULONG maxEvents) {
+    const NTSTATUS status = XdmaTimelineDrain(timeline, info, drained, maxEvents);
+    CHECK(status == STATUS_SUCCESS, "drain failed with 0x%x\n", (unsigned)status);
+    return info->numEvents;
+}
+
+static char* ExportToString(const XDMA_TIMELINE_INFO* info, XDMA_TIMELINE_EVENT* events,
+                            size_t numEvents) {
+    FILE* file = tmpfile();
+    if (file == NULL) {
+        fprintf(stderr, "failed to create a temporary file\n");
+        exit(1);
+    }
+    CHECK(timeline_export_json(file, info, events, numEvents) == 0, "export failed\n");
+    const long size = ftell(file);
+    char* json = (char*)calloc(1, (size_t)size + 1);
+    rewind(file);
+    if ((json == NULL) || (fread(json, 1, (size_t)size, file) != (size_t)size)) {
+        fprintf(stderr, "failed to read back the export\n");
+        exit(1);
+    }
+    fclose(file);
+    return json;
+}
+
+/// Brackets and braces balance outside of strings and the document is one object
+static int WellFormed(const char* json) {
+    char stack[64];
+    int depth = 0;
+    int inString = 0;
+    for (const char* p = json; *p != '\0'; ++p) {
+        if (inString) {
+            if (*p == '\\') {
+                p++;
+            } else if (*p == '"') {
+                inString = 0;
+            }
+        } else if (*p == '"') {
+            inString = 1;
+        } else if ((*p == '{') || (*p == '[')) {
+            if (depth == (int)sizeof(stack)) {
+                return 0;
+            }
+            stack[depth++] = *p;
+        } else if ((*p == '}') || (*p == ']')) {
+            if ((depth == 0) || (stack[--depth] != ((*p == '}') ? '{' : '['))) {
+                return 0;
+            }
+            if ((depth == 0) && (strspn(p + 1, " \r\n") != strlen(p + 1))) {
+                return 0; // trailing garbage
+            }
+        } else if (*p == ',') {
+            const char next = p[1 + strspn(p + 1, " \r\n")];
+            if ((next == '}') || (next == ']')) {
+                return 0; // trailing comma
+            }
+        }
+    }
+    return (depth == 0) && !inString && (json[0] == '{');
+}
+
+// ========================= ring wrap ============================================================
+
+static void TestWrap(void) {
+    XDMA_TIMELINE timeline;
+    XDMA_TIMELINE_RING* rings = NewRings(&timeline, 1); // one ring, the current cpu does not matter
+    XDMA_TIMELINE_INFO info;
+    XdmaTimelineStart(&timeline);
+
+    // lap the ring three times
+    const ULONG total = 3 * XDMA_TIMELINE_RING_ENTRIES + 123;
+    for (ULONG i = 0; i < total; ++i) {
+        XDMA_TIMELINE_LOG(&timeline, XDMA_TL_ARRIVAL, 0, 0, i);
+    }
+    ULONG n = Drain(&timeline, &info, XDMA_TIMELINE_RING_ENTRIES);
+    CHECK(n == XDMA_TIMELINE_RING_ENTRIES, "lapped ring drained %u events\n", n);
+    CHECK(info.dropped == total - XDMA_TIMELINE_RING_ENTRIES, "lapped ring dropped %u of %u\n",
+          info.dropped, total);
+    for (ULONG i = 0; i < n; ++i) {
+        const UINT64 expected = total - XDMA_TIMELINE_RING_ENTRIES + i;
+        CHECK((drained[i].arg == expected) && (drained[i].sequence == expected + 1),
+              "lapped ring event %u arg %llu sequence %u, expected %llu\n", i,
+              (unsigned long long)drained[i].arg, drained[i].sequence, (unsigned long long)expected);
+    }
+
+    // partial drains continue at the tail, the dropped count is kept since the start
+    for (ULONG i = 0; i < 100; ++i) {
+        XDMA_TIMELINE_LOG(&timeline, XDMA_TL_COMPLETE, 1, 2, total + i);
+    }
+    n = Drain(&timeline, &info, 30);
+    CHECK((n == 30) && (drained[0].arg == total) && (drained[29].arg == total + 29),
+          "first partial drain returned %u events from %llu\n", n, (unsigned long long)drained[0].arg);
+    n = Drain(&timeline, &info, XDMA_TIMELINE_RING_ENTRIES);
+    CHECK((n == 70) && (drained[0].arg == total + 30) && (drained[69].arg == total + 99),
+          "second partial drain returned %u events from %llu\n", n, (unsigned long long)drained[0].arg);
+    CHECK((drained[0].dir == 1) && (drained[0].channel == 2) && (drained[0].type == XDMA_TL_COMPLETE),
+          "event fields not preserved\n");
+    CHECK(info.dropped == total - XDMA_TIMELINE_RING_ENTRIES, "dropped count changed to %u\n",
+          info.dropped);
+
+    // stopped timelines record nothing, starting again discards the buffered events
+    XdmaTimelineStop(&timeline);
+    XDMA_TIMELINE_LOG(&timeline, XDMA_TL_ARRIVAL, 0, 0, 0);
+    n = Drain(&timeline, &info, XDMA_TIMELINE_RING_ENTRIES);
+    CHECK((n == 0) && (info.enabled == 0), "stopped timeline drained %u events\n", n);
+    XDMA_TIMELINE_LOG(&timeline, XDMA_TL_ARRIVAL, 0, 0, 0);
+    XdmaTimelineStart(&timeline);
+    XDMA_TIMELINE_LOG(&timeline, XDMA_TL_ARRIVAL, 0, 0, 7);
+    n = Drain(&timeline, &info, XDMA_TIMELINE_RING_ENTRIES);
+    CHECK((n == 1) && (drained[0].arg == 7) && (info.dropped == 0),
+          "restarted timeline drained %u events, %u dropped\n", n, info.dropped);
+    free(rings);
+}
+
+// ========================= concurrent producers =================================================
+
+typedef struct SIM_PRODUCER_T {
+    pthread_t thread;
+    unsigned id;
+    ULONG numEvents;
+    XDMA_TIMELINE* timeline;
+} SIM_PRODUCER;
+
+static volatile LONG producersDone = 0;
+
+static void* ProducerThread(void* arg) {
+    SIM_PRODUCER* p = (SIM_PRODUCER*)arg;
+    for (ULONG i = 0; i < p->numEvents; ++i) {
+        XDMA_TIMELINE_LOG(p->timeline, XDMA_TL_ISR, XDMA_TL_NO_ENGINE, XDMA_TL_NO_ENGINE,
+                          SIM_ARG(p->id, i));
+    }
+    InterlockedIncrement(&producersDone);
+    return NULL;
+}
+
+static void TestConcurrent(ULONG eventsPerProducer, unsigned numProducers, XDMA_TIMELINE_INFO* lastInfo,
+                           XDMA_TIMELINE_EVENT** lastEvents, ULONG* lastNumEvents) {
+    XDMA_TIMELINE timeline;
+    XDMA_TIMELINE_RING* rings = NewRings(&timeline, SIM_NUM_CPUS);
+    XdmaTimelineStart(&timeline);
+
+    unsigned char* seen = (unsigned char*)calloc((size_t)numProducers * eventsPerProducer, 1);
+    long long last[SIM_NUM_CPUS][SIM_MAX_PRODUCERS];
+    memset(last, 0xFF, sizeof(last)); // -1
+    static SIM_PRODUCER producers[SIM_MAX_PRODUCERS];
+    for (unsigned i = 0; i < numProducers; ++i) {
+        producers[i].id = i;
+        producers[i].numEvents = eventsPerProducer;
+        producers[i].timeline = &timeline;
+        if (pthread_create(&producers[i].thread, NULL, ProducerThread, &producers[i]) != 0) {
+            fprintf(stderr, "failed to start producer %u\n", i);
+            exit(1);
+        }
+    }
+
+    unsigned long long numDrained = 0;
+    unsigned long long drains = 0;
+    XDMA_TIMELINE_INFO info;
+    for (int done = 0, final = 0; !final;) {
+        final = done; // one more drain after all producers finished
+        const ULONG n = Drain(&timeline, &info, XDMA_TIMELINE_MAX_CPUS * XDMA_TIMELINE_RING_ENTRIES);
+        drains++;
+        for (ULONG i = 0; i < n; ++i) {
+            const unsigned producer = (unsigned)(drained[i].arg >> 32);
+            const ULONG index = (ULONG)drained[i].arg;
+            const unsigned cpu = drained[i].cpu;
+            if ((producer >= numProducers) || (index >= eventsPerProducer) || (cpu >= SIM_NUM_CPUS)) {
+                CHECK(0, "drained a corrupt event arg 0x%llx cpu %u\n",
+                      (unsigned long long)drained[i].arg, cpu);
+                continue;
+            }
+            unsigned char* s = &seen[(size_t)producer * eventsPerProducer + index];
+            CHECK(*s == 0, "event %u of producer %u drained twice\n", index, producer);
+            *s = 1;
+            CHECK((long long)index > last[cpu][producer],
+                  "event %u of producer %u out of order on ring %u\n", index, producer, cpu);
+            last[cpu][producer] = index;
+            numDrained++;
+        }
+        done = (producersDone == (LONG)numProducers);
+    }
+    for (unsigned i = 0; i < numProducers; ++i) {
+        pthread_join(producers[i].thread, NULL);
+    }
+    const unsigned long long total = (unsigned long long)numProducers * eventsPerProducer;
+    CHECK(numDrained + info.dropped == total, "%llu drained + %u dropped != %llu recorded\n",
+          numDrained, info.dropped, total);
+    printf("%u producers on %u rings: %llu events, %llu drained in %llu drains, %u dropped\n",
+           numProducers, SIM_NUM_CPUS, total, numDrained, drains, info.dropped);
+
+    // keep a real recording for the export test
+    XdmaTimelineStart(&timeline);
+    for (ULONG i = 0; i < 64; ++i) {
+        XDMA_TIMELINE_LOG(&timeline, XDMA_TL_ARRIVAL + (i % 8), i & 1, (i / 2) % 4, i);
+    }
+    *lastNumEvents = Drain(&timeline, lastInfo, XDMA_TIMELINE_RING_ENTRIES);
+    *lastEvents = (XDMA_TIMELINE_EVENT*)malloc(*lastNumEvents * sizeof(XDMA_TIMELINE_EVENT));
+    memcpy(*lastEvents, drained, *lastNumEvents * sizeof(XDMA_TIMELINE_EVENT));
+    free(seen);
+    free(rings);
+}
+
+// ========================= export ===============================================================
+
+static void TestExport(const XDMA_TIMELINE_INFO* recordedInfo, XDMA_TIMELINE_EVENT* recorded,
+                       ULONG numRecorded) {
+    // 1000 cycles per microsecond, events given out of order as drained from two rings
+    XDMA_TIMELINE_INFO info;
+    memset(&info, 0, sizeof(info));
+    info.frequency = 1000000;
+    info.cycles = 1000000000;
+    info.counter = 1000000;
+    info.numCpus = 2;
+    XDMA_TIMELINE_EVENT events[] = {
+        // cycles, sequence, type, dir, channel, cpu, arg
+        { 5000, 1, XDMA_TL_ISR, 0, 0, 1, 3 },
+        { 5500, 2, XDMA_TL_DPC_BEGIN, 0, 0, 1, 0 },
+        { 6500, 3, XDMA_TL_DPC_END, 0, 0, 1, 0 },
+        { 1000, 1, XDMA_TL_ARRIVAL, 0, 0, 0, 4096 },
+        { 2000, 2, XDMA_TL_PROGRAM_DMA, 0, 0, 0, 1 },
+        { 3000, 3, XDMA_TL_ENGINE_START, 0, 0, 0, 0 },
+        { 6000, 4, XDMA_TL_COMPLETE, 0, 0, 0, 4096 },
+        { 7000, 5, XDMA_TL_RING_BATCH, 1, 2, 0, 9 },
+    };
+    const size_t numEvents = sizeof(events) / sizeof(events[0]);
+    CHECK(timeline_cycles_per_second(&info) == 1e9, "calibration gives %.0f cycles per second\n",
+          timeline_cycles_per_second(&info));
+
+    char* json = ExportToString(&info, events, numEvents);
+    static const char* const expected[] = {
+        "\"ph\":\"i\",\"name\":\"arrival\",\"pid\":1,\"tid\":1,\"ts\":0.000",
+        "\"ph\":\"i\",\"name\":\"program dma\",\"pid\":1,\"tid\":1,\"ts\":1.000",
+        "\"ph\":\"X\",\"name\":\"transfer\",\"pid\":1,\"tid\":1,\"ts\":2.000,\"dur\":3.000",
+        "\"ph\":\"b\",\"name\":\"write\",\"pid\":1,\"tid\":1,\"ts\":0.000,\"cat\":\"request\",\"id\":1",
+        "\"ph\":\"e\",\"name\":\"write\",\"pid\":1,\"tid\":1,\"ts\":5.000,\"cat\":\"request\",\"id\":1",
+        "\"ph\":\"i\",\"name\":\"isr h2c_0\",\"pid\":1,\"tid\":101,\"ts\":4.000",
+        "\"ph\":\"X\",\"name\":\"dpc h2c_0\",\"pid\":1,\"tid\":101,\"ts\":4.500,\"dur\":1.000",
+        "\"ph\":\"C\",\"name\":\"ring results\",\"pid\":1,\"tid\":7,\"ts\":6.000,\"args\":{\"c2h_2\":9}",
+        "\"tid\":1,\"args\":{\"name\":\"h2c_0\"}",
+        "\"tid\":7,\"args\":{\"name\":\"c2h_2\"}",
+        "\"tid\":101,\"args\":{\"name\":\"cpu 1\"}",
+        "\"events\":8,\"dropped\":0,\"cpus\":2",
+    };
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); ++i) {
+        CHECK(strstr(json, expected[i]) != NULL, "export lacks %s\n", expected[i]);
+    }
+    CHECK(strstr(json, "cpu 0") == NULL, "export names a cpu track without events\n");
+    CHECK(WellFormed(json), "export of the known sequence is not well formed:\n%s\n", json);
+    for (size_t i = 1; i < numEvents; ++i) {
+        CHECK(events[i - 1].cycles <= events[i].cycles, "export did not sort the events\n");
+    }
+    free(json);
+
+    // a completion whose arrival was not captured gets no request slice
+    XDMA_TIMELINE_EVENT orphan[] = {
+        { 1000, 1, XDMA_TL_COMPLETE, 1, 0, 0, 64 },
+    };
+    json = ExportToString(&info, orphan, 1);
+    CHECK((strstr(json, "\"ph\":\"b\"") == NULL) &&
+          (strstr(json, "\"name\":\"complete\",\"pid\":1,\"tid\":5") != NULL),
+          "orphan completion exported as:\n%s\n", json);
+    CHECK(WellFormed(json), "export of an orphan completion is not well formed\n");
+    free(json);
+
+    // empty and recorded timelines
+    json = ExportToString(&info, NULL, 0);
+    CHECK(WellFormed(json), "export of an empty timeline is not well formed:\n%s\n", json);
+    free(json);
+    json = ExportToString(recordedInfo, recorded, numRecorded);
+    CHECK(WellFormed(json), "export of a recorded timeline is not well formed\n");
+    free(json);
+}
+
+int main(int argc, char* argv[]) {
+    const ULONG eventsPerProducer = (argc > 1) ? (ULONG)strtoul(argv[1], NULL, 0) : 1000000UL;
+    unsigned numProducers = (argc > 2) ? (unsigned)strtoul(argv[2], NULL, 0) : 4U;
+    if ((numProducers == 0) || (numProducers > SIM_MAX_PRODUCERS)) {
+        numProducers = SIM_MAX_PRODUCERS;
+    }
+
+    TestWrap();
+    XDMA_TIMELINE_INFO recordedInfo;
+    XDMA_TIMELINE_EVENT* recorded = NULL;
+    ULONG numRecorded = 0;
+    TestConcurrent(eventsPerProducer, numProducers, &recordedInfo, &recorded, &numRecorded);
+    TestExport(&recordedInfo, recorded, numRecorded);
+    free(recorded);
+
+    printf("%lu errors\n", errors);
+    return (errors == 0) ? 0 : 1;
+}
@@ -1,6 +1,5 @@
 #include <iostream>
 #include <string>
-#include <thread>
 #include <vector>
 #include <Windows.h>
 #include <SetupAPI.h>
@@ -51,6 +50,48 @@ public:
         return buffer;
     }
 
+    XDMA_EVENT_INFO wait(uint32_t mask) {
+        XDMA_EVENT_INFO info;
+        unsigned long num_bytes_returned;
+        if (!DeviceIoControl(h, IOCTL_XDMA_EVENT_WAIT, &mask, sizeof(mask), &info, sizeof(info),
+                             &num_bytes_returned, NULL)) {
+            throw std::runtime_error("IOCTL_XDMA_EVENT_WAIT failed! " + get_windows_error_msg());
+        } else if (num_bytes_returned != sizeof(info)) {
+            throw std::runtime_error("Failed to read all bytes!");
+        }
+        return info;
+    }
+
+    void read_block(long address, void* buffer, unsigned long size) {
+        if (INVALID_SET_FILE_POINTER == SetFilePointer(h, address, NULL, FILE_BEGIN)) {
+            throw std::runtime_error("SetFilePointer failed: " + get_windows_error_msg());
+        }
+        unsigned long num_bytes_read;
+        if (!ReadFile(h, buffer, size, &num_bytes_read, NULL)) {
+            throw std::runtime_error("Failed to read from stream! " + get_windows_error_msg());
+        } else if (num_bytes_read != size) {
+            throw std::runtime_error("Failed to read all bytes!");
+        }
+    }
+
+    void register_program(const XDMA_EVENT_PROGRAM& program) {
+        unsigned long num_bytes_returned;
+        if (!DeviceIoControl(h, IOCTL_XDMA_PROGRAM_REGISTER, (LPVOID)&program, sizeof(program),
+                             NULL, 0, &num_bytes_returned, NULL)) {
+            throw std::runtime_error("IOCTL_XDMA_PROGRAM_REGISTER failed! " + get_windows_error_msg());
+        }
+    }
+
+    // buffer receives XDMA_PROGRAM_RESULT followed by the transferred data
+    XDMA_PROGRAM_RESULT wait_program(std::vector<char>& buffer) {
+        unsigned long num_bytes_returned;
+        if (!DeviceIoControl(h, IOCTL_XDMA_PROGRAM_WAIT, NULL, 0, buffer.data(),
+                             (DWORD)buffer.size(), &num_bytes_returned, NULL)) {
+            throw std::runtime_error("IOCTL_XDMA_PROGRAM_WAIT failed! " + get_windows_error_msg());
+        }
+        return *reinterpret_cast<XDMA_PROGRAM_RESULT*>(buffer.data());
+    }
+
 private:
     HANDLE h;
 };
@@ -95,12 +136,68 @@ static std::vector<std::string> get_device_paths(GUID guid) {
     return device_paths;
 }
 
-int __cdecl main(int, char* argv[]) {
+// Measures the time from the user event interrupt until the c2h data is available to the
+// application - once with a ReadFile issued after the event wait returned and once with a dma
+// program that the driver starts directly from the user interrupt.
+static void measure_latency(const std::string& dev_path, unsigned event_id, unsigned channel,
+                            uint64_t address, uint32_t size, unsigned count) {
+
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    auto to_us = [&](int64_t ticks) { return (double)ticks * 1e6 / (double)frequency.QuadPart; };
+
+    const auto c2h_path = dev_path + "\\c2h_" + std::to_string(channel);
+    std::vector<char> buffer(sizeof(XDMA_PROGRAM_RESULT) + size);
+
+    double total = 0.0;
+    {
+        device_file user_event(dev_path + "\\event_" + std::to_string(event_id), GENERIC_READ);
+        device_file c2h(c2h_path, GENERIC_READ);
+        for (unsigned i = 0; i < count; ++i) {
+            const auto info = user_event.wait(1u << event_id);
+            c2h.read_block((long)address, buffer.data(), size);
+            LARGE_INTEGER now;
+            QueryPerformanceCounter(&now);
+            total += to_us(now.QuadPart - (int64_t)info.timestamp[event_id]);
+        }
+    }
+    std::cout << "event + ReadFile:   " << total / count << " us average over " << count << " events\n";
+
+    total = 0.0;
+    {
+        device_file c2h(c2h_path, GENERIC_READ);
+        XDMA_EVENT_PROGRAM program = { event_id, 0, address, size };
+        c2h.register_program(program);
+        for (unsigned i = 0; i < count; ++i) {
+            const auto result = c2h.wait_program(buffer);
+            if (result.status < 0) {
+                throw std::runtime_error("dma program transfer failed!");
+            }
+            LARGE_INTEGER now;
+            QueryPerformanceCounter(&now);
+            total += to_us(now.QuadPart - (int64_t)result.triggerTime);
+        }
+    }
+    std::cout << "event dma program:  " << total / count << " us average over " << count << " events\n";
+}
+
+int __cdecl main(int argc, char* argv[]) {
 
     try {
+        if ((argc >= 6) && (std::string(argv[1]) == "-l")) {
+            const auto dev_paths = get_device_paths(GUID_DEVINTERFACE_XDMA);
+            if (dev_paths.empty()) {
+                throw std::runtime_error("No XDMA device driver installed!");
+            }
+            const unsigned count = (argc >= 7) ? std::stoul(argv[6]) : 1000;
+            measure_latency(dev_paths[0], std::stoul(argv[2]), std::stoul(argv[3]),
+                            std::stoull(argv[4], nullptr, 0), std::stoul(argv[5], nullptr, 0), count);
+            return 0;
+        }
+
         std::cout << argv[0] << "\n";
-        std::cout << "This application opens all user event device files (event_0 to event_15) and waits on an event to be triggered.\n";
-        std::cout << "When an event is triggered, a corresponding message is printed to the terminal.\n";
+        std::cout << "This application waits on all user events (event_0 to event_15) with a single request.\n";
+        std::cout << "Whenever events are triggered, the number of occurrences since the last report is printed.\n";
         std::cout << "This application loops indefinitely. To exit press CTRL-C.\n";
 
         const auto dev_paths = get_device_paths(GUID_DEVINTERFACE_XDMA);
@@ -108,41 +205,19 @@ int __cdecl main(int, char* argv[]) {
             throw std::runtime_error("No XDMA device driver installed!");
         }
 
-
-        auto event_loop = [&](unsigned event_id) {
-            std::cout << ("Waiting on event_" + std::to_string(event_id) + "...\n");
-            while (true) {
-
-                    const auto event_dev_path = dev_paths[0] + "\\event_" + std::to_string(event_id);
-                    device_file user_event(event_dev_path, GENERIC_READ);
-                    auto val = user_event.read<uint8_t>(0); // this blocks in driver until event is triggered
-                    if (val == 1) {
-                        std::cout << ("event_" + std::to_string(event_id) + " received!\n");
-                    } // else timed out, so try again
+        // any event file accepts a wait on an arbitrary mask of events
+        device_file user_event(dev_paths[0] + "\\event_0", GENERIC_READ);
+        const uint32_t all_events = (1u << XDMA_MAX_USER_EVENTS) - 1;
+        std::cout << "Waiting on events...\n";
+        while (true) {
+            const auto info = user_event.wait(all_events); // blocks in driver until an event fired
+            for (unsigned event_id = 0; event_id < XDMA_MAX_USER_EVENTS; ++event_id) {
+                if (info.mask & (1u << event_id)) {
+                    std::cout << ("event_" + std::to_string(event_id) + " received " +
+                                  std::to_string(info.count[event_id]) + " time(s), last at " +
+                                  std::to_string(info.timestamp[event_id]) + "\n");
+                }
             }
-        };
-
-        std::thread event_threads[] = {
-            std::thread(event_loop, 0),
-            std::thread(event_loop, 1),
-            std::thread(event_loop, 2),
-            std::thread(event_loop, 3),
-            std::thread(event_loop, 4),
-            std::thread(event_loop, 5),
-            std::thread(event_loop, 6),
-            std::thread(event_loop, 7),
-            std::thread(event_loop, 8),
-            std::thread(event_loop, 9),
-            std::thread(event_loop, 10),
-            std::thread(event_loop, 11),
-            std::thread(event_loop, 12),
-            std::thread(event_loop, 13),
-            std::thread(event_loop, 14),
-            std::thread(event_loop, 15),
-        };
-
-        for (auto& t : event_threads) {
-            t.join();
         }
 
     } catch (const std::exception& e) {
@@ -0,0 +1,317 @@
+/*
+* xdma_bench - XDMA driver backend
+* ================================
+*
+* Runs the benchmark against the XDMA driver through its h2c_N and c2h_N device files.
+*  - block: synchronous ReadFile/WriteFile
+*  - async: overlapped I/O, the worker sleeps in WaitForMultipleObjects
+*  - poll:  overlapped I/O, the worker spins on HasOverlappedIoCompleted
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <strsafe.h>
+
+#include <Windows.h>
+#include <SetupAPI.h>
+#include <INITGUID.H>
+#include <WinIoCtl.h>
+
+#include "xdma_public.h"
+#include "xdma_bench.h"
+
+#pragma comment(lib, "setupapi.lib")
+
+typedef struct DRIVER_DEVICE_T {
+    char basePath[MAX_PATH + 1];
+    BENCH_MODE mode;
+} DRIVER_DEVICE;
+
+typedef struct DRIVER_SLOT_T {
+    unsigned char* buffer;
+    OVERLAPPED overlapped;
+    BOOL pending;
+    DWORD transferred;      // block mode result
+} DRIVER_SLOT;
+
+typedef struct DRIVER_CHANNEL_T {
+    HANDLE file;
+    BENCH_DIR dir;
+    BENCH_MODE mode;
+    unsigned qdepth;
+    DRIVER_SLOT* slots;
+    HANDLE* events;         // scratch array for WaitForMultipleObjects
+    unsigned* eventSlots;
+    int lastSlot;           // block mode: the completed transfer
+} DRIVER_CHANNEL;
+
+static int get_devices(GUID guid, char* devpath, size_t len_devpath) {
+
+    HDEVINFO device_info = SetupDiGetClassDevs((LPGUID)&guid, NULL, NULL, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
+    if (device_info == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "GetDevices INVALID_HANDLE_VALUE\n");
+        return 0;
+    }
+
+    SP_DEVICE_INTERFACE_DATA device_interface;
+    device_interface.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
+
+    // enumerate through devices
+    DWORD index;
+    for (index = 0; SetupDiEnumDeviceInterfaces(device_info, NULL, &guid, index, &device_interface); ++index) {
+
+        // get required buffer size
+        ULONG detailLength = 0;
+        if (!SetupDiGetDeviceInterfaceDetail(device_info, &device_interface, NULL, 0, &detailLength, NULL) && GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+            fprintf(stderr, "SetupDiGetDeviceInterfaceDetail - get length failed\n");
+            break;
+        }
+
+        // allocate space for device interface detail
+        PSP_DEVICE_INTERFACE_DETAIL_DATA dev_detail = (PSP_DEVICE_INTERFACE_DETAIL_DATA)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, detailLength);
+        if (!dev_detail) {
+            fprintf(stderr, "HeapAlloc failed\n");
+            break;
+        }
+        dev_detail->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
+
+        // get device interface detail
+        if (!SetupDiGetDeviceInterfaceDetail(device_info, &device_interface, dev_detail, detailLength, NULL, NULL)) {
+            fprintf(stderr, "SetupDiGetDeviceInterfaceDetail - get detail failed\n");
+            HeapFree(GetProcessHeap(), 0, dev_detail);
+            break;
+        }
+
+        StringCchCopy(devpath, len_devpath, dev_detail->DevicePath);
+        HeapFree(GetProcessHeap(), 0, dev_detail);
+    }
+
+    SetupDiDestroyDeviceInfoList(device_info);
+
+    return index;
+}
+
+static int driver_open(const BENCH_OPTIONS* options, void** device) {
+    DRIVER_DEVICE* dev = calloc(1, sizeof(DRIVER_DEVICE));
+    if (dev == NULL) {
+        return -1;
+    }
+    DWORD num_devices = get_devices(GUID_DEVINTERFACE_XDMA, dev->basePath, sizeof(dev->basePath));
+    if (options->verbose) {
+        fprintf(stderr, "Found %d Xilinx XDMA device(s), using %s\n", num_devices, dev->basePath);
+    }
+    if (num_devices < 1) {
+        fprintf(stderr, "No XDMA device found\n");
+        free(dev);
+        return -1;
+    }
+    dev->mode = options->mode;
+    *device = dev;
+    return 0;
+}
+
+static void driver_close(void* device) {
+    free(device);
+}
+
+static void driver_channel_close(void* channel);
+
+static int driver_channel_open(void* device, BENCH_DIR dir, unsigned channel, unsigned qdepth,
+                               size_t size, void** result) {
+    DRIVER_DEVICE* dev = (DRIVER_DEVICE*)device;
+
+    DRIVER_CHANNEL* chan = calloc(1, sizeof(DRIVER_CHANNEL));
+    if (chan == NULL) {
+        return -1;
+    }
+    chan->file = INVALID_HANDLE_VALUE;
+    chan->dir = dir;
+    chan->mode = dev->mode;
+    chan->qdepth = qdepth;
+    chan->lastSlot = -1;
+    chan->slots = calloc(qdepth, sizeof(DRIVER_SLOT));
+    chan->events = calloc(qdepth, sizeof(HANDLE));
+    chan->eventSlots = calloc(qdepth, sizeof(unsigned));
+    if (!chan->slots || !chan->events || !chan->eventSlots) {
+        goto ErrExit;
+    }
+
+    char path[MAX_PATH + 1];
+    StringCchPrintf(path, sizeof(path), "%s\\%s_%u", dev->basePath,
+                    (dir == BENCH_H2C) ? "h2c" : "c2h", channel);
+    DWORD flags = FILE_ATTRIBUTE_NORMAL;
+    if (chan->mode != BENCH_MODE_BLOCK) {
+        flags |= FILE_FLAG_OVERLAPPED;
+    }
+    chan->file = CreateFile(path, (dir == BENCH_H2C) ? GENERIC_WRITE : GENERIC_READ, 0, NULL,
+                            OPEN_EXISTING, flags, NULL);
+    if (chan->file == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "CreateFile(%s) failed with Win32 error code: %d\n", path, GetLastError());
+        goto ErrExit;
+    }
+
+    for (unsigned i = 0; i < qdepth; ++i) {
+        chan->slots[i].buffer = bench_aligned_alloc(size);
+        chan->slots[i].overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        if (!chan->slots[i].buffer || !chan->slots[i].overlapped.hEvent) {
+            fprintf(stderr, "Error allocating %zu bytes for slot %u\n", size, i);
+            goto ErrExit;
+        }
+    }
+    *result = chan;
+    return 0;
+
+ErrExit:
+    driver_channel_close(chan);
+    return -1;
+}
+
+static void driver_channel_close(void* channel) {
+    DRIVER_CHANNEL* chan = (DRIVER_CHANNEL*)channel;
+    if (chan->file != INVALID_HANDLE_VALUE) {
+        CancelIo(chan->file);
+    }
+    if (chan->slots) {
+        for (unsigned i = 0; i < chan->qdepth; ++i) {
+            DRIVER_SLOT* slot = &chan->slots[i];
+            if (slot->pending) { // wait for the cancelled request before freeing its buffer
+                DWORD transferred;
+                GetOverlappedResult(chan->file, &slot->overlapped, &transferred, TRUE);
+            }
+            if (slot->overlapped.hEvent) {
+                CloseHandle(slot->overlapped.hEvent);
+            }
+            bench_aligned_free(slot->buffer);
+        }
+    }
+    if (chan->file != INVALID_HANDLE_VALUE) {
+        CloseHandle(chan->file);
+    }
+    free(chan->slots);
+    free(chan->events);
+    free(chan->eventSlots);
+    free(chan);
+}
+
+static unsigned char* driver_buffer(void* channel, unsigned slot) {
+    DRIVER_CHANNEL* chan = (DRIVER_CHANNEL*)channel;
+    return chan->slots[slot].buffer;
+}
+
+static int driver_submit(void* channel, unsigned index, size_t size, uint64_t address) {
+    DRIVER_CHANNEL* chan = (DRIVER_CHANNEL*)channel;
+    DRIVER_SLOT* slot = &chan->slots[index];
+    BOOL ok;
+
+    if (chan->mode == BENCH_MODE_BLOCK) {
+        LARGE_INTEGER offset;
+        offset.QuadPart = (LONGLONG)address;
+        if (!SetFilePointerEx(chan->file, offset, NULL, FILE_BEGIN)) {
+            fprintf(stderr, "SetFilePointerEx failed with Win32 error code: %d\n", GetLastError());
+            return -1;
+        }
+        if (chan->dir == BENCH_H2C) {
+            ok = WriteFile(chan->file, slot->buffer, (DWORD)size, &slot->transferred, NULL);
+        } else {
+            ok = ReadFile(chan->file, slot->buffer, (DWORD)size, &slot->transferred, NULL);
+        }
+        if (!ok) {
+            fprintf(stderr, "Transfer failed with Win32 error code: %d\n", GetLastError());
+            return -1;
+        }
+        chan->lastSlot = (int)index;
+        return 0;
+    }
+
+    // the file offset of an overlapped request is the card address
+    slot->overlapped.Offset = (DWORD)(address & 0xFFFFFFFFULL);
+    slot->overlapped.OffsetHigh = (DWORD)(address >> 32);
+    ResetEvent(slot->overlapped.hEvent);
+    if (chan->dir == BENCH_H2C) {
+        ok = WriteFile(chan->file, slot->buffer, (DWORD)size, NULL, &slot->overlapped);
+    } else {
+        ok = ReadFile(chan->file, slot->buffer, (DWORD)size, NULL, &slot->overlapped);
+    }
+    if (!ok && (GetLastError() != ERROR_IO_PENDING)) {
+        fprintf(stderr, "Transfer failed with Win32 error code: %d\n", GetLastError());
+        return -1;
+    }
+    slot->pending = TRUE;
+    return 0;
+}
+
+static int driver_complete(DRIVER_CHANNEL* chan, unsigned index, unsigned* slot_index,
+                           size_t* bytes) {
+    DRIVER_SLOT* slot = &chan->slots[index];
+    DWORD transferred = 0;
+    slot->pending = FALSE;
+    if (!GetOverlappedResult(chan->file, &slot->overlapped, &transferred, FALSE)) {
+        fprintf(stderr, "Transfer failed with Win32 error code: %d\n", GetLastError());
+        return -1;
+    }
+    *slot_index = index;
+    *bytes = transferred;
+    return 0;
+}
+
+static int driver_reap(void* channel, unsigned* slot_index, size_t* bytes) {
+    DRIVER_CHANNEL* chan = (DRIVER_CHANNEL*)channel;
+
+    if (chan->mode == BENCH_MODE_BLOCK) {
+        if (chan->lastSlot < 0) {
+            return -1;
+        }
+        *slot_index = (unsigned)chan->lastSlot;
+        *bytes = chan->slots[chan->lastSlot].transferred;
+        chan->lastSlot = -1;
+        return 0;
+    }
+
+    if (chan->mode == BENCH_MODE_POLL) {
+        for (;;) {
+            BOOL any = FALSE;
+            for (unsigned i = 0; i < chan->qdepth; ++i) {
+                if (!chan->slots[i].pending) {
+                    continue;
+                }
+                any = TRUE;
+                if (HasOverlappedIoCompleted(&chan->slots[i].overlapped)) {
+                    return driver_complete(chan, i, slot_index, bytes);
+                }
+            }
+            if (!any) {
+                return -1;
+            }
+            YieldProcessor();
+        }
+    }
+
+    DWORD count = 0;
+    for (unsigned i = 0; i < chan->qdepth; ++i) {
+        if (chan->slots[i].pending) {
+            chan->events[count] = chan->slots[i].overlapped.hEvent;
+            chan->eventSlots[count] = i;
+            count++;
+        }
+    }
+    if (count == 0) {
+        return -1;
+    }
+    DWORD signalled = WaitForMultipleObjects(count, chan->events, FALSE, INFINITE);
+    if (signalled >= WAIT_OBJECT_0 + count) {
+        fprintf(stderr, "WaitForMultipleObjects failed with Win32 error code: %d\n", GetLastError());
+        return -1;
+    }
+    return driver_complete(chan, chan->eventSlots[signalled - WAIT_OBJECT_0], slot_index, bytes);
+}
+
+const BENCH_BACKEND bench_backend_driver = {
+    .name = "driver",
+    .open = driver_open,
+    .close = driver_close,
+    .channel_open = driver_channel_open,
+    .channel_close = driver_channel_close,
+    .buffer = driver_buffer,
+    .submit = driver_submit,
+    .reap = driver_reap,
+};
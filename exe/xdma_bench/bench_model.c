@@ -0,0 +1,389 @@
+/*
+* xdma_bench - software model backend
+* ===================================
+*
+* Runs the benchmark against the XDMA software model (libxdma/linux/xdma_model.h) through the
+* OS independent engine core, so descriptor building, block fetch optimization and completion
+* handling are the driver's code paths. The model thread moves the data at the configured
+* bandwidth and descriptor fetch latency.
+*
+* Each channel keeps its submitted transfers in a FIFO and runs one descriptor chain at a time, like
+* the driver does for a DMA transaction. Completion is detected from the poll mode writeback,
+* either by spinning (poll mode) or by sleeping until the model raises the channel interrupt.
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "xdma_model.h"
+#include "xdma_os_linux.h"
+#include "xdma_bench.h"
+
+#define MODEL_IRQ_TIMEOUT_NS    (1000000)   // backstop of an interrupt wait
+
+typedef struct MODEL_SLOT_T {
+    XDMA_OS_DMA_BUFFER data;
+    XDMA_OS_DMA_BUFFER desc;        // descriptor chain, one descriptor per page
+    XDMA_OS_DMA_BUFFER results;     // AXI-ST C2H DMA_RESULT per descriptor
+    ULONG numDesc;
+    size_t size;
+} MODEL_SLOT;
+
+typedef struct MODEL_DEVICE_T {
+    XDMA_MODEL model;
+    XDMA_OS_LINUX_DEVICE os;
+    const BENCH_OPTIONS* options;
+    pthread_mutex_t lock;
+    pthread_cond_t irq;             // broadcast by the model interrupt callback
+    pthread_mutex_t channelLock;
+    BOOLEAN channelInUse[2][XDMA_MODEL_MAX_CHANNELS];
+} MODEL_DEVICE;
+
+typedef struct MODEL_CHANNEL_T {
+    MODEL_DEVICE* device;
+    XDMA_MODEL_ENGINE* engine;
+    DirToDev dir;
+    EngineType type;
+    BOOLEAN poll;
+    XDMA_OS_DMA_BUFFER wb;          // poll mode writeback
+    unsigned qdepth;
+    MODEL_SLOT* slots;
+    unsigned* fifo;                 // submitted slots, fifo[head] is running on the engine
+    unsigned head;
+    unsigned count;
+} MODEL_CHANNEL;
+
+// ========================= helpers ==============================================================
+
+static VOID RegWrite(volatile UINT32* reg, UINT32 value)
+// W1S/W1C registers: wait until the model consumed the previous write, see xdma_model.h
+{
+    while (__atomic_load_n(reg, __ATOMIC_ACQUIRE) != 0) {
+        sched_yield();
+    }
+    __atomic_store_n(reg, value, __ATOMIC_RELEASE);
+}
+
+static VOID ModelIrq(IN XDMA_MODEL* model, IN void* context) {
+    UNREFERENCED_PARAMETER(model);
+    MODEL_DEVICE* dev = (MODEL_DEVICE*)context;
+    pthread_mutex_lock(&dev->lock);
+    pthread_cond_broadcast(&dev->irq);
+    pthread_mutex_unlock(&dev->lock);
+}
+
+static BOOLEAN SlotDone(const MODEL_CHANNEL* chan, const MODEL_SLOT* slot)
+// all descriptors written back or the engine stopped on an error
+{
+    const volatile XDMA_POLL_WB* wb = (const volatile XDMA_POLL_WB*)chan->wb.va;
+    return (wb->completedDescCount >= slot->numDesc) ||
+        ((chan->engine->regs->status & XDMA_STAT_EXPECTED_ZERO & ~XDMA_BUSY_BIT) != 0);
+}
+
+static VOID SlotFree(MODEL_SLOT* slot) {
+    XdmaOsDmaFree(&slot->data);
+    XdmaOsDmaFree(&slot->desc);
+    XdmaOsDmaFree(&slot->results);
+}
+
+// ========================= engine control =======================================================
+
+static VOID EngineStart(MODEL_CHANNEL* chan, MODEL_SLOT* slot) {
+    MODEL_DEVICE* dev = chan->device;
+    volatile XDMA_SGDMA_REGS* sgdma = chan->engine->sgdma;
+    const ULONG mrrsBytes = 1 << (dev->model.configRegs->pcieMRRS + 7);
+
+    ((volatile XDMA_POLL_WB*)chan->wb.va)->completedDescCount = 0;
+    CoreEngineBindDescriptors(sgdma, slot->desc.la);
+    CoreDescriptorOptimize(sgdma, (DMA_DESCRIPTOR*)slot->desc.va, slot->numDesc, mrrsBytes);
+    MemoryBarrier();
+    RegWrite(&chan->engine->regs->controlW1S, XDMA_CTRL_RUN_BIT);
+}
+
+static VOID EngineStop(MODEL_CHANNEL* chan) {
+    RegWrite(&chan->engine->regs->controlW1C, XDMA_CTRL_RUN_BIT);
+}
+
+static VOID EngineWait(MODEL_CHANNEL* chan, MODEL_SLOT* slot) {
+    if (chan->poll) {
+        while (!SlotDone(chan, slot)) {
+            sched_yield(); // the model engine needs a CPU as well
+        }
+        return;
+    }
+
+    MODEL_DEVICE* dev = chan->device;
+    pthread_mutex_lock(&dev->lock);
+    while (!SlotDone(chan, slot)) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += MODEL_IRQ_TIMEOUT_NS;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&dev->irq, &dev->lock, &deadline);
+    }
+    pthread_mutex_unlock(&dev->lock);
+}
+
+// ========================= backend ==============================================================
+
+static int model_open(const BENCH_OPTIONS* options, void** device) {
+
+    MODEL_DEVICE* dev = calloc(1, sizeof(MODEL_DEVICE));
+    if (dev == NULL) {
+        return -1;
+    }
+    dev->options = options;
+    pthread_mutex_init(&dev->lock, NULL);
+    pthread_cond_init(&dev->irq, NULL);
+    pthread_mutex_init(&dev->channelLock, NULL);
+
+    uint64_t maxSize = 0;
+    for (unsigned i = 0; i < options->sizes.count; ++i) {
+        maxSize = options->sizes.values[i] > maxSize ? options->sizes.values[i] : maxSize;
+    }
+
+    XDMA_MODEL_CONFIG config = {
+        .numH2C = XDMA_MODEL_MAX_CHANNELS,
+        .numC2H = XDMA_MODEL_MAX_CHANNELS,
+        .streaming = options->streaming ? TRUE : FALSE,
+        .bandwidth = options->modelBandwidth,
+        .fetchLatencyNs = options->modelLatencyNs,
+        .cardMemorySize = (size_t)(options->address + maxSize),
+        .pcieMRRS = 2, // 512 bytes
+        .pcieWidth = 8,
+        .irq = ModelIrq,
+        .irqContext = dev,
+    };
+    if (!NT_SUCCESS(XdmaModelCreate(&config, &dev->model))) {
+        fprintf(stderr, "XdmaModelCreate failed\n");
+        goto ErrExit;
+    }
+    PUCHAR bars[1] = { dev->model.bar };
+    size_t lengths[1] = { dev->model.barLength };
+    if (!NT_SUCCESS(XdmaOsLinuxOpenModel(bars, lengths, 1, &dev->os))) {
+        fprintf(stderr, "XdmaOsLinuxOpenModel failed\n");
+        goto ErrExit;
+    }
+    RegWrite(&dev->model.irqRegs->channelIntEnableW1S, 0xFFFFFFFFUL);
+    if (!NT_SUCCESS(XdmaModelStart(&dev->model))) {
+        fprintf(stderr, "XdmaModelStart failed\n");
+        goto ErrExit;
+    }
+
+    *device = dev;
+    return 0;
+
+ErrExit:
+    XdmaModelDestroy(&dev->model);
+    free(dev);
+    return -1;
+}
+
+static void model_close(void* device) {
+    MODEL_DEVICE* dev = (MODEL_DEVICE*)device;
+    XdmaModelDestroy(&dev->model);
+    XdmaOsLinuxClose(&dev->os);
+    pthread_cond_destroy(&dev->irq);
+    pthread_mutex_destroy(&dev->lock);
+    pthread_mutex_destroy(&dev->channelLock);
+    free(dev);
+}
+
+static void model_channel_close(void* channel);
+
+static int model_channel_open(void* device, BENCH_DIR dir, unsigned channel, unsigned qdepth,
+                              size_t size, void** result) {
+    MODEL_DEVICE* dev = (MODEL_DEVICE*)device;
+    const DirToDev engineDir = (dir == BENCH_H2C) ? H2C : C2H;
+
+    // one worker per engine - the engine runs one descriptor chain at a time
+    pthread_mutex_lock(&dev->channelLock);
+    BOOLEAN busy = dev->channelInUse[engineDir][channel];
+    dev->channelInUse[engineDir][channel] = TRUE;
+    pthread_mutex_unlock(&dev->channelLock);
+    if (busy) {
+        fprintf(stderr, "%s_%u is already used by another thread, the model backend supports "
+                "one thread per engine\n", engineDir == H2C ? "h2c" : "c2h", channel);
+        return -1;
+    }
+
+    MODEL_CHANNEL* chan = calloc(1, sizeof(MODEL_CHANNEL));
+    if (chan == NULL) {
+        goto ErrExit;
+    }
+    chan->device = dev;
+    chan->engine = &dev->model.engines[engineDir][channel];
+    chan->dir = engineDir;
+    chan->type = dev->options->streaming ? EngineType_ST : EngineType_MM;
+    chan->poll = (dev->options->mode == BENCH_MODE_POLL);
+    chan->qdepth = qdepth;
+    chan->slots = calloc(qdepth, sizeof(MODEL_SLOT));
+    chan->fifo = calloc(qdepth, sizeof(unsigned));
+    if ((chan->slots == NULL) || (chan->fifo == NULL)) {
+        goto ErrExit;
+    }
+
+    const ULONG numDesc = (ULONG)((size + BENCH_PAGE_SIZE - 1) / BENCH_PAGE_SIZE);
+    for (unsigned i = 0; i < qdepth; ++i) {
+        MODEL_SLOT* slot = &chan->slots[i];
+        if (!NT_SUCCESS(XdmaOsDmaAlloc(&dev->os, size, &slot->data)) ||
+            !NT_SUCCESS(XdmaOsDmaAlloc(&dev->os, numDesc * sizeof(DMA_DESCRIPTOR), &slot->desc))) {
+            goto ErrExit;
+        }
+        if ((chan->type == EngineType_ST) && (chan->dir == C2H) &&
+            !NT_SUCCESS(XdmaOsDmaAlloc(&dev->os, numDesc * sizeof(DMA_RESULT), &slot->results))) {
+            goto ErrExit;
+        }
+    }
+    if (!NT_SUCCESS(XdmaOsDmaAlloc(&dev->os, sizeof(XDMA_POLL_WB), &chan->wb))) {
+        goto ErrExit;
+    }
+
+    // completion is always detected from the writeback, interrupts only wake the waiter
+    volatile XDMA_ENGINE_REGS* regs = chan->engine->regs;
+    regs->pollModeWbLo = chan->wb.la.LowPart;
+    regs->pollModeWbHi = chan->wb.la.HighPart;
+    UINT32 control = XDMA_CTRL_POLL_MODE;
+    if (!chan->poll) {
+        const UINT32 sources = CoreEngineIrqSources(chan->type, chan->dir);
+        RegWrite(&regs->intEnableMaskW1S, sources);
+        control |= sources;
+    }
+    RegWrite(&regs->controlW1S, control);
+
+    *result = chan;
+    return 0;
+
+ErrExit:
+    fprintf(stderr, "Error allocating DMA memory\n");
+    if (chan) {
+        model_channel_close(chan);
+    } else {
+        pthread_mutex_lock(&dev->channelLock);
+        dev->channelInUse[engineDir][channel] = FALSE;
+        pthread_mutex_unlock(&dev->channelLock);
+    }
+    return -1;
+}
+
+static void model_channel_close(void* channel) {
+    MODEL_CHANNEL* chan = (MODEL_CHANNEL*)channel;
+    MODEL_DEVICE* dev = chan->device;
+    volatile XDMA_ENGINE_REGS* regs = chan->engine->regs;
+
+    RegWrite(&regs->controlW1C, 0xFFFFFFFFUL);
+    RegWrite(&regs->intEnableMaskW1C, 0xFFFFFFFFUL);
+    while ((regs->controlW1C != 0) || (regs->status & XDMA_BUSY_BIT)) {
+        sched_yield(); // engine stopped before its memory is released
+    }
+    regs->pollModeWbLo = 0;
+    regs->pollModeWbHi = 0;
+
+    if (chan->slots) {
+        for (unsigned i = 0; i < chan->qdepth; ++i) {
+            SlotFree(&chan->slots[i]);
+        }
+    }
+    XdmaOsDmaFree(&chan->wb);
+
+    pthread_mutex_lock(&dev->channelLock);
+    dev->channelInUse[chan->dir][chan->engine->channel] = FALSE;
+    pthread_mutex_unlock(&dev->channelLock);
+
+    free(chan->slots);
+    free(chan->fifo);
+    free(chan);
+}
+
+static unsigned char* model_buffer(void* channel, unsigned slot) {
+    MODEL_CHANNEL* chan = (MODEL_CHANNEL*)channel;
+    return (unsigned char*)chan->slots[slot].data.va;
+}
+
+static int model_submit(void* channel, unsigned index, size_t size, uint64_t address) {
+    MODEL_CHANNEL* chan = (MODEL_CHANNEL*)channel;
+    MODEL_SLOT* slot = &chan->slots[index];
+
+    // build the descriptor chain like the driver does from the scatter gather list
+    DMA_DESCRIPTOR* desc = (DMA_DESCRIPTOR*)slot->desc.va;
+    const UINT64 descLA = (UINT64)slot->desc.la.QuadPart;
+    const UINT64 dataLA = (UINT64)slot->data.la.QuadPart;
+    const UINT64 resultLA = (UINT64)slot->results.la.QuadPart;
+    slot->numDesc = (ULONG)((size + BENCH_PAGE_SIZE - 1) / BENCH_PAGE_SIZE);
+    slot->size = size;
+    for (ULONG i = 0; i < slot->numDesc; ++i) {
+        const size_t offset = (size_t)i * BENCH_PAGE_SIZE;
+        const UINT32 length = (UINT32)min(size - offset, (size_t)BENCH_PAGE_SIZE);
+        UINT64 deviceOffset = 0;
+        if (chan->type == EngineType_MM) {
+            deviceOffset = address + offset;
+        } else if (chan->dir == C2H) {
+            deviceOffset = resultLA + i * sizeof(DMA_RESULT);
+            ((volatile DMA_RESULT*)slot->results.va)[i].status = 0;
+        }
+        CoreDescriptorSet(&desc[i], chan->dir, dataLA + offset, deviceOffset, length,
+                          descLA + (i + 1) * sizeof(DMA_DESCRIPTOR));
+    }
+    CoreDescriptorSetLast(&desc[slot->numDesc - 1], chan->type);
+
+    chan->fifo[(chan->head + chan->count) % chan->qdepth] = index;
+    chan->count++;
+    if (chan->count == 1) {
+        EngineStart(chan, slot);
+    }
+    return 0;
+}
+
+static int model_reap(void* channel, unsigned* index, size_t* bytes) {
+    MODEL_CHANNEL* chan = (MODEL_CHANNEL*)channel;
+    if (chan->count == 0) {
+        return -1;
+    }
+    const unsigned done = chan->fifo[chan->head];
+    MODEL_SLOT* slot = &chan->slots[done];
+
+    EngineWait(chan, slot);
+    const UINT32 status = chan->engine->regs->status;
+    EngineStop(chan);
+
+    chan->head = (chan->head + 1) % chan->qdepth;
+    chan->count--;
+    if (chan->count) {
+        EngineStart(chan, &chan->slots[chan->fifo[chan->head]]);
+    }
+
+    if (status & XDMA_STAT_EXPECTED_ZERO & ~XDMA_BUSY_BIT) {
+        fprintf(stderr, "engine status 0x%08X\n", status);
+        return -1;
+    }
+
+    size_t transferred = slot->size;
+    if (slot->results.va) {
+        const volatile DMA_RESULT* results = (const volatile DMA_RESULT*)slot->results.va;
+        transferred = 0;
+        for (ULONG i = 0; i < slot->numDesc; ++i) {
+            transferred += results[i].length;
+        }
+    }
+    *index = done;
+    *bytes = transferred;
+    return 0;
+}
+
+const BENCH_BACKEND bench_backend_model = {
+    .name = "model",
+    .open = model_open,
+    .close = model_close,
+    .channel_open = model_channel_open,
+    .channel_close = model_channel_close,
+    .buffer = model_buffer,
+    .submit = model_submit,
+    .reap = model_reap,
+};
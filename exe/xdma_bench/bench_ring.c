@@ -0,0 +1,264 @@
+/*
+* xdma_bench - streaming ring backends
+* ====================================
+*
+* Measures the index handoff of the C2H streaming ring (XDMA_RING) between the engine dpc and the
+* reading thread on the host, without a device. A producer thread per channel stands in for the
+* engine and its dpc: it fills every block the reader has handed back, writes the block's
+* DMA_RESULT and publishes tail. The worker thread is the reader of EngineRingCopyBytesToMemory():
+* it copies the blocks between head and tail into its buffer and publishes head.
+*
+* ring-lock reads and publishes both indices under a spin lock, four lock round trips per dpc and
+* read like the driver used to take. ring-atomic uses the acquire/release accesses the driver uses
+* now. The difference of the latency and cpu time per GB of both at small transfer sizes is the
+* per-read cost of the lock.
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xdma_os.h"
+#include "xdma_core.h"
+#include "xdma_bench.h"
+
+#define RING_NUM_BLOCKS     (258U)              // XDMA_RING_NUM_BLOCKS
+#define RING_BLOCK_SIZE     (BENCH_PAGE_SIZE)   // XDMA_RING_BLOCK_SIZE
+
+typedef struct RING_DEVICE_T {
+    BOOLEAN useLock;
+} RING_DEVICE;
+
+/// Same index layout as XDMA_RING
+typedef struct RING_CHANNEL_T {
+    XDMA_CACHE_ALIGN volatile ULONG tail;   // next block to copy out - written by the producer
+    XDMA_CACHE_ALIGN volatile ULONG head;   // next block to fill - written by the reader
+    XDMA_CACHE_ALIGN XDMA_OS_LOCK lock;     // ring-lock only
+    BOOLEAN useLock;
+    volatile LONG stop;
+    pthread_t producer;
+    DMA_RESULT results[RING_NUM_BLOCKS];
+    unsigned char* blocks;                  // RING_NUM_BLOCKS blocks of RING_BLOCK_SIZE bytes
+    unsigned qdepth;
+    unsigned char** buffers;                // read buffer per slot
+    size_t* sizes;                          // requested bytes per slot
+    unsigned* fifo;                         // submitted slots, fifo[next] is read first
+    unsigned next;
+    unsigned count;
+} RING_CHANNEL;
+
+// ========================= index handoff ========================================================
+
+static ULONG LoadIndex(RING_CHANNEL* ring, volatile ULONG* index) {
+    if (ring->useLock) {
+        XdmaOsLockAcquire(&ring->lock);
+        const ULONG value = *index;
+        XdmaOsLockRelease(&ring->lock);
+        return value;
+    }
+    return XdmaOsLoadAcquire(index);
+}
+
+static VOID StoreIndex(RING_CHANNEL* ring, volatile ULONG* index, ULONG value) {
+    if (ring->useLock) {
+        XdmaOsLockAcquire(&ring->lock);
+        *index = value;
+        XdmaOsLockRelease(&ring->lock);
+        return;
+    }
+    XdmaOsStoreRelease(index, value);
+}
+
+static void* ProducerThread(void* arg) {
+    RING_CHANNEL* ring = (RING_CHANNEL*)arg;
+    ULONG tail = 0;
+
+    while (!ring->stop) {
+        // one block stays empty so a full ring is told apart from an empty one
+        const ULONG head = LoadIndex(ring, &ring->head);
+        ULONG filled = 0;
+        while (CoreRingAdvance(tail, RING_NUM_BLOCKS) != head) {
+            ring->results[tail].length = RING_BLOCK_SIZE;
+            ring->results[tail].status = XDMA_RESULT_EOP_BIT;
+            tail = CoreRingAdvance(tail, RING_NUM_BLOCKS);
+            filled++;
+        }
+        if (filled) {
+            StoreIndex(ring, &ring->tail, tail);
+        } else {
+            sched_yield(); // the reader needs a CPU to hand blocks back
+        }
+    }
+    return NULL;
+}
+
+// ========================= backend ==============================================================
+
+static int ring_open(BOOLEAN useLock, void** device) {
+    RING_DEVICE* dev = calloc(1, sizeof(RING_DEVICE));
+    if (dev == NULL) {
+        return -1;
+    }
+    dev->useLock = useLock;
+    *device = dev;
+    return 0;
+}
+
+static int ring_lock_open(const BENCH_OPTIONS* options, void** device) {
+    UNREFERENCED_PARAMETER(options);
+    return ring_open(TRUE, device);
+}
+
+static int ring_atomic_open(const BENCH_OPTIONS* options, void** device) {
+    UNREFERENCED_PARAMETER(options);
+    return ring_open(FALSE, device);
+}
+
+static void ring_close(void* device) {
+    free(device);
+}
+
+static void ring_channel_close(void* channel);
+
+static int ring_channel_open(void* device, BENCH_DIR dir, unsigned channel, unsigned qdepth,
+                             size_t size, void** result) {
+    UNREFERENCED_PARAMETER(channel);
+    const RING_DEVICE* dev = (const RING_DEVICE*)device;
+
+    if (dir != BENCH_C2H) {
+        fprintf(stderr, "The ring backends model the C2H streaming ring, use -d c2h\n");
+        return -1;
+    }
+    RING_CHANNEL* ring = bench_aligned_alloc(sizeof(RING_CHANNEL));
+    if (ring == NULL) {
+        goto ErrExit;
+    }
+    memset(ring, 0, sizeof(RING_CHANNEL));
+    ring->useLock = dev->useLock;
+    ring->qdepth = qdepth;
+    ring->blocks = bench_aligned_alloc((size_t)RING_NUM_BLOCKS * RING_BLOCK_SIZE);
+    ring->buffers = calloc(qdepth, sizeof(unsigned char*));
+    ring->sizes = calloc(qdepth, sizeof(size_t));
+    ring->fifo = calloc(qdepth, sizeof(unsigned));
+    if (!ring->blocks || !ring->buffers || !ring->sizes || !ring->fifo) {
+        goto ErrExit;
+    }
+    memset(ring->blocks, 0xA5, (size_t)RING_NUM_BLOCKS * RING_BLOCK_SIZE);
+    for (unsigned i = 0; i < qdepth; ++i) {
+        ring->buffers[i] = bench_aligned_alloc(size);
+        if (ring->buffers[i] == NULL) {
+            goto ErrExit;
+        }
+    }
+    if (!NT_SUCCESS(XdmaOsLockCreate(&ring->lock))) {
+        goto ErrExit;
+    }
+    if (pthread_create(&ring->producer, NULL, ProducerThread, ring)) {
+        fprintf(stderr, "Error starting the ring producer thread\n");
+        goto ErrExit;
+    }
+
+    *result = ring;
+    return 0;
+
+ErrExit:
+    fprintf(stderr, "Error allocating ring memory\n");
+    if (ring) {
+        ring->producer = 0;
+        ring_channel_close(ring);
+    }
+    return -1;
+}
+
+static void ring_channel_close(void* channel) {
+    RING_CHANNEL* ring = (RING_CHANNEL*)channel;
+
+    if (ring->producer) {
+        InterlockedExchange(&ring->stop, TRUE);
+        pthread_join(ring->producer, NULL);
+    }
+    if (ring->buffers) {
+        for (unsigned i = 0; i < ring->qdepth; ++i) {
+            bench_aligned_free(ring->buffers[i]);
+        }
+    }
+    bench_aligned_free(ring->blocks);
+    free(ring->buffers);
+    free(ring->sizes);
+    free(ring->fifo);
+    bench_aligned_free(ring);
+}
+
+static unsigned char* ring_buffer(void* channel, unsigned slot) {
+    RING_CHANNEL* ring = (RING_CHANNEL*)channel;
+    return ring->buffers[slot];
+}
+
+static int ring_submit(void* channel, unsigned slot, size_t size, uint64_t address) {
+    UNREFERENCED_PARAMETER(address);
+    RING_CHANNEL* ring = (RING_CHANNEL*)channel;
+    ring->sizes[slot] = size;
+    ring->fifo[(ring->next + ring->count) % ring->qdepth] = slot;
+    ring->count++;
+    return 0;
+}
+
+static int ring_reap(void* channel, unsigned* slot, size_t* bytes) {
+    RING_CHANNEL* ring = (RING_CHANNEL*)channel;
+    if (ring->count == 0) {
+        return -1;
+    }
+    const unsigned done = ring->fifo[ring->next];
+    unsigned char* buffer = ring->buffers[done];
+    size_t remaining = ring->sizes[done];
+    size_t offset = 0;
+
+    // the reader owns head, like EngineRingCopyBytesToMemory()
+    ULONG head = ring->head;
+    while (remaining) {
+        const ULONG tail = LoadIndex(ring, &ring->tail);
+        if (head == tail) {
+            sched_yield(); // the driver waits for the completion signal here
+            continue;
+        }
+        while ((head != tail) && remaining) {
+            const size_t received = min((size_t)ring->results[head].length, remaining);
+            memcpy(buffer + offset, ring->blocks + (size_t)head * RING_BLOCK_SIZE, received);
+            offset += received;
+            remaining -= received;
+            ring->results[head].length = 0;
+            head = CoreRingAdvance(head, RING_NUM_BLOCKS);
+        }
+        StoreIndex(ring, &ring->head, head);
+    }
+
+    ring->next = (ring->next + 1) % ring->qdepth;
+    ring->count--;
+    *slot = done;
+    *bytes = offset;
+    return 0;
+}
+
+const BENCH_BACKEND bench_backend_ring_lock = {
+    .name = "ring-lock",
+    .open = ring_lock_open,
+    .close = ring_close,
+    .channel_open = ring_channel_open,
+    .channel_close = ring_channel_close,
+    .buffer = ring_buffer,
+    .submit = ring_submit,
+    .reap = ring_reap,
+};
+
+const BENCH_BACKEND bench_backend_ring_atomic = {
+    .name = "ring-atomic",
+    .open = ring_atomic_open,
+    .close = ring_close,
+    .channel_open = ring_channel_open,
+    .channel_close = ring_channel_close,
+    .buffer = ring_buffer,
+    .submit = ring_submit,
+    .reap = ring_reap,
+};
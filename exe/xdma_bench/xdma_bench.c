@@ -0,0 +1,554 @@
+/*
+* xdma_bench - DMA benchmark
+* ==========================
+*
+* Sweeps transfer size, queue depth, thread count, channel set, direction, interface and
+* completion mode against a backend and reports throughput, IOPS, CPU time per GB and latency
+* percentiles as CSV or JSON.
+*/
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <malloc.h>
+#else
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xdma_bench.h"
+
+// ========================= platform =============================================================
+
+#ifdef _WIN32
+
+typedef HANDLE bench_thread_t;
+
+uint64_t bench_now_ns(void) {
+    static LARGE_INTEGER freq = { 0 };
+    LARGE_INTEGER now;
+    if (freq.QuadPart == 0) {
+        QueryPerformanceFrequency(&freq);
+    }
+    QueryPerformanceCounter(&now);
+    return (uint64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+}
+
+uint64_t bench_thread_cpu_ns(void) {
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+        return 0;
+    }
+    ULARGE_INTEGER k = { kernel.dwLowDateTime, kernel.dwHighDateTime };
+    ULARGE_INTEGER u = { user.dwLowDateTime, user.dwHighDateTime };
+    return (k.QuadPart + u.QuadPart) * 100; // 100ns units
+}
+
+void* bench_aligned_alloc(size_t size) {
+    return _aligned_malloc(size, BENCH_PAGE_SIZE);
+}
+
+void bench_aligned_free(void* buffer) {
+    _aligned_free(buffer);
+}
+
+static DWORD WINAPI thread_thunk(LPVOID arg);
+
+static int thread_start(bench_thread_t* thread, void* arg) {
+    *thread = CreateThread(NULL, 0, thread_thunk, arg, 0, NULL);
+    return (*thread == NULL) ? -1 : 0;
+}
+
+static void thread_join(bench_thread_t thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+#else
+
+typedef pthread_t bench_thread_t;
+
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+uint64_t bench_now_ns(void) {
+    return clock_ns(CLOCK_MONOTONIC);
+}
+
+uint64_t bench_thread_cpu_ns(void) {
+    return clock_ns(CLOCK_THREAD_CPUTIME_ID);
+}
+
+void* bench_aligned_alloc(size_t size) {
+    return aligned_alloc(BENCH_PAGE_SIZE, (size + BENCH_PAGE_SIZE - 1) & ~(size_t)(BENCH_PAGE_SIZE - 1));
+}
+
+void bench_aligned_free(void* buffer) {
+    free(buffer);
+}
+
+static void* thread_thunk(void* arg);
+
+static int thread_start(bench_thread_t* thread, void* arg) {
+    return pthread_create(thread, NULL, thread_thunk, arg) ? -1 : 0;
+}
+
+static void thread_join(bench_thread_t thread) {
+    pthread_join(thread, NULL);
+}
+
+#endif
+
+// ========================= options ==============================================================
+
+static BENCH_OPTIONS options = {
+#ifdef _WIN32
+    .backend = "driver",
+#else
+    .backend = "model",
+#endif
+    .sizes = { 1, { 4096 } },
+    .qdepths = { 1, { 1 } },
+    .threads = { 1, { 1 } },
+    .channelMask = 0x1,
+    .dir = BENCH_H2C,
+    .streaming = 0,
+    .mode = BENCH_MODE_BLOCK,
+    .address = 0,
+    .ios = 1000,
+    .format = BENCH_FORMAT_CSV,
+    .verbose = 0,
+    .modelBandwidth = 4000ULL * 1000 * 1000,
+    .modelLatencyNs = 1000,
+};
+
+static const BENCH_BACKEND* backends[] = {
+#ifdef _WIN32
+    &bench_backend_driver,
+#else
+    &bench_backend_model,
+    &bench_backend_ring_lock,
+    &bench_backend_ring_atomic,
+#endif
+};
+
+static const char* const dir_names[] = { "h2c", "c2h", "bidir" };
+static const char* const mode_names[] = { "block", "async", "poll" };
+
+static void usage(const char* const exe_name) {
+    printf("%s usage:\n\n", exe_name);
+    printf("%s [OPTIONS]\n", exe_name);
+    printf("- OPTIONS : \n");
+    printf("            -b backend: driver (Windows), model, ring-lock or ring-atomic (Linux)\n");
+    printf("            -d direction: h2c | c2h | bidir (default h2c)\n");
+    printf("            -i interface: mm | st (default mm), must match the IP configuration\n");
+    printf("            -m completion mode: block | async | poll (default block)\n");
+    printf("            -s transfer sizes in bytes (default 4096)\n");
+    printf("            -q queue depths per thread (default 1)\n");
+    printf("            -t threads per direction (default 1)\n");
+    printf("            -c channel set, e.g. 0,1 (default 0)\n");
+    printf("            -a card address of AXI-MM transfers (default 0)\n");
+    printf("            -n transfers per thread and sweep point (default 1000)\n");
+    printf("            -o output format: csv | json (default csv)\n");
+    printf("            -B model bandwidth per engine in MB/s (default 4000)\n");
+    printf("            -L model descriptor fetch latency in ns (default 1000)\n");
+    printf("            -v more verbose output\n");
+    printf("- Lists are comma separated, e.g. 1,4,16, or a power of two range, e.g. 64:65536\n");
+}
+
+static int parse_list(const char* arg, BENCH_LIST* list) {
+    list->count = 0;
+    const char* range = strchr(arg, ':');
+    if (range) {
+        uint64_t first = strtoull(arg, NULL, 0);
+        uint64_t last = strtoull(range + 1, NULL, 0);
+        for (uint64_t value = first; value && (value <= last); value *= 2) {
+            if (list->count == BENCH_MAX_LIST) {
+                return -1;
+            }
+            list->values[list->count++] = value;
+        }
+        return list->count ? 0 : -1;
+    }
+    char* end = (char*)arg;
+    do {
+        if (list->count == BENCH_MAX_LIST) {
+            return -1;
+        }
+        uint64_t value = strtoull(end, &end, 0);
+        if (value == 0) {
+            return -1;
+        }
+        list->values[list->count++] = value;
+    } while (*end++ == ',');
+    return 0;
+}
+
+static int parse_enum(const char* arg, const char* const* names, int count) {
+    for (int i = 0; i < count; ++i) {
+        if (strcmp(arg, names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int parse(int argc, char* argv[]) {
+    int argidx = 1;
+    while (argidx < argc) {
+        const char* arg = argv[argidx];
+        if (((arg[0] != '-') && (arg[0] != '/')) || (arg[1] == '\0')) {
+            break;
+        }
+        const char opt = arg[1];
+        if ((opt == '?') || (opt == 'h')) {
+            usage(argv[0]);
+            return 0;
+        }
+        if (opt == 'v') {
+            options.verbose = 1;
+            argidx++;
+            continue;
+        }
+        if (argidx + 1 >= argc) {
+            fprintf(stderr, "Error: option -%c needs a value\n\n", opt);
+            usage(argv[0]);
+            return 0;
+        }
+        const char* value = argv[argidx + 1];
+        int ok = 1;
+        switch (opt) {
+            case 'b':
+                options.backend = value;
+                break;
+            case 'd': {
+                int dir = parse_enum(value, dir_names, 3);
+                ok = (dir >= 0);
+                options.dir = (BENCH_DIR)dir;
+                break;
+            }
+            case 'i':
+                ok = (strcmp(value, "mm") == 0) || (strcmp(value, "st") == 0);
+                options.streaming = (strcmp(value, "st") == 0);
+                break;
+            case 'm': {
+                int mode = parse_enum(value, mode_names, 3);
+                ok = (mode >= 0);
+                options.mode = (BENCH_MODE)mode;
+                break;
+            }
+            case 's':
+                ok = (parse_list(value, &options.sizes) == 0);
+                break;
+            case 'q':
+                ok = (parse_list(value, &options.qdepths) == 0);
+                break;
+            case 't':
+                ok = (parse_list(value, &options.threads) == 0);
+                break;
+            case 'c': {
+                char* end = (char*)value;
+                options.channelMask = 0;
+                do {
+                    unsigned long ch = strtoul(end, &end, 0);
+                    ok = ok && (ch < BENCH_MAX_CHANNELS);
+                    options.channelMask |= 1U << (ch % BENCH_MAX_CHANNELS);
+                } while (*end++ == ',');
+                break;
+            }
+            case 'a':
+                options.address = strtoull(value, NULL, 0);
+                break;
+            case 'n':
+                options.ios = strtoul(value, NULL, 0);
+                ok = (options.ios > 0);
+                break;
+            case 'o':
+                ok = (strcmp(value, "csv") == 0) || (strcmp(value, "json") == 0);
+                options.format = (strcmp(value, "json") == 0) ? BENCH_FORMAT_JSON : BENCH_FORMAT_CSV;
+                break;
+            case 'B':
+                options.modelBandwidth = strtoull(value, NULL, 0) * 1000 * 1000;
+                break;
+            case 'L':
+                options.modelLatencyNs = strtoull(value, NULL, 0);
+                break;
+            default:
+                ok = 0;
+                break;
+        }
+        if (!ok) {
+            fprintf(stderr, "Error: invalid option: %s %s\n\n", arg, value);
+            usage(argv[0]);
+            return 0;
+        }
+        argidx += 2;
+    }
+    if (argidx != argc) {
+        usage(argv[0]);
+        return 0;
+    }
+    return 1;
+}
+
+// ========================= workers ==============================================================
+
+typedef struct BENCH_WORKER_T {
+    const BENCH_BACKEND* backend;
+    void* device;
+    BENCH_DIR dir;
+    unsigned channel;
+    unsigned qdepth;
+    size_t size;
+    uint64_t* latencies;        // one per transfer in ns
+    uint64_t bytes;
+    uint64_t cpuNs;
+    int status;
+    bench_thread_t thread;
+} BENCH_WORKER;
+
+static int run_worker(BENCH_WORKER* w) {
+    void* chan = NULL;
+    uint64_t* submitted_at = calloc(w->qdepth, sizeof(uint64_t));
+    unsigned* free_slots = calloc(w->qdepth, sizeof(unsigned));
+    int status = -1;
+    if (!submitted_at || !free_slots) {
+        goto Exit;
+    }
+    if (w->backend->channel_open(w->device, w->dir, w->channel, w->qdepth, w->size, &chan)) {
+        fprintf(stderr, "%s_%u: opening channel failed\n", dir_names[w->dir], w->channel);
+        goto Exit;
+    }
+    for (unsigned slot = 0; slot < w->qdepth; ++slot) {
+        memset(w->backend->buffer(chan, slot), (int)slot, w->size);
+        free_slots[slot] = slot;
+    }
+
+    unsigned num_free = w->qdepth;
+    unsigned submitted = 0;
+    unsigned completed = 0;
+    const uint64_t cpu_start = bench_thread_cpu_ns();
+    while (completed < options.ios) {
+        while (num_free && (submitted < options.ios)) {
+            unsigned slot = free_slots[--num_free];
+            submitted_at[slot] = bench_now_ns();
+            if (w->backend->submit(chan, slot, w->size, options.address)) {
+                fprintf(stderr, "%s_%u: submit failed\n", dir_names[w->dir], w->channel);
+                goto CloseChannel;
+            }
+            submitted++;
+        }
+        unsigned slot = 0;
+        size_t bytes = 0;
+        if (w->backend->reap(chan, &slot, &bytes)) {
+            fprintf(stderr, "%s_%u: transfer failed\n", dir_names[w->dir], w->channel);
+            goto CloseChannel;
+        }
+        w->latencies[completed++] = bench_now_ns() - submitted_at[slot];
+        w->bytes += bytes;
+        free_slots[num_free++] = slot;
+    }
+    w->cpuNs = bench_thread_cpu_ns() - cpu_start;
+    status = 0;
+
+CloseChannel:
+    w->backend->channel_close(chan);
+Exit:
+    free(submitted_at);
+    free(free_slots);
+    return status;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI thread_thunk(LPVOID arg) {
+#else
+static void* thread_thunk(void* arg) {
+#endif
+    BENCH_WORKER* w = (BENCH_WORKER*)arg;
+    w->status = run_worker(w);
+    return 0;
+}
+
+// ========================= results ==============================================================
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_us(const uint64_t* sorted, size_t count, double p) {
+    size_t idx = (size_t)(p * (double)(count - 1) + 0.5);
+    return (double)sorted[idx] / 1000.0;
+}
+
+static unsigned num_rows = 0;
+
+static void print_row(const BENCH_BACKEND* backend, size_t size, unsigned qdepth,
+                      unsigned threads, uint64_t ios, uint64_t bytes, uint64_t wall_ns,
+                      uint64_t cpu_ns, const uint64_t* latencies) {
+    const double seconds = (double)wall_ns / 1e9;
+    const double mbps = (double)bytes / seconds / 1e6;
+    const double iops = (double)ios / seconds;
+    const double cpu_per_gb = bytes ? ((double)cpu_ns / 1e9) / ((double)bytes / 1e9) : 0.0;
+    const double p50 = percentile_us(latencies, (size_t)ios, 0.50);
+    const double p99 = percentile_us(latencies, (size_t)ios, 0.99);
+    const double p999 = percentile_us(latencies, (size_t)ios, 0.999);
+    const char* interface_name = options.streaming ? "st" : "mm";
+
+    if (options.format == BENCH_FORMAT_CSV) {
+        if (num_rows == 0) {
+            printf("backend,interface,direction,mode,size,qdepth,threads,channels,ios,bytes,"
+                   "seconds,mb_per_s,iops,cpu_s_per_gb,p50_us,p99_us,p999_us\n");
+        }
+        printf("%s,%s,%s,%s,%zu,%u,%u,0x%x,%llu,%llu,%.6f,%.2f,%.0f,%.4f,%.2f,%.2f,%.2f\n",
+               backend->name, interface_name, dir_names[options.dir], mode_names[options.mode],
+               size, qdepth, threads, options.channelMask, (unsigned long long)ios,
+               (unsigned long long)bytes, seconds, mbps, iops, cpu_per_gb, p50, p99, p999);
+    } else {
+        printf("%s  {\"backend\": \"%s\", \"interface\": \"%s\", \"direction\": \"%s\", "
+               "\"mode\": \"%s\", \"size\": %zu, \"qdepth\": %u, \"threads\": %u, "
+               "\"channels\": \"0x%x\", \"ios\": %llu, \"bytes\": %llu, \"seconds\": %.6f, "
+               "\"mb_per_s\": %.2f, \"iops\": %.0f, \"cpu_s_per_gb\": %.4f, \"p50_us\": %.2f, "
+               "\"p99_us\": %.2f, \"p999_us\": %.2f}",
+               num_rows ? ",\n" : "[\n", backend->name, interface_name, dir_names[options.dir],
+               mode_names[options.mode], size, qdepth, threads, options.channelMask,
+               (unsigned long long)ios, (unsigned long long)bytes, seconds, mbps, iops,
+               cpu_per_gb, p50, p99, p999);
+    }
+    fflush(stdout);
+    num_rows++;
+}
+
+// ========================= sweep ================================================================
+
+static int run_point(const BENCH_BACKEND* backend, void* device, size_t size, unsigned qdepth,
+                     unsigned threads) {
+    unsigned channels[BENCH_MAX_CHANNELS];
+    unsigned num_channels = 0;
+    for (unsigned ch = 0; ch < BENCH_MAX_CHANNELS; ++ch) {
+        if (options.channelMask & (1U << ch)) {
+            channels[num_channels++] = ch;
+        }
+    }
+
+    const unsigned num_dirs = (options.dir == BENCH_BIDIR) ? 2 : 1;
+    const unsigned num_workers = num_dirs * threads;
+    BENCH_WORKER* workers = calloc(num_workers, sizeof(BENCH_WORKER));
+    uint64_t* latencies = calloc((size_t)num_workers * options.ios, sizeof(uint64_t));
+    int status = -1;
+    if (!workers || !latencies) {
+        fprintf(stderr, "Error allocating worker state\n");
+        goto Exit;
+    }
+
+    // threads are spread round robin over the channel set
+    for (unsigned i = 0; i < num_workers; ++i) {
+        BENCH_WORKER* w = &workers[i];
+        w->backend = backend;
+        w->device = device;
+        w->dir = (options.dir == BENCH_BIDIR) ? (BENCH_DIR)(i % 2) : options.dir;
+        w->channel = channels[(i / num_dirs) % num_channels];
+        w->qdepth = qdepth;
+        w->size = size;
+        w->latencies = latencies + (size_t)i * options.ios;
+    }
+
+    const uint64_t start = bench_now_ns();
+    unsigned started = 0;
+    for (; started < num_workers; ++started) {
+        if (thread_start(&workers[started].thread, &workers[started])) {
+            fprintf(stderr, "Error starting worker thread\n");
+            break;
+        }
+    }
+    for (unsigned i = 0; i < started; ++i) {
+        thread_join(workers[i].thread);
+    }
+    const uint64_t wall_ns = bench_now_ns() - start;
+    if (started != num_workers) {
+        goto Exit;
+    }
+
+    uint64_t bytes = 0;
+    uint64_t cpu_ns = 0;
+    for (unsigned i = 0; i < num_workers; ++i) {
+        if (workers[i].status) {
+            goto Exit;
+        }
+        bytes += workers[i].bytes;
+        cpu_ns += workers[i].cpuNs;
+    }
+
+    const uint64_t ios = (uint64_t)num_workers * options.ios;
+    qsort(latencies, (size_t)ios, sizeof(uint64_t), compare_u64);
+    print_row(backend, size, qdepth, threads, ios, bytes, wall_ns, cpu_ns, latencies);
+    status = 0;
+
+Exit:
+    free(workers);
+    free(latencies);
+    return status;
+}
+
+int main(int argc, char* argv[]) {
+
+    if (!parse(argc, argv)) {
+        return -1;
+    }
+
+    const BENCH_BACKEND* backend = NULL;
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); ++i) {
+        if (strcmp(backends[i]->name, options.backend) == 0) {
+            backend = backends[i];
+        }
+    }
+    if (backend == NULL) {
+        fprintf(stderr, "Error: backend '%s' is not available on this platform\n", options.backend);
+        return -1;
+    }
+    if ((options.mode == BENCH_MODE_BLOCK) &&
+        ((options.qdepths.count > 1) || (options.qdepths.values[0] != 1))) {
+        fprintf(stderr, "Warning: block mode has a queue depth of 1\n");
+        options.qdepths.count = 1;
+        options.qdepths.values[0] = 1;
+    }
+
+    void* device = NULL;
+    if (backend->open(&options, &device)) {
+        fprintf(stderr, "Error: opening the %s backend failed\n", backend->name);
+        return -1;
+    }
+
+    int status = 0;
+    for (unsigned s = 0; s < options.sizes.count; ++s) {
+        for (unsigned q = 0; q < options.qdepths.count; ++q) {
+            for (unsigned t = 0; t < options.threads.count; ++t) {
+                if (options.verbose) {
+                    fprintf(stderr, "size=%llu qdepth=%llu threads=%llu\n",
+                            (unsigned long long)options.sizes.values[s],
+                            (unsigned long long)options.qdepths.values[q],
+                            (unsigned long long)options.threads.values[t]);
+                }
+                if (run_point(backend, device, (size_t)options.sizes.values[s],
+                              (unsigned)options.qdepths.values[q],
+                              (unsigned)options.threads.values[t])) {
+                    status = -1;
+                }
+            }
+        }
+    }
+    if ((options.format == BENCH_FORMAT_JSON) && num_rows) {
+        printf("\n]\n");
+    }
+
+    backend->close(device);
+    return status;
+}
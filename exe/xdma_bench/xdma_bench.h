@@ -0,0 +1,87 @@
+/*
+* xdma_bench - DMA benchmark
+* ==========================
+*
+* Shared declarations of the benchmark core (xdma_bench.c) and its backends:
+*  - bench_driver.c: the XDMA Windows driver through its device files
+*  - bench_model.c:  the software engine model (libxdma/linux/xdma_model.h) on Linux
+*  - bench_ring.c:   the C2H streaming ring index handoff between dpc and reader on Linux
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BENCH_MAX_LIST          (16)    // entries of a sweep list
+#define BENCH_MAX_CHANNELS      (4)
+#define BENCH_PAGE_SIZE         (4096)
+
+typedef enum BENCH_DIR_T {
+    BENCH_H2C = 0,
+    BENCH_C2H = 1,
+    BENCH_BIDIR = 2,
+} BENCH_DIR;
+
+/// How a worker waits for its transfers
+typedef enum BENCH_MODE_T {
+    BENCH_MODE_BLOCK,   // one blocking transfer at a time
+    BENCH_MODE_ASYNC,   // up to queue depth transfers in flight, sleep until one completes
+    BENCH_MODE_POLL,    // up to queue depth transfers in flight, spin until one completes
+} BENCH_MODE;
+
+typedef enum BENCH_FORMAT_T {
+    BENCH_FORMAT_CSV,
+    BENCH_FORMAT_JSON,
+} BENCH_FORMAT;
+
+typedef struct BENCH_LIST_T {
+    unsigned count;
+    uint64_t values[BENCH_MAX_LIST];
+} BENCH_LIST;
+
+typedef struct BENCH_OPTIONS_T {
+    const char* backend;
+    BENCH_LIST sizes;           // transfer sizes in bytes
+    BENCH_LIST qdepths;         // transfers in flight per worker
+    BENCH_LIST threads;         // workers per direction, spread over the channel set
+    unsigned channelMask;       // channel set
+    BENCH_DIR dir;
+    int streaming;              // AXI-ST instead of AXI-MM
+    BENCH_MODE mode;
+    uint64_t address;           // card address of AXI-MM transfers
+    unsigned ios;               // transfers per worker and sweep point
+    BENCH_FORMAT format;
+    int verbose;
+    uint64_t modelBandwidth;    // model backend: bytes per second per engine
+    uint64_t modelLatencyNs;    // model backend: descriptor fetch latency
+} BENCH_OPTIONS;
+
+/// A benchmark target. One channel object is owned by exactly one worker thread.
+typedef struct BENCH_BACKEND_T {
+    const char* name;
+    int (*open)(const BENCH_OPTIONS* options, void** device);
+    void (*close)(void* device);
+    /// qdepth slots with a buffer of size bytes each
+    int (*channel_open)(void* device, BENCH_DIR dir, unsigned channel, unsigned qdepth,
+                        size_t size, void** chan);
+    void (*channel_close)(void* chan);
+    unsigned char* (*buffer)(void* chan, unsigned slot);
+    int (*submit)(void* chan, unsigned slot, size_t size, uint64_t address);
+    /// wait for a submitted transfer, returns its slot and the number of bytes transferred
+    int (*reap)(void* chan, unsigned* slot, size_t* bytes);
+} BENCH_BACKEND;
+
+#ifdef _WIN32
+extern const BENCH_BACKEND bench_backend_driver;
+#else
+extern const BENCH_BACKEND bench_backend_model;
+extern const BENCH_BACKEND bench_backend_ring_lock;
+extern const BENCH_BACKEND bench_backend_ring_atomic;
+#endif
+
+// platform helpers, see xdma_bench.c
+uint64_t bench_now_ns(void);
+uint64_t bench_thread_cpu_ns(void);
+void* bench_aligned_alloc(size_t size);
+void bench_aligned_free(void* buffer);
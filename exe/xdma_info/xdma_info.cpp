@@ -1,5 +1,6 @@
 
 #include <cassert>
+#include <cstring>
 #include <iostream>
 #include <string>
 #include <system_error>
@@ -142,6 +143,8 @@ public:
     void print_details();
 private:
     HANDLE control = NULL;
+    vector<uint32_t> shadow; // register snapshot of the config BAR, empty if unavailable
+    void load_registers();
     uint32_t read_register(long addr);
     void read_block(long addr, size_t size, void* buffer);
     void print_block(long offset);
@@ -341,15 +344,55 @@ void xdma_device::print_block(long base) {
     cout << '\n';
 }
 
+void xdma_device::load_registers() {
+    // snapshot all registers printed below with a single IOCTL_XDMA_REG_BATCH request
+    const long num_blocks = 7;
+    const long num_channels = 4;
+    const long channel_regs_size = 0xD4;
+
+    vector<XDMA_REG_OP> ops;
+    for (long block = 0; block < num_blocks; ++block) {
+        for (long channel = 0; channel < num_channels; ++channel) {
+            for (long offset = 0; offset < channel_regs_size; offset += sizeof(uint32_t)) {
+                XDMA_REG_OP op = { 0 };
+                op.op = XDMA_REG_OP_READ;
+                op.bar = XDMA_REG_BAR_SELF;
+                op.offset = block * 0x1000 + channel * 0x100 + offset;
+                ops.push_back(op);
+            }
+        }
+    }
+
+    const DWORD size = static_cast<DWORD>(ops.size() * sizeof(XDMA_REG_OP));
+    DWORD num_bytes = 0;
+    if (!DeviceIoControl(control, IOCTL_XDMA_REG_BATCH, ops.data(), size, ops.data(), size, &num_bytes, NULL)) {
+        return; // older driver - fall back to ReadFile for each access
+    }
+
+    shadow.assign(num_blocks * 0x1000 / sizeof(uint32_t), 0);
+    for (const auto& op : ops) {
+        if (op.status != 0) {
+            shadow.clear();
+            return;
+        }
+        shadow[static_cast<size_t>(op.offset / sizeof(uint32_t))] = op.result;
+    }
+}
+
 void xdma_device::print_details() {
     cout << std::hex;
 
+    load_registers();
+
     for (long i = 0; i < 7; ++i) {
         print_block(i * 0x1000);
     }
 }
 
 uint32_t xdma_device::read_register(long addr) {
+    if (!shadow.empty()) {
+        return shadow[addr / sizeof(uint32_t)];
+    }
     int value = -1;
     size_t num_bytes_read;
     if (INVALID_SET_FILE_POINTER == SetFilePointer(control, addr, NULL, FILE_BEGIN)) {
@@ -362,6 +405,10 @@ uint32_t xdma_device::read_register(long addr) {
 }
 
 void xdma_device::read_block(long addr, size_t size, void* buffer) {
+    if (!shadow.empty()) {
+        memcpy(buffer, &shadow[addr / sizeof(uint32_t)], size);
+        return;
+    }
     size_t num_bytes_read;
     if (INVALID_SET_FILE_POINTER == SetFilePointer(control, addr, NULL, FILE_BEGIN)) {
         throw runtime_error("SetFilePointer failed: " + std::to_string(GetLastError()));
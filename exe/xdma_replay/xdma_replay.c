@@ -0,0 +1,576 @@
+/*
+* xdma_replay - I/O trace capture and replay
+* ==========================================
+*
+* Controls the driver's i/o trace capture (IOCTL_XDMA_TRACE_CONTROL), saves the captured requests
+* to a file (IOCTL_XDMA_TRACE_DUMP) and re-issues them on the h2c_* and c2h_* files, either with
+* the original inter-arrival timing or as fast as possible. The replay reports how its latency
+* and throughput deviate from the capture.
+*
+* Trace file format: XDMA_TRACE_INFO followed by XDMA_TRACE_INFO.numRecords XDMA_TRACE_RECORDs.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strsafe.h>
+
+#include <Windows.h>
+#include <SetupAPI.h>
+#include <INITGUID.H>
+#include <WinIoCtl.h>
+
+#include "xdma_public.h"
+
+#pragma comment(lib, "setupapi.lib")
+
+#define MAX_CHANNELS        (4)
+#define DEFAULT_INFLIGHT    (64)
+#define SLEEP_THRESHOLD_US  (2000)  // sleep instead of spinning if the next request is further away
+
+typedef struct {
+    BOOL verbose;
+    BOOL fast;              // ignore the captured timing
+    DWORD inflight;         // requests in flight at most
+    const char* command;
+    const char* file;
+} Options;
+
+static Options options = { FALSE, FALSE, DEFAULT_INFLIGHT, NULL, NULL };
+
+/// measurement of one replayed request
+typedef struct {
+    LONGLONG scheduled;     // when the request should have been issued
+    LONGLONG issued;
+    LONGLONG completed;
+    DWORD bytes;
+    BOOL failed;
+} Replayed;
+
+/// one overlapped request in flight
+typedef struct {
+    OVERLAPPED overlapped;
+    BYTE* buffer;
+    HANDLE file;
+    DWORD record;           // index of the record, ~0 if the slot is free
+} Slot;
+
+#define verbose_msg(...) {if (options.verbose) printf(__VA_ARGS__);}
+
+static int get_devices(GUID guid, char* devpath, size_t len_devpath) {
+
+    HDEVINFO device_info = SetupDiGetClassDevs((LPGUID)&guid, NULL, NULL, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
+    if (device_info == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "GetDevices INVALID_HANDLE_VALUE\n");
+        exit(-1);
+    }
+
+    SP_DEVICE_INTERFACE_DATA device_interface;
+    device_interface.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
+
+    // enumerate through devices
+    DWORD index;
+    for (index = 0; SetupDiEnumDeviceInterfaces(device_info, NULL, &guid, index, &device_interface); ++index) {
+
+        // get required buffer size
+        ULONG detailLength = 0;
+        if (!SetupDiGetDeviceInterfaceDetail(device_info, &device_interface, NULL, 0, &detailLength, NULL) && GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+            fprintf(stderr, "SetupDiGetDeviceInterfaceDetail - get length failed\n");
+            break;
+        }
+
+        // allocate space for device interface detail
+        PSP_DEVICE_INTERFACE_DETAIL_DATA dev_detail = (PSP_DEVICE_INTERFACE_DETAIL_DATA)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, detailLength);
+        if (!dev_detail) {
+            fprintf(stderr, "HeapAlloc failed\n");
+            break;
+        }
+        dev_detail->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
+
+        // get device interface detail
+        if (!SetupDiGetDeviceInterfaceDetail(device_info, &device_interface, dev_detail, detailLength, NULL, NULL)) {
+            fprintf(stderr, "SetupDiGetDeviceInterfaceDetail - get detail failed\n");
+            HeapFree(GetProcessHeap(), 0, dev_detail);
+            break;
+        }
+
+        StringCchCopy(devpath, len_devpath, dev_detail->DevicePath);
+        HeapFree(GetProcessHeap(), 0, dev_detail);
+    }
+
+    SetupDiDestroyDeviceInfoList(device_info);
+
+    return index;
+}
+
+static void usage(const char* const exe_name) {
+    printf("%s usage:\n\n", exe_name);
+    printf("%s start | stop | dump <FILE> | replay <FILE> [OPTIONS]\n", exe_name);
+    printf("- start :   Clear the driver's i/o trace log and start capturing.\n");
+    printf("- stop :    Stop capturing, the log is kept.\n");
+    printf("- dump :    Save the latest %lu captured requests to FILE.\n", XDMA_TRACE_MAX_RECORDS);
+    printf("- replay :  Re-issue the requests of FILE and compare latency and throughput.\n");
+    printf("- OPTIONS : \n");
+    printf("            -f issue as fast as possible instead of with the captured timing\n");
+    printf("            -q N requests in flight at most (default: %d)\n", DEFAULT_INFLIGHT);
+    printf("            -v more verbose output\n");
+}
+
+static int parse(int argc, char* argv[]) {
+
+    // xdma_replay <command> [FILE] [OPTIONS]
+    if (argc < 2) {
+        usage(argv[0]);
+        return 0;
+    }
+    options.command = argv[1];
+    int argidx = 2;
+    if ((strcmp(options.command, "dump") == 0) || (strcmp(options.command, "replay") == 0)) {
+        if (argc < 3) {
+            usage(argv[0]);
+            return 0;
+        }
+        options.file = argv[2];
+        argidx = 3;
+    } else if ((strcmp(options.command, "start") != 0) && (strcmp(options.command, "stop") != 0)) {
+        usage(argv[0]);
+        return 0;
+    }
+
+    while ((argidx < argc) && ((argv[argidx][0] == '-') || (argv[argidx][0] == '/'))) {
+        switch (argv[argidx][1]) {
+            case '?':
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            case 'f':
+                options.fast = TRUE;
+                argidx++;
+                break;
+            case 'v':
+                options.verbose = TRUE;
+                argidx++;
+                break;
+            case 'q':
+                if (argidx + 1 >= argc) {
+                    usage(argv[0]);
+                    return 0;
+                }
+                options.inflight = strtoul(argv[argidx + 1], NULL, 0);
+                if ((options.inflight == 0) || (options.inflight > MAXIMUM_WAIT_OBJECTS)) {
+                    fprintf(stderr, "Error: -q must be within 1..%d\n", MAXIMUM_WAIT_OBJECTS);
+                    return 0;
+                }
+                argidx += 2;
+                break;
+            default:
+                fprintf(stderr, "Error: unknown option: %s\n\n", argv[argidx]);
+                usage(argv[0]);
+                return 0;
+        }
+    }
+    if (argidx != argc) {
+        usage(argv[0]);
+        return 0;
+    }
+    return 1;
+}
+
+static HANDLE open_node(const char* base_path, const char* node, DWORD flags) {
+    char path[MAX_PATH + 1] = "";
+    strcpy_s(path, sizeof path, base_path);
+    strcat_s(path, sizeof path, "\\");
+    strcat_s(path, sizeof path, node);
+    HANDLE file = CreateFile(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, flags, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "Error opening %s, win32 error code: %ld\n", node, GetLastError());
+    }
+    return file;
+}
+
+// ========================= capture ==============================================================
+
+static int trace_control(HANDLE control, UINT32 command) {
+    DWORD bytes = 0;
+    if (!DeviceIoControl(control, IOCTL_XDMA_TRACE_CONTROL, &command, sizeof(command), NULL, 0, &bytes, NULL)) {
+        fprintf(stderr, "IOCTL_XDMA_TRACE_CONTROL failed with Win32 error code: %ld\n", GetLastError());
+        return -1;
+    }
+    printf("i/o trace capture %s\n", command == XDMA_TRACE_START ? "started" : "stopped");
+    return 0;
+}
+
+static int trace_dump(HANDLE control, const char* file_name) {
+    const DWORD length = sizeof(XDMA_TRACE_INFO) + XDMA_TRACE_MAX_RECORDS * sizeof(XDMA_TRACE_RECORD);
+    XDMA_TRACE_INFO* info = (XDMA_TRACE_INFO*)malloc(length);
+    if (!info) {
+        fprintf(stderr, "Error allocating %ld bytes of memory\n", length);
+        return -1;
+    }
+    int status = -1;
+    DWORD bytes = 0;
+    if (!DeviceIoControl(control, IOCTL_XDMA_TRACE_DUMP, NULL, 0, info, length, &bytes, NULL)) {
+        fprintf(stderr, "IOCTL_XDMA_TRACE_DUMP failed with Win32 error code: %ld\n", GetLastError());
+        goto Exit;
+    }
+
+    FILE* out = NULL;
+    if (fopen_s(&out, file_name, "wb") || !out) {
+        fprintf(stderr, "Error opening %s\n", file_name);
+        goto Exit;
+    }
+    if (fwrite(info, 1, bytes, out) != bytes) {
+        fprintf(stderr, "Error writing %s\n", file_name);
+        fclose(out);
+        goto Exit;
+    }
+    fclose(out);
+    printf("saved %u of %llu captured requests to %s%s\n", info->numRecords, info->captured, file_name,
+           info->enabled ? " (capture still running)" : "");
+    status = 0;
+Exit:
+    free(info);
+    return status;
+}
+
+// ========================= statistics ===========================================================
+
+static int compare_ll(const void* a, const void* b) {
+    LONGLONG x = *(const LONGLONG*)a;
+    LONGLONG y = *(const LONGLONG*)b;
+    return (x > y) - (x < y);
+}
+
+typedef struct {
+    double seconds;     // first arrival to last completion
+    double mbps;
+    double mean_us;
+    double p50_us;
+    double p99_us;
+    double max_us;
+} Summary;
+
+/// values: latencies in ticks, sorted in place
+static void summarize(LONGLONG* values, DWORD count, double ticks_per_us, LONGLONG span,
+                      ULONGLONG bytes, Summary* summary) {
+    qsort(values, count, sizeof(LONGLONG), compare_ll);
+    double sum = 0.0;
+    for (DWORD i = 0; i < count; ++i) {
+        sum += (double)values[i];
+    }
+    summary->seconds = (double)span / (ticks_per_us * 1e6);
+    summary->mbps = summary->seconds > 0.0 ? (double)bytes / summary->seconds / 1e6 : 0.0;
+    summary->mean_us = sum / count / ticks_per_us;
+    summary->p50_us = (double)values[(size_t)(0.50 * (count - 1) + 0.5)] / ticks_per_us;
+    summary->p99_us = (double)values[(size_t)(0.99 * (count - 1) + 0.5)] / ticks_per_us;
+    summary->max_us = (double)values[count - 1] / ticks_per_us;
+}
+
+static double deviation(double replay, double capture) {
+    return capture != 0.0 ? (replay - capture) * 100.0 / capture : 0.0;
+}
+
+static void report(const XDMA_TRACE_INFO* info, const XDMA_TRACE_RECORD* records,
+                   const Replayed* replayed, double replay_ticks_per_us) {
+    const DWORD n = info->numRecords;
+    const double capture_ticks_per_us = (double)info->frequency / 1e6;
+    LONGLONG* values = (LONGLONG*)malloc(n * sizeof(LONGLONG));
+    if (!values) {
+        return;
+    }
+
+    // capture
+    ULONGLONG bytes = 0;
+    LONGLONG last = 0;
+    DWORD errors = 0;
+    for (DWORD i = 0; i < n; ++i) {
+        values[i] = (LONGLONG)(records[i].complete - records[i].arrival);
+        bytes += records[i].bytes;
+        last = max(last, (LONGLONG)records[i].complete);
+        errors += records[i].status < 0;
+    }
+    Summary capture;
+    summarize(values, n, capture_ticks_per_us, last - (LONGLONG)records[0].arrival, bytes, &capture);
+
+    // replay
+    bytes = 0;
+    last = 0;
+    DWORD replay_errors = 0;
+    double abs_dev_us = 0.0;
+    for (DWORD i = 0; i < n; ++i) {
+        values[i] = replayed[i].completed - replayed[i].issued;
+        bytes += replayed[i].bytes;
+        last = max(last, replayed[i].completed);
+        replay_errors += replayed[i].failed;
+        double captured_us = (double)(records[i].complete - records[i].arrival) / capture_ticks_per_us;
+        double replayed_us = (double)values[i] / replay_ticks_per_us;
+        abs_dev_us += replayed_us > captured_us ? replayed_us - captured_us : captured_us - replayed_us;
+    }
+    Summary replay;
+    summarize(values, n, replay_ticks_per_us, last - replayed[0].issued, bytes, &replay);
+
+    // how late the requests were issued compared to the captured timing
+    for (DWORD i = 0; i < n; ++i) {
+        values[i] = replayed[i].issued - replayed[i].scheduled;
+    }
+    qsort(values, n, sizeof(LONGLONG), compare_ll);
+    double late_p50_us = (double)values[(size_t)(0.50 * (n - 1) + 0.5)] / replay_ticks_per_us;
+    double late_p99_us = (double)values[(size_t)(0.99 * (n - 1) + 0.5)] / replay_ticks_per_us;
+
+    printf("\n%-16s %14s %14s %10s\n", "", "capture", "replay", "deviation");
+    printf("%-16s %14lu %14lu\n", "requests", n, n);
+    printf("%-16s %14lu %14lu\n", "errors", errors, replay_errors);
+    printf("%-16s %14.6f %14.6f %9.1f%%\n", "duration [s]", capture.seconds, replay.seconds, deviation(replay.seconds, capture.seconds));
+    printf("%-16s %14.2f %14.2f %9.1f%%\n", "throughput [MB/s]", capture.mbps, replay.mbps, deviation(replay.mbps, capture.mbps));
+    printf("%-16s %14.2f %14.2f %9.1f%%\n", "latency mean [us]", capture.mean_us, replay.mean_us, deviation(replay.mean_us, capture.mean_us));
+    printf("%-16s %14.2f %14.2f %9.1f%%\n", "latency p50 [us]", capture.p50_us, replay.p50_us, deviation(replay.p50_us, capture.p50_us));
+    printf("%-16s %14.2f %14.2f %9.1f%%\n", "latency p99 [us]", capture.p99_us, replay.p99_us, deviation(replay.p99_us, capture.p99_us));
+    printf("%-16s %14.2f %14.2f %9.1f%%\n", "latency max [us]", capture.max_us, replay.max_us, deviation(replay.max_us, capture.max_us));
+    printf("\nmean absolute per request latency deviation: %.2f us\n", abs_dev_us / n);
+    if (!options.fast) {
+        printf("issue delay behind the captured timing: p50 %.2f us, p99 %.2f us\n", late_p50_us, late_p99_us);
+    }
+    free(values);
+}
+
+// ========================= replay ===============================================================
+
+static XDMA_TRACE_INFO* load_trace(const char* file_name) {
+    FILE* in = NULL;
+    if (fopen_s(&in, file_name, "rb") || !in) {
+        fprintf(stderr, "Error opening %s\n", file_name);
+        return NULL;
+    }
+    XDMA_TRACE_INFO header;
+    XDMA_TRACE_INFO* info = NULL;
+    if (fread(&header, sizeof(header), 1, in) != 1) {
+        fprintf(stderr, "Error reading %s\n", file_name);
+        goto Exit;
+    }
+    const size_t length = sizeof(header) + (size_t)header.numRecords * sizeof(XDMA_TRACE_RECORD);
+    info = (XDMA_TRACE_INFO*)malloc(length);
+    if (!info) {
+        fprintf(stderr, "Error allocating %zu bytes of memory\n", length);
+        goto Exit;
+    }
+    *info = header;
+    if (fread(info + 1, sizeof(XDMA_TRACE_RECORD), header.numRecords, in) != header.numRecords) {
+        fprintf(stderr, "%s is truncated\n", file_name);
+        free(info);
+        info = NULL;
+    }
+Exit:
+    fclose(in);
+    return info;
+}
+
+static LONGLONG now(void) {
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart;
+}
+
+static void complete_slot(Slot* slot, Replayed* replayed) {
+    DWORD bytes = 0;
+    Replayed* r = &replayed[slot->record];
+    r->completed = now();
+    if (!GetOverlappedResult(slot->file, &slot->overlapped, &bytes, FALSE)) {
+        verbose_msg("request %lu failed with Win32 error code: %ld\n", slot->record, GetLastError());
+        r->failed = TRUE;
+    }
+    r->bytes = bytes;
+    slot->record = ~0UL;
+}
+
+/// harvest completed requests, returns the number of requests still in flight
+static DWORD reap(Slot* slots, Replayed* replayed) {
+    DWORD busy = 0;
+    for (DWORD i = 0; i < options.inflight; ++i) {
+        if (slots[i].record == ~0UL) {
+            continue;
+        }
+        if (HasOverlappedIoCompleted(&slots[i].overlapped)) {
+            complete_slot(&slots[i], replayed);
+        } else {
+            busy++;
+        }
+    }
+    return busy;
+}
+
+static Slot* free_slot(Slot* slots, Replayed* replayed) {
+    for (;;) {
+        reap(slots, replayed);
+        for (DWORD i = 0; i < options.inflight; ++i) {
+            if (slots[i].record == ~0UL) {
+                return &slots[i];
+            }
+        }
+        HANDLE events[MAXIMUM_WAIT_OBJECTS];
+        for (DWORD i = 0; i < options.inflight; ++i) {
+            events[i] = slots[i].overlapped.hEvent;
+        }
+        WaitForMultipleObjects(options.inflight, events, FALSE, INFINITE);
+    }
+}
+
+static int trace_replay(const char* base_path, const char* file_name) {
+    int status = -1;
+    HANDLE files[2][MAX_CHANNELS];
+    for (int d = 0; d < 2; ++d) {
+        for (int ch = 0; ch < MAX_CHANNELS; ++ch) {
+            files[d][ch] = INVALID_HANDLE_VALUE;
+        }
+    }
+    Slot* slots = NULL;
+    Replayed* replayed = NULL;
+
+    XDMA_TRACE_INFO* info = load_trace(file_name);
+    if (!info) {
+        return -1;
+    }
+    const XDMA_TRACE_RECORD* records = (const XDMA_TRACE_RECORD*)(info + 1);
+    const DWORD n = info->numRecords;
+    if ((n == 0) || (info->frequency == 0)) {
+        fprintf(stderr, "%s contains no requests\n", file_name);
+        goto Exit;
+    }
+
+    // open every engine of the capture and size the buffers for the largest request
+    DWORD max_length = 0;
+    for (DWORD i = 0; i < n; ++i) {
+        const XDMA_TRACE_RECORD* r = &records[i];
+        if ((r->dir > 1) || (r->channel >= MAX_CHANNELS)) {
+            fprintf(stderr, "record %lu has an invalid engine\n", i);
+            goto Exit;
+        }
+        max_length = max(max_length, r->length);
+        if (files[r->dir][r->channel] == INVALID_HANDLE_VALUE) {
+            char node[16];
+            sprintf_s(node, sizeof node, "%s_%u", r->dir ? "c2h" : "h2c", r->channel);
+            files[r->dir][r->channel] = open_node(base_path, node, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED);
+            if (files[r->dir][r->channel] == INVALID_HANDLE_VALUE) {
+                goto Exit;
+            }
+        }
+    }
+    slots = (Slot*)calloc(options.inflight, sizeof(Slot));
+    replayed = (Replayed*)calloc(n, sizeof(Replayed));
+    if (!slots || !replayed) {
+        fprintf(stderr, "Error allocating memory\n");
+        goto Exit;
+    }
+    for (DWORD i = 0; i < options.inflight; ++i) {
+        slots[i].record = ~0UL;
+        slots[i].overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        slots[i].buffer = (BYTE*)_aligned_malloc(max(max_length, 1), 4096);
+        if (!slots[i].overlapped.hEvent || !slots[i].buffer) {
+            fprintf(stderr, "Error allocating slot %lu\n", i);
+            goto Exit;
+        }
+        memset(slots[i].buffer, 0, max(max_length, 1));
+    }
+
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    const double ticks_per_us = (double)freq.QuadPart / 1e6;
+    const double scale = (double)freq.QuadPart / (double)info->frequency; // capture to replay ticks
+
+    printf("replaying %lu requests from %s %s\n", n, file_name, options.fast ? "as fast as possible" : "with the captured timing");
+    const LONGLONG t0 = now();
+    for (DWORD i = 0; i < n; ++i) {
+        const XDMA_TRACE_RECORD* r = &records[i];
+        Replayed* rep = &replayed[i];
+
+        // wait for the captured arrival time, completing requests meanwhile
+        rep->scheduled = t0 + (LONGLONG)((double)(r->arrival - records[0].arrival) * scale);
+        if (options.fast) {
+            rep->scheduled = now();
+        }
+        for (LONGLONG t = now(); t < rep->scheduled; t = now()) {
+            if (reap(slots, replayed) == 0 && (rep->scheduled - t) > (LONGLONG)(SLEEP_THRESHOLD_US * ticks_per_us)) {
+                Sleep(1);
+            }
+        }
+
+        Slot* slot = free_slot(slots, replayed);
+        slot->record = i;
+        slot->file = files[r->dir][r->channel];
+        slot->overlapped.Offset = (DWORD)(r->offset & 0xFFFFFFFFULL);
+        slot->overlapped.OffsetHigh = (DWORD)(r->offset >> 32);
+        ResetEvent(slot->overlapped.hEvent);
+        rep->issued = now();
+        BOOL ok = r->dir ? ReadFile(slot->file, slot->buffer, r->length, NULL, &slot->overlapped) :
+            WriteFile(slot->file, slot->buffer, r->length, NULL, &slot->overlapped);
+        if (!ok && (GetLastError() != ERROR_IO_PENDING)) {
+            verbose_msg("request %lu failed with Win32 error code: %ld\n", i, GetLastError());
+            rep->completed = now();
+            rep->failed = TRUE;
+            slot->record = ~0UL;
+        }
+    }
+    while (reap(slots, replayed)) {
+        ; // wait for the remaining requests
+    }
+
+    report(info, records, replayed, ticks_per_us);
+    status = 0;
+
+Exit:
+    if (slots) {
+        for (DWORD i = 0; i < options.inflight; ++i) {
+            if (slots[i].overlapped.hEvent) {
+                CloseHandle(slots[i].overlapped.hEvent);
+            }
+            _aligned_free(slots[i].buffer);
+        }
+    }
+    for (int d = 0; d < 2; ++d) {
+        for (int ch = 0; ch < MAX_CHANNELS; ++ch) {
+            if (files[d][ch] != INVALID_HANDLE_VALUE) {
+                CloseHandle(files[d][ch]);
+            }
+        }
+    }
+    free(slots);
+    free(replayed);
+    free(info);
+    return status;
+}
+
+int __cdecl main(int argc, char* argv[]) {
+
+    int status = -1;
+
+    // parse command line arguments
+    if (!parse(argc, argv)) {
+        return -1;
+    }
+
+    // get device path from GUID
+    char device_base_path[MAX_PATH + 1] = "";
+    DWORD num_devices = get_devices(GUID_DEVINTERFACE_XDMA, device_base_path, sizeof(device_base_path));
+    verbose_msg("Devices found: %d\n", num_devices);
+    if (num_devices < 1) {
+        fprintf(stderr, "No XDMA device found\n");
+        return -1;
+    }
+
+    if (strcmp(options.command, "replay") == 0) {
+        return trace_replay(device_base_path, options.file);
+    }
+
+    HANDLE control = open_node(device_base_path, "control", FILE_ATTRIBUTE_NORMAL);
+    if (control == INVALID_HANDLE_VALUE) {
+        return -1;
+    }
+    if (strcmp(options.command, "start") == 0) {
+        status = trace_control(control, XDMA_TRACE_START);
+    } else if (strcmp(options.command, "stop") == 0) {
+        status = trace_control(control, XDMA_TRACE_STOP);
+    } else {
+        status = trace_dump(control, options.file);
+    }
+    CloseHandle(control);
+    return status;
+}
@@ -27,9 +27,17 @@ typedef struct {
     enum Direction direction;
     size_t alignment;
     BOOL binary;
+    DWORD sweep;
+    BOOL map;
+    BOOL write_combined;
 } Options;
 
-static Options options = { FALSE, NULL, NULL, NULL, 0, 0, C2H, 0, FALSE };
+static Options options = { FALSE, NULL, NULL, NULL, 0, 0, C2H, 0, FALSE, 0, FALSE, FALSE };
+static volatile BYTE* mapped_bar = NULL;
+static ULONGLONG mapped_length = 0;
+
+#define SWEEP_MIN_SIZE  (64)
+#define SWEEP_MAX_SIZE  (64 * 1024)
 
 static int verbose_msg(const char* const fmt, ...) {
     int ret = 0;
@@ -183,6 +191,9 @@ static void usage(const char* const exe_name) {
     printf("            -b open file as binary\n");
     printf("            -f use contents of file as input or write output into file.\n");
     printf("            -l length of data to read/write (default: 4 bytes or whole file if '-f' flag is used)\n");
+    printf("            -m access user/bypass BAR through a user-space mapping instead of ReadFile/WriteFile\n");
+    printf("            -w map bypass BAR write-combined (implies -m)\n");
+    printf("            -s N sweep transfer sizes from %d B to %d KB, N transfers per size\n", SWEEP_MIN_SIZE, SWEEP_MAX_SIZE / 1024);
     printf("            -v more verbose output\n");
     printf("- DATA :    Space separated bytes (big endian) in decimal or hex, \n");
     printf("            e.g.: 17 34 51 68\n");
@@ -242,6 +253,20 @@ static int parse(int argc, char* argv[]) {
                 options.alignment = strtoul(argv[argidx],  NULL, 0);
                 argidx++;
                 break;
+            case 'm':
+                options.map = TRUE;
+                argidx++;
+                break;
+            case 'w':
+                options.map = TRUE;
+                options.write_combined = TRUE;
+                argidx++;
+                break;
+            case 's':
+                argidx++;
+                options.sweep = strtoul(argv[argidx],  NULL, 0);
+                argidx++;
+                break;
             default:
                 fprintf(stderr, "Error: unknown option: %c\n\n", argv[argidx][1]);
                 usage(argv[0]);
@@ -267,6 +292,98 @@ static int parse(int argc, char* argv[]) {
     return 1;
 }
 
+static int map_bar(HANDLE device) {
+    ULONG flags = options.write_combined ? XDMA_MAP_WRITE_COMBINED : 0;
+    XDMA_BAR_MAPPING mapping = { 0 };
+    DWORD num_bytes = 0;
+    if (!DeviceIoControl(device, IOCTL_XDMA_MAP_BAR, &flags, sizeof(flags), &mapping, sizeof(mapping), &num_bytes, NULL)) {
+        fprintf(stderr, "IOCTL_XDMA_MAP_BAR failed with Win32 error code: %ld\n", GetLastError());
+        return -1;
+    }
+    mapped_bar = (volatile BYTE*)mapping.address;
+    mapped_length = mapping.length;
+    verbose_msg("BAR mapped at %p, length %llu%s\n", mapped_bar, mapped_length,
+                options.write_combined ? " (write-combined)" : "");
+    return 0;
+}
+
+static BOOL mapped_transfer(BYTE* buffer, DWORD size) {
+    if ((ULONGLONG)options.address.QuadPart + size > mapped_length) {
+        fprintf(stderr, "Access of %ld bytes at 0x%llx exceeds BAR length %llu\n", size, options.address.QuadPart, mapped_length);
+        return FALSE;
+    }
+    volatile BYTE* bar = mapped_bar + options.address.QuadPart;
+    if (options.direction == C2H) {
+        for (DWORD i = 0; i < size / sizeof(UINT32); ++i) {
+            ((UINT32*)buffer)[i] = ((volatile UINT32*)bar)[i];
+        }
+        for (DWORD i = size & ~3UL; i < size; ++i) {
+            buffer[i] = bar[i];
+        }
+    } else {
+        for (DWORD i = 0; i < size / sizeof(UINT32); ++i) {
+            ((volatile UINT32*)bar)[i] = ((UINT32*)buffer)[i];
+        }
+        for (DWORD i = size & ~3UL; i < size; ++i) {
+            bar[i] = buffer[i];
+        }
+        MemoryBarrier(); // flush write-combining buffers
+    }
+    return TRUE;
+}
+
+static int run_sweep(HANDLE device) {
+
+    LARGE_INTEGER start;
+    LARGE_INTEGER stop;
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+
+    BYTE* buffer = allocate_buffer(SWEEP_MAX_SIZE, options.alignment);
+    if (!buffer) {
+        fprintf(stderr, "Error allocating %d bytes of memory, error code: %ld\n", SWEEP_MAX_SIZE, GetLastError());
+        return -1;
+    }
+    memset(buffer, 0, SWEEP_MAX_SIZE);
+
+    printf("%10s %12s %12s\n", "size[B]", "latency[us]", "MB/s");
+    for (DWORD size = SWEEP_MIN_SIZE; size <= SWEEP_MAX_SIZE; size *= 2) {
+        QueryPerformanceCounter(&start);
+        for (DWORD i = 0; i < options.sweep; ++i) {
+            DWORD num_bytes = 0;
+            if (mapped_bar) {
+                if (!mapped_transfer(buffer, size)) {
+                    _aligned_free(buffer);
+                    return -1;
+                }
+                continue;
+            }
+            if (INVALID_SET_FILE_POINTER == SetFilePointerEx(device, options.address, NULL, FILE_BEGIN)) {
+                fprintf(stderr, "Error setting file pointer, win32 error code: %ld\n", GetLastError());
+                _aligned_free(buffer);
+                return -1;
+            }
+            BOOL ok = (options.direction == C2H) ?
+                ReadFile(device, buffer, size, &num_bytes, NULL) :
+                WriteFile(device, buffer, size, &num_bytes, NULL);
+            if (!ok || (num_bytes != size)) {
+                fprintf(stderr, "Transfer of %ld bytes failed with Win32 error code: %ld\n", size, GetLastError());
+                _aligned_free(buffer);
+                return -1;
+            }
+        }
+        QueryPerformanceCounter(&stop);
+
+        double time_sec = (unsigned long long)(stop.QuadPart - start.QuadPart) / (double)freq.QuadPart;
+        double latency_us = time_sec * 1e6 / options.sweep;
+        double throughput = ((double)size * options.sweep) / (time_sec * 1024.0 * 1024.0);
+        printf("%10ld %12.2f %12.2f\n", size, latency_us, throughput);
+    }
+
+    _aligned_free(buffer);
+    return 0;
+}
+
 int __cdecl main(int argc, char* argv[]) {
 
     int status = -1;
@@ -305,6 +422,15 @@ int __cdecl main(int argc, char* argv[]) {
         goto CleanupDevice;
     }
 
+    if (options.map && map_bar(device)) {
+        goto CleanupDevice;
+    }
+
+    if (options.sweep) {
+        status = run_sweep(device);
+        goto CleanupDevice;
+    }
+
     LARGE_INTEGER start;
     LARGE_INTEGER stop;
     LARGE_INTEGER freq;
@@ -323,7 +449,11 @@ int __cdecl main(int argc, char* argv[]) {
 
         // read from device into allocated buffer
         QueryPerformanceCounter(&start);
-        if (!ReadFile(device, options.data, options.size, &options.size, NULL)) {
+        if (mapped_bar) {
+            if (!mapped_transfer(options.data, options.size)) {
+                goto CleanupDevice;
+            }
+        } else if (!ReadFile(device, options.data, options.size, &options.size, NULL)) {
             fprintf(stderr, "ReadFile from device %s failed with Win32 error code: %ld\n",
                     device_path, GetLastError());
             goto CleanupDevice;
@@ -378,7 +508,11 @@ int __cdecl main(int argc, char* argv[]) {
         }
 
         QueryPerformanceCounter(&start);
-        if (!WriteFile(device, options.data, options.size, &options.size, NULL)) {
+        if (mapped_bar) {
+            if (!mapped_transfer(options.data, options.size)) {
+                goto CleanupDevice;
+            }
+        } else if (!WriteFile(device, options.data, options.size, &options.size, NULL)) {
             fprintf(stderr, "WriteFile to device %s failed with Win32 error code: %d\n",
                     device_path, GetLastError());
             goto CleanupDevice;
@@ -0,0 +1,245 @@
+/*
+* xdma_timeline - timeline export
+* ===============================
+*
+* Track layout of the exported timeline:
+*  - one track per engine (h2c_0 .. c2h_3): request arrivals, programmed transfers and
+*    "transfer" slices from the engine start to the request completion
+*  - one track per cpu: interrupts and "dpc" slices
+*  - async "request" slices from the arrival to the completion of each read/write request,
+*    requests of an engine are completed in arrival order
+*  - one counter per streaming engine with the number of ring results per batch
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "timeline_export.h"
+
+#define NUM_ENGINES         (8)     // 4 channels per direction
+#define ENGINE_TID(e)       (1 + (e))
+#define CPU_TID(cpu)        (100 + (cpu))
+#define MAX_PENDING         (1024)  // arrivals which wait for their completion, per engine
+
+typedef struct {
+    uint64_t start;                 // engine start cycles, 0 if no transfer is running
+    uint64_t arrivals[MAX_PENDING]; // fifo of request arrival cycles
+    uint64_t lengths[MAX_PENDING];
+    unsigned head;
+    unsigned count;
+    int seen;
+} ENGINE_STATE;
+
+typedef struct {
+    FILE* out;
+    uint64_t origin;        // cycles of the first event
+    double cyclesPerUs;
+    int first;              // no event was written yet
+    unsigned requestId;
+    ENGINE_STATE engines[NUM_ENGINES];
+    uint64_t dpcStart[XDMA_TIMELINE_MAX_CPUS];
+    int dpcEngine[XDMA_TIMELINE_MAX_CPUS];
+    int cpuSeen[XDMA_TIMELINE_MAX_CPUS];
+} EXPORT_STATE;
+
+static const char* engine_name(int engine) {
+    static const char* names[NUM_ENGINES] = {
+        "h2c_0", "h2c_1", "h2c_2", "h2c_3", "c2h_0", "c2h_1", "c2h_2", "c2h_3"
+    };
+    return (engine >= 0) ? names[engine] : "device";
+}
+
+/// Engine index of an event, -1 for device wide events
+static int event_engine(const XDMA_TIMELINE_EVENT* event) {
+    if ((event->dir > 1) || (event->channel >= NUM_ENGINES / 2)) {
+        return -1;
+    }
+    return event->dir * (NUM_ENGINES / 2) + event->channel;
+}
+
+static int compare_events(const void* a, const void* b) {
+    const XDMA_TIMELINE_EVENT* x = (const XDMA_TIMELINE_EVENT*)a;
+    const XDMA_TIMELINE_EVENT* y = (const XDMA_TIMELINE_EVENT*)b;
+    if (x->cycles != y->cycles) {
+        return (x->cycles < y->cycles) ? -1 : 1;
+    }
+    if (x->cpu != y->cpu) {
+        return (x->cpu < y->cpu) ? -1 : 1;
+    }
+    return (x->sequence < y->sequence) ? -1 : (x->sequence > y->sequence);
+}
+
+static double to_us(const EXPORT_STATE* state, uint64_t cycles) {
+    return (double)(int64_t)(cycles - state->origin) / state->cyclesPerUs;
+}
+
+/// Start a new trace event object, the caller closes it with "}"
+static void begin_event(EXPORT_STATE* state, const char* phase, const char* name, int tid,
+                        uint64_t cycles) {
+    fprintf(state->out, "%s\n{\"ph\":\"%s\",\"name\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%.3f",
+            state->first ? "" : ",", phase, name, tid, to_us(state, cycles));
+    state->first = 0;
+}
+
+static void instant(EXPORT_STATE* state, const char* name, int tid, uint64_t cycles,
+                    const char* argName, uint64_t arg) {
+    begin_event(state, "i", name, tid, cycles);
+    fprintf(state->out, ",\"s\":\"t\",\"args\":{\"%s\":%llu}}", argName, (unsigned long long)arg);
+}
+
+static void slice(EXPORT_STATE* state, const char* name, int tid, uint64_t start, uint64_t end,
+                  const char* argName, uint64_t arg) {
+    begin_event(state, "X", name, tid, start);
+    fprintf(state->out, ",\"dur\":%.3f,\"args\":{\"%s\":%llu}}",
+            (double)(end - start) / state->cyclesPerUs, argName, (unsigned long long)arg);
+}
+
+static void thread_name(EXPORT_STATE* state, int tid, const char* name, int sortIndex) {
+    fprintf(state->out, "%s\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%d,"
+            "\"args\":{\"name\":\"%s\"}},\n{\"ph\":\"M\",\"name\":\"thread_sort_index\",\"pid\":1,"
+            "\"tid\":%d,\"args\":{\"sort_index\":%d}}",
+            state->first ? "" : ",", tid, name, tid, sortIndex);
+    state->first = 0;
+}
+
+static void engine_event(EXPORT_STATE* state, const XDMA_TIMELINE_EVENT* event, int engine) {
+    ENGINE_STATE* e = &state->engines[engine];
+    const int tid = ENGINE_TID(engine);
+    e->seen = 1;
+
+    switch (event->type) {
+    case XDMA_TL_ARRIVAL:
+        instant(state, "arrival", tid, event->cycles, "bytes", event->arg);
+        if (e->count < MAX_PENDING) {
+            const unsigned slot = (e->head + e->count) % MAX_PENDING;
+            e->arrivals[slot] = event->cycles;
+            e->lengths[slot] = event->arg;
+            e->count++;
+        }
+        break;
+    case XDMA_TL_PROGRAM_DMA:
+        instant(state, "program dma", tid, event->cycles, "descriptors", event->arg);
+        break;
+    case XDMA_TL_ENGINE_START:
+        e->start = event->cycles;
+        break;
+    case XDMA_TL_COMPLETE:
+        if (e->start != 0) {
+            slice(state, "transfer", tid, e->start, event->cycles, "bytes", event->arg);
+            e->start = 0;
+        } else {
+            instant(state, "complete", tid, event->cycles, "bytes", event->arg);
+        }
+        // the oldest arrival belongs to this completion unless it arrived before the capture
+        if ((e->count > 0) && (e->arrivals[e->head] <= event->cycles)) {
+            const unsigned id = ++state->requestId;
+            begin_event(state, "b", (event->dir == 0) ? "write" : "read", tid, e->arrivals[e->head]);
+            fprintf(state->out, ",\"cat\":\"request\",\"id\":%u,\"args\":{\"length\":%llu}}", id,
+                    (unsigned long long)e->lengths[e->head]);
+            begin_event(state, "e", (event->dir == 0) ? "write" : "read", tid, event->cycles);
+            fprintf(state->out, ",\"cat\":\"request\",\"id\":%u,\"args\":{\"bytes\":%llu}}", id,
+                    (unsigned long long)event->arg);
+            e->head = (e->head + 1) % MAX_PENDING;
+            e->count--;
+        }
+        break;
+    case XDMA_TL_RING_BATCH:
+        begin_event(state, "C", "ring results", tid, event->cycles);
+        fprintf(state->out, ",\"args\":{\"%s\":%llu}}", engine_name(engine),
+                (unsigned long long)event->arg);
+        break;
+    default:
+        break;
+    }
+}
+
+static void cpu_event(EXPORT_STATE* state, const XDMA_TIMELINE_EVENT* event, int engine) {
+    const unsigned cpu = event->cpu % XDMA_TIMELINE_MAX_CPUS;
+    const int tid = CPU_TID(cpu);
+    char name[32];
+    state->cpuSeen[cpu] = 1;
+
+    switch (event->type) {
+    case XDMA_TL_ISR:
+        snprintf(name, sizeof(name), "isr %s", engine_name(engine));
+        instant(state, name, tid, event->cycles, "message", event->arg);
+        break;
+    case XDMA_TL_DPC_BEGIN:
+        state->dpcStart[cpu] = event->cycles;
+        state->dpcEngine[cpu] = engine;
+        break;
+    case XDMA_TL_DPC_END:
+        if (state->dpcStart[cpu] != 0) {
+            snprintf(name, sizeof(name), "dpc %s", engine_name(state->dpcEngine[cpu]));
+            slice(state, name, tid, state->dpcStart[cpu], event->cycles, "cpu", cpu);
+            state->dpcStart[cpu] = 0;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+double timeline_cycles_per_second(const XDMA_TIMELINE_INFO* info) {
+    if ((info->counter > info->startCounter) && (info->cycles > info->startCycles) &&
+        (info->frequency != 0)) {
+        return (double)(info->cycles - info->startCycles) * (double)info->frequency /
+            (double)(info->counter - info->startCounter);
+    }
+    return (double)info->frequency;
+}
+
+int timeline_export_json(FILE* out, const XDMA_TIMELINE_INFO* info, XDMA_TIMELINE_EVENT* events,
+                         size_t numEvents) {
+    const double cyclesPerSecond = timeline_cycles_per_second(info);
+    if (cyclesPerSecond <= 0.0) {
+        fprintf(stderr, "Error: the timeline has no cycle counter calibration\n");
+        return -1;
+    }
+    EXPORT_STATE* state = (EXPORT_STATE*)calloc(1, sizeof(EXPORT_STATE));
+    if (state == NULL) {
+        fprintf(stderr, "Error allocating %zu bytes of memory\n", sizeof(EXPORT_STATE));
+        return -1;
+    }
+    qsort(events, numEvents, sizeof(XDMA_TIMELINE_EVENT), compare_events);
+
+    state->out = out;
+    state->origin = (numEvents > 0) ? events[0].cycles : 0;
+    state->cyclesPerUs = cyclesPerSecond / 1e6;
+    state->first = 1;
+
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"cyclesPerSecond\":%.0f,"
+            "\"events\":%zu,\"dropped\":%u,\"cpus\":%u},\n\"traceEvents\":[",
+            cyclesPerSecond, numEvents, info->dropped, info->numCpus);
+    fprintf(out, "\n{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":1,\"args\":{\"name\":\"XDMA\"}}");
+    state->first = 0;
+
+    for (size_t i = 0; i < numEvents; ++i) {
+        const XDMA_TIMELINE_EVENT* event = &events[i];
+        const int engine = event_engine(event);
+        if ((event->type == XDMA_TL_ISR) || (event->type == XDMA_TL_DPC_BEGIN) ||
+            (event->type == XDMA_TL_DPC_END)) {
+            cpu_event(state, event, engine);
+        } else if (engine >= 0) {
+            engine_event(state, event, engine);
+        }
+    }
+
+    // name the tracks which have events
+    for (int e = 0; e < NUM_ENGINES; ++e) {
+        if (state->engines[e].seen) {
+            thread_name(state, ENGINE_TID(e), engine_name(e), e);
+        }
+    }
+    for (unsigned cpu = 0; cpu < XDMA_TIMELINE_MAX_CPUS; ++cpu) {
+        if (state->cpuSeen[cpu]) {
+            char name[16];
+            snprintf(name, sizeof(name), "cpu %u", cpu);
+            thread_name(state, CPU_TID(cpu), name, CPU_TID(cpu));
+        }
+    }
+    fprintf(out, "\n]}\n");
+
+    free(state);
+    return ferror(out) ? -1 : 0;
+}
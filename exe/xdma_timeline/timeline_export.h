@@ -0,0 +1,27 @@
+/*
+* xdma_timeline - timeline export
+* ===============================
+*
+* Converts drained XDMA timeline events (xdma_timeline.h) into the Chrome trace event JSON format,
+* which chrome://tracing and the Perfetto UI (ui.perfetto.dev) open. Does not depend on any
+* Windows API so timelines can be exported on any platform.
+*/
+
+#pragma once
+
+#ifdef _WIN32
+#include <Windows.h>  // base types of xdma_timeline.h
+#endif
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "xdma_timeline.h"
+
+/// Cycle counter frequency of a drained timeline, calibrated by its info header
+double timeline_cycles_per_second(const XDMA_TIMELINE_INFO* info);
+
+/// Write the events as a Chrome trace event JSON document. The events are sorted by time in place.
+/// Returns 0 on success.
+int timeline_export_json(FILE* out, const XDMA_TIMELINE_INFO* info, XDMA_TIMELINE_EVENT* events,
+                         size_t numEvents);
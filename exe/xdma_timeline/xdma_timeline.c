@@ -0,0 +1,321 @@
+/*
+* xdma_timeline - event timeline recorder
+* =======================================
+*
+* Controls the driver's per-cpu event rings (IOCTL_XDMA_TIMELINE_CONTROL), drains them
+* (IOCTL_XDMA_TIMELINE_DRAIN) and writes the events as a Chrome trace event JSON timeline for
+* chrome://tracing or ui.perfetto.dev. Raw drains are saved as XDMA_TIMELINE_INFO followed by
+* XDMA_TIMELINE_INFO.numEvents events and can be exported on any platform later.
+*/
+
+#ifdef _WIN32
+#define _CRT_SECURE_NO_WARNINGS // fopen() is shared with the other platforms
+#include <Windows.h>
+#include <SetupAPI.h>
+#include <INITGUID.H>
+#include <WinIoCtl.h>
+#include <strsafe.h>
+
+#include "xdma_public.h"
+
+#pragma comment(lib, "setupapi.lib")
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timeline_export.h"
+
+#define DRAIN_INTERVAL_MS   (10)
+#define MAX_DRAIN_EVENTS    (XDMA_TIMELINE_MAX_CPUS * XDMA_TIMELINE_RING_ENTRIES)
+
+/// Events collected by one or more drains
+typedef struct {
+    XDMA_TIMELINE_INFO info;    // of the latest drain, numEvents is the total
+    XDMA_TIMELINE_EVENT* events;
+    size_t capacity;
+} TIMELINE;
+
+static int write_json(const char* file_name, TIMELINE* timeline) {
+    FILE* out = NULL;
+    if ((out = fopen(file_name, "w")) == NULL) {
+        fprintf(stderr, "Error opening %s\n", file_name);
+        return -1;
+    }
+    int status = timeline_export_json(out, &timeline->info, timeline->events,
+                                      timeline->info.numEvents);
+    if (fclose(out) != 0) {
+        status = -1;
+    }
+    if (status == 0) {
+        printf("wrote %u events (%u dropped) at %.3f GHz to %s\n", timeline->info.numEvents,
+               timeline->info.dropped, timeline_cycles_per_second(&timeline->info) / 1e9,
+               file_name);
+    }
+    return status;
+}
+
+static int export_file(const char* in_name, const char* out_name) {
+    FILE* in = NULL;
+    TIMELINE timeline = { 0 };
+    XDMA_TIMELINE_INFO info;
+    int status = -1;
+
+    if ((in = fopen(in_name, "rb")) == NULL) {
+        fprintf(stderr, "Error opening %s\n", in_name);
+        return -1;
+    }
+    if (fread(&info, sizeof(info), 1, in) != 1) {
+        fprintf(stderr, "Error reading %s\n", in_name);
+        goto Exit;
+    }
+    timeline.capacity = info.numEvents ? info.numEvents : 1;
+    timeline.events = (XDMA_TIMELINE_EVENT*)malloc(timeline.capacity * sizeof(XDMA_TIMELINE_EVENT));
+    if (timeline.events == NULL) {
+        fprintf(stderr, "Error allocating memory for %u events\n", info.numEvents);
+        goto Exit;
+    }
+    if (fread(timeline.events, sizeof(XDMA_TIMELINE_EVENT), info.numEvents, in) != info.numEvents) {
+        fprintf(stderr, "%s is truncated\n", in_name);
+        goto Exit;
+    }
+    timeline.info = info;
+    status = write_json(out_name, &timeline);
+Exit:
+    fclose(in);
+    free(timeline.events);
+    return status;
+}
+
+#ifdef _WIN32
+
+static int append_events(TIMELINE* timeline, const XDMA_TIMELINE_INFO* info,
+                         const XDMA_TIMELINE_EVENT* events) {
+    const size_t total = (size_t)timeline->info.numEvents + info->numEvents;
+    if (total > timeline->capacity) {
+        size_t capacity = timeline->capacity ? timeline->capacity : 65536;
+        while (capacity < total) {
+            capacity *= 2;
+        }
+        XDMA_TIMELINE_EVENT* grown = (XDMA_TIMELINE_EVENT*)realloc(timeline->events,
+                                                                 capacity * sizeof(XDMA_TIMELINE_EVENT));
+        if (grown == NULL) {
+            fprintf(stderr, "Error allocating memory for %zu events\n", capacity);
+            return -1;
+        }
+        timeline->events = grown;
+        timeline->capacity = capacity;
+    }
+    memcpy(&timeline->events[timeline->info.numEvents], events,
+           info->numEvents * sizeof(XDMA_TIMELINE_EVENT));
+    const UINT32 numEvents = (UINT32)total;
+    timeline->info = *info;
+    timeline->info.numEvents = numEvents;
+    return 0;
+}
+
+static int get_devices(GUID guid, char* devpath, size_t len_devpath) {
+
+    HDEVINFO device_info = SetupDiGetClassDevs((LPGUID)&guid, NULL, NULL, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
+    if (device_info == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "GetDevices INVALID_HANDLE_VALUE\n");
+        exit(-1);
+    }
+
+    SP_DEVICE_INTERFACE_DATA device_interface;
+    device_interface.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
+
+    // enumerate through devices
+    DWORD index;
+    for (index = 0; SetupDiEnumDeviceInterfaces(device_info, NULL, &guid, index, &device_interface); ++index) {
+
+        // get required buffer size
+        ULONG detailLength = 0;
+        if (!SetupDiGetDeviceInterfaceDetail(device_info, &device_interface, NULL, 0, &detailLength, NULL) && GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+            fprintf(stderr, "SetupDiGetDeviceInterfaceDetail - get length failed\n");
+            break;
+        }
+
+        // allocate space for device interface detail
+        PSP_DEVICE_INTERFACE_DETAIL_DATA dev_detail = (PSP_DEVICE_INTERFACE_DETAIL_DATA)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, detailLength);
+        if (!dev_detail) {
+            fprintf(stderr, "HeapAlloc failed\n");
+            break;
+        }
+        dev_detail->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
+
+        // get device interface detail
+        if (!SetupDiGetDeviceInterfaceDetail(device_info, &device_interface, dev_detail, detailLength, NULL, NULL)) {
+            fprintf(stderr, "SetupDiGetDeviceInterfaceDetail - get detail failed\n");
+            HeapFree(GetProcessHeap(), 0, dev_detail);
+            break;
+        }
+
+        StringCchCopy(devpath, len_devpath, dev_detail->DevicePath);
+        HeapFree(GetProcessHeap(), 0, dev_detail);
+    }
+
+    SetupDiDestroyDeviceInfoList(device_info);
+
+    return index;
+}
+
+static HANDLE open_control(void) {
+    char base_path[MAX_PATH + 1] = "";
+    if (get_devices(GUID_DEVINTERFACE_XDMA, base_path, sizeof(base_path)) < 1) {
+        fprintf(stderr, "No XDMA device found\n");
+        return INVALID_HANDLE_VALUE;
+    }
+    char path[MAX_PATH + 1] = "";
+    strcpy_s(path, sizeof path, base_path);
+    strcat_s(path, sizeof path, "\\control");
+    HANDLE control = CreateFile(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL, NULL);
+    if (control == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "Error opening control device, win32 error code: %ld\n", GetLastError());
+    }
+    return control;
+}
+
+static int timeline_control(HANDLE control, UINT32 command) {
+    DWORD bytes = 0;
+    if (!DeviceIoControl(control, IOCTL_XDMA_TIMELINE_CONTROL, &command, sizeof(command), NULL, 0,
+                         &bytes, NULL)) {
+        fprintf(stderr, "IOCTL_XDMA_TIMELINE_CONTROL failed with Win32 error code: %ld\n",
+                GetLastError());
+        return -1;
+    }
+    return 0;
+}
+
+/// Drain the driver's rings once and append the events to timeline. buffer holds MAX_DRAIN_EVENTS.
+static int timeline_drain(HANDLE control, XDMA_TIMELINE_INFO* buffer, TIMELINE* timeline) {
+    const DWORD length = sizeof(XDMA_TIMELINE_INFO) + MAX_DRAIN_EVENTS * sizeof(XDMA_TIMELINE_EVENT);
+    DWORD bytes = 0;
+    if (!DeviceIoControl(control, IOCTL_XDMA_TIMELINE_DRAIN, NULL, 0, buffer, length, &bytes, NULL)) {
+        fprintf(stderr, "IOCTL_XDMA_TIMELINE_DRAIN failed with Win32 error code: %ld\n",
+                GetLastError());
+        return -1;
+    }
+    return append_events(timeline, buffer, (const XDMA_TIMELINE_EVENT*)(buffer + 1));
+}
+
+static int write_raw(const char* file_name, const TIMELINE* timeline) {
+    FILE* out = NULL;
+    if (fopen_s(&out, file_name, "wb") || !out) {
+        fprintf(stderr, "Error opening %s\n", file_name);
+        return -1;
+    }
+    int status = 0;
+    if ((fwrite(&timeline->info, sizeof(timeline->info), 1, out) != 1) ||
+        (fwrite(timeline->events, sizeof(XDMA_TIMELINE_EVENT), timeline->info.numEvents, out) !=
+         timeline->info.numEvents)) {
+        fprintf(stderr, "Error writing %s\n", file_name);
+        status = -1;
+    }
+    fclose(out);
+    if (status == 0) {
+        printf("saved %u events (%u dropped) to %s\n", timeline->info.numEvents,
+               timeline->info.dropped, file_name);
+    }
+    return status;
+}
+
+static int device_command(char* argv[]) {
+    const char* command = argv[1];
+    int status = -1;
+    TIMELINE timeline = { 0 };
+    XDMA_TIMELINE_INFO* buffer = NULL;
+
+    HANDLE control = open_control();
+    if (control == INVALID_HANDLE_VALUE) {
+        return -1;
+    }
+
+    if (strcmp(command, "start") == 0) {
+        status = timeline_control(control, XDMA_TIMELINE_START);
+        goto Exit;
+    }
+    if (strcmp(command, "stop") == 0) {
+        status = timeline_control(control, XDMA_TIMELINE_STOP);
+        goto Exit;
+    }
+
+    buffer = (XDMA_TIMELINE_INFO*)malloc(sizeof(XDMA_TIMELINE_INFO) +
+                                         MAX_DRAIN_EVENTS * sizeof(XDMA_TIMELINE_EVENT));
+    if (buffer == NULL) {
+        fprintf(stderr, "Error allocating the drain buffer\n");
+        goto Exit;
+    }
+
+    if (strcmp(command, "drain") == 0) { // drain <FILE>
+        if (timeline_drain(control, buffer, &timeline) == 0) {
+            status = write_raw(argv[2], &timeline);
+        }
+        goto Exit;
+    }
+
+    // record <SECONDS> <FILE.json>
+    const double seconds = atof(argv[2]);
+    if (timeline_control(control, XDMA_TIMELINE_START) != 0) {
+        goto Exit;
+    }
+    printf("recording for %.1f seconds\n", seconds);
+    const ULONGLONG end = GetTickCount64() + (ULONGLONG)(seconds * 1000.0);
+    do {
+        Sleep(DRAIN_INTERVAL_MS); // drain often enough that the rings do not overflow
+        if (timeline_drain(control, buffer, &timeline) != 0) {
+            goto Exit;
+        }
+    } while (GetTickCount64() < end);
+    if ((timeline_control(control, XDMA_TIMELINE_STOP) != 0) ||
+        (timeline_drain(control, buffer, &timeline) != 0)) {
+        goto Exit;
+    }
+    status = write_json(argv[3], &timeline);
+
+Exit:
+    free(buffer);
+    free(timeline.events);
+    CloseHandle(control);
+    return status;
+}
+
+#endif
+
+static void usage(const char* exe_name) {
+    printf("%s usage:\n\n", exe_name);
+#ifdef _WIN32
+    printf("%s start | stop\n", exe_name);
+    printf("    Start recording (discards buffered events) or stop recording.\n");
+    printf("%s drain <FILE>\n", exe_name);
+    printf("    Save the buffered events to FILE.\n");
+    printf("%s record <SECONDS> <FILE.json>\n", exe_name);
+    printf("    Record for SECONDS, draining every %d ms, and export the timeline to FILE.json.\n",
+           DRAIN_INTERVAL_MS);
+#endif
+    printf("%s export <FILE> <FILE.json>\n", exe_name);
+    printf("    Export the events saved by drain to FILE.json.\n");
+    printf("\nOpen the JSON file in chrome://tracing or https://ui.perfetto.dev\n");
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return -1;
+    }
+    const char* command = argv[1];
+    if ((strcmp(command, "export") == 0) && (argc == 4)) {
+        return export_file(argv[2], argv[3]);
+    }
+#ifdef _WIN32
+    if ((((strcmp(command, "start") == 0) || (strcmp(command, "stop") == 0)) && (argc == 2)) ||
+        ((strcmp(command, "drain") == 0) && (argc == 3)) ||
+        ((strcmp(command, "record") == 0) && (argc == 4))) {
+        return device_command(argv);
+    }
+#endif
+    usage(argv[0]);
+    return -1;
+}
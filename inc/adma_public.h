@@ -26,7 +26,15 @@ DEFINE_GUID(GUID_DEVINTERFACE_ADMA, //==GUID_DEVINTERFACE_XDMA
 
 
 #define	ADMA_FILE_H2C_0		L"\\ah2c_0"
+#define	ADMA_FILE_H2C_1		L"\\ah2c_1"
+#define	ADMA_FILE_H2C_2		L"\\ah2c_2"
+#define	ADMA_FILE_H2C_3		L"\\ah2c_3"
+
 #define	ADMA_FILE_C2H_0		L"\\ac2h_0"
+#define	ADMA_FILE_C2H_1		L"\\ac2h_1"
+#define	ADMA_FILE_C2H_2		L"\\ac2h_2"
+#define	ADMA_FILE_C2H_3		L"\\ac2h_3"
+
 #define	ADMA_FILE_USER		L"\\user"
 #define	ADMA_FILE_CONTROL	L"\\control"
 
@@ -39,13 +47,87 @@ DEFINE_GUID(GUID_DEVINTERFACE_ADMA, //==GUID_DEVINTERFACE_XDMA
 #define IOCTL_ADMA_PERF_GET     ADMA_IOCTL(0x3)
 #define IOCTL_ADMA_ADDRMODE_GET ADMA_IOCTL(0x4)
 #define IOCTL_ADMA_ADDRMODE_SET ADMA_IOCTL(0x5)
+#define IOCTL_ADMA_A2P_GET      ADMA_IOCTL(0x6)
+#define IOCTL_ADMA_DESCMODE_SET ADMA_IOCTL(0x7)
+#define IOCTL_ADMA_PROGRAM_GET  ADMA_IOCTL(0x8)
+#define IOCTL_ADMA_POLLMODE_SET ADMA_IOCTL(0x9)
+#define IOCTL_ADMA_POLL_GET     ADMA_IOCTL(0xA)
+#define IOCTL_ADMA_LITE_SET     ADMA_IOCTL(0xB)
+#define IOCTL_ADMA_LITE_GET     ADMA_IOCTL(0xC)
+
+// descriptor delivery modes for IOCTL_ADMA_DESCMODE_SET, set for both directions of the channel
+#define ADMA_DESC_MODE_DISPATCHER   (0) // descriptors are written into the dispatcher over mmio
+#define ADMA_DESC_MODE_PREFETCHER   (1) // descriptors are fetched from host memory by the prefetcher
 
 // structure for IOCTL_ADMA_PERF_GET
+// counted from IOCTL_ADMA_PERF_START until IOCTL_ADMA_PERF_STOP or, while running, until the get.
+// all times are observed by the host, a transfer counts as busy from programming until its
+// completion is handled in the dpc, so busyNs includes the msi and dpc latency. throughput is
+// bytes * 1000000000 / busyNs. callers passing only the first three members receive just those
 typedef struct {
-    UINT64 clockCycleCount;
-    UINT64 dataCycleCount;
-    UINT64 pendingCount;
+    UINT64 elapsedNs;       // host time counted
+    UINT64 busyNs;          // host time with a transfer outstanding
+    UINT64 idleNs;          // host time with no transfer outstanding
+    UINT64 bytes;           // bytes transferred
+    UINT64 transfers;       // completed requests, filled ring blocks on a streaming engine
+    UINT64 samples;         // completions folded into busyNs
+    UINT32 running;         // 1 = counting
 }ADMA_PERF_DATA;
 
+// structure for IOCTL_ADMA_A2P_GET
+// address translation window statistics of one engine direction
+typedef struct {
+    UINT64 hits;        // sg elements mapped by an already programmed window
+    UINT64 misses;      // sg elements which required (re)programming a table entry
+    UINT64 splits;      // extra descriptors issued because an element crossed a window boundary
+    UINT64 drains;      // waits for the dispatcher because all windows were in use by one transfer
+    UINT32 numWindows;  // table entries owned by this direction
+    UINT32 windowSize;  // bytes mapped by one table entry
+}ADMA_A2P_STATS;
+
+// structure for IOCTL_ADMA_PROGRAM_GET
+// host side cost of handing transfers to the engine, cleared when the descriptor mode changes
+typedef struct {
+    UINT64 transfers;       // programmed dma transfers
+    UINT64 descriptors;     // descriptors built for these transfers
+    UINT64 doorbells;       // descriptor deliveries written over mmio
+    UINT64 programTicks;    // host time spent programming, in performance counter ticks
+    UINT64 tickFrequency;   // performance counter frequency in Hz
+    UINT32 descMode;        // ADMA_DESC_MODE_*
+}ADMA_PROGRAM_STATS;
+
+// structure for IOCTL_ADMA_POLLMODE_SET
+typedef struct {
+    UINT32 enable;          // 1 = spin for completion, 0 = wait for the interrupt
+    UINT32 budgetUs;        // longest spin before completion is left to the interrupt, 0 = default
+}ADMA_POLL_MODE;
+
+// structure for IOCTL_ADMA_POLL_GET
+// completion latency from programming the engine until the driver sees the transfer done, kept in
+// both modes so that they can be compared. cleared by IOCTL_ADMA_POLLMODE_SET
+typedef struct {
+    UINT64 completed;       // completed requests
+    UINT64 latencyTicks;    // sum of their completion latency, in performance counter ticks
+    UINT64 polled;          // spins which saw the transfer complete
+    UINT64 fallbacks;       // spins which ran out of budget and left completion to the interrupt
+    UINT64 tickFrequency;   // performance counter frequency in Hz
+    UINT32 pollMode;        // 1 = poll mode
+    UINT32 budgetUs;        // spin budget
+}ADMA_POLL_STATS;
+
+// structure for IOCTL_ADMA_LITE_GET, IOCTL_ADMA_LITE_SET takes the threshold as a ULONG
+// request latency from arrival at the engine until completion, for the transfers which took the
+// lite path and for those of at most maxSize bytes which took the full descriptor path. cleared by
+// IOCTL_ADMA_LITE_SET
+typedef struct {
+    UINT64 liteTransfers;       // requests copied through a pre-mapped lite slot
+    UINT64 liteLatencyTicks;    // sum of their latency, in performance counter ticks
+    UINT64 fullTransfers;       // requests of at most maxSize bytes mapped by a dma transaction
+    UINT64 fullLatencyTicks;    // sum of their latency, in performance counter ticks
+    UINT64 tickFrequency;       // performance counter frequency in Hz
+    UINT32 threshold;           // requests up to this size take the lite path, 0 = disabled
+    UINT32 maxSize;             // largest threshold
+}ADMA_LITE_STATS;
+
 #endif/*__ADMA_WINDOWS_H__*/
 
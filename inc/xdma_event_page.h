@@ -0,0 +1,79 @@
+/*
+* XDMA User Event Notification Page
+* =================================
+*
+* Copyright 2017 Xilinx Inc.
+* Copyright 2010-2012 Sidebranch
+* Copyright 2010-2012 Leon Woestenberg <leon@sidebranch.com>
+*
+* Maintainer:
+* -----------
+* Alexander Hornburg <alexander.hornburg@xilinx.com>
+*
+* Description:
+* ------------
+* Layout of the read-only page which the driver shares with processes via IOCTL_XDMA_MAP_EVENTS,
+* the publishing step of the user interrupt DPC and the application side reader. This header does
+* not depend on any Windows API so the protocol can be exercised on other platforms as well, see
+* exe/event_page_sim.
+*
+* Protocol:
+* ---------
+* Each time event n fires the DPC stores timestamp[n] and then increments sequence[n]. A reader
+* which finds sequence[n] unchanged around its read of timestamp[n] holds the timestamp of
+* occurrence sequence[n], or of occurrence sequence[n] + 1 if the DPC is publishing it right now.
+*/
+
+#ifndef __XDMA_EVENT_PAGE_H__
+#define __XDMA_EVENT_PAGE_H__
+
+#if defined(_WIN32)
+#define XDMA_EVENT_PAGE_BARRIER()   MemoryBarrier()
+#define XDMA_EVENT_PAGE_INCREMENT(target) InterlockedIncrement((volatile LONG*)(target))
+#else
+#include <stdint.h>
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+#define XDMA_EVENT_PAGE_BARRIER()   __sync_synchronize()
+#define XDMA_EVENT_PAGE_INCREMENT(target) __sync_add_and_fetch((target), 1)
+#endif
+
+// ========================= constants ============================================================
+
+#define XDMA_MAX_USER_EVENTS    (16)
+
+// ========================= type declarations ====================================================
+
+// layout of the read-only page mapped by IOCTL_XDMA_MAP_EVENTS on any event_* file. Each time
+// event n fires the driver stores timestamp[n] and then increments sequence[n], so a thread can
+// spin on sequence[n] without issuing any I/O request.
+typedef struct {
+    volatile UINT32 sequence[XDMA_MAX_USER_EVENTS];  // number of occurrences since driver load
+    volatile UINT64 timestamp[XDMA_MAX_USER_EVENTS]; // QueryPerformanceCounter() value of the last occurrence
+}XDMA_EVENT_PAGE;
+
+// ========================= driver side ==========================================================
+
+/// Publish one occurrence of an event, called from the user interrupt DPC
+static __inline void xdma_event_page_publish(XDMA_EVENT_PAGE* page, unsigned eventId,
+                                             UINT64 timestamp) {
+    page->timestamp[eventId] = timestamp;
+    XDMA_EVENT_PAGE_INCREMENT(&page->sequence[eventId]); // releases the timestamp
+}
+
+// ========================= application side helpers =============================================
+
+/// Read the occurrence count of an event and the timestamp belonging to it, see Protocol above
+static __inline UINT32 xdma_event_page_read(const XDMA_EVENT_PAGE* page, unsigned eventId,
+                                            UINT64* timestamp) {
+    UINT32 sequence;
+    do {
+        sequence = page->sequence[eventId];
+        XDMA_EVENT_PAGE_BARRIER(); // read the timestamp only after observing the count
+        *timestamp = page->timestamp[eventId];
+        XDMA_EVENT_PAGE_BARRIER(); // and before checking that the count did not move
+    } while (sequence != page->sequence[eventId]);
+    return sequence;
+}
+
+#endif/*__XDMA_EVENT_PAGE_H__*/
@@ -19,6 +19,10 @@
 #ifndef __XDMA_WINDOWS_H__
 #define __XDMA_WINDOWS_H__
 
+#include "xdma_queue.h"
+#include "xdma_timeline.h"
+#include "xdma_event_page.h"
+
 // 74c7e4a9-6d5d-4a70-bc0d-20691dff9e9d
 DEFINE_GUID(GUID_DEVINTERFACE_XDMA, 
             0x74c7e4a9, 0x6d5d, 0x4a70, 0xbc, 0x0d, 0x20, 0x69, 0x1d, 0xff, 0x9e, 0x9d);
@@ -26,6 +30,7 @@ DEFINE_GUID(GUID_DEVINTERFACE_XDMA,
 #define	XDMA_FILE_USER		L"\\user"
 #define	XDMA_FILE_CONTROL	L"\\control"
 #define XDMA_FILE_BYPASS	L"\\bypass"
+#define	XDMA_FILE_QUEUE		L"\\queue"
 
 #define	XDMA_FILE_EVENT_0	L"\\event_0"
 #define	XDMA_FILE_EVENT_1	L"\\event_1"
@@ -62,6 +67,22 @@ DEFINE_GUID(GUID_DEVINTERFACE_XDMA,
 #define IOCTL_XDMA_PERF_GET     XDMA_IOCTL(0x3)
 #define IOCTL_XDMA_ADDRMODE_GET XDMA_IOCTL(0x4)
 #define IOCTL_XDMA_ADDRMODE_SET XDMA_IOCTL(0x5)
+#define IOCTL_XDMA_MAP_BAR      XDMA_IOCTL(0x6)
+#define IOCTL_XDMA_REG_BATCH    XDMA_IOCTL(0x7)
+#define IOCTL_XDMA_EVENT_WAIT   XDMA_IOCTL(0x8)
+#define IOCTL_XDMA_MAP_EVENTS   XDMA_IOCTL(0x9)
+#define IOCTL_XDMA_PROGRAM_REGISTER XDMA_IOCTL(0xA)
+#define IOCTL_XDMA_PROGRAM_WAIT     XDMA_IOCTL(0xB)
+#define IOCTL_XDMA_QUEUE_SETUP  XDMA_IOCTL(0xC)
+#define IOCTL_XDMA_QUEUE_ENTER  XDMA_IOCTL(0xD)
+#define IOCTL_XDMA_TRACE_CONTROL XDMA_IOCTL(0xE)
+#define IOCTL_XDMA_TRACE_DUMP   XDMA_IOCTL(0xF)
+#define IOCTL_XDMA_TIMELINE_CONTROL XDMA_IOCTL(0x10)
+#define IOCTL_XDMA_TIMELINE_DRAIN   XDMA_IOCTL(0x11)
+#define IOCTL_XDMA_SPILL_GET    XDMA_IOCTL(0x12)
+
+// flags for IOCTL_XDMA_MAP_BAR
+#define XDMA_MAP_WRITE_COMBINED (0x1) // only valid on the bypass device node
 
 // structure for IOCTL_XDMA_PERF_GET
 typedef struct {
@@ -70,5 +91,123 @@ typedef struct {
     UINT64 pendingCount;
 }XDMA_PERF_DATA;
 
+// register operations for IOCTL_XDMA_REG_BATCH
+#define XDMA_REG_OP_READ        (0) // result = reg
+#define XDMA_REG_OP_WRITE       (1) // reg = data
+#define XDMA_REG_OP_RMW         (2) // reg = (reg & ~mask) | (data & mask), result = new value
+#define XDMA_REG_OP_POLL        (3) // wait until (reg & mask) == (data & mask), result = last value
+
+#define XDMA_REG_BAR_SELF       (0xFFFFFFFFUL)  // BAR of the device file the IOCTL is issued on
+#define XDMA_REG_POLL_MAX_TIMEOUT_US (100000UL) // upper limit for XDMA_REG_OP_POLL timeouts
+#define XDMA_REG_BATCH_MAX_OPS  (256UL)         // operations per IOCTL_XDMA_REG_BATCH
+#define XDMA_REG_BATCH_MAX_POLL_US (XDMA_REG_POLL_MAX_TIMEOUT_US) // summed POLL wait per batch
+
+// structure for IOCTL_XDMA_REG_BATCH - input and output are arrays of this structure.
+// Operations execute in order, processing stops at the first failing operation. All POLL
+// operations of a batch share XDMA_REG_BATCH_MAX_POLL_US, a POLL finding it used up times out.
+typedef struct {
+    UINT32 op;          // XDMA_REG_OP_*
+    UINT32 bar;         // BAR index or XDMA_REG_BAR_SELF
+    UINT64 offset;      // byte offset into the BAR, must be 4 byte aligned
+    UINT32 data;        // value to write or compare
+    UINT32 mask;        // bit mask for RMW and POLL
+    UINT32 timeoutUs;   // timeout for POLL in microseconds
+    UINT32 result;      // [out] register value
+    INT32 status;       // [out] NTSTATUS of this operation
+    UINT32 reserved;
+}XDMA_REG_OP;
+
+// structure for IOCTL_XDMA_MAP_BAR, IOCTL_XDMA_MAP_EVENTS and IOCTL_XDMA_QUEUE_SETUP
+// the mapping is valid until the device file is closed
+typedef struct {
+    UINT64 address; // virtual address of the BAR in the calling process
+    UINT64 length;  // length of the mapping in bytes
+}XDMA_BAR_MAPPING;
+
+// structure returned by ReadFile on an event_* file (when the buffer is large enough) and by
+// IOCTL_XDMA_EVENT_WAIT. The input of IOCTL_XDMA_EVENT_WAIT is a UINT32 bit mask of the events to
+// wait on, 0 selects the event of the device file. The request completes as soon as at least one
+// of the events has fired since it was last returned to user-space; no occurrence is lost.
+typedef struct {
+    UINT32 mask;                            // events returned in this structure
+    UINT32 reserved;
+    UINT32 count[XDMA_MAX_USER_EVENTS];     // occurrences since the last read, per event
+    UINT64 timestamp[XDMA_MAX_USER_EVENTS]; // QueryPerformanceCounter() value of the last occurrence
+}XDMA_EVENT_INFO;
+
+#define XDMA_PROGRAM_MAX_LENGTH (64UL * 1024UL)
+
+// input of IOCTL_XDMA_PROGRAM_REGISTER on a memory mapped h2c_* or c2h_* file. On H2C the payload
+// to send follows this structure. Each time the user event fires the driver starts the transfer
+// from its interrupt handler. The program stays registered until the device file is closed,
+// regular reads and writes on the engine fail with ERROR_BUSY in the meantime.
+typedef struct {
+    UINT32 eventId;         // user event (0-15) which starts the transfer
+    UINT32 reserved;
+    UINT64 deviceAddress;   // card address of the transfer
+    UINT64 length;          // bytes per transfer, at most XDMA_PROGRAM_MAX_LENGTH
+}XDMA_EVENT_PROGRAM;
+
+// output of IOCTL_XDMA_PROGRAM_WAIT, on C2H followed by the received data. The program is not
+// triggered again until the result of the previous transfer has been collected.
+typedef struct {
+    INT32 status;           // NTSTATUS of the transfer
+    UINT32 length;          // number of bytes transferred
+    UINT64 triggerTime;     // QueryPerformanceCounter() value when the user event started the transfer
+    UINT64 completeTime;    // QueryPerformanceCounter() value when the transfer finished
+}XDMA_PROGRAM_RESULT;
+
+#define XDMA_TRACE_MAX_RECORDS  (16384UL) // capacity of the i/o trace log, a power of 2
+
+// input of IOCTL_XDMA_TRACE_CONTROL on the control file. Starting clears the log.
+#define XDMA_TRACE_STOP         (0)
+#define XDMA_TRACE_START        (1)
+
+// flags of XDMA_TRACE_RECORD
+#define XDMA_TRACE_FLAG_BOUNCE  (0x1) // transferred through the small transfer bounce buffer
+#define XDMA_TRACE_FLAG_POLL    (0x2) // engine in poll mode
+
+// one read or write request on an h2c_* or c2h_* file, written when the request completes.
+// Timestamps are QueryPerformanceCounter() values.
+typedef struct {
+    UINT32 sequence;        // 1-based position in the capture
+    UINT8 dir;              // 0 = H2C (write), 1 = C2H (read)
+    UINT8 channel;
+    UINT16 flags;           // XDMA_TRACE_FLAG_*
+    INT32 status;           // NTSTATUS the request completed with
+    UINT32 length;          // requested bytes
+    UINT32 bytes;           // transferred bytes
+    UINT32 reserved;
+    UINT64 offset;          // card address (file offset)
+    UINT64 arrival;         // request entered the driver
+    UINT64 start;           // request was dispatched to the engine
+    UINT64 complete;        // request was completed
+}XDMA_TRACE_RECORD;
+
+// output of IOCTL_XDMA_TRACE_DUMP, followed by numRecords records oldest first. The log keeps the
+// latest XDMA_TRACE_MAX_RECORDS requests, captured - numRecords older ones were overwritten or did
+// not fit into the output buffer.
+typedef struct {
+    UINT64 frequency;       // QueryPerformanceFrequency()
+    UINT64 captured;        // requests recorded since the capture was started
+    UINT32 numRecords;
+    UINT32 enabled;         // capture is running
+}XDMA_TRACE_INFO;
+
+// output of IOCTL_XDMA_SPILL_GET on a streaming c2h_* file. The spill buffer is sized by the
+// SPILL_BUFFER_MB driver parameter; blocks are moved into it once SPILL_HIGH_WATER blocks of the
+// receive ring are filled. The counters restart each time the file is opened.
+typedef struct {
+    UINT64 capacity;        // bytes, 0 = spill mode disabled
+    UINT64 level;           // bytes currently held in the spill buffer
+    UINT64 levelHighWater;  // largest level seen
+    UINT64 spilledBytes;    // bytes moved from the ring into the spill buffer
+    UINT64 spilledBlocks;   // ring blocks moved into the spill buffer
+    UINT64 overflows;       // times a block had to stay in the ring because the spill buffer was full
+    UINT64 contended;       // times blocks could not be moved because a read was copying out
+    UINT32 ringHighWater;   // largest number of filled ring blocks seen by the dpc
+    UINT32 highWaterMark;   // filled ring blocks at which blocks are spilled
+}XDMA_SPILL_STATS;
+
 #endif/*__XDMA_WINDOWS_H__*/
 
@@ -0,0 +1,142 @@
+/*
+* XDMA Shared Queue Ring Protocol
+* ===============================
+*
+* Copyright 2017 Xilinx Inc.
+* Copyright 2010-2012 Sidebranch
+* Copyright 2010-2012 Leon Woestenberg <leon@sidebranch.com>
+*
+* Maintainer:
+* -----------
+* Alexander Hornburg <alexander.hornburg@xilinx.com>
+*
+* Description:
+* ------------
+* Layout of the submission/completion rings which the driver shares with a process via
+* IOCTL_XDMA_QUEUE_SETUP, and the application side producer/consumer helpers. This header does not
+* depend on any Windows API so the protocol can be used on other platforms as well.
+*
+* Protocol:
+* ---------
+* All indices are free running 32 bit counters, the ring slot is (index & (XDMA_QUEUE_DEPTH - 1)).
+* The application writes submission entries and advances sqTail, the driver consumes them when
+* IOCTL_XDMA_QUEUE_ENTER is issued (the doorbell) and advances sqHead. The driver writes completion
+* entries and advances cqTail, the application consumes them and advances cqHead. Each index is
+* written by one side only and lives in its own cache line.
+*/
+
+#ifndef __XDMA_QUEUE_H__
+#define __XDMA_QUEUE_H__
+
+#if defined(_WIN32)
+#define XDMA_QUEUE_BARRIER()    MemoryBarrier()
+#else
+#include <stdint.h>
+typedef uint32_t UINT32;
+typedef int32_t INT32;
+typedef uint64_t UINT64;
+#define XDMA_QUEUE_BARRIER()    __sync_synchronize()
+#endif
+
+// ========================= constants ============================================================
+
+#define XDMA_QUEUE_DEPTH        (256)       // entries per ring, power of two
+#define XDMA_QUEUE_SQ_OFFSET    (0x1000)    // byte offset of the submission ring
+#define XDMA_QUEUE_CQ_OFFSET    (0x4000)    // byte offset of the completion ring
+#define XDMA_QUEUE_DATA_OFFSET  (0x8000)    // byte offset of the dma data area
+#define XDMA_QUEUE_DATA_SIZE    (0x100000)  // size of the dma data area
+#define XDMA_QUEUE_SIZE         (XDMA_QUEUE_DATA_OFFSET + XDMA_QUEUE_DATA_SIZE)
+
+// submission opcodes
+#define XDMA_QUEUE_OP_NOP           (0) // completes immediately
+#define XDMA_QUEUE_OP_H2C           (1) // data area -> card, on h2c_<index>
+#define XDMA_QUEUE_OP_C2H           (2) // card -> data area, on c2h_<index>
+#define XDMA_QUEUE_OP_REG           (3) // register operation on BAR <index>, see XDMA_REG_OP_*
+#define XDMA_QUEUE_OP_EVENT_WAIT    (4) // completes when one of the events in <index> has fired
+
+// engine bits of the IOCTL_XDMA_QUEUE_SETUP input mask
+#define XDMA_QUEUE_ENGINE_H2C(channel)  (1UL << (channel))
+#define XDMA_QUEUE_ENGINE_C2H(channel)  (1UL << (4 + (channel)))
+
+// flags of the IOCTL_XDMA_QUEUE_ENTER input
+#define XDMA_QUEUE_ENTER_WAIT   (0x1) // block until at least one completion is available
+
+// ========================= type declarations ====================================================
+
+typedef struct {
+    volatile UINT32 sqHead;     // next submission the driver consumes, written by the driver
+    UINT32 reserved0[15];
+    volatile UINT32 sqTail;     // next free submission slot, written by the application
+    UINT32 reserved1[15];
+    volatile UINT32 cqHead;     // next completion the application consumes, written by the application
+    UINT32 reserved2[15];
+    volatile UINT32 cqTail;     // next free completion slot, written by the driver
+    UINT32 reserved3[15];
+}XDMA_QUEUE_HEADER;
+
+typedef struct {
+    UINT32 opcode;      // XDMA_QUEUE_OP_*
+    UINT32 index;       // engine channel (H2C/C2H), BAR index (REG) or event mask (EVENT_WAIT)
+    UINT64 address;     // card address (H2C/C2H) or BAR offset (REG)
+    UINT32 dataOffset;  // host buffer offset into the data area (H2C/C2H)
+    UINT32 length;      // number of bytes (H2C/C2H)
+    UINT32 regOp;       // XDMA_REG_OP_* (REG)
+    UINT32 data;        // value to write or compare (REG)
+    UINT32 mask;        // bit mask for RMW (REG)
+    UINT32 timeoutUs;   // unused, XDMA_REG_OP_POLL is rejected on the queue (REG)
+    UINT64 userData;    // returned unchanged in the completion
+}XDMA_QUEUE_SQE;
+
+typedef struct {
+    UINT64 userData;    // from the submission
+    INT32 status;       // NTSTATUS of the operation
+    UINT32 result;      // bytes transferred, register value or fired event mask
+}XDMA_QUEUE_CQE;
+
+// ========================= application side helpers =============================================
+
+static __inline XDMA_QUEUE_HEADER* xdma_queue_header(void* base) {
+    return (XDMA_QUEUE_HEADER*)base;
+}
+
+static __inline XDMA_QUEUE_SQE* xdma_queue_sq(void* base) {
+    return (XDMA_QUEUE_SQE*)((char*)base + XDMA_QUEUE_SQ_OFFSET);
+}
+
+static __inline XDMA_QUEUE_CQE* xdma_queue_cq(void* base) {
+    return (XDMA_QUEUE_CQE*)((char*)base + XDMA_QUEUE_CQ_OFFSET);
+}
+
+static __inline void* xdma_queue_data(void* base) {
+    return (char*)base + XDMA_QUEUE_DATA_OFFSET;
+}
+
+/// Queue a submission entry. Returns 0 if the submission ring is full.
+/// The driver only sees new entries after the next IOCTL_XDMA_QUEUE_ENTER.
+static __inline int xdma_queue_submit(void* base, const XDMA_QUEUE_SQE* sqe) {
+    XDMA_QUEUE_HEADER* header = xdma_queue_header(base);
+    UINT32 tail = header->sqTail;
+    if (tail - header->sqHead >= XDMA_QUEUE_DEPTH) {
+        return 0;
+    }
+    xdma_queue_sq(base)[tail & (XDMA_QUEUE_DEPTH - 1)] = *sqe;
+    XDMA_QUEUE_BARRIER(); // entry must be visible before the index
+    header->sqTail = tail + 1;
+    return 1;
+}
+
+/// Take the next completion entry. Returns 0 if the completion ring is empty.
+static __inline int xdma_queue_reap(void* base, XDMA_QUEUE_CQE* cqe) {
+    XDMA_QUEUE_HEADER* header = xdma_queue_header(base);
+    UINT32 head = header->cqHead;
+    if (head == header->cqTail) {
+        return 0;
+    }
+    XDMA_QUEUE_BARRIER(); // read the entry only after observing the index
+    *cqe = xdma_queue_cq(base)[head & (XDMA_QUEUE_DEPTH - 1)];
+    XDMA_QUEUE_BARRIER(); // entry must be read before the slot is handed back
+    header->cqHead = head + 1;
+    return 1;
+}
+
+#endif/*__XDMA_QUEUE_H__*/
@@ -0,0 +1,79 @@
+/*
+* XDMA Event Timeline
+* ===================
+*
+* Copyright 2017 Xilinx Inc.
+* Copyright 2010-2012 Sidebranch
+* Copyright 2010-2012 Leon Woestenberg <leon@sidebranch.com>
+*
+* Maintainer:
+* -----------
+* Alexander Hornburg <alexander.hornburg@xilinx.com>
+*
+* Description:
+* ------------
+* Layout of the binary events the driver records into its per-cpu event rings and returns with
+* IOCTL_XDMA_TIMELINE_DRAIN. Each event is a cycle counter (TSC) stamp plus a type and one argument,
+* cheap enough to be left running in production. This header does not depend on any Windows API
+* so drained timelines can be processed on other platforms as well.
+*/
+
+#ifndef __XDMA_TIMELINE_H__
+#define __XDMA_TIMELINE_H__
+
+#if !defined(_WIN32)
+#include <stdint.h>
+typedef uint8_t UINT8;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+#endif
+
+// ========================= constants ============================================================
+
+#define XDMA_TIMELINE_MAX_CPUS      (64)    // cpus with their own ring, others share them
+#define XDMA_TIMELINE_RING_ENTRIES  (4096)  // events per cpu, power of two
+
+// input of IOCTL_XDMA_TIMELINE_CONTROL on the control file. Starting discards all buffered events.
+#define XDMA_TIMELINE_STOP          (0)
+#define XDMA_TIMELINE_START         (1)
+
+// event types
+#define XDMA_TL_ARRIVAL         (1) // read/write request entered the driver, arg = length
+#define XDMA_TL_PROGRAM_DMA     (2) // XDMA_EngineProgramDma(), arg = number of descriptors
+#define XDMA_TL_ENGINE_START    (3) // engine run bit set
+#define XDMA_TL_ISR             (4) // interrupt service routine entered, arg = message id
+#define XDMA_TL_DPC_BEGIN       (5) // interrupt dpc entered
+#define XDMA_TL_DPC_END         (6) // interrupt dpc left
+#define XDMA_TL_RING_BATCH      (7) // streaming ring results processed, arg = number of results
+#define XDMA_TL_COMPLETE        (8) // read/write request completed, arg = bytes transferred
+
+#define XDMA_TL_NO_ENGINE       (0xFF) // dir and channel of device wide events
+
+// ========================= type declarations ====================================================
+
+typedef struct {
+    UINT64 cycles;      // cycle counter when the event was recorded
+    UINT32 sequence;    // 1-based position in the ring of the cpu
+    UINT8 type;         // XDMA_TL_*
+    UINT8 dir;          // 0 = H2C, 1 = C2H or XDMA_TL_NO_ENGINE
+    UINT8 channel;      // engine channel or XDMA_TL_NO_ENGINE
+    UINT8 cpu;          // ring the event was recorded into
+    UINT64 arg;
+}XDMA_TIMELINE_EVENT;
+
+// output of IOCTL_XDMA_TIMELINE_DRAIN, followed by numEvents events. Events of one cpu are in order,
+// the rings are concatenated. Two cycle counter/performance counter pairs calibrate the cycle
+// counter: cycles per second = (cycles - startCycles) * frequency / (counter - startCounter)
+typedef struct {
+    UINT64 frequency;       // QueryPerformanceFrequency()
+    UINT64 startCycles;     // cycle counter when the timeline was started
+    UINT64 startCounter;    // performance counter when the timeline was started
+    UINT64 cycles;          // cycle counter when the events were drained
+    UINT64 counter;         // performance counter when the events were drained
+    UINT32 numEvents;
+    UINT32 dropped;         // events overwritten before they were drained since the start
+    UINT32 numCpus;         // rings
+    UINT32 enabled;         // timeline is recording
+}XDMA_TIMELINE_INFO;
+
+#endif/*__XDMA_TIMELINE_H__*/
@@ -260,6 +260,8 @@ static void GetRegisterModules(IN PADMA_DEVICE adma) {
 
 NTSTATUS ADMA_DeviceOpen(WDFDEVICE wdfDevice,
                          PADMA_DEVICE adma,
+                         ULONG numChannels,
+                         ULONG channelStride,
                          WDFCMRESLIST ResourcesRaw,
                          WDFCMRESLIST ResourcesTranslated) {
 
@@ -270,6 +272,8 @@ NTSTATUS ADMA_DeviceOpen(WDFDEVICE wdfDevice,
     DeviceDefaultInitialize(adma);
 
     adma->wdfDevice = wdfDevice;
+    adma->numChannels = numChannels; // checked by ProbeEngines
+    adma->channelStride = channelStride;
 
     // map PCIe BARs to host memory
     status = MapBARs(adma, ResourcesTranslated);
@@ -298,14 +302,27 @@ NTSTATUS ADMA_DeviceOpen(WDFDEVICE wdfDevice,
     }
 */
 
-	adma->a2pTransTbl->a2pAddrLo0 = 0xFFFFFFFCUL;
-	adma->a2pMask = adma->a2pTransTbl->a2pAddrLo0;
+	adma->a2pTransTbl->entry[0].a2pAddrLo = 0xFFFFFFFCUL;
+	adma->a2pMask = adma->a2pTransTbl->entry[0].a2pAddrLo;
 	if (!adma->a2pMask) {
 		status = STATUS_INTERNAL_ERROR;
 		TraceError(DBG_INIT, " FPGA bit error %!STATUS!", status);
 		return status;
 	}
-	TraceInfo(DBG_INIT, "a2p_mask = 0x%08x", adma->a2pMask);
+	adma->a2pTransTbl->entry[0].a2pAddrLo = 0;
+
+	// count the implemented table entries, unimplemented ones read back as zero
+	adma->a2pNumEntries = 1;
+	while (adma->a2pNumEntries < ADMA_A2P_MAX_ENTRIES) {
+		volatile ADMA_A2P_ENTRY* entry = &adma->a2pTransTbl->entry[adma->a2pNumEntries];
+		entry->a2pAddrLo = 0xFFFFFFFCUL;
+		if (entry->a2pAddrLo != adma->a2pMask) {
+			break;
+		}
+		entry->a2pAddrLo = 0;
+		adma->a2pNumEntries++;
+	}
+	TraceInfo(DBG_INIT, "a2p_mask = 0x%08x, entries = %u", adma->a2pMask, adma->a2pNumEntries);
 
     // WDF DMA Enabler - at least 32 bytes alignment for decriport table Page81, Page53 4 bytes alignment
 	WdfDeviceSetAlignmentRequirement(adma->wdfDevice, FILE_32_BYTE_ALIGNMENT); //add by zhuce 
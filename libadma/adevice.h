@@ -58,14 +58,18 @@ typedef struct ADMA_DEVICE_T {
 
 	volatile ADMA_A2P_TRANS_TBL *a2pTransTbl;
 	UINT32 a2pMask;
+	ULONG a2pNumEntries; // implemented translation table entries
 
     // DMA Engine management
     ADMA_ENGINE engines[ADMA_MAX_NUM_CHANNELS][ADMA_NUM_DIRECTIONS];
+    ULONG numChannels;          // channels used by ProbeEngines, engines[0..numChannels-1]
+    ULONG channelStride;        // config bar distance of consecutive mSGDMA dispatchers
     WDFDMAENABLER dmaEnabler;   // WDF DMA Enabler for the engine queues
 
     // Interrupt Resources
     WDFINTERRUPT lineInterrupt;
     WDFINTERRUPT channelInterrupts[ADMA_MAX_CHAN_IRQ];
+    ADMA_DISPATCHER dispatchers[ADMA_MAX_NUM_CHANNELS]; // per channel, see EnginesAssignInterrupt()
 
     // user events
     ADMA_EVENT userEvents[ADMA_MAX_USER_IRQ];
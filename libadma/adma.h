@@ -32,12 +32,16 @@
  * \brief Open and initialize an ADMA device given by the WDFDEVICE handle.
  * \param wdfDevice     [IN]        The OS device handle
  * \param adma          [IN]        The ADMA device context
+ * \param numChannels   [IN]        Number of DMA channels behind the config BAR, 1..ADMA_MAX_NUM_CHANNELS
+ * \param channelStride [IN]        Config BAR distance of consecutive channels (modular SGDMA only)
  * \param ResourcesRaw  [IN]        List of PCIe resources assigned to this device
  * \param ResourcesTranslated [IN]  List of PCIe resources assigned to this device
  * \return STATUS_SUCCESS on successful completion. All other return values indicate error conditions. 
  */
 NTSTATUS ADMA_DeviceOpen(WDFDEVICE wdfDevice,
                          PADMA_DEVICE adma,
+                         ULONG numChannels,
+                         ULONG channelStride,
                          WDFCMRESLIST ResourcesRaw,
                          WDFCMRESLIST ResourcesTranslated);
 
@@ -88,10 +92,49 @@ NTSTATUS ADMA_UserIsrDisable(PADMA_DEVICE xdma, ULONG eventId);
  */
 EVT_WDF_PROGRAM_DMA ADMA_EngineProgramDma;
 
+/**
+ * \brief Select how descriptors are delivered to the modular SGDMA of a DMA engine's channel. In
+ *        prefetcher mode descriptors are linked in host memory and only the list head is written
+ *        to the device. One A2P window of each engine is reserved for its descriptor list.
+ *        H2C and C2H share the dispatcher, both switch and both have to be idle.
+ * \param engine        [IN]        The DMA engine context
+ * \param mode          [IN]        ADMA_DESC_MODE_DISPATCHER or ADMA_DESC_MODE_PREFETCHER
+ * \return STATUS_SUCCESS on successful completion. All other return values indicate error conditions. 
+ */
+NTSTATUS ADMA_EngineSetDescMode(ADMA_ENGINE* engine, ULONG mode);
+
 /**
  * \brief Select between polling and interrupts as a mechanism for determining dma transfer 
  *        completion on a per DMA engine basis.
  * \param engine        [IN]        The DMA engine context
  * \param pollMode      [IN]        true = use polling, false = use interrupts
  */
-void ADMA_EngineSetPollMode(ADMA_ENGINE* engine, BOOLEAN pollMode);
\ No newline at end of file
+void ADMA_EngineSetPollMode(ADMA_ENGINE* engine, BOOLEAN pollMode);
+
+/**
+ * \brief Limit how long a poll mode engine spins for completion before it falls back to its
+ *        interrupt. Also clears the engine's completion latency counters.
+ * \param engine        [IN]        The DMA engine context
+ * \param budgetUs      [IN]        spin budget in microseconds, 0 = ADMA_POLL_DEFAULT_BUDGET_US
+ */
+void ADMA_EngineSetPollBudget(ADMA_ENGINE* engine, ULONG budgetUs);
+
+/**
+ * \brief Turn a C2H engine into a streaming engine which captures continuously into a ring of
+ *        page sized blocks, one per descriptor of the arria10 descriptor table. Every descriptor
+ *        reads a block from the same card address, which must be a FIFO-like avalon slave. Must
+ *        be called before the engine's queue is created.
+ * \param engine        [IN]        The DMA engine context
+ * \param cardAddress   [IN]        avalon address of the stream source
+ * \return STATUS_SUCCESS on successful completion. STATUS_NOT_SUPPORTED on the modular SGDMA.
+ */
+NTSTATUS ADMA_EngineSetStream(ADMA_ENGINE* engine, UINT64 cardAddress);
+
+/**
+ * \brief Route transfers up to the given size through the engine's pre-mapped lite buffer instead
+ *        of building a scatter-gather transaction. Also clears the engine's lite path counters.
+ * \param engine        [IN]        The DMA engine context
+ * \param threshold     [IN]        Size in bytes, 0 = disabled. Clamped to ADMA_LITE_SLOT_SIZE
+ * \return STATUS_SUCCESS on successful completion. STATUS_NOT_SUPPORTED on the modular SGDMA.
+ */
+NTSTATUS ADMA_EngineSetLiteThreshold(ADMA_ENGINE* engine, size_t threshold);
\ No newline at end of file
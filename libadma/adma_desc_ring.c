@@ -0,0 +1,99 @@
+/*
+* ADMA Descriptor Ring Accounting
+* ===========
+*
+* Copyright 2018 Qinger Inc.
+*
+* Maintainer:
+* -----------
+* zhuce <qingermaker@sina.com>
+*
+* References:
+* -----------
+*   [1] ug_a10_pcie_avmm_dma.pdf - Intel Arria 10 or Intel Cyclone10 Avalon-MM DMA Interface for PCIe* Solutions User Guide
+*/
+
+// ========================= include dependencies =================================================
+
+#include "adma_desc_ring.h"
+
+// ========================= function definitions =================================================
+
+VOID AdmaDescRingInit(OUT ADMA_DESC_RING* ring, IN ULONG lastPtr) {
+    ULONG i;
+
+    ring->next = (lastPtr < ADMA_DESC_RING_SIZE) ? (lastPtr + 1) % ADMA_DESC_RING_SIZE : 0;
+    ring->used = 0;
+    ring->oldest = 0;
+    ring->pending = 0;
+    for (i = 0; i < ADMA_DESC_RING_MAX_REQUESTS; i++) {
+        ring->request[i].first = 0;
+        ring->request[i].count = 0;
+        ring->request[i].context = NULL;
+    }
+    ring->submitted = 0;
+    ring->completed = 0;
+    ring->maxUsed = 0;
+    ring->maxPending = 0;
+}
+
+ULONG AdmaDescRingFree(IN const ADMA_DESC_RING* ring) {
+    return ADMA_DESC_RING_CAPACITY - ring->used;
+}
+
+BOOLEAN AdmaDescRingSubmit(IN OUT ADMA_DESC_RING* ring, IN ULONG count, IN PVOID context,
+                           OUT ULONG* first) {
+    if ((count == 0) || (count > AdmaDescRingFree(ring)) ||
+        (ring->pending == ADMA_DESC_RING_MAX_REQUESTS)) {
+        return FALSE;
+    }
+
+    ADMA_DESC_RING_REQUEST* request =
+        &ring->request[(ring->oldest + ring->pending) % ADMA_DESC_RING_MAX_REQUESTS];
+    request->first = ring->next;
+    request->count = count;
+    request->context = context;
+
+    *first = ring->next;
+    ring->next = (ring->next + count) % ADMA_DESC_RING_SIZE;
+    ring->used += count;
+    ring->pending++;
+
+    ring->submitted++;
+    if (ring->used > ring->maxUsed) {
+        ring->maxUsed = ring->used;
+    }
+    if (ring->pending > ring->maxPending) {
+        ring->maxPending = ring->pending;
+    }
+    return TRUE;
+}
+
+ULONG AdmaDescRingLastPtr(IN const ADMA_DESC_RING* ring) {
+    return (ring->next + ADMA_DESC_RING_SIZE - 1) % ADMA_DESC_RING_SIZE;
+}
+
+PVOID AdmaDescRingComplete(IN OUT ADMA_DESC_RING* ring, IN OUT volatile UINT32* status) {
+    if (ring->pending == 0) {
+        return NULL;
+    }
+
+    ADMA_DESC_RING_REQUEST* request = &ring->request[ring->oldest];
+    const ULONG last = (request->first + request->count - 1) % ADMA_DESC_RING_SIZE;
+    if (!(status[last] & ADMA_DESC_RING_DONE)) {
+        return NULL;
+    }
+
+    // descriptors complete in order, the whole request is done
+    for (ULONG i = 0; i < request->count; i++) {
+        status[(request->first + i) % ADMA_DESC_RING_SIZE] = 0;
+    }
+
+    PVOID context = request->context;
+    request->context = NULL;
+    ring->used -= request->count;
+    ring->oldest = (ring->oldest + 1) % ADMA_DESC_RING_MAX_REQUESTS;
+    ring->pending--;
+    ring->completed++;
+    return context;
+}
@@ -0,0 +1,97 @@
+/*
+* ADMA Descriptor Ring Accounting
+* ===========
+*
+* Copyright 2018 Qinger Inc.
+*
+* Maintainer:
+* -----------
+* zhuce <qingermaker@sina.com>
+*
+* Description:
+* ------------
+* Bookkeeping of the Arria10 descriptor table when it is used as a ring shared by several
+* requests. The descriptor controller processes descriptors up to the last pointer and writes the
+* done bit of each descriptor's ADMA_RESULT status word. Requests occupy consecutive descriptor
+* ids and are retired in submission order once the status word of their last descriptor is done.
+* There is no WDK dependency, the accounting builds on a Linux host and is exercised against a
+* simulated status writer by exe/adma_ring_sim.
+*
+* References:
+* -----------
+*   [1] ug_a10_pcie_avmm_dma.pdf - Intel Arria 10 or Intel Cyclone10 Avalon-MM DMA Interface for PCIe* Solutions User Guide
+*/
+
+#pragma once
+
+// ========================= include dependencies =================================================
+
+#if defined(_KERNEL_MODE)
+#include <ntddk.h>
+#else // host build
+#include <stddef.h>
+#include <stdint.h>
+typedef void VOID;
+typedef void* PVOID;
+typedef uint8_t BOOLEAN;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef uint32_t ULONG;
+#define IN
+#define OUT
+#define TRUE    (1)
+#define FALSE   (0)
+#endif
+
+// ========================= constants ============================================================
+
+#define ADMA_DESC_RING_SIZE         (128U)  // descriptors in the table, ADMA_MAX_DESCRIPTOR_NUM
+#define ADMA_DESC_RING_CAPACITY     (ADMA_DESC_RING_SIZE - 1U) // a full table is ambiguous to the last pointer
+#define ADMA_DESC_RING_MAX_REQUESTS (4U)    // requests in flight at once
+#define ADMA_DESC_RING_DESC_PER_REQUEST (ADMA_DESC_RING_CAPACITY / ADMA_DESC_RING_MAX_REQUESTS)
+#define ADMA_DESC_RING_DONE         (0x1UL) // done bit of a descriptor status word
+
+// ========================= type declarations ====================================================
+
+/// A request occupying descriptors first .. first+count-1 (modulo ring size)
+typedef struct ADMA_DESC_RING_REQUEST_T {
+    ULONG first;
+    ULONG count;
+    PVOID context;
+} ADMA_DESC_RING_REQUEST;
+
+typedef struct ADMA_DESC_RING_T {
+    ULONG next;         // next free descriptor id
+    ULONG used;         // descriptors owned by hw
+    ULONG oldest;       // request[] index of the oldest request in flight
+    ULONG pending;      // requests in flight
+    ADMA_DESC_RING_REQUEST request[ADMA_DESC_RING_MAX_REQUESTS];
+
+    // statistics
+    UINT64 submitted;   // requests
+    UINT64 completed;   // requests
+    ULONG maxUsed;      // descriptor high water mark
+    ULONG maxPending;   // request high water mark
+} ADMA_DESC_RING;
+
+// ========================= function declarations ================================================
+
+/// Start an empty ring behind the descriptor the last pointer register currently points to.
+/// A last pointer out of range (0xFF after reset) starts the ring at descriptor 0.
+VOID AdmaDescRingInit(OUT ADMA_DESC_RING* ring, IN ULONG lastPtr);
+
+/// Reserve count consecutive descriptors for a request. On success first receives the id of the
+/// first descriptor, the caller fills them and then writes AdmaDescRingLastPtr() to hw.
+/// Fails if the ring lacks free descriptors or request slots.
+BOOLEAN AdmaDescRingSubmit(IN OUT ADMA_DESC_RING* ring, IN ULONG count, IN PVOID context,
+                           OUT ULONG* first);
+
+/// The last pointer covering all submitted descriptors
+ULONG AdmaDescRingLastPtr(IN const ADMA_DESC_RING* ring);
+
+/// Retire the oldest request if the status word of its last descriptor is done. Clears the
+/// status words of its descriptors for reuse and returns its context, NULL if nothing completed.
+PVOID AdmaDescRingComplete(IN OUT ADMA_DESC_RING* ring, IN OUT volatile UINT32* status);
+
+/// Free descriptors
+ULONG AdmaDescRingFree(IN const ADMA_DESC_RING* ring);
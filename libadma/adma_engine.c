@@ -41,9 +41,35 @@ static NTSTATUS EngineCreateDescriptorBuffer(IN OUT ADMA_ENGINE *engine);
 static NTSTATUS EngineCreateRingBuffer(IN ADMA_ENGINE* engine);
 static void EngineConfigureInterrupt(IN OUT ADMA_ENGINE *engine, IN UINT index);
 static void EngineProcessTransfer(IN ADMA_ENGINE *engine);
+static void DumpDescriptor(IN const ADMA_DESCRIPTOR* const desc);
+static ULONG SgListNextRun(IN PSCATTER_GATHER_LIST SgList, IN OUT ULONG *element,
+                           IN OUT ULONG *offset, OUT UINT64 *hostAddr);
+#if defined(ALTERA_ARRIA10)
+static void EngineProcessDescRing(IN ADMA_ENGINE *engine);
+static ADMA_RING_TRANSFER* EngineRingTransfer(IN ADMA_ENGINE *engine,
+                                              IN WDFDMATRANSACTION transaction);
+static BOOLEAN EngineRingProgram(IN ADMA_ENGINE *engine, IN OUT ADMA_RING_TRANSFER *transfer);
+static NTSTATUS EngineCreateLiteBuffer(IN OUT ADMA_ENGINE *engine);
+static ADMA_LITE_SLOT* EngineLiteSlot(IN ADMA_ENGINE *engine, IN PVOID context);
+static void EngineLiteComplete(IN ADMA_ENGINE *engine, IN ADMA_LITE_SLOT *slot);
+#endif
 static UINT EngineProcessRing(IN ADMA_ENGINE *engine);
 static void EngineRingAdvance(UINT* index);
 static NTSTATUS EngineCreatePollWriteBackBuffer(IN OUT ADMA_ENGINE *engine);
+static void EngineCountCompletion(IN ADMA_ENGINE *engine, IN LONGLONG start, IN size_t bytes);
+static void EngineSamplePerf(IN ADMA_ENGINE *engine, IN UINT64 bytes, IN UINT64 transfers,
+                             IN LONGLONG start);
+#if !defined(ALTERA_ARRIA10)
+static void EngineA2pInit(IN OUT ADMA_ENGINE *engine, IN ULONG engineIndex);
+static UINT32 EngineA2pMap(IN ADMA_ENGINE *engine, IN UINT64 hostAddr, OUT UINT64 *windowBytes);
+static NTSTATUS EngineCreatePrefetchBuffer(IN OUT ADMA_ENGINE *engine);
+static void EngineDrain(IN ADMA_ENGINE *engine);
+static void EnginePrefetchKick(IN ADMA_ENGINE *engine, IN BOOLEAN last);
+static void EngineDispatchFlush(IN ADMA_ENGINE *engine, IN UINT32 control);
+static void EngineDispatchReset(IN ADMA_ENGINE *engine);
+static void EngineCollectResponses(IN ADMA_ENGINE *engine);
+static void EngineProcessResponses(IN ADMA_ENGINE *engine);
+#endif
 
 // Mark these functions as pageable code
 #ifdef ALLOC_PRAGMA
@@ -82,10 +108,10 @@ static NTSTATUS EngineCreateDescriptorBuffer(IN OUT ADMA_ENGINE *engine) {
     //engine->sgdma->firstDescAdj = 0; // depends on transfer - set later in ProgramDMA
 
 	if (engine->dir == H2C) {
-		engine->sgdma->epDescFifoLo = ADMA_RD_DTS_ADDR;
+		engine->sgdma->epDescFifoLo = ADMA_RD_DTS_ADDR + engine->channel * ADMA_DTS_CHANNEL_OFFSET;
 		engine->sgdma->epDescFifoHi = 0;
 	} else {
-		engine->sgdma->epDescFifoLo = ADMA_WR_DTS_ADDR;
+		engine->sgdma->epDescFifoLo = ADMA_WR_DTS_ADDR + engine->channel * ADMA_DTS_CHANNEL_OFFSET;
 		engine->sgdma->epDescFifoHi = 0;
 	}
 
@@ -204,6 +230,151 @@ static void EngineProcessTransfer(IN ADMA_ENGINE *engine)
 #endif
 }
 
+#if defined(ALTERA_ARRIA10)
+static void EngineProcessDescRing(IN ADMA_ENGINE *engine)
+// retire the requests whose last descriptor the descriptor controller has marked done, in order
+{
+    ADMA_RESULT* results = (ADMA_RESULT*)WdfCommonBufferGetAlignedVirtualAddress(engine->descBuffer);
+
+    for (;;) {
+        WdfSpinLockAcquire(engine->descRingLock);
+        PVOID context = AdmaDescRingComplete(&engine->descRing, results->status);
+        ADMA_LITE_SLOT *slot = EngineLiteSlot(engine, context);
+        ADMA_RING_TRANSFER *transfer = (slot == NULL) ? (ADMA_RING_TRANSFER*)context : NULL;
+        if ((transfer != NULL) && (transfer->element < transfer->sgList->NumberOfElements)) {
+            // more of the scatter/gather list to go, the part just retired made room for it
+            BOOLEAN programmed = EngineRingProgram(engine, transfer);
+            WdfSpinLockRelease(engine->descRingLock);
+            if (!programmed) {
+                NTSTATUS status = STATUS_SUCCESS;
+                WDFREQUEST request = WdfDmaTransactionGetRequest(transfer->transaction);
+                WdfDmaTransactionDmaCompletedFinal(transfer->transaction, 0, &status);
+                WdfDmaTransactionRelease(transfer->transaction);
+                EngineReleaseTransaction(engine, transfer->transaction);
+                WdfRequestComplete(request, STATUS_INSUFFICIENT_RESOURCES);
+            }
+            continue;
+        }
+        WdfSpinLockRelease(engine->descRingLock);
+        if (slot != NULL) { // small transfer through the lite buffer
+            EngineLiteComplete(engine, slot);
+            continue;
+        }
+        if (transfer == NULL) {
+            break;
+        }
+
+        // for a split transaction this programs the next fragment via ADMA_EngineProgramDma
+        WDFDMATRANSACTION transaction = transfer->transaction;
+        NTSTATUS status = STATUS_SUCCESS;
+        WDFREQUEST request = WdfDmaTransactionGetRequest(transaction);
+        BOOLEAN completed = WdfDmaTransactionDmaCompleted(transaction, &status);
+        if (completed) {
+            size_t bytesTransferred = WdfDmaTransactionGetBytesTransferred(transaction);
+            TraceInfo(DBG_DMA, "%s_%u request %p complete, bytesTransferred=%llu",
+                      DirectionToString(engine->dir), engine->channel, request, bytesTransferred);
+            EngineCountCompletion(engine, transfer->start, bytesTransferred);
+            if (bytesTransferred <= ADMA_LITE_SLOT_SIZE) { // could have taken the lite path
+                LONGLONG now = KeQueryPerformanceCounter(NULL).QuadPart;
+                InterlockedIncrement64((volatile LONG64*)&engine->lite.stats.fullTransfers);
+                InterlockedAdd64((volatile LONG64*)&engine->lite.stats.fullLatencyTicks,
+                                 now - transfer->arrival);
+            }
+            WdfDmaTransactionRelease(transaction);
+            EngineReleaseTransaction(engine, transaction); // before the queue presents a new one
+            WdfRequestCompleteWithInformation(request, status, bytesTransferred);
+        }
+    }
+}
+#endif
+
+WDFDMATRANSACTION EngineAcquireTransaction(IN ADMA_ENGINE *engine) {
+    for (ULONG i = 0; i < ADMA_DESC_RING_MAX_REQUESTS; i++) {
+        if (InterlockedCompareExchange(&engine->transactionBusy[i], 1, 0) == 0) {
+            engine->ringTransfers[i].arrival = KeQueryPerformanceCounter(NULL).QuadPart;
+            return engine->transactions[i];
+        }
+    }
+    return NULL;
+}
+
+VOID EngineReleaseTransaction(IN ADMA_ENGINE *engine, IN WDFDMATRANSACTION transaction) {
+    for (ULONG i = 0; i < ADMA_DESC_RING_MAX_REQUESTS; i++) {
+        if (engine->transactions[i] == transaction) {
+            InterlockedExchange(&engine->transactionBusy[i], 0);
+            return;
+        }
+    }
+}
+
+#if defined(ALTERA_ARRIA10)
+static ADMA_RING_TRANSFER* EngineRingTransfer(IN ADMA_ENGINE *engine,
+                                              IN WDFDMATRANSACTION transaction) {
+    for (ULONG i = 0; i < ADMA_DESC_RING_MAX_REQUESTS; i++) {
+        if (engine->ringTransfers[i].transaction == transaction) {
+            return &engine->ringTransfers[i];
+        }
+    }
+    return NULL;
+}
+
+static BOOLEAN EngineRingProgram(IN ADMA_ENGINE *engine, IN OUT ADMA_RING_TRANSFER *transfer)
+// put the next part of a transfer onto the descriptor ring, called with descRingLock held
+{
+    ADMA_DESCRIPTOR *descriptor = (ADMA_DESCRIPTOR*)((PUCHAR)WdfCommonBufferGetAlignedVirtualAddress(engine->descBuffer) + ADMA_DESCRIPTOR_OFFSET);
+
+    // the descriptors of a part are claimed at once, so count them first
+    ULONG element = transfer->element;
+    ULONG offset = transfer->offset;
+    UINT64 hostAddr;
+    ULONG count = 0;
+    while ((count < ADMA_DESC_RING_DESC_PER_REQUEST) &&
+           (SgListNextRun(transfer->sgList, &element, &offset, &hostAddr) != 0)) {
+        count++;
+    }
+
+    ULONG first;
+    if (!AdmaDescRingSubmit(&engine->descRing, count, transfer, &first)) {
+        TraceError(DBG_DMA, "%s_%u no room for %u descriptors (%u free)",
+                   DirectionToString(engine->dir), engine->channel, count,
+                   AdmaDescRingFree(&engine->descRing));
+        return FALSE;
+    }
+
+    for (ULONG i = 0; i < count; i++) {
+        ULONG id = (first + i) % ADMA_MAX_DESCRIPTOR_NUM;
+        ULONG length = SgListNextRun(transfer->sgList, &transfer->element, &transfer->offset,
+                                     &hostAddr);
+        descriptor[id].control = LIMIT_TO_32((id << ADMA_DESCRIPTOR_ID_SHIFT) | (length / sizeof(UINT32)));
+        if (transfer->toDevice) {
+            // source is host memory
+            descriptor[id].srcAddrLo = LIMIT_TO_32(hostAddr);
+            descriptor[id].srcAddrHi = LIMIT_TO_32(hostAddr >> 32);
+            descriptor[id].dstAddrLo = LIMIT_TO_32(transfer->deviceOffset);
+            descriptor[id].dstAddrHi = LIMIT_TO_32(transfer->deviceOffset >> 32);
+        } else {
+            // destination is host memory
+            descriptor[id].srcAddrLo = LIMIT_TO_32(transfer->deviceOffset);
+            descriptor[id].srcAddrHi = LIMIT_TO_32(transfer->deviceOffset >> 32);
+            descriptor[id].dstAddrLo = LIMIT_TO_32(hostAddr);
+            descriptor[id].dstAddrHi = LIMIT_TO_32(hostAddr >> 32);
+        }
+        transfer->deviceOffset += length;
+        DumpDescriptor(&(descriptor[id]));
+    }
+    MemoryBarrier();
+
+    if ((first + count) > ADMA_MAX_DESCRIPTOR_NUM) {
+        // the controller only wraps around after it was pointed at the end of the table
+        engine->sgdma->dmaLastPtr = ADMA_MAX_DESCRIPTOR_NUM - 1;
+    }
+    engine->sgdma->dmaLastPtr = AdmaDescRingLastPtr(&engine->descRing);
+    engine->programStats.descriptors += count;
+    engine->programStats.doorbells++;
+    return TRUE;
+}
+#endif
+
 static void DumpDescriptor(IN const ADMA_DESCRIPTOR* const desc) {
 #if 0
 #if DBG
@@ -312,17 +483,56 @@ static void OptimizeDescriptors(IN ADMA_ENGINE *engine, IN ADMA_DESCRIPTOR * con
 #endif
 }
 
-static BOOLEAN EngineExists(PADMA_DEVICE adma, DirToDev dir, ULONG channel) {
+static ULONG EngineRegOffset(PADMA_DEVICE adma, DirToDev dir, ULONG channel)
+// offset of the engine's register block in the config bar
+{
+#if defined(ALTERA_ARRIA10)
+    UNREFERENCED_PARAMETER(adma);
+    return (dir * BLOCK_OFFSET) + (channel * ENGINE_OFFSET) + SGDMA_BLOCK_OFFSET;
+#else
+    UNREFERENCED_PARAMETER(dir); // both directions are served by the channel's dispatcher
+    return channel * adma->channelStride;
+#endif
+}
+
+static BOOLEAN EngineExists(PADMA_DEVICE adma, DirToDev dir, ULONG channel)
+// check a channel configured by NUM_CHANNELS against the mapped bar. the arria10 descriptor
+// controller also has to read back a written pattern, the dispatcher csr has no register which
+// could tell it apart from a hole in the avalon address map
+{
+    const ULONG offset = EngineRegOffset(adma, dir, channel);
+    if (channel == 0) {
+        return TRUE; // always there, the bar may be mapped shorter than the register map
+    }
+#if defined(ALTERA_ARRIA10)
+    if ((offset + sizeof(ADMA_SGDMA_REGS)) > adma->barLength[adma->configBarIdx]) {
+        return FALSE;
+    }
     PUCHAR configBarAddr = (PUCHAR)adma->bar[adma->configBarIdx];
-    const ULONG offset = (dir * BLOCK_OFFSET) + (channel * ENGINE_OFFSET);
-    ADMA_ENGINE_REGS* engineRegs = (ADMA_ENGINE_REGS*)(configBarAddr + offset);
-    UINT32 engineID = engineRegs->identifier;
-    return (engineID & ADMA_ID_MASK) == ADMA_ID;
+    volatile ADMA_SGDMA_REGS* sgdma = (ADMA_SGDMA_REGS*)(configBarAddr + offset);
+    const UINT32 pattern = 0xA5A5A5A5UL;
+    sgdma->rcStatusDescHi = pattern;
+    BOOLEAN exists = (sgdma->rcStatusDescHi == pattern);
+    sgdma->rcStatusDescHi = 0;
+    return exists;
+#else
+    // the csr, descriptor, prefetcher and response blocks of the channel all have to be mapped
+    const size_t end = max(max(MODULAR_SGDMA_CSR_REG_OFFSET + sizeof(ADMA_MODULAR_SGDMA_CSR),
+                               MODULAR_SGDMA_DESCRIPTOR_REG_OFFSET +
+                               sizeof(ADMA_MODULAR_SGDMA_EXTEND_DESCRIPTOR)),
+                           max(MODULAR_SGDMA_PREFETCHER_REG_OFFSET +
+                               sizeof(ADMA_MODULAR_SGDMA_PREFETCHER),
+                               MODULAR_SGDMA_RESPONSE_REG_OFFSET +
+                               sizeof(ADMA_MODULAR_SGDMA_RESPONSE)));
+    if ((offset + end) > adma->barLength[adma->configBarIdx]) {
+        return FALSE;
+    }
+    return TRUE;
+#endif
 }
 
 static NTSTATUS EngineCreate(PADMA_DEVICE adma, ADMA_ENGINE* engine, DirToDev dir, ULONG channel,
                              ULONG engineIndex) {
-	UNREFERENCED_PARAMETER(engineIndex);
     NTSTATUS status;
 
     engine->parentDevice = adma;
@@ -330,15 +540,18 @@ static NTSTATUS EngineCreate(PADMA_DEVICE adma, ADMA_ENGINE* engine, DirToDev di
     engine->dir = dir;
     PUCHAR configBarAddr = (PUCHAR)adma->bar[adma->configBarIdx];
     //engine->regs = (ADMA_ENGINE_REGS*)(configBarAddr + offset);//currently not use for adma
+	const ULONG offset = EngineRegOffset(adma, dir, channel);
+    engine->dispatcher = &adma->dispatchers[channel];
 #if defined(ALTERA_ARRIA10)
-	const ULONG offset = (dir * BLOCK_OFFSET) + (channel * ENGINE_OFFSET);//for adma engine num is 1, ENGINE_OFFSET has no effect
-    engine->sgdma = (ADMA_SGDMA_REGS*)(configBarAddr + offset + SGDMA_BLOCK_OFFSET);
+    UNREFERENCED_PARAMETER(engineIndex); // the a2p windows are only set up for the dispatcher
+    engine->sgdma = (ADMA_SGDMA_REGS*)(configBarAddr + offset);
 #else
 	//only one dir c2h,
-	const ULONG offset = 0;// ((1 - dir) * BLOCK_OFFSET) + (channel * ENGINE_OFFSET);//for adma engine num is 1, ENGINE_OFFSET has no effect
 	engine->modSgdmaCsr = (ADMA_MODULAR_SGDMA_CSR*)(configBarAddr + offset + MODULAR_SGDMA_CSR_REG_OFFSET);
 	engine->modSgdmaStdDes = (ADMA_MODULAR_SGDMA_STANDARD_DESCRIPTOR*)(configBarAddr + offset + MODULAR_SGDMA_DESCRIPTOR_REG_OFFSET);
 	engine->modSgdmaResponse = (ADMA_MODULAR_SGDMA_RESPONSE*)(configBarAddr + offset + MODULAR_SGDMA_RESPONSE_REG_OFFSET);
+	engine->modSgdmaPrefetcher = (ADMA_MODULAR_SGDMA_PREFETCHER*)(configBarAddr + offset + MODULAR_SGDMA_PREFETCHER_REG_OFFSET);
+	engine->dispatcher->csrControl = engine->modSgdmaCsr->control; // read at probe, the driver owns the register from here
 #endif
     // AXI-MM or AXI-ST? 0 = MM, 1 = ST
     //engine->type = (engine->regs->identifier & ADMA_ID_ST_BIT) != 0;
@@ -360,6 +573,28 @@ static NTSTATUS EngineCreate(PADMA_DEVICE adma, ADMA_ENGINE* engine, DirToDev di
 #endif
     // capture alignment requirements
     //EngineGetAlignments(engine);//comment by zc, adma hasn't this feature
+#if !defined(ALTERA_ARRIA10)
+    // the dispatcher reaches host memory through the a2p translation table
+    EngineA2pInit(engine, engineIndex);
+
+    // host side descriptor list, only used in prefetcher mode
+    status = EngineCreatePrefetchBuffer(engine);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "EngineCreatePrefetchBuffer() failed: %!STATUS!", status);
+        return status;
+    }
+#endif
+    engine->dispatcher->descMode = ADMA_DESC_MODE_DISPATCHER;
+    LARGE_INTEGER frequency;
+    KeQueryPerformanceCounter(&frequency);
+    engine->programStats.tickFrequency = frequency.QuadPart;
+    engine->pollStats.tickFrequency = frequency.QuadPart;
+    engine->pollStats.budgetUs = engine->pollBudgetUs = ADMA_POLL_DEFAULT_BUDGET_US;
+    status = WdfSpinLockCreate(WDF_NO_OBJECT_ATTRIBUTES, &engine->perf.lock);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "WdfSpinLockCreate failed: %!STATUS!", status);
+        return status;
+    }
 #if defined(ALTERA_ARRIA10)
     // create and bind dma desciptor buffer to hw
     status = EngineCreateDescriptorBuffer(engine);
@@ -376,6 +611,35 @@ static NTSTATUS EngineCreate(PADMA_DEVICE adma, ADMA_ENGINE* engine, DirToDev di
         TraceError(DBG_INIT, "WdfDmaTransactionCreate() failed: %!STATUS!", status);
         return status;
     }
+#if defined(ALTERA_ARRIA10)
+    // several requests share the descriptor table, each needs a transaction of its own
+    for (ULONG i = 0; i < ADMA_DESC_RING_MAX_REQUESTS; i++) {
+        status = WdfDmaTransactionCreate(adma->dmaEnabler, WDF_NO_OBJECT_ATTRIBUTES,
+                                         &engine->transactions[i]);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_INIT, "WdfDmaTransactionCreate() failed: %!STATUS!", status);
+            return status;
+        }
+        engine->transactionBusy[i] = 0;
+        engine->ringTransfers[i].transaction = engine->transactions[i];
+    }
+    status = WdfSpinLockCreate(WDF_NO_OBJECT_ATTRIBUTES, &engine->descRingLock);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "WdfSpinLockCreate failed: %!STATUS!", status);
+        return status;
+    }
+    AdmaDescRingInit(&engine->descRing, engine->sgdma->dmaLastPtr);
+    engine->work = EngineProcessDescRing;
+
+    // pre-mapped slots for small transfers, unused until a threshold is set
+    status = EngineCreateLiteBuffer(engine);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "EngineCreateLiteBuffer() failed: %!STATUS!", status);
+        return status;
+    }
+#else
+    engine->work = EngineProcessResponses;
+#endif
 #if 0
     if ((engine->type == EngineType_ST) && (engine->dir == C2H)) {
         engine->work = EngineProcessRing;
@@ -446,12 +710,416 @@ static UINT32 EngineStatus(IN ADMA_ENGINE *engine, IN BOOLEAN clear)
     return status;
 }
 
+// ========================= address translation ==================================================
+
+#if !defined(ALTERA_ARRIA10)
+static void EngineA2pInit(IN OUT ADMA_ENGINE *engine, IN ULONG engineIndex)
+// give the engine its own slice of the a2p translation table
+{
+    PADMA_DEVICE adma = engine->parentDevice;
+    ADMA_A2P_WINDOWS *a2p = &engine->a2p;
+
+    RtlZeroMemory(a2p, sizeof(*a2p));
+    a2p->windowSize = (UINT64)(UINT32)(~adma->a2pMask) + 1;
+
+    ULONG first;
+    const ULONG numEngines = ADMA_NUM_DIRECTIONS * adma->numChannels;
+    ULONG perEngine = adma->a2pNumEntries / numEngines;
+    if (perEngine == 0) {
+        // not enough entries to separate the engines, traffic of different engines will
+        // evict each others windows
+        TraceWarning(DBG_INIT, "%s_%u only %u a2p entries for %u engines, sharing entries",
+                     DirectionToString(engine->dir), engine->channel, adma->a2pNumEntries,
+                     numEngines);
+        perEngine = 1;
+        first = engineIndex % adma->a2pNumEntries;
+    } else {
+        first = engineIndex * perEngine;
+    }
+    a2p->numWindows = min(perEngine, ADMA_A2P_MAX_WINDOWS);
+    for (ULONG i = 0; i < a2p->numWindows; i++) {
+        a2p->window[i].entry = first + i;
+    }
+
+    a2p->stats.numWindows = a2p->numWindows;
+    a2p->stats.windowSize = (UINT32)a2p->windowSize;
+    TraceInfo(DBG_INIT, "%s_%u a2p entries %u-%u, window size 0x%llx",
+              DirectionToString(engine->dir), engine->channel, first,
+              first + a2p->numWindows - 1, a2p->windowSize);
+}
+
+static BOOLEAN EngineIsIdle(IN ADMA_ENGINE *engine)
+// no descriptor queued in or fetched by the engine
+{
+    UINT32 status = engine->modSgdmaCsr->status;
+    if (!(status & CSR_DESCRIPTOR_BUFFER_EMPTY_MASK) || (status & CSR_BUSY_MASK)) {
+        return FALSE;
+    }
+    if ((engine->dispatcher->descMode == ADMA_DESC_MODE_PREFETCHER) &&
+        (engine->modSgdmaPrefetcher->control & PREFETCHER_CONTROL_RUN_MASK)) {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void EngineDrain(IN ADMA_ENGINE *engine)
+// hand over pending descriptors and wait until the engine has consumed all of them. afterwards
+// no a2p window and no prefetch descriptor is referenced by hw any more.
+{
+    if (engine->dispatcher->descMode == ADMA_DESC_MODE_PREFETCHER) {
+        EnginePrefetchKick(engine, FALSE);
+    } else {
+        EngineDispatchFlush(engine, 0);
+    }
+    ULONG us = 0;
+    while (!EngineIsIdle(engine) && (us < ADMA_A2P_DRAIN_TIMEOUT_US)) {
+        EngineCollectResponses(engine);
+        KeStallExecutionProcessor(1);
+        us++;
+    }
+    if (us == ADMA_A2P_DRAIN_TIMEOUT_US) {
+        TraceError(DBG_DMA, "%s_%u timeout waiting for engine to drain (status=0x%08x)",
+                   DirectionToString(engine->dir), engine->channel, engine->modSgdmaCsr->status);
+    }
+    EngineCollectResponses(engine);
+    engine->a2p.generation++;
+    engine->prefetch.first = 0;
+    engine->prefetch.count = 0;
+    engine->prefetch.done = 0;
+}
+
+static UINT32 EngineA2pMap(IN ADMA_ENGINE *engine, IN UINT64 hostAddr, OUT UINT64 *windowBytes)
+// map a host bus address into one of the engines windows and return its avalon address.
+// windowBytes receives the number of bytes left in the window from hostAddr on.
+{
+    PADMA_DEVICE adma = engine->parentDevice;
+    ADMA_A2P_WINDOWS *a2p = &engine->a2p;
+    const UINT64 base = hostAddr & ~(a2p->windowSize - 1);
+    ADMA_A2P_WINDOW *window = NULL;
+
+    for (ULONG i = 0; i < a2p->numWindows; i++) {
+        ADMA_A2P_WINDOW *candidate = &a2p->window[i];
+        if (candidate->valid && (candidate->base == base)) {
+            window = candidate;
+            break;
+        }
+        // prefer unused windows, then the least recently used one
+        if ((window == NULL) || (window->valid &&
+            (!candidate->valid || ((LONG)(candidate->lastUse - window->lastUse) < 0)))) {
+            window = candidate;
+        }
+    }
+
+    if (window->valid && (window->base == base)) {
+        a2p->stats.hits++;
+    } else {
+        a2p->stats.misses++;
+        if (window->valid && (window->generation == a2p->generation)) {
+            // the lru window is in use by this transfer, hence all of them are. descriptors
+            // already queued must complete before an entry may be remapped
+            a2p->stats.drains++;
+            EngineDrain(engine);
+        }
+        volatile ADMA_A2P_ENTRY *entry = &adma->a2pTransTbl->entry[window->entry];
+        entry->a2pAddrLo = (LIMIT_TO_32(base) & adma->a2pMask) | ADMA_A2P_ADDR_SPACE_64;
+        entry->a2pAddrHi = LIMIT_TO_32(base >> 32);
+        window->base = base;
+        window->valid = TRUE;
+        TraceVerbose(DBG_DMA, "%s_%u a2p entry %u -> 0x%llx",
+                     DirectionToString(engine->dir), engine->channel, window->entry, base);
+    }
+    window->lastUse = ++a2p->clock;
+    window->generation = a2p->generation;
+
+    *windowBytes = a2p->windowSize - (hostAddr - base);
+    return LIMIT_TO_32(ADMA_A2P_TXS_BASE + (window->entry * a2p->windowSize) + (hostAddr - base));
+}
+
+// ========================= descriptor delivery ==================================================
+
+static NTSTATUS EngineCreatePrefetchBuffer(IN OUT ADMA_ENGINE *engine) {
+    size_t bufferSize = (ADMA_PREFETCH_NUM_DESC + 1) * sizeof(ADMA_MODULAR_SGDMA_PREFETCH_DESCRIPTOR);
+    NTSTATUS status = WdfCommonBufferCreate(engine->parentDevice->dmaEnabler, bufferSize,
+                                            WDF_NO_OBJECT_ATTRIBUTES, &engine->prefetch.buffer);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "WdfCommonBufferCreate failed: %!STATUS!", status);
+        return status;
+    }
+    engine->prefetch.desc = (ADMA_MODULAR_SGDMA_PREFETCH_DESCRIPTOR*)
+        WdfCommonBufferGetAlignedVirtualAddress(engine->prefetch.buffer);
+    RtlZeroMemory(engine->prefetch.desc, bufferSize);
+    return status;
+}
+
+static void EnginePrefetchKick(IN ADMA_ENGINE *engine, IN BOOLEAN last)
+// hand the descriptors built since the last kick to the prefetcher, the last kick of a transfer
+// requests the interrupt
+{
+    ADMA_PREFETCH *prefetch = &engine->prefetch;
+    if (prefetch->count == prefetch->first) {
+        return;
+    }
+
+    // the chain ends at the first descriptor not owned by hw
+    prefetch->desc[prefetch->count].control = 0;
+    if (last) {
+        prefetch->desc[prefetch->count - 1].control |= DESCRIPTOR_CONTROL_TRANSFER_COMPLETE_IRQ_MASK;
+    }
+    MemoryBarrier();
+
+    UINT32 head = prefetch->avalonBase +
+        (prefetch->first * sizeof(ADMA_MODULAR_SGDMA_PREFETCH_DESCRIPTOR));
+    engine->modSgdmaPrefetcher->nextDescLo = head;
+    engine->modSgdmaPrefetcher->nextDescHi = 0;
+    engine->modSgdmaPrefetcher->control = PREFETCHER_CONTROL_RUN_MASK |
+                                          PREFETCHER_CONTROL_GLOBAL_INT_EN_MASK;
+    engine->programStats.doorbells++;
+    TraceVerbose(DBG_DMA, "%s_%u prefetch descriptors %u-%u, head=0x%08x",
+                 DirectionToString(engine->dir), engine->channel, prefetch->first,
+                 prefetch->count - 1, head);
+
+    prefetch->first = prefetch->count;
+}
+
+static void EngineDispatchFlush(IN ADMA_ENGINE *engine, IN UINT32 control)
+// write the held back descriptor into the dispatcher
+{
+    if (!engine->dispatchHeld) {
+        return;
+    }
+    engine->dispatchHeld = FALSE;
+    if (engine->responseErrors & ADMA_RESPONSE_DISPATCH_TIMEOUT) {
+        engine->numDescriptors--; // the transfer failed already, drop the rest of it
+        return;
+    }
+
+    // a fragment is cut at ADMA_DESC_FIFO_DEPTH descriptors so it fits into the fifo, a full one
+    // means the dispatcher does not make progress
+    ULONG us = 0;
+    while ((engine->modSgdmaCsr->status & CSR_DESCRIPTOR_BUFFER_FULL_MASK) &&
+           (us < ADMA_DESC_FIFO_TIMEOUT_US)) {
+        EngineCollectResponses(engine); // a full response fifo would stall the dispatcher
+        KeStallExecutionProcessor(1);
+        us++;
+    }
+    if (us == ADMA_DESC_FIFO_TIMEOUT_US) {
+        // writing into the full fifo would lose the descriptor and its response never arrives
+        TraceError(DBG_DMA, "%s_%u timeout waiting for descriptor fifo (status=0x%08x)",
+                   DirectionToString(engine->dir), engine->channel,
+                   engine->modSgdmaCsr->status);
+        engine->responseErrors |= ADMA_RESPONSE_DISPATCH_TIMEOUT;
+        engine->numDescriptors--;
+        return;
+    }
+    engine->modSgdmaStdDes->readAddress = engine->held.readAddress;
+    engine->modSgdmaStdDes->writeAddress = engine->held.writeAddress;
+    engine->modSgdmaStdDes->transferLength = engine->held.transferLength;
+    engine->modSgdmaStdDes->control = DESCRIPTOR_CONTROL_GO_MASK | control;
+    engine->programStats.doorbells++;
+}
+
+static void EngineDispatchReset(IN ADMA_ENGINE *engine)
+// discard the descriptors of a failed transfer still queued in the dispatcher
+{
+    engine->modSgdmaCsr->control = engine->dispatcher->csrControl | CSR_RESET_MASK;
+    ULONG us = 0;
+    while ((engine->modSgdmaCsr->status & CSR_RESET_STATE_MASK) &&
+           (us < ADMA_DESC_FIFO_TIMEOUT_US)) {
+        KeStallExecutionProcessor(1);
+        us++;
+    }
+    engine->modSgdmaCsr->control = engine->dispatcher->csrControl; // the reset clears the interrupt enable
+    engine->numResponses = engine->numDescriptors; // none of the written ones answers any more
+    TraceError(DBG_DMA, "%s_%u dispatcher reset (status=0x%08x)",
+               DirectionToString(engine->dir), engine->channel, engine->modSgdmaCsr->status);
+}
+
+static void EngineQueueDescriptor(IN ADMA_ENGINE *engine, IN UINT32 readAddress,
+                                  IN UINT32 writeAddress, IN ULONG length)
+// deliver one descriptor either directly to the dispatcher or into the host side list
+{
+    engine->programStats.descriptors++;
+    engine->numDescriptors++;
+
+    if (engine->dispatcher->descMode == ADMA_DESC_MODE_PREFETCHER) {
+        ADMA_PREFETCH *prefetch = &engine->prefetch;
+        if (prefetch->count == ADMA_PREFETCH_NUM_DESC) { // list full
+            EngineDrain(engine);
+        }
+        ULONG index = prefetch->count++;
+        ADMA_MODULAR_SGDMA_PREFETCH_DESCRIPTOR *desc = &prefetch->desc[index];
+        desc->readAddress = readAddress;
+        desc->writeAddress = writeAddress;
+        desc->transferLength = length;
+        desc->nextDescPtr = prefetch->avalonBase +
+            ((index + 1) * sizeof(ADMA_MODULAR_SGDMA_PREFETCH_DESCRIPTOR));
+        desc->actualBytesTransferred = 0;
+        desc->status = 0;
+        desc->control = DESCRIPTOR_CONTROL_OWNED_BY_HW_MASK | DESCRIPTOR_CONTROL_GO_MASK;
+    } else {
+        // one descriptor is held back, only the last one of a transfer requests the interrupt
+        EngineDispatchFlush(engine, 0);
+        engine->held.readAddress = readAddress;
+        engine->held.writeAddress = writeAddress;
+        engine->held.transferLength = length;
+        engine->dispatchHeld = TRUE;
+    }
+}
+
+static void EngineCollectResponses(IN ADMA_ENGINE *engine)
+// count the descriptors hw has answered, from the response fifo in dispatcher mode or from the
+// write back into the host side list in prefetcher mode
+{
+    if (engine->dispatcher->descMode == ADMA_DESC_MODE_PREFETCHER) {
+        ADMA_PREFETCH *prefetch = &engine->prefetch;
+        while ((prefetch->done < prefetch->first) &&
+               !(prefetch->desc[prefetch->done].control & DESCRIPTOR_CONTROL_OWNED_BY_HW_MASK)) {
+            engine->responseErrors |= prefetch->desc[prefetch->done].status;
+            engine->numResponses++;
+            prefetch->done++;
+        }
+        return;
+    }
+    while (!(engine->modSgdmaCsr->status & CSR_RESPONSE_BUFFER_EMPTY_MASK)) {
+        (void)engine->modSgdmaResponse->actualBytesTransferred;
+        engine->responseErrors |= engine->modSgdmaResponse->status; // reading the status pops
+        engine->numResponses++;
+    }
+}
+
+static void EngineCompleteRequest(IN ADMA_ENGINE *engine, IN WDFREQUEST request, IN NTSTATUS status)
+// hand the request of the finished transaction back, unless EvtCancelDma has taken it
+{
+    size_t bytesTransferred = WdfDmaTransactionGetBytesTransferred(engine->dmaTransaction);
+    TraceInfo(DBG_DMA, "%s_%u request %p complete, bytesTransferred=%llu",
+              DirectionToString(engine->dir), engine->channel, request, bytesTransferred);
+    if (NT_SUCCESS(status)) {
+        EngineCountCompletion(engine, engine->transferStart, bytesTransferred);
+    }
+    if (WdfRequestUnmarkCancelable(request) == STATUS_CANCELLED) {
+        return; // EvtCancelDma completes it
+    }
+    WdfDmaTransactionRelease(engine->dmaTransaction);
+    WdfRequestCompleteWithInformation(request, status, bytesTransferred);
+}
+
+BOOLEAN EngineCompleteProgramError(IN ADMA_ENGINE *engine) {
+    // the caller of WdfDmaTransactionExecute and the dpc both look, only one takes it
+    if (InterlockedExchange(&engine->programFailed, 0) == 0) {
+        return FALSE;
+    }
+    EngineCompleteRequest(engine, WdfDmaTransactionGetRequest(engine->dmaTransaction),
+                          STATUS_IO_DEVICE_ERROR);
+    return TRUE;
+}
+
+static void EngineProcessResponses(IN ADMA_ENGINE *engine)
+// complete the transfer once every descriptor of it was answered. called by the dpc and by the
+// poll loop
+{
+    if (!engine->transferPending) {
+        return; // still being programmed, its interrupt stays pending until then
+    }
+    if (InterlockedCompareExchange(&engine->serviceBusy, 1, 0) != 0) {
+        return; // the other caller is at it
+    }
+    EngineCollectResponses(engine);
+    if (engine->numResponses < engine->numDescriptors) {
+        InterlockedExchange(&engine->serviceBusy, 0);
+        return;
+    }
+    engine->transferPending = FALSE;
+    engine->modSgdmaCsr->status = CSR_IRQ_SET_MASK; // acknowledge the interrupt
+    InterlockedExchange(&engine->serviceBusy, 0);
+
+    // for a split transaction this programs the next fragment via ADMA_EngineProgramDma
+    NTSTATUS status = STATUS_SUCCESS;
+    WDFREQUEST request = WdfDmaTransactionGetRequest(engine->dmaTransaction);
+    BOOLEAN completed;
+    if (engine->responseErrors) {
+        TraceError(DBG_DMA, "%s_%u transfer failed, response status 0x%08x",
+                   DirectionToString(engine->dir), engine->channel, engine->responseErrors);
+        completed = WdfDmaTransactionDmaCompletedFinal(engine->dmaTransaction, 0, &status);
+        status = STATUS_IO_DEVICE_ERROR;
+    } else if (engine->fragmentShort) {
+        // the framework maps the rest of the sg list as the next fragment
+        completed = WdfDmaTransactionDmaCompletedWithLength(engine->dmaTransaction,
+                                                            engine->fragmentBytes, &status);
+    } else {
+        completed = WdfDmaTransactionDmaCompleted(engine->dmaTransaction, &status);
+    }
+    if (EngineCompleteProgramError(engine)) {
+        return; // programming the next fragment failed
+    }
+    if (completed) {
+        EngineCompleteRequest(engine, request, status);
+    }
+}
+#endif
+
+static void EngineCountCompletion(IN ADMA_ENGINE *engine, IN LONGLONG start, IN size_t bytes) {
+    LONGLONG now = KeQueryPerformanceCounter(NULL).QuadPart;
+    InterlockedIncrement64((volatile LONG64*)&engine->pollStats.completed);
+    InterlockedAdd64((volatile LONG64*)&engine->pollStats.latencyTicks, now - start);
+    EngineSamplePerf(engine, bytes, 1, start);
+}
+
+void EngineGetA2pStats(IN ADMA_ENGINE* engine, OUT ADMA_A2P_STATS* stats) {
+    ASSERTMSG("argument engine is NULL!", engine != NULL);
+    ASSERTMSG("argument stats is NULL!", stats != NULL);
+
+    *stats = engine->a2p.stats;
+}
+
+void EngineGetProgramStats(IN ADMA_ENGINE* engine, OUT ADMA_PROGRAM_STATS* stats) {
+    ASSERTMSG("argument engine is NULL!", engine != NULL);
+    ASSERTMSG("argument stats is NULL!", stats != NULL);
+
+    *stats = engine->programStats;
+}
+
+void EngineGetPollStats(IN ADMA_ENGINE* engine, OUT ADMA_POLL_STATS* stats) {
+    ASSERTMSG("argument engine is NULL!", engine != NULL);
+    ASSERTMSG("argument stats is NULL!", stats != NULL);
+
+    *stats = engine->pollStats;
+}
+
+static ULONG SgListNextRun(IN PSCATTER_GATHER_LIST SgList, IN OUT ULONG *element,
+                           IN OUT ULONG *offset, OUT UINT64 *hostAddr)
+// merge the physically contiguous scatter/gather elements from element/offset on into a run of at
+// most ADMA_ONE_DESCRIPTOR_MAX_TRANS_SIZE bytes. returns its length, 0 at the end of the list
+{
+    ULONG length = 0;
+    while (*element < SgList->NumberOfElements) {
+        const SCATTER_GATHER_ELEMENT *sg = &SgList->Elements[*element];
+        UINT64 address = (UINT64)sg->Address.QuadPart + *offset;
+        if (length == 0) {
+            *hostAddr = address;
+        } else if ((*hostAddr + length) != address) {
+            break; // not contiguous
+        }
+        ULONG chunk = min(sg->Length - *offset, ADMA_ONE_DESCRIPTOR_MAX_TRANS_SIZE - length);
+        length += chunk;
+        *offset += chunk;
+        if (*offset == sg->Length) {
+            (*element)++;
+            *offset = 0;
+        }
+        if (length == ADMA_ONE_DESCRIPTOR_MAX_TRANS_SIZE) {
+            break;
+        }
+    }
+    return length;
+}
+
 BOOLEAN ADMA_EngineProgramDma(IN WDFDMATRANSACTION Transaction, IN WDFDEVICE Device,
                               IN WDFCONTEXT context, IN WDF_DMA_DIRECTION Direction,
                               IN PSCATTER_GATHER_LIST SgList)
     // this programs the engine to start a dma transfer
 {
     UNREFERENCED_PARAMETER(Device);
+    LARGE_INTEGER programStart = KeQueryPerformanceCounter(NULL);
 
     WDFREQUEST request = WdfDmaTransactionGetRequest(Transaction);
     WDF_REQUEST_PARAMETERS params;
@@ -461,30 +1129,60 @@ BOOLEAN ADMA_EngineProgramDma(IN WDFDMATRANSACTION Transaction, IN WDFDEVICE Dev
         (SIZE_T)params.Parameters.Write.DeviceOffset :
         (SIZE_T)params.Parameters.Read.DeviceOffset;
 
-    // get virtual and physical pointers to descriptor buffer
     ADMA_ENGINE * engine = (ADMA_ENGINE*)context;
-#if defined(ALTERA_ARRIA10)
-    ADMA_DESCRIPTOR *descriptor = (ADMA_DESCRIPTOR*)((PUCHAR)WdfCommonBufferGetAlignedVirtualAddress(engine->descBuffer) + ADMA_DESCRIPTOR_OFFSET);
-#endif
     //PHYSICAL_ADDRESS descBufferLA = WdfCommonBufferGetAlignedLogicalAddress(engine->descBuffer);
 
     // offset into the transaction (if it is split)
     deviceOffset += WdfDmaTransactionGetBytesTransferred(Transaction);
 
-    TraceVerbose(DBG_DMA, "device addr=%lld, num descriptors=%d",
+    TraceVerbose(DBG_DMA, "device addr=%lld, num sg elements=%d",
                  deviceOffset, SgList->NumberOfElements);
 
-	engine->parentDevice->a2pTransTbl->a2pAddrLo0 = (SgList->Elements[0].Address.LowPart & engine->parentDevice->a2pMask) | 0x1;
-	engine->parentDevice->a2pTransTbl->a2pAddrHi0 = SgList->Elements[0].Address.HighPart;
-
 #if defined(ALTERA_ARRIA10)
-	ULONG id = engine->sgdma->dmaLastPtr;// id = 0~127 or 0xFF
+	// the scatter/gather list goes onto the descriptor ring in parts, behind the requests
+	// already in flight. parts beyond the first follow as their predecessor completes
+	ADMA_RING_TRANSFER *transfer = EngineRingTransfer(engine, Transaction);
+	ASSERTMSG("transaction is not from the engine's pool!", transfer != NULL);
+	transfer->sgList = SgList;
+	transfer->element = 0;
+	transfer->offset = 0;
+	transfer->deviceOffset = deviceOffset;
+	transfer->toDevice = (Direction == WdfDmaDirectionWriteToDevice);
+	transfer->start = programStart.QuadPart;
+
+	WdfSpinLockAcquire(engine->descRingLock);
+	BOOLEAN programmed = EngineRingProgram(engine, transfer);
+	WdfSpinLockRelease(engine->descRingLock);
+	if (!programmed) {
+		return FALSE;
+	}
+
+    // start the engine
+    EngineStart(engine);
 #else
 	engine->modSgdmaCsr->status = 0;
-#endif
-
-	//SgList->NumberOfElements < ADMA_MAX_DESCRIPTOR_NUM, WDF help do this
-    for (ULONG i = 0; i < SgList->NumberOfElements; i++) {
+	engine->a2p.generation++; // windows of earlier transfers may be recycled
+	engine->prefetch.first = 0; // so may the prefetch descriptors
+	engine->prefetch.count = 0;
+	engine->prefetch.done = 0;
+	engine->numDescriptors = 0;
+	engine->numResponses = 0;
+	engine->responseErrors = 0;
+	engine->transferPending = FALSE;
+	engine->transferStart = programStart.QuadPart;
+	engine->fragmentBytes = 0;
+	engine->fragmentShort = FALSE;
+
+	// physically contiguous elements are merged into one run first. the dispatcher's fifo takes
+	// ADMA_DESC_FIFO_DEPTH descriptors, the rest of the sg list becomes the next fragment
+	const ULONG maxDescriptors = (engine->dispatcher->descMode == ADMA_DESC_MODE_DISPATCHER) ?
+		ADMA_DESC_FIFO_DEPTH : MAXULONG;
+	ULONG element = 0;
+	ULONG offset = 0;
+	UINT64 hostAddr;
+	ULONG remaining;
+	for (ULONG i = 0; !engine->fragmentShort &&
+		 ((remaining = SgListNextRun(SgList, &element, &offset, &hostAddr)) != 0); i++) {
 #if 0
         // next descriptor bus address 
         descBufferLA.QuadPart += sizeof(DMA_DESCRIPTOR);
@@ -511,59 +1209,41 @@ BOOLEAN ADMA_EngineProgramDma(IN WDFDMATRANSACTION Transaction, IN WDFDEVICE Dev
             TraceWarning(DBG_DMA, "Error: Dma Transfer is not aligned");
         }
 #endif
+		while (remaining > 0) {
+			if (engine->numDescriptors == maxDescriptors) {
+				engine->fragmentShort = TRUE;
+				break;
+			}
+			// host memory is reached through an a2p window, runs crossing a window
+			// boundary are split into one descriptor per window
+			UINT64 windowBytes;
+			UINT32 avalonAddr = EngineA2pMap(engine, hostAddr, &windowBytes);
+			ULONG length = (windowBytes < remaining) ? (ULONG)windowBytes : remaining;
+			if (length < remaining) {
+				engine->a2p.stats.splits++;
+			}
+			if (Direction == WdfDmaDirectionWriteToDevice) {
+				// source is host memory
+				EngineQueueDescriptor(engine, avalonAddr, LIMIT_TO_32(deviceOffset), length);
+			}
+			else {
+				// destination is host memory
+				EngineQueueDescriptor(engine, LIMIT_TO_32(deviceOffset), avalonAddr, length);
+			}
+			TraceInfo(DBG_INIT, "des[%d] ha=0x%llx aa=0x%08x da=0x%08x len=0x%x", i, 
+				hostAddr, avalonAddr, LIMIT_TO_32(deviceOffset), length);
 
-#if defined(ALTERA_ARRIA10)
-		id = (id + 1) % ADMA_MAX_DESCRIPTOR_NUM;
-		descriptor[id].control = LIMIT_TO_32((id << 18) | SgList->Elements[i].Length);
-		ULONG hostAddrLo = SgList->Elements[i].Address.LowPart;
-		LONG hostAddrHi = SgList->Elements[i].Address.HighPart;
-		if (Direction == WdfDmaDirectionWriteToDevice) {
-			// source is host memory
-			descriptor[id].srcAddrLo = hostAddrLo;
-			descriptor[id].srcAddrHi = hostAddrHi;
-			descriptor[id].dstAddrLo = LIMIT_TO_32(deviceOffset);
-			descriptor[id].dstAddrHi = LIMIT_TO_32(deviceOffset >> 32);
-		}
-		else {
-			// destination is host memory
-			descriptor[id].srcAddrLo = LIMIT_TO_32(deviceOffset);
-			descriptor[id].srcAddrHi = LIMIT_TO_32(deviceOffset >> 32);
-			descriptor[id].dstAddrLo = hostAddrLo;
-			descriptor[id].dstAddrHi = hostAddrHi;
+			hostAddr += length;
+			remaining -= length;
+			deviceOffset += length;
+			engine->fragmentBytes += length;
 		}
-#else
-		ULONG hostAddrLo = SgList->Elements[i].Address.LowPart;
-		LONG hostAddrHi = SgList->Elements[i].Address.HighPart;
-		if (Direction == WdfDmaDirectionWriteToDevice) {
-			// source is host memory
-			engine->modSgdmaStdDes->readAddress = hostAddrLo;
-			engine->modSgdmaStdDes->writeAddress = LIMIT_TO_32(deviceOffset);
-		}
-		else {
-			// destination is host memory
-			engine->modSgdmaStdDes->readAddress = LIMIT_TO_32(deviceOffset);
-			engine->modSgdmaStdDes->writeAddress = hostAddrLo & (~engine->parentDevice->a2pMask);
-		}
-		engine->modSgdmaStdDes->transferLength = SgList->Elements[i].Length;
-		engine->modSgdmaStdDes->control = DESCRIPTOR_CONTROL_TRANSFER_COMPLETE_IRQ_MASK | 
-										  DESCRIPTOR_CONTROL_GO_MASK;
-		TraceInfo(DBG_INIT, "des[%d] ha=0x%08x%08x da=0x%08x len=0x%x", i, 
-			hostAddrHi, hostAddrLo, LIMIT_TO_32(deviceOffset), SgList->Elements[i].Length);
-
-		deviceOffset += SgList->Elements[i].Length;
-#endif
 	}
 
 #if 0
     OptimizeDescriptors(engine, descriptor, SgList->NumberOfElements);
 #endif
 
-#if defined(ALTERA_ARRIA10)
-    for (ULONG i = 0; i < SgList->NumberOfElements; i++) {
-        DumpDescriptor(&(descriptor[i]));
-    }
-#endif
-
 #if 0
     if (engine->poll) {
         engine->numDescriptors = SgList->NumberOfElements;
@@ -574,26 +1254,55 @@ BOOLEAN ADMA_EngineProgramDma(IN WDFDMATRANSACTION Transaction, IN WDFDEVICE Dev
     // start the engine
     EngineStart(engine);
 
-#if defined(ALTERA_ARRIA10)
-	engine->sgdma->dmaLastPtr = id;
+	if (engine->dispatcher->descMode == ADMA_DESC_MODE_PREFETCHER) {
+		EnginePrefetchKick(engine, TRUE);
+	} else {
+		EngineDispatchFlush(engine, DESCRIPTOR_CONTROL_TRANSFER_COMPLETE_IRQ_MASK);
+	}
+	if (engine->responseErrors & ADMA_RESPONSE_DISPATCH_TIMEOUT) {
+		// no interrupt follows. the transaction ends here, the caller of
+		// WdfDmaTransactionExecute or the dpc completes the request, see EngineCompleteProgramError
+		NTSTATUS status;
+		EngineDispatchReset(engine);
+		(void)WdfDmaTransactionDmaCompletedFinal(Transaction, 0, &status);
+		InterlockedExchange(&engine->programFailed, 1);
+		return FALSE;
+	}
+	MemoryBarrier();
+	engine->transferPending = TRUE; // the responses may be collected from now on
 #endif
 
     MemoryBarrier();
 
+    engine->programStats.transfers++;
+    engine->programStats.programTicks += KeQueryPerformanceCounter(NULL).QuadPart - programStart.QuadPart;
+
     return TRUE;
 }
 
 NTSTATUS ProbeEngines(IN PADMA_DEVICE adma) {
 	PAGED_CODE();
 
+	// neither ip has an identifier register, ADMA_DeviceOpen got the channel count from the
+	// NUM_CHANNELS parameter. the first channel which fails the check ends the list
+	const ULONG requested = min(max(adma->numChannels, 1UL), ADMA_MAX_NUM_CHANNELS);
+	adma->numChannels = 0;
+	while ((adma->numChannels < requested) &&
+		   EngineExists(adma, H2C, adma->numChannels) && EngineExists(adma, C2H, adma->numChannels)) {
+		adma->numChannels++;
+	}
+	if (adma->numChannels < requested) {
+		TraceWarning(DBG_INIT, "%u dma channel(s) configured, channel %u not found",
+					 requested, adma->numChannels);
+	}
+	TraceInfo(DBG_INIT, "%u dma channel(s) used", adma->numChannels);
+
 	ULONG engineIndex = 0;
 
 	// iterate over H2C (FPGA performs PCIe reads towards FPGA),
 	// then C2H (FPGA performs PCIe writes from FPGA)
 	for (UINT dir = H2C; dir < 2; dir++) { // 0=H2C, 1=C2H
-		for (ULONG ch = 0; ch < ADMA_MAX_NUM_CHANNELS; ch++) {
-
-			//if (EngineExists(adma, dir, ch)) {
+		for (ULONG ch = 0; ch < adma->numChannels; ch++) {
 			ADMA_ENGINE* engine = &(adma->engines[ch][dir]);
 			NTSTATUS status = EngineCreate(adma, engine, dir, ch, engineIndex);
 			if (!NT_SUCCESS(status)) {
@@ -614,19 +1323,20 @@ NTSTATUS EnginesAssignInterrupt(IN PADMA_DEVICE adma) {
 	// iterate over H2C (FPGA performs PCIe reads towards FPGA),
 	// then C2H (FPGA performs PCIe writes from FPGA)
 	for (UINT dir = H2C; dir < 2; dir++) { // 0=H2C, 1=C2H
-		for (ULONG ch = 0; ch < ADMA_MAX_NUM_CHANNELS; ch++) {
-			//if (EngineExists(adma, dir, ch)) {
+		for (ULONG ch = 0; ch < adma->numChannels; ch++) {
 			ADMA_ENGINE* engine = &(adma->engines[ch][dir]);
 			EngineConfigureInterrupt(engine, engineIndex);
 			engineIndex++;
 			TraceInfo(DBG_INIT, "%s_%u engine assign interrupt",
 				DirectionToString(dir), ch);
-			//} else {     // skip inactive engines
-			//    TraceInfo(DBG_INIT, "Skipping non-existing engine %s_%u",
-			//              DirectionToString(dir), ch);
-			//}
 		}
 	}
+
+	// both directions of a channel are serviced by the vector bound to its H2C engine
+	for (ULONG ch = 0; ch < adma->numChannels; ch++) {
+		adma->dispatchers[ch].interrupt = (adma->channelInterrupts[ch] != NULL) ?
+			adma->channelInterrupts[ch] : adma->lineInterrupt;
+	}
 	return STATUS_SUCCESS;
 }
 
@@ -636,9 +1346,14 @@ void EngineStart(IN ADMA_ENGINE *engine) {
     TraceInfo(DBG_DMA, "%s_%u engine started (control=0x%08x)",
               DirectionToString(engine->dir), engine->channel, engine->regs->control);
 #endif
+#if defined(ALTERA_ARRIA10)
+	TraceInfo(DBG_DMA, "%s_%u engine started (lastPtr=%u)",
+		DirectionToString(engine->dir), engine->channel, engine->sgdma->dmaLastPtr);
+#else
 	TraceInfo(DBG_DMA, "%s_%u engine started (control=0x%08x status=0x%08x)",
 		DirectionToString(engine->dir), engine->channel, engine->modSgdmaCsr->control,
 		engine->modSgdmaCsr->status);
+#endif
 }
 
 void EngineStop(IN ADMA_ENGINE *engine) {
@@ -663,8 +1378,12 @@ void EngineEnableInterrupt(IN ADMA_ENGINE* engine) {
 #if 0
     engine->parentDevice->interruptRegs->channelIntEnableW1S = engine->irqBitMask;
 #endif
-	UINT32 reg = engine->modSgdmaCsr->control;
-	engine->modSgdmaCsr->control = reg | CSR_GLOBAL_INTERRUPT_MASK;
+#if !defined(ALTERA_ARRIA10) // the arria10 descriptor controller has no per engine mask
+	ADMA_DISPATCHER *dispatcher = engine->dispatcher;
+	dispatcher->irqEngines |= BIT_N(engine->dir);
+	dispatcher->csrControl |= CSR_GLOBAL_INTERRUPT_MASK;
+	engine->modSgdmaCsr->control = dispatcher->csrControl;
+#endif
 
     TraceInfo(DBG_IRQ, "%s_%u enabled interrupt", DirectionToString(engine->dir), engine->channel);
 }
@@ -678,34 +1397,48 @@ void EngineDisableInterrupt(IN ADMA_ENGINE* engine) {
     engine->parentDevice->interruptRegs->channelIntEnableW1C = engine->irqBitMask;
 #endif
 
-	UINT32 reg = engine->modSgdmaCsr->control;
-	engine->modSgdmaCsr->control = reg & (~CSR_GLOBAL_INTERRUPT_MASK);
+#if !defined(ALTERA_ARRIA10)
+	ADMA_DISPATCHER *dispatcher = engine->dispatcher;
+	dispatcher->irqEngines &= ~BIT_N(engine->dir);
+	if (dispatcher->irqEngines == 0) {
+		dispatcher->csrControl &= ~CSR_GLOBAL_INTERRUPT_MASK;
+		engine->modSgdmaCsr->control = dispatcher->csrControl;
+	}
+#endif
 
     TraceInfo(DBG_IRQ, "%s_%u disabled interrupt", DirectionToString(engine->dir), engine->channel);
 }
 
-char* DirectionToString(const DirToDev dir) {
+void EngineSetInterrupt(IN ADMA_ENGINE* engine, IN BOOLEAN enable) {
+    ASSERTMSG("argument engine is NULL!", engine != NULL);
+
+    // the interrupt callbacks change the shared shadow with this lock held
+    WDFINTERRUPT interrupt = engine->dispatcher->interrupt;
+    if (interrupt != NULL) {
+        WdfInterruptAcquireLock(interrupt);
+    }
+    if (enable) {
+        EngineEnableInterrupt(engine);
+    } else {
+        EngineDisableInterrupt(engine);
+    }
+    if (interrupt != NULL) {
+        WdfInterruptReleaseLock(interrupt);
+    }
+}
+
+char* DirectionToString(const DirToDev dir) {
     return dir == H2C ? "H2C" : "C2H";
 }
 
 // ========================= streaming engine ============================================
 
-static NTSTATUS EngineCreateRingBuffer(IN ADMA_ENGINE* engine) {
+// On the arria10 a streaming C2H engine owns its whole descriptor table. Descriptor i always moves
+// one block from the stream's card address into ring block i, so the table is written once. Blocks
+// the reader is done with are re-armed by moving dmaLastPtr along, hw reports every filled block
+// with the done bit of the descriptor's ADMA_RESULT status word.
 
-    // create dma result buffer
-    size_t resultBufferSize = (ADMA_MAX_TRANSFER_SIZE / PAGE_SIZE + 2) * sizeof(ADMA_RESULT);
-    NTSTATUS status = WdfCommonBufferCreate(engine->parentDevice->dmaEnabler, resultBufferSize,
-                                            WDF_NO_OBJECT_ATTRIBUTES, &engine->ring.results);
-    if (!NT_SUCCESS(status)) {
-        TraceError(DBG_INIT, "WdfCommonBufferCreate failed: %!STATUS!", status);
-        return status;
-    }
-    PUCHAR resultBufferVA = (PUCHAR)WdfCommonBufferGetAlignedVirtualAddress(engine->ring.results);
-    RtlZeroMemory(resultBufferVA, resultBufferSize);
-
-    TraceVerbose(DBG_INIT, "engine[%u][%u] dma result buffer @ pa=0x%08llx",
-                 engine->channel, engine->dir,
-                 WdfCommonBufferGetAlignedLogicalAddress(engine->ring.results).QuadPart);
+static NTSTATUS EngineCreateRingBuffer(IN ADMA_ENGINE* engine) {
 
     // create dma data buffer
     PHYSICAL_ADDRESS low, high, skip;
@@ -742,7 +1475,7 @@ static NTSTATUS EngineCreateRingBuffer(IN ADMA_ENGINE* engine) {
                      engine->ring.mdl[i]->Next);
     }
 
-    status = WdfSpinLockCreate(WDF_NO_OBJECT_ATTRIBUTES, &engine->ring.lock);
+    NTSTATUS status = WdfSpinLockCreate(WDF_NO_OBJECT_ATTRIBUTES, &engine->ring.lock);
     if (!NT_SUCCESS(status)) {
         TraceError(DBG_INIT, "WdfSpinLockCreate failed: %!STATUS!", status);
         return status;
@@ -753,130 +1486,60 @@ static NTSTATUS EngineCreateRingBuffer(IN ADMA_ENGINE* engine) {
     return status;
 }
 
-static UINT EngineProcessRing(IN ADMA_ENGINE *engine) {
-#if 0
-    UINT32 engineStatus = EngineStatus(engine, TRUE);
-    if (engineStatus & ADMA_ALIGN_MISMATCH_BIT & ADMA_MAGIC_STOPPED_BIT & ADMA_FETCH_STOPPED_BIT
-        & ADMA_STAT_READ_ERROR & ADMA_STAT_DESCRIPTOR_ERROR) {
-        TraceError(DBG_DMA, "Engine error during transfer! 0x%08x", engineStatus);
-    }
-    UINT eopCount = 0;
-    DMA_RESULT* results = (DMA_RESULT*)WdfCommonBufferGetAlignedVirtualAddress(engine->ring.results);
+static UINT EngineProcessRing(IN ADMA_ENGINE *engine)
+// move tail over the blocks hw has filled and wake the reader, returns the number of blocks
+{
+#if defined(ALTERA_ARRIA10)
+    ADMA_RESULT* results = (ADMA_RESULT*)WdfCommonBufferGetAlignedVirtualAddress(engine->descBuffer);
+    UINT count = 0;
 
     WdfSpinLockAcquire(engine->ring.lock);
     UINT tail = engine->ring.tail;
-    UINT head = engine->ring.head;
-    WdfSpinLockRelease(engine->ring.lock);
-
-    TraceInfo(DBG_DMA, "%s_%u ring head=%u, tail=%u, eop=%u, credits=%u",
-              DirectionToString(engine->dir), engine->channel, head, tail, eopCount,
-              engine->sgdma->descCredits);
-
-    for (; results[tail].status; EngineRingAdvance(&tail)) {
-
-        if (results[tail].status & ADMA_RESULT_EOP_BIT) {
-            eopCount++;
-        }
-
-        results[tail].status = 0; // mark current dma result as processed
+    while (results->status[tail] & ADMA_DESC_RING_DONE) {
+        results->status[tail] = 0; // mark current dma result as processed
+        EngineRingAdvance(&tail);
+        count++;
     }
-
-    TraceInfo(DBG_DMA, "%s_%u ring head=%u, tail=%u, eop=%u, credits=%u",
-              DirectionToString(engine->dir), engine->channel, head, tail, eopCount,
-              engine->sgdma->descCredits);
-
-    WdfSpinLockAcquire(engine->ring.lock);
     engine->ring.tail = tail;
-    WdfSpinLockRelease(engine->ring.lock);
 
-    // If any packets are completed, start the Io Read queue 
-    // also start the queue on an overflow since we need to tell the client that an overflow happened
-    if (eopCount > 0) {
-        TraceVerbose(DBG_DMA, "starting engine queue");
+    // the signal is only ever changed under the ring lock, so the reader cannot miss a set
+    if (count > 0) {
         KeSetEvent(&engine->ring.completionSignal, IO_NO_INCREMENT, FALSE);
     }
+    WdfSpinLockRelease(engine->ring.lock);
 
-
-    // clear poll writeback buffer
-    if (engine->poll) {
-        ADMA_POLL_WB* wbBuffer = (ADMA_POLL_WB*)WdfCommonBufferGetAlignedVirtualAddress(engine->pollWbBuffer);
-        size_t wbBufferLength = WdfCommonBufferGetLength(engine->pollWbBuffer);
-        RtlZeroMemory(wbBuffer, wbBufferLength);
-        engine->numDescriptors = 0;
+    if (count > 0) {
+        // a capturing engine is busy the whole time since the previous block
+        EngineSamplePerf(engine, (UINT64)count * ADMA_RING_BLOCK_SIZE, count, 0);
+        TraceVerbose(DBG_DMA, "%s_%u ring head=%u, tail=%u, %u blocks filled",
+                     DirectionToString(engine->dir), engine->channel, engine->ring.head, tail, count);
     }
-
-    return eopCount;
+    return count;
 #else
 	UNREFERENCED_PARAMETER(engine);
 	return 0;
 #endif
 }
 
-static void EngineRingProgramDma(IN ADMA_ENGINE* engine) {
-#if 0
-    // get virtual and physical pointers to descriptor buffer
-    DMA_DESCRIPTOR *descriptor = (DMA_DESCRIPTOR*)WdfCommonBufferGetAlignedVirtualAddress(engine->descBuffer);
-    PHYSICAL_ADDRESS nextDescLA = WdfCommonBufferGetAlignedLogicalAddress(engine->descBuffer);
-
-    // get physical address to dma result buffer
-    PHYSICAL_ADDRESS resultBufferLA = WdfCommonBufferGetAlignedLogicalAddress(engine->ring.results);
+static void EngineRingProgramDma(IN ADMA_ENGINE* engine)
+// point descriptor i of the table at ring block i, the descriptors are reused unchanged
+{
+#if defined(ALTERA_ARRIA10)
+    ADMA_DESCRIPTOR *descriptor = (ADMA_DESCRIPTOR*)((PUCHAR)WdfCommonBufferGetAlignedVirtualAddress(engine->descBuffer) + ADMA_DESCRIPTOR_OFFSET);
 
-    // fill descriptors 
     for (ULONG i = 0; i < ADMA_RING_NUM_BLOCKS; ++i) {
-        descriptor[i].control = (ADMA_DESC_MAGIC | ADMA_DESC_EOP_BIT | ADMA_DESC_COMPLETED_BIT);
-        descriptor[i].numBytes = ADMA_RING_BLOCK_SIZE;
-
-        // source address are unused, will be overwritten by hardware with dma result
-        descriptor[i].srcAddrLo = resultBufferLA.LowPart;
-        descriptor[i].srcAddrHi = resultBufferLA.HighPart;
-        resultBufferLA.QuadPart += sizeof(DMA_RESULT);
+        // source is the stream, every block is read from the same card address
+        descriptor[i].srcAddrLo = LIMIT_TO_32(engine->ring.cardAddress);
+        descriptor[i].srcAddrHi = LIMIT_TO_32(engine->ring.cardAddress >> 32);
 
         // destination is host memory
         PHYSICAL_ADDRESS dst = MmGetPhysicalAddress(MmGetMdlVirtualAddress(engine->ring.mdl[i]));
         descriptor[i].dstAddrLo = dst.LowPart;
         descriptor[i].dstAddrHi = dst.HighPart;
 
-        // next descriptor bus address 
-        nextDescLA.QuadPart += sizeof(DMA_DESCRIPTOR);
-        descriptor[i].nextLo = nextDescLA.LowPart;
-        descriptor[i].nextHi = nextDescLA.HighPart;
-
-        if (FALSE == DescriptorIsAligned(engine, descriptor)) {
-            TraceWarning(DBG_DMA, "Error: Dma Transfer is not aligned");
-        }
-    }
-
-    // make the discriptor list circular
-    nextDescLA = WdfCommonBufferGetAlignedLogicalAddress(engine->descBuffer);
-    DMA_DESCRIPTOR* last = &descriptor[ADMA_RING_NUM_BLOCKS - 1];
-    last->nextLo = nextDescLA.LowPart;
-    last->nextHi = nextDescLA.HighPart;
-
-    // Optimize for PCIe fetches
-    OptimizeDescriptors(engine, descriptor, ADMA_RING_NUM_BLOCKS);
-
-    // Print to log
-    TraceVerbose(DBG_DMA, "first desc @ 0x%08x%08x",
-                 engine->sgdma->firstDescHi, engine->sgdma->firstDescLo);
-    for (ULONG i = 0; i < ADMA_RING_NUM_BLOCKS; i++) {
+        descriptor[i].control = LIMIT_TO_32((i << ADMA_DESCRIPTOR_ID_SHIFT) | (ADMA_RING_BLOCK_SIZE / sizeof(UINT32)));
         DumpDescriptor(&(descriptor[i]));
     }
-    TraceVerbose(DBG_DMA, "last desc points to 0x%08x%08x", last->nextHi, last->nextLo);
-
-    if (engine->poll) {
-        engine->numDescriptors = 0;
-    }
-
-    // set initial descriptor credits for throtteling
-    engine->sgdma->descCredits = ADMA_RING_NUM_BLOCKS - 1;
-    TraceInfo(DBG_DMA, "%s_%u set %u initial descriptor credits",
-              DirectionToString(engine->dir), engine->channel, engine->sgdma->descCredits);
-
-    MemoryBarrier();
-
-    // start the engine
-    EngineStart(engine);
-
     MemoryBarrier();
 #else
 	UNREFERENCED_PARAMETER(engine);
@@ -884,18 +1547,43 @@ static void EngineRingProgramDma(IN ADMA_ENGINE* engine) {
 }
 
 static void EngineClearDmaResults(IN ADMA_ENGINE *engine) {
-#if 0
+#if defined(ALTERA_ARRIA10)
     TraceVerbose(DBG_DMA, "clearing DMA results...");
-    DMA_RESULT * results = (DMA_RESULT*)WdfCommonBufferGetAlignedVirtualAddress(engine->ring.results);
+    ADMA_RESULT* results = (ADMA_RESULT*)WdfCommonBufferGetAlignedVirtualAddress(engine->descBuffer);
     for (UINT i = 0; i < ADMA_RING_NUM_BLOCKS; ++i) {
-        results[i].status = 0;
-        results[i].length = 0;
+        results->status[i] = 0;
     }
 #else
 	UNREFERENCED_PARAMETER(engine);
 #endif
 }
 
+static void EngineRingArm(IN ADMA_ENGINE *engine)
+// hand the blocks the reader is done with back to hw, called with ring.lock held
+{
+#if defined(ALTERA_ARRIA10)
+    // the block in front of head stays unarmed, a full table is ambiguous to the last pointer
+    ULONG lastPtr = (engine->ring.head + ADMA_DESC_RING_CAPACITY - 1) % ADMA_MAX_DESCRIPTOR_NUM;
+    ULONG first = (engine->ring.lastPtr + 1) % ADMA_MAX_DESCRIPTOR_NUM;
+    ULONG count = (lastPtr + ADMA_MAX_DESCRIPTOR_NUM - engine->ring.lastPtr) % ADMA_MAX_DESCRIPTOR_NUM;
+    if (count == 0) {
+        return;
+    }
+
+    MemoryBarrier(); // status words are cleared before hw may write them again
+    if ((first + count) > ADMA_MAX_DESCRIPTOR_NUM) {
+        // the controller only wraps around after it was pointed at the end of the table
+        engine->sgdma->dmaLastPtr = ADMA_MAX_DESCRIPTOR_NUM - 1;
+    }
+    engine->sgdma->dmaLastPtr = lastPtr;
+    engine->ring.lastPtr = lastPtr;
+    engine->programStats.descriptors += count;
+    engine->programStats.doorbells++;
+#else
+	UNREFERENCED_PARAMETER(engine);
+#endif
+}
+
 static void EngineRingAdvance(UINT* index) {
     if (*index == ADMA_RING_NUM_BLOCKS - 1) { // wrap-around
         *index = 0;
@@ -904,101 +1592,346 @@ static void EngineRingAdvance(UINT* index) {
     }
 }
 
+NTSTATUS ADMA_EngineSetStream(ADMA_ENGINE* engine, UINT64 cardAddress) {
+
+    EXPECT(engine != NULL);
+
+#if defined(ALTERA_ARRIA10)
+    if ((engine->enabled == FALSE) || (engine->dir != C2H)) {
+        return STATUS_INVALID_PARAMETER;
+    }
+    if (engine->type == EngineType_ST) {
+        return STATUS_SUCCESS;
+    }
+    if (engine->descRing.pending != 0) {
+        return STATUS_DEVICE_BUSY;
+    }
+
+    NTSTATUS status = EngineCreateRingBuffer(engine);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "EngineCreateRingBuffer() failed: %!STATUS!", status);
+        return status;
+    }
+
+    // the ring starts where the controller stopped, nothing is armed yet
+    engine->ring.cardAddress = cardAddress;
+    engine->ring.head = engine->descRing.next;
+    engine->ring.tail = engine->descRing.next;
+    engine->ring.headOffset = 0;
+    engine->ring.lastPtr = (engine->descRing.next + ADMA_MAX_DESCRIPTOR_NUM - 1) % ADMA_MAX_DESCRIPTOR_NUM;
+    EngineClearDmaResults(engine);
+    EngineRingProgramDma(engine);
+
+    engine->type = EngineType_ST;
+    engine->work = EngineProcessRing;
+
+    TraceInfo(DBG_INIT, "%s_%u streaming from card address 0x%llx into %u blocks of %uB",
+              DirectionToString(engine->dir), engine->channel, cardAddress,
+              ADMA_RING_NUM_BLOCKS, ADMA_RING_BLOCK_SIZE);
+    return STATUS_SUCCESS;
+#else
+    // the modular sgdma has no descriptor table to cycle through
+    UNREFERENCED_PARAMETER(cardAddress);
+    return STATUS_NOT_SUPPORTED;
+#endif
+}
+
 void EngineRingSetup(IN ADMA_ENGINE *engine) {
-    engine->ring.head = 0;
-    engine->ring.tail = 0;
+    EngineProcessRing(engine);
+
+    // data captured while nobody was reading is dropped
+    WdfSpinLockAcquire(engine->ring.lock);
+    engine->ring.head = engine->ring.tail;
+    engine->ring.headOffset = 0;
+    EngineRingArm(engine);
     KeClearEvent(&engine->ring.completionSignal);
-    EngineRingProgramDma(engine);
+    WdfSpinLockRelease(engine->ring.lock);
+
+    TraceVerbose(DBG_DMA, "%s_%u ring head=tail=%u, lastPtr=%u",
+                 DirectionToString(engine->dir), engine->channel, engine->ring.head,
+                 engine->ring.lastPtr);
 }
 
 void EngineRingTeardown(IN ADMA_ENGINE *engine) {
-    EngineStop(engine);
-    EngineClearDmaResults(engine);
-    engine->ring.head = 0;
-    engine->ring.tail = 0;
+    // armed descriptors cannot be taken back from the controller, it stops at the last pointer and
+    // the blocks filled until then are dropped by the next EngineRingSetup()
+    WdfSpinLockAcquire(engine->ring.lock);
+    engine->ring.head = engine->ring.tail;
+    engine->ring.headOffset = 0;
+    KeClearEvent(&engine->ring.completionSignal);
+    WdfSpinLockRelease(engine->ring.lock);
 }
 
 NTSTATUS EngineRingCopyBytesToMemory(IN ADMA_ENGINE *engine, WDFMEMORY outputMem, 
                                    size_t length, LARGE_INTEGER timeout, size_t* bytesRead ) {
-#if 0
-	NTSTATUS status = 0;
-    if (engine->poll) { // poll mode - poll for completion
+    NTSTATUS status = STATUS_SUCCESS;
+    *bytesRead = 0;
+
+    if (engine->poll) { // poll mode - spin for completion first
         status = EnginePollRing(engine);
         if (!NT_SUCCESS(status)) {
-            goto ErrorExit;
+            return status;
+        }
+    } else {
+        EngineProcessRing(engine);
+    }
+
+    // wait for completion signal only if there is nothing to read, the status words are checked
+    // in between as the msi only follows the last armed descriptor
+    LONGLONG remaining = -timeout.QuadPart; // relative, 100ns units
+    for (;;) {
+        WdfSpinLockAcquire(engine->ring.lock);
+        BOOLEAN empty = (engine->ring.head == engine->ring.tail);
+        if (empty) {
+            KeClearEvent(&engine->ring.completionSignal);
+        }
+        WdfSpinLockRelease(engine->ring.lock);
+        if (!empty) {
+            break;
         }
-    } else { // interrupt mode - wait for completion signal
-        status = KeWaitForSingleObject(&engine->ring.completionSignal, Executive, KernelMode, FALSE, &timeout);
-        if (status == STATUS_TIMEOUT) {
-            goto ErrorExit;
+        if (remaining <= 0) {
+            return STATUS_TIMEOUT;
         }
+
+        LARGE_INTEGER slice;
+        slice.QuadPart = -min(remaining, (LONGLONG)ADMA_RING_WAIT_SLICE_US * 10);
+        remaining += slice.QuadPart;
+        KeWaitForSingleObject(&engine->ring.completionSignal, Executive, KernelMode, FALSE, &slice);
+        EngineProcessRing(engine);
     }
 
-    DMA_RESULT* results = (DMA_RESULT*)WdfCommonBufferGetAlignedVirtualAddress(engine->ring.results);
-    size_t offset = 0;
-    UINT32 numDescProcessed = 0;
-    size_t numBytesRemaining = length;
     WdfSpinLockAcquire(engine->ring.lock);
     UINT head = engine->ring.head;
     UINT tail = engine->ring.tail;
+    ULONG headOffset = engine->ring.headOffset;
     WdfSpinLockRelease(engine->ring.lock);
 
-    TraceVerbose(DBG_DMA, "%s_%u head=%u, tail=%u, credits=%u",
-                 DirectionToString(engine->dir), engine->channel, head, tail, engine->sgdma->descCredits);
-
-    while ((head != tail) && numBytesRemaining) {
-
-        // get dma ring buffer address and bytes transferred
-        PVOID rxBufferVa = MmGetMdlVirtualAddress(engine->ring.mdl[head]);
-        size_t numBytesReceived = results[head].length;
-
-        // limit buffer size
-        if (numBytesReceived > numBytesRemaining) {
-            numBytesReceived = numBytesRemaining;
-        } else if (numBytesReceived == 0) {
-            KeClearEvent(&engine->ring.completionSignal);
-            break;
-        }
+    // blocks between head and tail belong to the reader, the dpc only moves tail
+    size_t offset = 0;
+    while ((head != tail) && (offset < length)) {
+        PUCHAR rxBufferVa = (PUCHAR)MmGetMdlVirtualAddress(engine->ring.mdl[head]) + headOffset;
+        size_t numBytes = min(ADMA_RING_BLOCK_SIZE - headOffset, length - offset);
 
         // copy to user
-        status = WdfMemoryCopyFromBuffer(outputMem, offset, rxBufferVa, numBytesReceived);
+        status = WdfMemoryCopyFromBuffer(outputMem, offset, rxBufferVa, numBytes);
         if (!NT_SUCCESS(status)) {
             TraceError(DBG_DMA, "WdfMemoryCopyFromBuffer failed: %!STATUS!", status);
-            goto ErrorExit;
+            break;
         }
 
-        numDescProcessed++;
-        offset += numBytesReceived;
-        numBytesRemaining -= numBytesReceived;
-
-        results[head].length = 0;
-        EngineRingAdvance(&head);
-    }
-
-    if (results[head].length == 0) {
-        KeClearEvent(&engine->ring.completionSignal);
+        offset += numBytes;
+        headOffset += (ULONG)numBytes;
+        if (headOffset == ADMA_RING_BLOCK_SIZE) { // a partly read block stays with the reader
+            headOffset = 0;
+            EngineRingAdvance(&head);
+        }
     }
 
     WdfSpinLockAcquire(engine->ring.lock);
     engine->ring.head = head;
-    engine->sgdma->descCredits = numDescProcessed;
+    engine->ring.headOffset = headOffset;
+    EngineRingArm(engine);
+    if (head == engine->ring.tail) {
+        KeClearEvent(&engine->ring.completionSignal);
+    }
     WdfSpinLockRelease(engine->ring.lock);
 
-    *bytesRead = length - numBytesRemaining;
+    *bytesRead = offset;
 
-    TraceVerbose(DBG_DMA, "%s_%u read %lluB available,  head=%u, tail=%u, credits=%u",
+    TraceVerbose(DBG_DMA, "%s_%u read %lluB, head=%u, tail=%u, lastPtr=%u",
                  DirectionToString(engine->dir), engine->channel, *bytesRead, head, tail,
-                 engine->sgdma->descCredits);
+                 engine->ring.lastPtr);
 
-ErrorExit:
+    return status;
+}
+
+//========================= small transfer fast path ==============================================
+
+#if defined(ALTERA_ARRIA10)
+static NTSTATUS EngineCreateLiteBuffer(IN OUT ADMA_ENGINE *engine) {
+    SIZE_T bufferSize = ADMA_DESC_RING_MAX_REQUESTS * ADMA_LITE_SLOT_SIZE;
+
+    NTSTATUS status = WdfCommonBufferCreate(engine->parentDevice->dmaEnabler, bufferSize,
+                                            WDF_NO_OBJECT_ATTRIBUTES, &engine->lite.buffer);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "WdfCommonBufferCreate failed: %!STATUS!", status);
+        return status;
+    }
+    engine->lite.data = (PUCHAR)WdfCommonBufferGetAlignedVirtualAddress(engine->lite.buffer);
+    engine->lite.dataLA = WdfCommonBufferGetAlignedLogicalAddress(engine->lite.buffer);
+    RtlZeroMemory(engine->lite.data, bufferSize);
+
+    for (ULONG i = 0; i < ADMA_DESC_RING_MAX_REQUESTS; i++) {
+        engine->lite.slot[i].request = NULL;
+        engine->lite.slot[i].length = 0;
+        engine->lite.slot[i].busy = 0;
+    }
+    RtlZeroMemory(&engine->lite.stats, sizeof(engine->lite.stats));
+    engine->lite.stats.tickFrequency = engine->pollStats.tickFrequency;
+    engine->lite.stats.maxSize = ADMA_LITE_SLOT_SIZE;
+
+    TraceVerbose(DBG_INIT, "%s_%u lite buffer at 0x%08x%08x, size=%lld",
+                 DirectionToString(engine->dir), engine->channel,
+                 engine->lite.dataLA.HighPart, engine->lite.dataLA.LowPart, bufferSize);
+    return status;
+}
+
+static ADMA_LITE_SLOT* EngineLiteSlot(IN ADMA_ENGINE *engine, IN PVOID context)
+// the lite slot a retired ring context refers to, NULL for a dma transaction
+{
+    if ((context >= (PVOID)&engine->lite.slot[0]) &&
+        (context < (PVOID)&engine->lite.slot[ADMA_DESC_RING_MAX_REQUESTS])) {
+        return (ADMA_LITE_SLOT*)context;
+    }
+    return NULL;
+}
+
+static void EngineLiteComplete(IN ADMA_ENGINE *engine, IN ADMA_LITE_SLOT *slot)
+// complete a request which was transferred via a lite slot
+{
+    WDFREQUEST request = slot->request;
+    size_t length = slot->length;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    if (engine->dir == C2H) { // copy received bytes into the request memory
+        WDFMEMORY requestMemory;
+        status = WdfRequestRetrieveOutputMemory(request, &requestMemory);
+        if (NT_SUCCESS(status)) {
+            PUCHAR data = engine->lite.data + ((slot - engine->lite.slot) * ADMA_LITE_SLOT_SIZE);
+            status = WdfMemoryCopyFromBuffer(requestMemory, 0, data, length);
+        }
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_DMA, "%s_%u lite copy failed: %!STATUS!",
+                       DirectionToString(engine->dir), engine->channel, status);
+            length = 0;
+        }
+    }
+
+    LONGLONG now = KeQueryPerformanceCounter(NULL).QuadPart;
+    InterlockedIncrement64((volatile LONG64*)&engine->lite.stats.liteTransfers);
+    InterlockedAdd64((volatile LONG64*)&engine->lite.stats.liteLatencyTicks, now - slot->arrival);
+    EngineCountCompletion(engine, slot->arrival, length);
+
+    TraceInfo(DBG_DMA, "%s_%u lite request %p complete, bytesTransferred=%llu",
+              DirectionToString(engine->dir), engine->channel, request, length);
+
+    slot->request = NULL;
+    InterlockedExchange(&slot->busy, 0); // before the queue presents a new one
+    WdfRequestCompleteWithInformation(request, status, length);
+}
+#endif
+
+NTSTATUS EngineLiteTransfer(IN ADMA_ENGINE *engine, IN WDFREQUEST request, IN size_t length) {
+#if defined(ALTERA_ARRIA10)
+    LONGLONG arrival = KeQueryPerformanceCounter(NULL).QuadPart;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    if ((length == 0) || (length > engine->lite.stats.threshold) || (length % sizeof(UINT32))) {
+        return STATUS_INVALID_PARAMETER; // the descriptor counts dwords
+    }
+
+    ADMA_LITE_SLOT *slot = NULL;
+    for (ULONG i = 0; i < ADMA_DESC_RING_MAX_REQUESTS; i++) {
+        if (InterlockedCompareExchange(&engine->lite.slot[i].busy, 1, 0) == 0) {
+            slot = &engine->lite.slot[i];
+            break;
+        }
+    }
+    if (slot == NULL) {
+        return STATUS_DEVICE_BUSY;
+    }
+    ULONG index = (ULONG)(slot - engine->lite.slot);
+    UINT64 hostAddr = (UINT64)engine->lite.dataLA.QuadPart + ((UINT64)index * ADMA_LITE_SLOT_SIZE);
+
+    WDF_REQUEST_PARAMETERS params;
+    WDF_REQUEST_PARAMETERS_INIT(&params);
+    WdfRequestGetParameters(request, &params);
+    LONGLONG deviceOffset = (engine->dir == H2C) ?
+        params.Parameters.Write.DeviceOffset :
+        params.Parameters.Read.DeviceOffset;
+
+    if (engine->dir == H2C) { // copy payload from the request memory
+        WDFMEMORY requestMemory;
+        status = WdfRequestRetrieveInputMemory(request, &requestMemory);
+        if (NT_SUCCESS(status)) {
+            status = WdfMemoryCopyToBuffer(requestMemory, 0,
+                                           engine->lite.data + ((size_t)index * ADMA_LITE_SLOT_SIZE),
+                                           length);
+        }
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_DMA, "%s_%u lite copy failed: %!STATUS!",
+                       DirectionToString(engine->dir), engine->channel, status);
+            InterlockedExchange(&slot->busy, 0);
+            return status;
+        }
+    }
+
+    slot->request = request;
+    slot->length = length;
+    slot->arrival = arrival;
+
+    // a single descriptor behind the requests already in flight
+    ADMA_DESCRIPTOR *descriptor = (ADMA_DESCRIPTOR*)((PUCHAR)WdfCommonBufferGetAlignedVirtualAddress(engine->descBuffer) + ADMA_DESCRIPTOR_OFFSET);
+    WdfSpinLockAcquire(engine->descRingLock);
+    ULONG id;
+    if (!AdmaDescRingSubmit(&engine->descRing, 1, slot, &id)) {
+        WdfSpinLockRelease(engine->descRingLock);
+        slot->request = NULL;
+        InterlockedExchange(&slot->busy, 0);
+        return STATUS_DEVICE_BUSY;
+    }
+    descriptor[id].control = LIMIT_TO_32((id << ADMA_DESCRIPTOR_ID_SHIFT) | (length / sizeof(UINT32)));
+    if (engine->dir == H2C) {
+        descriptor[id].srcAddrLo = LIMIT_TO_32(hostAddr);
+        descriptor[id].srcAddrHi = LIMIT_TO_32(hostAddr >> 32);
+        descriptor[id].dstAddrLo = LIMIT_TO_32(deviceOffset);
+        descriptor[id].dstAddrHi = LIMIT_TO_32(deviceOffset >> 32);
+    } else {
+        descriptor[id].srcAddrLo = LIMIT_TO_32(deviceOffset);
+        descriptor[id].srcAddrHi = LIMIT_TO_32(deviceOffset >> 32);
+        descriptor[id].dstAddrLo = LIMIT_TO_32(hostAddr);
+        descriptor[id].dstAddrHi = LIMIT_TO_32(hostAddr >> 32);
+    }
+    DumpDescriptor(&(descriptor[id]));
+    MemoryBarrier();
+    engine->sgdma->dmaLastPtr = AdmaDescRingLastPtr(&engine->descRing);
+    engine->programStats.transfers++;
+    engine->programStats.descriptors++;
+    engine->programStats.doorbells++;
+    WdfSpinLockRelease(engine->descRingLock);
+
+    EngineStart(engine);
     return status;
 #else
-	UNREFERENCED_PARAMETER(engine);
-	UNREFERENCED_PARAMETER(outputMem);
-	UNREFERENCED_PARAMETER(length);
-	UNREFERENCED_PARAMETER(timeout);
-	UNREFERENCED_PARAMETER(bytesRead);
-	return 0;
+    UNREFERENCED_PARAMETER(engine);
+    UNREFERENCED_PARAMETER(request);
+    UNREFERENCED_PARAMETER(length);
+    return STATUS_NOT_SUPPORTED;
+#endif
+}
+
+VOID EngineGetLiteStats(IN ADMA_ENGINE* engine, OUT ADMA_LITE_STATS* stats) {
+    ASSERTMSG("argument engine is NULL!", engine != NULL);
+    ASSERTMSG("argument stats is NULL!", stats != NULL);
+
+    *stats = engine->lite.stats;
+}
+
+NTSTATUS ADMA_EngineSetLiteThreshold(ADMA_ENGINE* engine, size_t threshold) {
+
+    EXPECT(engine != NULL);
+
+#if defined(ALTERA_ARRIA10)
+    UINT32 maxSize = engine->lite.stats.maxSize;
+    LONGLONG tickFrequency = engine->lite.stats.tickFrequency;
+    RtlZeroMemory(&engine->lite.stats, sizeof(engine->lite.stats));
+    engine->lite.stats.tickFrequency = tickFrequency;
+    engine->lite.stats.maxSize = maxSize;
+    engine->lite.stats.threshold = (UINT32)min(threshold, ADMA_LITE_SLOT_SIZE);
+    return STATUS_SUCCESS;
+#else
+    // the dispatcher needs an a2p window per transfer anyway, there is no setup to save
+    return (threshold == 0) ? STATUS_SUCCESS : STATUS_NOT_SUPPORTED;
 #endif
 }
 
@@ -1028,85 +1961,134 @@ static NTSTATUS EngineCreatePollWriteBackBuffer(IN OUT ADMA_ENGINE *engine) {
 
 NTSTATUS EnginePollTransfer(IN ADMA_ENGINE* engine) {
 
-    ADMA_POLL_WB* writeback_data = (ADMA_POLL_WB*)WdfCommonBufferGetAlignedVirtualAddress(engine->pollWbBuffer);
-    const ULONG expected = engine->numDescriptors;
-    volatile ULONG actual = 0;
-
-    do {
-        actual = writeback_data->completedDescCount;
-
-        if (actual & ADMA_WB_ERR_MASK) {
-            TraceError(DBG_DMA, "error on writeback %u", actual);
-            return STATUS_INTERNAL_ERROR;
-        }
-        actual &= ADMA_WB_COUNT_MASK;
+    LARGE_INTEGER frequency;
+    LONGLONG start = KeQueryPerformanceCounter(&frequency).QuadPart;
+    LONGLONG budget = (frequency.QuadPart * engine->pollBudgetUs) / 1000000;
+    BOOLEAN done;
 
-        if (actual > expected) {
-            actual = expected | ADMA_WB_ERR_MASK;
+    // the same completion routine as the dpc, whichever sees the transfer done first completes it
+    for (;;) {
+#if defined(ALTERA_ARRIA10)
+        EngineProcessDescRing(engine); // spins on the status word of the last descriptor
+        done = (engine->descRing.pending == 0);
+#else
+        EngineProcessResponses(engine); // drains the response fifo or the prefetcher write back
+        done = !engine->transferPending;
+#endif
+        if (done || ((KeQueryPerformanceCounter(NULL).QuadPart - start) >= budget)) {
+            break;
         }
-    } while (expected != actual);
-
-    TraceVerbose(DBG_DMA, "%u descriptors completed", actual);
+        YieldProcessor();
+    }
 
-    EngineProcessTransfer(engine);
+    if (done) {
+        InterlockedIncrement64((volatile LONG64*)&engine->pollStats.polled);
+    } else {
+        // a long transfer, stop burning the cpu and let the interrupt complete it
+        InterlockedIncrement64((volatile LONG64*)&engine->pollStats.fallbacks);
+        TraceVerbose(DBG_DMA, "%s_%u poll budget of %uus exceeded, waiting for interrupt",
+                     DirectionToString(engine->dir), engine->channel, engine->pollBudgetUs);
+        EngineSetInterrupt(engine, TRUE);
+    }
 
     return STATUS_SUCCESS;
 }
 
 NTSTATUS EnginePollRing(IN ADMA_ENGINE* engine) {
-    ADMA_POLL_WB* writeback_data = (ADMA_POLL_WB*)WdfCommonBufferGetAlignedVirtualAddress(engine->pollWbBuffer);
-    volatile ULONG completed = 0;
-    volatile UINT eopCount = 0;
-    UINT tryCount = 0;
-    do {
-        completed = writeback_data->completedDescCount;
 
+    LARGE_INTEGER frequency;
+    LONGLONG start = KeQueryPerformanceCounter(&frequency).QuadPart;
+    LONGLONG budget = (frequency.QuadPart * engine->pollBudgetUs) / 1000000;
 
-        if (completed & ADMA_WB_ERR_MASK) {
-            TraceError(DBG_DMA, "error on writeback %u", completed);
-            return STATUS_INTERNAL_ERROR;
+    // spin while the ring is empty, past the budget the reader waits for the completion signal
+    while ((EngineProcessRing(engine) == 0) && (engine->ring.head == engine->ring.tail)) {
+        if ((KeQueryPerformanceCounter(NULL).QuadPart - start) >= budget) {
+            InterlockedIncrement64((volatile LONG64*)&engine->pollStats.fallbacks);
+            return STATUS_SUCCESS;
         }
-        if (completed) {
-            eopCount = EngineProcessRing(engine);
-            TraceVerbose(DBG_DMA, "complete=%u, eop=%u", completed, eopCount);
-        }
-        tryCount++;
-        if (tryCount >= 100000) {
-            break;
-        }
-
-    } while (!eopCount);
-
-    TraceVerbose(DBG_DMA, "complete=%u, eop=%u, tryCount=%u", completed, eopCount, tryCount);
+        YieldProcessor();
+    }
 
+    InterlockedIncrement64((volatile LONG64*)&engine->pollStats.polled);
     return STATUS_SUCCESS;
 }
 
 //========================= performance counters interface ========================================
 
+static UINT64 EnginePerfTicksToNs(IN LONGLONG ticks, IN LONGLONG frequency) {
+    // split to keep hours of ticks times 10^9 within 64 bit
+    return ((UINT64)(ticks / frequency) * 1000000000ULL) +
+           (((UINT64)(ticks % frequency) * 1000000000ULL) / (UINT64)frequency);
+}
+
+static void EngineSamplePerf(IN ADMA_ENGINE *engine, IN UINT64 bytes, IN UINT64 transfers,
+                             IN LONGLONG start)
+// fold a completion into the performance counters, the engine counts as busy from start, the
+// time it was programmed, or since the previous completion if start is 0 or earlier than that
+{
+    LONGLONG now = KeQueryPerformanceCounter(NULL).QuadPart;
+    WdfSpinLockAcquire(engine->perf.lock);
+    if (engine->perf.running) {
+        // requests in flight together complete in order, their overlap is counted once
+        LONGLONG from = max(start, engine->perf.lastEnd);
+        if (now > from) {
+            engine->perf.busyTicks += now - from;
+        }
+        engine->perf.lastEnd = now;
+        engine->perf.samples++;
+        engine->perf.bytes += bytes;
+        engine->perf.transfers += transfers;
+    }
+    WdfSpinLockRelease(engine->perf.lock);
+}
+
 void EngineStartPerf(IN ADMA_ENGINE* engine) {
-	UNREFERENCED_PARAMETER(engine);
-#if 0
     ASSERTMSG("argument engine is NULL!", engine != NULL);
 
-    // Automatically stops performance counters when a descriptor with the stop bit is completed.
-    engine->regs->perfCtrl = ADMA_PERF_CLEAR;
-    engine->regs->perfCtrl = ADMA_PERF_AUTO | ADMA_PERF_RUN;
-#endif
+    WdfSpinLockAcquire(engine->perf.lock);
+    engine->perf.busyTicks = 0;
+    engine->perf.bytes = 0;
+    engine->perf.transfers = 0;
+    engine->perf.samples = 0;
+    engine->perf.startTicks = KeQueryPerformanceCounter(NULL).QuadPart;
+    engine->perf.stopTicks = engine->perf.startTicks;
+    engine->perf.lastEnd = engine->perf.startTicks;
+    engine->perf.running = TRUE;
+    WdfSpinLockRelease(engine->perf.lock);
 }
 
-void EngineGetPerf(IN ADMA_ENGINE* engine, OUT ADMA_PERF_DATA* perfData) {
-    TraceVerbose(DBG_DMA, "cycleCount=0x%08x%08x dataCount=0x%08x%08x pendingCount=0x%08x%08x",
-                 engine->regs->perfCycHi, engine->regs->perfCycLo,
-                 engine->regs->perfDatHi, engine->regs->perfDatLo,
-                 engine->regs->perfPndHi, engine->regs->perfPndLo);
+void EngineStopPerf(IN ADMA_ENGINE* engine) {
+    ASSERTMSG("argument engine is NULL!", engine != NULL);
 
+    WdfSpinLockAcquire(engine->perf.lock);
+    if (engine->perf.running) {
+        engine->perf.stopTicks = KeQueryPerformanceCounter(NULL).QuadPart;
+        engine->perf.running = FALSE;
+    }
+    WdfSpinLockRelease(engine->perf.lock);
+}
+
+void EngineGetPerf(IN ADMA_ENGINE* engine, OUT ADMA_PERF_DATA* perfData) {
     ASSERTMSG("argument engine is NULL!", engine != NULL);
     ASSERTMSG("argument perfData is NULL!", perfData != NULL);
 
-    perfData->clockCycleCount = ((UINT64)engine->regs->perfCycHi << 32) + engine->regs->perfCycLo;
-    perfData->dataCycleCount = ((UINT64)engine->regs->perfDatHi << 32) + engine->regs->perfDatLo;
-    perfData->pendingCount = ((UINT64)engine->regs->perfPndHi << 32) + engine->regs->perfPndHi;
+    WdfSpinLockAcquire(engine->perf.lock);
+    LONGLONG end = engine->perf.running ? KeQueryPerformanceCounter(NULL).QuadPart
+                                        : engine->perf.stopTicks;
+    LONGLONG elapsed = end - engine->perf.startTicks;
+    LONGLONG idle = (elapsed > engine->perf.busyTicks) ? (elapsed - engine->perf.busyTicks) : 0;
+    perfData->elapsedNs = EnginePerfTicksToNs(elapsed, engine->pollStats.tickFrequency);
+    perfData->busyNs = EnginePerfTicksToNs(engine->perf.busyTicks, engine->pollStats.tickFrequency);
+    perfData->idleNs = EnginePerfTicksToNs(idle, engine->pollStats.tickFrequency);
+    perfData->bytes = engine->perf.bytes;
+    perfData->transfers = engine->perf.transfers;
+    perfData->samples = engine->perf.samples;
+    perfData->running = engine->perf.running ? 1 : 0;
+    WdfSpinLockRelease(engine->perf.lock);
+
+    TraceVerbose(DBG_DMA, "%s_%u elapsedNs=%llu busyNs=%llu idleNs=%llu bytes=%llu",
+                 DirectionToString(engine->dir), engine->channel, perfData->elapsedNs,
+                 perfData->busyNs, perfData->idleNs, perfData->bytes);
 }
 
 void ADMA_EngineSetPollMode(ADMA_ENGINE* engine, BOOLEAN pollMode) {
@@ -1114,15 +2096,114 @@ void ADMA_EngineSetPollMode(ADMA_ENGINE* engine, BOOLEAN pollMode) {
     EXPECT(engine != NULL);
 
     if (engine->enabled == TRUE) {
-        if (pollMode) {
-            //EngineDisableInterrupt(engine);
-            engine->regs->controlW1S = ADMA_CTRL_POLL_MODE;
-            engine->regs->controlW1C = ADMA_CTRL_IE_ALL;
-        } else {
-            engine->regs->controlW1C = ADMA_CTRL_POLL_MODE;
-            engine->regs->controlW1S = ADMA_CTRL_IE_ALL;
-            //EngineEnableInterrupt(engine);
-        }
+        // the arria10 msi cannot be masked per engine, there the dpc merely finds nothing left
+        EngineSetInterrupt(engine, !pollMode);
         engine->poll = pollMode;
+        engine->pollStats.pollMode = pollMode ? 1 : 0;
     }
-}
\ No newline at end of file
+}
+
+void ADMA_EngineSetPollBudget(ADMA_ENGINE* engine, ULONG budgetUs) {
+
+    EXPECT(engine != NULL);
+
+    engine->pollBudgetUs = budgetUs ? budgetUs : ADMA_POLL_DEFAULT_BUDGET_US;
+    LONGLONG tickFrequency = engine->pollStats.tickFrequency;
+    RtlZeroMemory(&engine->pollStats, sizeof(engine->pollStats));
+    engine->pollStats.tickFrequency = tickFrequency;
+    engine->pollStats.budgetUs = engine->pollBudgetUs;
+    engine->pollStats.pollMode = engine->poll ? 1 : 0;
+}
+
+#if !defined(ALTERA_ARRIA10)
+static BOOLEAN EnginePrefetchListFits(IN ADMA_ENGINE *engine)
+// the descriptor list gets a window of its own which is never recycled
+{
+    ADMA_A2P_WINDOWS *a2p = &engine->a2p;
+    PHYSICAL_ADDRESS listLA = WdfCommonBufferGetAlignedLogicalAddress(engine->prefetch.buffer);
+    UINT64 listOffset = listLA.QuadPart & (a2p->windowSize - 1);
+    if ((a2p->numWindows < 2) ||
+        ((listOffset + WdfCommonBufferGetLength(engine->prefetch.buffer)) > a2p->windowSize)) {
+        TraceError(DBG_DMA, "%s_%u no a2p window for the descriptor list (windows=%u size=0x%llx)",
+                   DirectionToString(engine->dir), engine->channel, a2p->numWindows,
+                   a2p->windowSize);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void EngineSwitchDescMode(IN ADMA_ENGINE *engine, IN ULONG mode)
+// reserve or return the descriptor list window, the prefetcher has been stopped
+{
+    PADMA_DEVICE adma = engine->parentDevice;
+    ADMA_A2P_WINDOWS *a2p = &engine->a2p;
+    if (mode == ADMA_DESC_MODE_PREFETCHER) {
+        PHYSICAL_ADDRESS listLA = WdfCommonBufferGetAlignedLogicalAddress(engine->prefetch.buffer);
+        UINT64 listBase = listLA.QuadPart & ~(a2p->windowSize - 1);
+        UINT64 listOffset = listLA.QuadPart - listBase;
+        ADMA_A2P_WINDOW *window = &a2p->window[--a2p->numWindows];
+        window->valid = FALSE;
+        volatile ADMA_A2P_ENTRY *entry = &adma->a2pTransTbl->entry[window->entry];
+        entry->a2pAddrLo = (LIMIT_TO_32(listBase) & adma->a2pMask) | ADMA_A2P_ADDR_SPACE_64;
+        entry->a2pAddrHi = LIMIT_TO_32(listBase >> 32);
+        engine->prefetch.avalonBase = LIMIT_TO_32(ADMA_A2P_TXS_BASE +
+            (window->entry * a2p->windowSize) + listOffset);
+        engine->prefetch.first = 0;
+        engine->prefetch.count = 0;
+        engine->prefetch.done = 0;
+    } else {
+        a2p->window[a2p->numWindows++].valid = FALSE;
+    }
+    a2p->stats.numWindows = a2p->numWindows;
+
+    LONGLONG tickFrequency = engine->programStats.tickFrequency;
+    RtlZeroMemory(&engine->programStats, sizeof(engine->programStats));
+    engine->programStats.tickFrequency = tickFrequency;
+    engine->programStats.descMode = mode;
+}
+#endif
+
+NTSTATUS ADMA_EngineSetDescMode(ADMA_ENGINE* engine, ULONG mode) {
+
+    EXPECT(engine != NULL);
+
+#if defined(ALTERA_ARRIA10)
+    // the arria10 descriptor controller always fetches its descriptor table from host memory
+    UNREFERENCED_PARAMETER(mode);
+    return STATUS_NOT_SUPPORTED;
+#else
+    if ((mode != ADMA_DESC_MODE_DISPATCHER) && (mode != ADMA_DESC_MODE_PREFETCHER)) {
+        return STATUS_INVALID_PARAMETER;
+    }
+    ADMA_DISPATCHER *dispatcher = engine->dispatcher;
+    if (mode == dispatcher->descMode) {
+        return STATUS_SUCCESS;
+    }
+    // the csr and the prefetcher are the channel's, idle covers both directions
+    if (!EngineIsIdle(engine)) {
+        TraceError(DBG_DMA, "channel %u busy, cannot change descriptor mode", engine->channel);
+        return STATUS_DEVICE_BUSY;
+    }
+
+    // H2C and C2H feed the same dispatcher, switch both or none
+    ADMA_ENGINE *engines = engine->parentDevice->engines[engine->channel];
+    if (mode == ADMA_DESC_MODE_PREFETCHER) {
+        for (UINT dir = H2C; dir < ADMA_NUM_DIRECTIONS; dir++) {
+            if (engines[dir].enabled && !EnginePrefetchListFits(&engines[dir])) {
+                return STATUS_NOT_SUPPORTED;
+            }
+        }
+    }
+    engine->modSgdmaPrefetcher->control = 0;
+    for (UINT dir = H2C; dir < ADMA_NUM_DIRECTIONS; dir++) {
+        if (engines[dir].enabled) {
+            EngineSwitchDescMode(&engines[dir], mode);
+        }
+    }
+    dispatcher->descMode = mode;
+
+    TraceInfo(DBG_DMA, "channel %u descriptor mode %s", engine->channel,
+              mode == ADMA_DESC_MODE_PREFETCHER ? "prefetcher" : "dispatcher");
+    return STATUS_SUCCESS;
+#endif
+}
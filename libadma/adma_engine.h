@@ -21,19 +21,31 @@
 #include <wdf.h>
 #include "areg.h"
 #include "adma_public.h"
+#include "adma_desc_ring.h"
 
 // ========================= constants ============================================================
 
-#define ADMA_MAX_NUM_CHANNELS   (1)
+#define ADMA_MAX_NUM_CHANNELS   (4) // dma controllers/dispatchers behind the config bar, probed
 #define ADMA_NUM_DIRECTIONS     (2)
 #define ADMA_MAX_CHAN_IRQ       (ADMA_NUM_DIRECTIONS * ADMA_MAX_NUM_CHANNELS)
-#define ADMA_RING_NUM_BLOCKS    (258U)
+#define ADMA_RING_NUM_BLOCKS    (ADMA_MAX_DESCRIPTOR_NUM) // one block per descriptor of the table
 #define ADMA_RING_BLOCK_SIZE    (PAGE_SIZE)
 //#define ADMA_MAX_TRANSFER_SIZE  (8UL * 1024UL * 1024UL)
 #define ADMA_MAX_DESCRIPTOR_NUM	(128UL)
 #define ADMA_DESCRIPTOR_OFFSET	(0x200)
-#define ADMA_ONE_DESCRIPTOR_MAX_TRANS_SIZE (1024UL * 1024UL - 4UL)
-#define ADMA_MAX_TRANSFER_SIZE  (ADMA_MAX_DESCRIPTOR_NUM * PAGE_SIZE)//(ADMA_MAX_DESCRIPTOR_NUM * ADMA_ONE_DESCRIPTOR_MAX_TRANS_SIZE)
+#define ADMA_ONE_DESCRIPTOR_MAX_TRANS_SIZE (1024UL * 1024UL - 4UL) // 18 bit dword count
+#define ADMA_MAX_TRANSFER_SIZE  (ADMA_MAX_DESCRIPTOR_NUM * ADMA_ONE_DESCRIPTOR_MAX_TRANS_SIZE)
+#define ADMA_A2P_MAX_WINDOWS    (32U) // per engine, the table is partitioned between all engines
+#define ADMA_A2P_DRAIN_TIMEOUT_US (10000U)
+#define ADMA_DESCRIPTOR_ID_SHIFT (18) // descriptor id above the dword count in the control word
+#define ADMA_DESC_FIFO_TIMEOUT_US (10000U)
+#define ADMA_DESC_FIFO_DEPTH    (128U) // dispatcher descriptor fifo, as configured in platform designer
+#define ADMA_RESPONSE_DISPATCH_TIMEOUT (1UL << 31) // driver's own response error, hw uses bits [8:0]
+#define ADMA_POLL_DEFAULT_BUDGET_US (50U) // spin for completion before falling back to the interrupt
+#define ADMA_RING_WAIT_SLICE_US (1000U) // the msi only follows the last armed descriptor, re-check
+#define ADMA_LITE_SLOT_SIZE     (16UL * 1024UL) // largest transfer of the lite path
+#define ADMA_LITE_DEFAULT_THRESHOLD (4UL * 1024UL)
+#define ADMA_PREFETCH_NUM_DESC  (PAGE_SIZE / sizeof(ADMA_MODULAR_SGDMA_PREFETCH_DESCRIPTOR) - 1)
 
 // ========================= forward declarations =================================================
 
@@ -49,17 +61,99 @@ typedef enum DirToDev_t {
     C2H = 1  // Card-to-Host - read from device
 } DirToDev;
 
-/// Ring buffer abstraction for streaming DMA
+/// Ring buffer abstraction for streaming DMA. On the arria10 block i is filled by descriptor i of
+/// the engine's table, hw owns the blocks from tail up to lastPtr, the reader those from head up
+/// to tail.
 typedef struct ADMA_RING_T {
-    WDFCOMMONBUFFER results;
     PMDL mdl[ADMA_RING_NUM_BLOCKS]; // memory descriptor list - host side
     CHAR dmaTransferContext[DMA_TRANSFER_CONTEXT_SIZE_V1];
-    UINT head;
-    UINT tail;
+    UINT head;          // next block to hand to the reader
+    UINT tail;          // next block hw completes
+    ULONG headOffset;   // bytes of the head block already read
+    ULONG lastPtr;      // last descriptor armed
+    UINT64 cardAddress; // avalon address the stream is read from
     WDFSPINLOCK lock;
     KEVENT completionSignal;
 }ADMA_RING, *PADMA_RING;
 
+/// One Avalon-MM to PCIe translation window owned by an engine
+typedef struct ADMA_A2P_WINDOW_T {
+    UINT64 base;        // host bus address mapped by the window (window size aligned)
+    ULONG entry;        // index into the A2P translation table
+    ULONG lastUse;      // lru stamp
+    ULONG generation;   // transfer which last referenced the window
+    BOOLEAN valid;
+} ADMA_A2P_WINDOW;
+
+/// Translation windows of one engine. Windows stay mapped across requests and are recycled in
+/// least recently used order, a window referenced by the transfer being programmed is never
+/// recycled without draining the dispatcher first.
+typedef struct ADMA_A2P_WINDOWS_T {
+    ADMA_A2P_WINDOW window[ADMA_A2P_MAX_WINDOWS];
+    ULONG numWindows;
+    UINT64 windowSize;
+    ULONG clock;        // lru clock
+    ULONG generation;   // incremented for every programmed transfer
+    ADMA_A2P_STATS stats;
+} ADMA_A2P_WINDOWS;
+
+/// Linked descriptor list in host memory for the mSGDMA descriptor prefetcher. The list is rebuilt
+/// from the first slot for every transfer, the slot behind the last usable one is never owned by
+/// hw and terminates the chain when the list is full.
+typedef struct ADMA_PREFETCH_T {
+    WDFCOMMONBUFFER buffer;
+    ADMA_MODULAR_SGDMA_PREFETCH_DESCRIPTOR *desc;
+    UINT32 avalonBase;  // avalon address of desc[0] through the reserved a2p window
+    ULONG first;        // first descriptor not yet handed to the prefetcher
+    ULONG count;        // descriptors built
+    ULONG done;         // first descriptor not yet seen written back by hw
+} ADMA_PREFETCH;
+
+/// Progress of a transaction on the arria10 descriptor ring. Its scatter/gather list is programmed
+/// in parts of up to ADMA_DESC_RING_DESC_PER_REQUEST descriptors, one part in flight at a time.
+typedef struct ADMA_RING_TRANSFER_T {
+    WDFDMATRANSACTION transaction;
+    PSCATTER_GATHER_LIST sgList;
+    ULONG element;          // next scatter/gather element to program
+    ULONG offset;           // bytes of it already programmed
+    LONGLONG deviceOffset;  // card address of the next part
+    BOOLEAN toDevice;
+    LONGLONG start;         // performance counter when the transfer was programmed
+    LONGLONG arrival;       // performance counter when the request took the transaction
+} ADMA_RING_TRANSFER;
+
+/// A request copied through a pre-mapped piece of the lite buffer. It takes a single descriptor on
+/// the arria10 descriptor ring and no dma transaction.
+typedef struct ADMA_LITE_SLOT_T {
+    WDFREQUEST request;
+    size_t length;
+    LONGLONG arrival;       // performance counter when the request arrived
+    volatile LONG busy;
+} ADMA_LITE_SLOT;
+
+/// Small transfer fast path of an engine, one slot for every request the ring keeps in flight
+typedef struct ADMA_LITE_T {
+    WDFCOMMONBUFFER buffer; // ADMA_DESC_RING_MAX_REQUESTS slots of ADMA_LITE_SLOT_SIZE bytes
+    PUCHAR data;
+    PHYSICAL_ADDRESS dataLA;
+    ADMA_LITE_SLOT slot[ADMA_DESC_RING_MAX_REQUESTS];
+    ADMA_LITE_STATS stats;
+} ADMA_LITE;
+
+/// Performance counters of an engine between IOCTL_ADMA_PERF_START and IOCTL_ADMA_PERF_STOP. The
+/// busy time is taken from host timestamps, from programming to completion of each transfer.
+typedef struct ADMA_PERF_T {
+    WDFSPINLOCK lock;
+    BOOLEAN running;
+    LONGLONG startTicks;    // performance counter at start
+    LONGLONG stopTicks;     // performance counter at stop
+    LONGLONG lastEnd;       // performance counter at the last completion
+    LONGLONG busyTicks;     // performance counter ticks with a transfer outstanding
+    UINT64 bytes;
+    UINT64 transfers;
+    UINT64 samples;
+} ADMA_PERF;
+
 /// engine specific work to perform after dma transfer completion is detected
 typedef VOID(*PFN_ADMA_ENGINE_WORK)(IN struct ADMA_ENGINE_T *engine);
 
@@ -81,6 +175,15 @@ typedef enum EngineType_t {
     EngineType_ST,      // Streaming
 } EngineType;
 
+/// A channel's modular SGDMA dispatcher. H2C and C2H of the channel share its csr, response fifo,
+/// prefetcher and msi, so the interrupt enable is kept here, under the lock of that interrupt.
+typedef struct ADMA_DISPATCHER_T {
+    WDFINTERRUPT interrupt; // the channel's vector, or the line interrupt serving all channels
+    UINT32 csrControl;      // shadow of the csr control, interrupt enable without an mmio read
+    UINT32 irqEngines;      // BIT_N(dir) of the engines waiting for the interrupt
+    ULONG descMode;         // ADMA_DESC_MODE_DISPATCHER or ADMA_DESC_MODE_PREFETCHER, of both engines
+} ADMA_DISPATCHER;
+
 /// DMA engine abstraction
 typedef struct ADMA_ENGINE_T {
 
@@ -94,6 +197,8 @@ typedef struct ADMA_ENGINE_T {
 	volatile ADMA_MODULAR_SGDMA_STANDARD_DESCRIPTOR *modSgdmaStdDes;
 	volatile ADMA_MODULAR_SGDMA_EXTEND_DESCRIPTOR *modSgdmaExtDes;
 	volatile ADMA_MODULAR_SGDMA_RESPONSE *modSgdmaResponse;
+	volatile ADMA_MODULAR_SGDMA_PREFETCHER *modSgdmaPrefetcher;
+	ADMA_DISPATCHER *dispatcher; // shared with the other direction of the channel
 
     // engine configuration
     UINT32 irqBitMask;
@@ -111,6 +216,13 @@ typedef struct ADMA_ENGINE_T {
     WDFDMATRANSACTION dmaTransaction;
     PFN_ADMA_ENGINE_WORK work; // engine work for interrupt processing
 
+    // arria10 descriptor table shared by the requests in flight
+    ADMA_DESC_RING descRing;
+    WDFSPINLOCK descRingLock;
+    WDFDMATRANSACTION transactions[ADMA_DESC_RING_MAX_REQUESTS];
+    ADMA_RING_TRANSFER ringTransfers[ADMA_DESC_RING_MAX_REQUESTS]; // same index as transactions
+    volatile LONG transactionBusy[ADMA_DESC_RING_MAX_REQUESTS];
+
     // specific to streaming interface
     ADMA_RING ring;
 
@@ -118,6 +230,33 @@ typedef struct ADMA_ENGINE_T {
     ULONG poll;
     WDFCOMMONBUFFER pollWbBuffer; // buffer for holding poll mode descriptor writeback data
     ULONG numDescriptors; // keep count of descriptors in transfer for poll mode
+    ULONG pollBudgetUs;
+    ADMA_POLL_STATS pollStats;
+
+    // mSGDMA transfer completion
+    volatile BOOLEAN transferPending;   // all descriptors of the transfer are delivered
+    LONGLONG transferStart;             // performance counter when the transfer was programmed
+    ULONG numResponses;                 // descriptors answered by hw
+    UINT32 responseErrors;              // or-ed response status
+    volatile LONG serviceBusy;          // completion is being processed, by poll or dpc
+    size_t fragmentBytes;               // bytes queued for the fragment
+    BOOLEAN fragmentShort;              // the descriptor fifo took only part of the sg list
+    volatile LONG programFailed;        // EvtProgramDma finished the transaction with an error
+    ADMA_MODULAR_SGDMA_STANDARD_DESCRIPTOR held; // dispatcher descriptor not yet written
+    BOOLEAN dispatchHeld;
+
+    // avalon-mm to pcie address translation
+    ADMA_A2P_WINDOWS a2p;
+
+    // descriptor delivery, the mode is kept in the dispatcher
+    ADMA_PREFETCH prefetch;
+    ADMA_PROGRAM_STATS programStats;
+
+    // performance counters
+    ADMA_PERF perf;
+
+    // small transfer fast path
+    ADMA_LITE lite;
 } ADMA_ENGINE;
 
 #pragma pack(1)
@@ -155,6 +294,8 @@ typedef struct {
 
 #pragma pack()
 
+C_ASSERT(ADMA_DESC_RING_SIZE == ADMA_MAX_DESCRIPTOR_NUM);
+
 // ========================= function declarations ================================================
 
 struct ADMA_DEVICE_T;
@@ -166,6 +307,12 @@ NTSTATUS ProbeEngines(IN PADMA_DEVICE adma);
 // Assign interrupt add by zhuce
 NTSTATUS EnginesAssignInterrupt(IN PADMA_DEVICE adma);
 
+/// Take an unused dma transaction of the engine's pool, NULL if all are in flight
+WDFDMATRANSACTION EngineAcquireTransaction(IN ADMA_ENGINE *engine);
+
+/// Return a dma transaction to the engine's pool
+VOID EngineReleaseTransaction(IN ADMA_ENGINE *engine, IN WDFDMATRANSACTION transaction);
+
 /// Start the DMA engine
 /// The transfer descriptors should be initialized and bound to HW before calling this function
 VOID EngineStart(IN ADMA_ENGINE *engine);
@@ -173,34 +320,62 @@ VOID EngineStart(IN ADMA_ENGINE *engine);
 /// Stop the DMA engine
 VOID EngineStop(IN ADMA_ENGINE *engine);
 
-/// Configure the streaming ring buffer and start the cyclic DMA transfer
+/// Drop data left in the streaming ring and arm all free blocks for the cyclic DMA transfer
 VOID EngineRingSetup(IN ADMA_ENGINE *engine);
 
-/// Reset the streaming ring buffer and stop the cyclic DMA transfer
+/// Drop data left in the streaming ring and stop re-arming its blocks
 VOID EngineRingTeardown(IN ADMA_ENGINE *engine);
 
-/// Poll the write-back buffer for DMA transfer completion
+/// Complete the request of a transaction which EvtProgramDma had to finish with an error, called
+/// after WdfDmaTransactionExecute returned. FALSE if the transfer is under way (modular SGDMA)
+BOOLEAN EngineCompleteProgramError(IN ADMA_ENGINE *engine);
+
+/// Spin for the completion of the transfer just programmed, at most pollBudgetUs. Past the budget
+/// the engine interrupt is enabled and completes the transfer instead.
 NTSTATUS EnginePollTransfer(IN ADMA_ENGINE* engine);
 
-/// Poll the write-back buffer for DMA transfer completion
+/// Spin on the descriptor status words of the streaming ring for new data, at most pollBudgetUs
 NTSTATUS EnginePollRing(IN ADMA_ENGINE* engine);
 
-/// enable the engines interrupt
+/// enable the engines interrupt, with the lock of engine->dispatcher->interrupt held
 VOID EngineEnableInterrupt(IN ADMA_ENGINE* engine);
 
-/// disable the engines interrupt
+/// disable the engines interrupt, the dispatcher keeps it enabled while the other direction waits.
+/// call with the lock of engine->dispatcher->interrupt held
 VOID EngineDisableInterrupt(IN ADMA_ENGINE* engine);
 
-/// Arm the performance counters of the ADMA engine
-/// Automatically stops when a dma descriptor with the stop bit is completed
+/// enable or disable the engines interrupt from outside the interrupt callbacks
+VOID EngineSetInterrupt(IN ADMA_ENGINE* engine, IN BOOLEAN enable);
+
+/// Clear and start the performance counters of the ADMA engine
 VOID EngineStartPerf(IN ADMA_ENGINE* engine);
 
-/// Get the performance counters 
+/// Stop the performance counters, they keep their values until the next start
+VOID EngineStopPerf(IN ADMA_ENGINE* engine);
+
+/// Get the performance counters, up to the current time while they run
 VOID EngineGetPerf(IN ADMA_ENGINE* engine, OUT ADMA_PERF_DATA* perfData);
 
+/// Get the address translation window statistics
+VOID EngineGetA2pStats(IN ADMA_ENGINE* engine, OUT ADMA_A2P_STATS* stats);
+
+/// Get the host side programming cost counters
+VOID EngineGetProgramStats(IN ADMA_ENGINE* engine, OUT ADMA_PROGRAM_STATS* stats);
+
+/// Get the completion latency counters
+VOID EngineGetPollStats(IN ADMA_ENGINE* engine, OUT ADMA_POLL_STATS* stats);
+
+/// Start a request of at most lite.stats.threshold bytes through a lite slot. Fails with
+/// STATUS_DEVICE_BUSY if no slot or descriptor is free, the request is then still the caller's.
+NTSTATUS EngineLiteTransfer(IN ADMA_ENGINE *engine, IN WDFREQUEST request, IN size_t length);
+
+/// Get the lite path latency counters
+VOID EngineGetLiteStats(IN ADMA_ENGINE* engine, OUT ADMA_LITE_STATS* stats);
+
 /// Stringify the Engine direction (H2C/C2H)
 char* DirectionToString(DirToDev dir);
 
-/// Copy data from the ring buffer directly into a WDFMEMORY object
+/// Copy data from the ring buffer directly into a WDFMEMORY object. Returns what is available,
+/// waits up to the relative timeout only if the ring is empty.
 NTSTATUS EngineRingCopyBytesToMemory(IN ADMA_ENGINE *engine, WDFMEMORY outputMem,
                                      size_t length, LARGE_INTEGER timeout, size_t* bytesRead);
\ No newline at end of file
@@ -47,6 +47,11 @@ EVT_WDF_INTERRUPT_DISABLE    EvtUserInterruptDisable;
 
 // ====================== static setup functions =================================================
 
+static ULONG NumChannelVectors(IN PADMA_DEVICE adma) {
+    // H2C and C2H of a channel share one message, on the mSGDMA they also share the dispatcher
+    return adma->numChannels;
+}
+
 static UINT32 BuildVectorReg(UINT32 a, UINT32 b, UINT32 c, UINT32 d) {
     UINT32 reg_val = 0;
     reg_val |= (a & 0x1f) << 0;
@@ -250,9 +255,10 @@ static NTSTATUS SetupMultiMsiInterrupts(IN PADMA_DEVICE adma, IN WDFCMRESLIST Re
         }
         resource->u.MessageInterrupt.Raw.MessageCount = numVectors;
         resourceRaw->u.MessageInterrupt.Raw.MessageCount = numVectors;
-        // individual resource/msgId for each channel interrupt (H2C 0-3 and C2H 0-3)
+        // individual resource/msgId for each of the n channels, bound to the H2C engines 0..n-1 by
+        // EnginesAssignInterrupt, the channel dpc also services C2H
         //for (int n = 0; n < (2 * ADMA_MAX_NUM_CHANNELS); n++) {
-		for (int n = 0; n < ADMA_MAX_NUM_CHANNELS; n++) {//altera H2C/C2H share a interrupt
+		for (ULONG n = 0; n < NumChannelVectors(adma); n++) {
 			status = SetupChannelInterrupt(adma, n, resourceRaw, resource);
             if (!NT_SUCCESS(status)) {
                 TraceError(DBG_INIT, "Error in setup channel interrupt: %!STATUS!", status);
@@ -326,9 +332,11 @@ NTSTATUS EvtInterruptEnable(IN WDFINTERRUPT Interrupt, IN WDFDEVICE device) {
 	irq->regs->enable = 0xFFFF;
 
 	for (UINT dir = H2C; dir < 2; dir++) { // 0=H2C, 1=C2H
-		for (ULONG ch = 0; ch < ADMA_MAX_NUM_CHANNELS; ch++) {
+		for (ULONG ch = 0; ch < irq->adma->numChannels; ch++) {
 			ADMA_ENGINE* engine = &(irq->adma->engines[ch][dir]);
-			EngineEnableInterrupt(engine);
+			if (!engine->poll) {
+				EngineEnableInterrupt(engine);
+			}
 		}
 	}
 
@@ -349,7 +357,7 @@ NTSTATUS EvtInterruptDisable(IN WDFINTERRUPT Interrupt, IN WDFDEVICE device) {
 	IRQ_CONTEXT* irq = GetIrqContext(Interrupt);
 	irq->regs->enable = 0;
 	for (UINT dir = H2C; dir < 2; dir++) { // 0=H2C, 1=C2H
-		for (ULONG ch = 0; ch < ADMA_MAX_NUM_CHANNELS; ch++) {
+		for (ULONG ch = 0; ch < irq->adma->numChannels; ch++) {
 			ADMA_ENGINE* engine = &(irq->adma->engines[ch][dir]);
 			EngineDisableInterrupt(engine);
 		}
@@ -455,7 +463,15 @@ VOID EvtInterruptDpc(IN WDFINTERRUPT interrupt, IN WDFOBJECT device)
     irq->userIrqPending = 0x0;
     WdfInterruptReleaseLock(interrupt);
 #endif
-
+    // a single vector serves every channel, let each engine look for its completions
+    for (UINT dir = H2C; dir < ADMA_NUM_DIRECTIONS; dir++) {
+        for (ULONG ch = 0; ch < irq->adma->numChannels; ch++) {
+            ADMA_ENGINE* engine = &irq->adma->engines[ch][dir];
+            if (engine->enabled && (engine->work != NULL)) {
+                engine->work(engine);
+            }
+        }
+    }
 
     TraceVerbose(DBG_IRQ, "channel EN=0x%08X RQ=0x%08X",
                  irq->regs->enable, irq->regs->status);
@@ -499,11 +515,17 @@ BOOLEAN EvtChannelInterruptIsr(IN WDFINTERRUPT Interrupt, IN ULONG MessageID)
     PIRQ_CONTEXT irq = GetIrqContext(Interrupt);
 
     EXPECT(irq != NULL);
+    if (irq->engine == NULL) { // msi-x vector beyond the engines found
+        return FALSE;
+    }
 
     TraceVerbose(DBG_IRQ, "%s_%u interrupt occurred! messageId=%u",
                  DirectionToString(irq->engine->dir), irq->engine->channel, MessageID);
 
-    EngineDisableInterrupt(irq->engine);
+    // H2C and C2H of the channel share the vector, hold it off for both until the dpc ran
+    for (UINT dir = H2C; dir < ADMA_NUM_DIRECTIONS; dir++) {
+        EngineDisableInterrupt(&irq->adma->engines[irq->engine->channel][dir]);
+    }
 
     return WdfInterruptQueueDpcForIsr(Interrupt);   // schedule deferred work
 }
@@ -517,9 +539,23 @@ VOID EvtChannelInterruptDpc(IN WDFINTERRUPT interrupt, IN WDFOBJECT device)
     // do engine specific work (either EngineProcessTransfer (MM) or EngineProcessRing (ST))
     irq->engine->work(irq->engine);
 #endif
-    // reenable interrupt for this dma engine
+    // H2C and C2H of a channel share the interrupt, service both
+    for (UINT dir = H2C; dir < ADMA_NUM_DIRECTIONS; dir++) {
+        ADMA_ENGINE* engine = &irq->adma->engines[irq->engine->channel][dir];
+        if (engine->enabled && (engine->work != NULL)) {
+            engine->work(engine);
+        }
+    }
+    // reenable the interrupt for both engines, a poll mode engine only takes one after a spin ran
+    // out of budget. nobody spins for the next fragment of a split transaction, which the work
+    // above may just have programmed, so its interrupt stays enabled
     WdfInterruptAcquireLock(interrupt);
-    EngineEnableInterrupt(irq->engine);
+    for (UINT dir = H2C; dir < ADMA_NUM_DIRECTIONS; dir++) {
+        ADMA_ENGINE* engine = &irq->adma->engines[irq->engine->channel][dir];
+        if (engine->enabled && (!engine->poll || engine->transferPending)) {
+            EngineEnableInterrupt(engine);
+        }
+    }
     WdfInterruptReleaseLock(interrupt);
 }
 
@@ -606,9 +642,11 @@ NTSTATUS SetupInterrupts(IN PADMA_DEVICE adma,
     }
     TraceVerbose(DBG_INIT, "adma->numIrqResources=%u numMsiVectors=%u", numIrqResources, numMsiVectors);
 
-    if (numIrqResources >= ADMA_MAX_NUM_IRQ) { // msi-x
+    // a vector per channel, otherwise all channels share one
+    const ULONG numIrq = ADMA_MAX_USER_IRQ + NumChannelVectors(adma);
+    if (numIrqResources >= numIrq) { // msi-x
         status = SetupMsixInterrupts(adma, ResourcesRaw, ResourcesTranslated);
-    } else if (numMsiVectors >= ADMA_MAX_NUM_IRQ) { //multi-message MSI with enough contiguous vectors
+    } else if (numMsiVectors >= numIrq) { //multi-message MSI with enough contiguous vectors
         status = SetupMultiMsiInterrupts(adma, ResourcesRaw, ResourcesTranslated, numMsiVectors);
     } else { // Line or single-message MSI
         status = SetupSingleInterrupt(adma, ResourcesRaw, ResourcesTranslated);
@@ -42,10 +42,13 @@
 #define CONFIG_BLOCK_OFFSET 0 // change by zhuce (3 * BLOCK_OFFSET)
 #define SGDMA_BLOCK_OFFSET  (0x0)//(4 * BLOCK_OFFSET)
 #define SGDMA_COMMON_BLOCK_OFFSET (6 * BLOCK_OFFSET)
-#define ENGINE_OFFSET       (0x100UL)//for adma current no effect//(0x100UL)
+#define ENGINE_OFFSET       (2 * BLOCK_OFFSET)//channel stride, read and write descriptor controller of a channel
 
 
 #define A2P_TRANS_TBL_OFFSET				(0x1000)
+#define ADMA_A2P_MAX_ENTRIES				(512)
+#define ADMA_A2P_ADDR_SPACE_64				(0x1UL)
+#define ADMA_A2P_TXS_BASE					(0x0UL)//avalon address of the TXS slave as seen by the dispatcher
 #define ADMA_IRQ_REGS_OFFSET				(0x40)
 //bits of the SGDMA engine control register
 #define ADMA_CTRL_RUN_BIT                   (BIT_N(0))
@@ -98,11 +101,14 @@
 
 #define ADMA_RD_DTS_ADDR					(0x80000000UL)//add by zc
 #define ADMA_WR_DTS_ADDR					(0x80002000UL)//add by zc
+#define ADMA_DTS_CHANNEL_OFFSET				(0x4000UL)//descriptor table slaves of further channels follow at this stride
 
 //Cyclone IV
 #define MODULAR_SGDMA_DESCRIPTOR_REG_OFFSET			(0x6000020)
 #define MODULAR_SGDMA_CSR_REG_OFFSET				(0x6000000)
 #define MODULAR_SGDMA_RESPONSE_REG_OFFSET			(0x40c0)
+#define MODULAR_SGDMA_PREFETCHER_REG_OFFSET		(0x6000040)
+#define MODULAR_SGDMA_CHANNEL_OFFSET				(0x100)//further dispatchers (csr, descriptor, response, prefetcher) follow at this stride
 #define FRAME_BUFFER_REG_ADDR						(0x4040)
 #define CLOCK_VIDEO_REG_ADDR						(0x4000)
 
@@ -137,6 +143,24 @@
 #define DESCRIPTOR_CONTROL_EARLY_DONE_ENABLE_OFFSET      (24)
 #define DESCRIPTOR_CONTROL_GO_MASK                       (1UL<<31)  // at a minimum you always have to write '1' to this bit as it commits the descriptor to the dispatcher
 #define DESCRIPTOR_CONTROL_GO_OFFSET                     (31)
+#define DESCRIPTOR_CONTROL_OWNED_BY_HW_MASK              (1UL<<30)  // prefetcher descriptors only, cleared by hw on write back
+#define DESCRIPTOR_CONTROL_OWNED_BY_HW_OFFSET            (30)
+
+// masks for the prefetcher control register bits
+#define PREFETCHER_CONTROL_RUN_MASK             (1)
+#define PREFETCHER_CONTROL_RUN_OFFSET           (0)
+#define PREFETCHER_CONTROL_DESC_POLL_EN_MASK    (1<<1)
+#define PREFETCHER_CONTROL_DESC_POLL_EN_OFFSET  (1)
+#define PREFETCHER_CONTROL_RESET_MASK           (1<<2)
+#define PREFETCHER_CONTROL_RESET_OFFSET         (2)
+#define PREFETCHER_CONTROL_GLOBAL_INT_EN_MASK   (1<<3)
+#define PREFETCHER_CONTROL_GLOBAL_INT_EN_OFFSET (3)
+#define PREFETCHER_CONTROL_PARK_MODE_MASK       (1<<4)
+#define PREFETCHER_CONTROL_PARK_MODE_OFFSET     (4)
+
+// masks for the prefetcher status register bits
+#define PREFETCHER_STATUS_IRQ_MASK              (1)
+#define PREFETCHER_STATUS_IRQ_OFFSET            (0)
 
 // masks for the status register bits
 #define CSR_BUSY_MASK                           (1)
@@ -275,11 +299,16 @@ typedef struct {
     UINT32 creditModeEnableW1C; // 0x28
 } ADMA_SGDMA_COMMON_REGS, *PADMA_SGDMA_COMMON_REGS;
 
+/// Avalon-MM to PCIe address translation table (0x1000)
+/// Each entry maps one window of the TXS slave onto a host bus address. Only as many entries as
+/// address pages were configured in the IP are implemented, the rest read back as zero.
 typedef struct {
-	UINT32 a2pAddrLo0;
-	UINT32 a2pAddrHi0;
-	UINT32 a2pAddrLo1;
-	UINT32 a2pAddrHi1;
+	UINT32 a2pAddrLo; // bits [1:0] select the address space, see ADMA_A2P_ADDR_SPACE_64
+	UINT32 a2pAddrHi;
+} ADMA_A2P_ENTRY, *PADMA_A2P_ENTRY;
+
+typedef struct {
+	ADMA_A2P_ENTRY entry[ADMA_A2P_MAX_ENTRIES];
 } ADMA_A2P_TRANS_TBL, *PADMA_A2P_TRANS_TBL;
 
 // c4 sgdma dispatcher, for c4, descriptor is located on ep memory not in host memory
@@ -308,6 +337,27 @@ typedef struct {
 	UINT32 actualBytesTransferred;
 	UINT32 status;
 } ADMA_MODULAR_SGDMA_RESPONSE, *PADMA_MODULAR_SGDMA_RESPONSE;
+
+// descriptor prefetcher, fetches linked descriptors from host memory and feeds the dispatcher
+typedef struct {
+	UINT32 control;
+	UINT32 nextDescLo;
+	UINT32 nextDescHi;
+	UINT32 pollFrequency;
+	UINT32 status;
+} ADMA_MODULAR_SGDMA_PREFETCHER, *PADMA_MODULAR_SGDMA_PREFETCHER;
+
+// linked descriptor as read by the prefetcher (enhanced features off), located in host memory
+typedef struct {
+	UINT32 readAddress;
+	UINT32 writeAddress;
+	UINT32 transferLength;
+	UINT32 nextDescPtr;
+	UINT32 actualBytesTransferred; // written back by hw
+	UINT32 status;                 // written back by hw
+	UINT32 reserved;
+	UINT32 control;
+} ADMA_MODULAR_SGDMA_PREFETCH_DESCRIPTOR, *PADMA_MODULAR_SGDMA_PREFETCH_DESCRIPTOR;
 /*
 Enhanced features off:
 
@@ -79,7 +79,9 @@ static void DeviceDefaultInitialize(IN PXDMA_DEVICE xdma) {
     for (UINT32 i = 0; i < XDMA_MAX_NUM_BARS; i++) {
         xdma->bar[i] = NULL;
         xdma->barLength[i] = 0;
+        xdma->barStart[i].QuadPart = 0;
     }
+    xdma->bypassCacheType = MmNonCached;
     xdma->configBarIdx = 0;
     xdma->userBarIdx = -1;
     xdma->bypassBarIdx = -1;
@@ -94,6 +96,11 @@ static void DeviceDefaultInitialize(IN PXDMA_DEVICE xdma) {
         for (ULONG ch = 0; ch < XDMA_MAX_NUM_CHANNELS; ch++) {
             xdma->engines[ch][dir].enabled = FALSE;
             xdma->engines[ch][dir].poll = FALSE;
+            xdma->engines[ch][dir].bounce.buffer.va = NULL;
+            xdma->engines[ch][dir].bounce.threshold = 0;
+            xdma->engines[ch][dir].bounce.request = NULL;
+            xdma->engines[ch][dir].program.state = XDMA_PROGRAM_NONE;
+            xdma->engines[ch][dir].direct.busy = FALSE;
         }
     }
 
@@ -106,6 +113,31 @@ static void DeviceDefaultInitialize(IN PXDMA_DEVICE xdma) {
     }
 }
 
+// Allocate the engines on a cache line boundary, the device context only has the pool alignment.
+// The memory is kept when the hardware is prepared again.
+static NTSTATUS AllocateEngines(IN PXDMA_DEVICE xdma) {
+    const size_t size = XDMA_MAX_NUM_CHANNELS * sizeof(*xdma->engines);
+
+    if (xdma->engineMemory == NULL) {
+        WDF_OBJECT_ATTRIBUTES attribs;
+        WDF_OBJECT_ATTRIBUTES_INIT(&attribs);
+        attribs.ParentObject = xdma->wdfDevice;
+        PVOID buffer;
+        NTSTATUS status = WdfMemoryCreate(&attribs, NonPagedPoolNx, 0,
+                                          size + XDMA_CACHE_LINE_SIZE - 1, &xdma->engineMemory,
+                                          &buffer);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_INIT, "WdfMemoryCreate failed: %!STATUS!", status);
+            return status;
+        }
+        const ULONG_PTR aligned = ((ULONG_PTR)buffer + XDMA_CACHE_LINE_SIZE - 1) &
+            ~(ULONG_PTR)(XDMA_CACHE_LINE_SIZE - 1);
+        xdma->engines = (XDMA_ENGINE(*)[XDMA_NUM_DIRECTIONS])aligned;
+    }
+    RtlZeroMemory(xdma->engines, size);
+    return STATUS_SUCCESS;
+}
+
 // Iterate through PCIe resources and map BARS into host memory
 static NTSTATUS MapBARs(IN PXDMA_DEVICE xdma, IN WDFCMRESLIST ResourcesTranslated) {
 
@@ -121,6 +153,7 @@ static NTSTATUS MapBARs(IN PXDMA_DEVICE xdma, IN WDFCMRESLIST ResourcesTranslate
 
         if (resource->Type == CmResourceTypeMemory) {
             xdma->barLength[xdma->numBars] = resource->u.Memory.Length;
+            xdma->barStart[xdma->numBars] = resource->u.Memory.Start;
             xdma->bar[xdma->numBars] = MmMapIoSpace(resource->u.Memory.Start,
                                                     resource->u.Memory.Length, MmNonCached);
             if (xdma->bar[xdma->numBars] == NULL) {
@@ -196,10 +229,16 @@ NTSTATUS XDMA_DeviceOpen(WDFDEVICE wdfDevice,
 
     NTSTATUS status = STATUS_INTERNAL_ERROR;
 
-    DeviceDefaultInitialize(xdma);
-
     xdma->wdfDevice = wdfDevice;
 
+    status = AllocateEngines(xdma);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "AllocateEngines() failed! %!STATUS!", status);
+        return status;
+    }
+
+    DeviceDefaultInitialize(xdma);
+
     // map PCIe BARs to host memory
     status = MapBARs(xdma, ResourcesTranslated);
     if (!NT_SUCCESS(status)) {
@@ -251,6 +290,31 @@ NTSTATUS XDMA_DeviceOpen(WDFDEVICE wdfDevice,
     return status;
 }
 
+NTSTATUS XDMA_SetBypassWriteCombined(PXDMA_DEVICE xdma, BOOLEAN writeCombined) {
+
+    const MEMORY_CACHING_TYPE cacheType = writeCombined ? MmWriteCombined : MmNonCached;
+    if (xdma->bypassBarIdx < 0) {
+        return writeCombined ? STATUS_NOT_FOUND : STATUS_SUCCESS;
+    }
+    if (cacheType == xdma->bypassCacheType) {
+        return STATUS_SUCCESS;
+    }
+
+    // the same physical pages must not be mapped with conflicting cache attributes, so the kernel
+    // mapping is replaced before any user mapping can exist
+    const LONG idx = xdma->bypassBarIdx;
+    PVOID bar = MmMapIoSpace(xdma->barStart[idx], xdma->barLength[idx], cacheType);
+    if (bar == NULL) {
+        TraceError(DBG_INIT, "MmMapIoSpace returned NULL! for BAR%d", idx);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    MmUnmapIoSpace(xdma->bar[idx], xdma->barLength[idx]);
+    xdma->bar[idx] = bar;
+    xdma->bypassCacheType = cacheType;
+    TraceInfo(DBG_INIT, "bypass BAR%d remapped at 0x%08p, cacheType=%d", idx, bar, cacheType);
+    return STATUS_SUCCESS;
+}
+
 void XDMA_DeviceClose(PXDMA_DEVICE xdma) {
 
     // todo - stop every engine?
@@ -265,6 +329,17 @@ void XDMA_DeviceClose(PXDMA_DEVICE xdma) {
         xdma->interruptRegs->channelVector[1] = 0;
     }
 
+    // release the spill buffers, they are allocated again when the hardware is prepared
+    if (xdma && xdma->engines) {
+        for (UINT dir = H2C; dir < 2; dir++) { // 0=H2C, 1=C2H
+            for (ULONG ch = 0; ch < XDMA_MAX_NUM_CHANNELS; ch++) {
+                EngineFreeSpill(&xdma->engines[ch][dir]);
+            }
+        }
+    }
+
+    xdma->bypassCacheType = MmNonCached;
+
     // Unmap any I/O ports. Disconnecting from the interrupt will be done automatically by the framework.
     for (UINT i = 0; i < xdma->numBars; i++) {
         if (xdma->bar[i] != NULL) {
@@ -47,25 +47,34 @@ typedef struct XDMA_EVENT_T {
 } XDMA_EVENT;
 
 /// The XDMA device context
+/// Members read on every transfer and interrupt come first, the i/o trace log which requests
+/// update while a capture runs is kept behind the cold members. The engines live in a separate
+/// cache line aligned allocation, see XDMA_DeviceOpen().
 typedef struct XDMA_DEVICE_T {
 
+    // DMA Engine management
+    XDMA_ENGINE (*engines)[XDMA_NUM_DIRECTIONS]; // [XDMA_MAX_NUM_CHANNELS][XDMA_NUM_DIRECTIONS]
+    volatile XDMA_CONFIG_REGS *configRegs;
+    volatile XDMA_IRQ_REGS *interruptRegs;
+    volatile XDMA_SGDMA_COMMON_REGS * sgdmaRegs;
+
+    // per-cpu binary event rings
+    XDMA_TIMELINE timeline;
+
     // WDF 
     WDFDEVICE wdfDevice;
+    WDFDMAENABLER dmaEnabler;   // WDF DMA Enabler for the engine queues
+    WDFMEMORY engineMemory;     // backs engines
 
     // PCIe BAR access
     UINT numBars;
     PVOID bar[XDMA_MAX_NUM_BARS]; // kernel virtual address of BAR
     ULONG barLength[XDMA_MAX_NUM_BARS];
+    PHYSICAL_ADDRESS barStart[XDMA_MAX_NUM_BARS];
+    MEMORY_CACHING_TYPE bypassCacheType; // of every mapping of the bypass BAR, kernel and user
     ULONG configBarIdx;
     LONG userBarIdx;
     LONG bypassBarIdx;
-    volatile XDMA_CONFIG_REGS *configRegs;
-    volatile XDMA_IRQ_REGS *interruptRegs;
-    volatile XDMA_SGDMA_COMMON_REGS * sgdmaRegs;
-
-    // DMA Engine management
-    XDMA_ENGINE engines[XDMA_MAX_NUM_CHANNELS][XDMA_NUM_DIRECTIONS];
-    WDFDMAENABLER dmaEnabler;   // WDF DMA Enabler for the engine queues
 
     // Interrupt Resources
     WDFINTERRUPT lineInterrupt;
@@ -74,6 +83,9 @@ typedef struct XDMA_DEVICE_T {
     // user events
     XDMA_EVENT userEvents[XDMA_MAX_USER_IRQ];
 
+    // log of completed read/write requests
+    XDMA_IO_TRACE ioTrace;
+
 } XDMA_DEVICE, *PXDMA_DEVICE;
 
 // ========================= function declarations ================================================
@@ -28,13 +28,6 @@
 #include "dma_engine.tmh"
 #endif
 
-// ========================= constants ============================================================
-
-#define XDMA_ENG_IRQ_NUM        (1)
-#define XDMA_DESC_MAGIC         (0xAD4B0000)
-#define XDMA_WB_COUNT_MASK      (0x00ffffffUL)
-#define XDMA_WB_ERR_MASK        (BIT_N(31))
-
 // ========================= static function declarations =========================================
 
 static UINT32 EngineStatus(IN XDMA_ENGINE *engine, IN BOOLEAN clear);
@@ -44,8 +37,19 @@ static NTSTATUS EngineCreateRingBuffer(IN XDMA_ENGINE* engine);
 static void EngineConfigureInterrupt(IN OUT XDMA_ENGINE *engine, IN UINT index);
 static void EngineProcessTransfer(IN XDMA_ENGINE *engine);
 static UINT EngineProcessRing(IN XDMA_ENGINE *engine);
-static void EngineRingAdvance(UINT* index);
 static NTSTATUS EngineCreatePollWriteBackBuffer(IN OUT XDMA_ENGINE *engine);
+static NTSTATUS EngineCreateBounceBuffer(IN OUT XDMA_ENGINE *engine);
+static void EngineProcessBounce(IN XDMA_ENGINE *engine);
+static void EngineProcessProgram(IN XDMA_ENGINE *engine);
+static void EngineProcessDirect(IN XDMA_ENGINE *engine);
+static void EnginePatchBounceDescriptor(IN XDMA_ENGINE *engine, IN LONGLONG deviceOffset,
+                                        IN size_t length);
+static void EngineSpillRing(IN XDMA_ENGINE *engine, IN UINT tail);
+static void EngineSpillAcquire(IN XDMA_ENGINE *engine);
+static void EngineSpillRelease(IN XDMA_ENGINE *engine);
+static void EngineSpillReset(IN XDMA_ENGINE *engine);
+static NTSTATUS EngineSpillCopyToMemory(IN XDMA_ENGINE *engine, IN WDFMEMORY outputMem,
+                                        IN size_t length, OUT size_t* bytesCopied);
 
 // Mark these functions as pageable code
 #ifdef ALLOC_PRAGMA
@@ -64,21 +68,15 @@ static NTSTATUS EngineCreateDescriptorBuffer(IN OUT XDMA_ENGINE *engine) {
     // allocate host-side buffer for descriptors
     SIZE_T bufferSize = (XDMA_MAX_TRANSFER_SIZE / PAGE_SIZE + 2) * sizeof(DMA_DESCRIPTOR);
 
-    NTSTATUS status = WdfCommonBufferCreate(engine->parentDevice->dmaEnabler, bufferSize,
-                                            WDF_NO_OBJECT_ATTRIBUTES, &engine->descBuffer);
+    NTSTATUS status = XdmaOsDmaAlloc(engine->parentDevice->dmaEnabler, bufferSize,
+                                     &engine->descBuffer);
     if (!NT_SUCCESS(status)) {
-        TraceError(DBG_INIT, "WdfCommonBufferCreate failed: %!STATUS!", status);
         return status;
     }
 
-    PHYSICAL_ADDRESS descBufferLA = WdfCommonBufferGetAlignedLogicalAddress(engine->descBuffer);
-    PUCHAR descBufferVA = (PUCHAR)WdfCommonBufferGetAlignedVirtualAddress(engine->descBuffer);
-    RtlZeroMemory(descBufferVA, bufferSize);
-
     // give hw the physical start address of the descriptor buffer
-    engine->sgdma->firstDescLo = descBufferLA.LowPart;
-    engine->sgdma->firstDescHi = descBufferLA.HighPart;
-    engine->sgdma->firstDescAdj = 0; // depends on transfer - set later in ProgramDMA
+    // first adjacent count depends on transfer - set later in ProgramDMA
+    CoreEngineBindDescriptors(engine->sgdma, engine->descBuffer.la);
 
     TraceVerbose(DBG_INIT, "descriptor buffer at 0x%08x%08x, size=%lld",
                  engine->sgdma->firstDescHi, engine->sgdma->firstDescLo, bufferSize);
@@ -87,9 +85,7 @@ static NTSTATUS EngineCreateDescriptorBuffer(IN OUT XDMA_ENGINE *engine) {
 
 static void EngineConfigureInterrupt(IN OUT XDMA_ENGINE *engine, IN UINT index) {
     // engine interrupt request bit(s) - interrupt bit depends on number of engines present
-    // see Figure 2-4 on page 46 of pcie dma product guide [1]
-    engine->irqBitMask = (1 << XDMA_ENG_IRQ_NUM) - 1;
-    engine->irqBitMask <<= (index * XDMA_ENG_IRQ_NUM);
+    engine->irqBitMask = CoreEngineIrqBitMask(index);
 
     // bind msi interrupt context with this engine
     if (engine->parentDevice->channelInterrupts[index] != NULL) {
@@ -98,10 +94,7 @@ static void EngineConfigureInterrupt(IN OUT XDMA_ENGINE *engine, IN UINT index)
     }
 
     // enable interrupts
-    UINT32 regVal = XDMA_CTRL_IE_ALL;
-    if ((engine->type == EngineType_ST) && (engine->dir == C2H)) {
-        regVal |= XDMA_CTRL_IE_IDLE_STOPPED;
-    }
+    UINT32 regVal = CoreEngineIrqSources(engine->type, engine->dir);
     engine->regs->intEnableMaskW1S = regVal;
     engine->regs->controlW1S = regVal;
     TraceVerbose(DBG_INIT, "engineIrqBitMask=0x%08x, intEnableMask=0x%08x",
@@ -120,6 +113,33 @@ static void EngineProcessTransfer(IN XDMA_ENGINE *engine)
         return;
     }
 
+    // interrupt of a bounce transfer whose request EngineBounceCancel() completed? - unless the
+    // next transfer has completed meanwhile, there is nothing to process
+    if (InterlockedExchange(&engine->bounce.cancelled, FALSE) &&
+        !(EngineStatus(engine, FALSE) & (XDMA_DESCRIPTOR_STOPPED_BIT | XDMA_DESCRIPTOR_COMPLETED_BIT))) {
+        TraceInfo(DBG_DMA, "%s_%u interrupt of a cancelled bounce transfer",
+                  DirectionToString(engine->dir), engine->channel);
+        return;
+    }
+
+    // transfer started by a user event? - no request involved
+    if (engine->program.state == XDMA_PROGRAM_RUNNING) {
+        EngineProcessProgram(engine);
+        return;
+    }
+
+    // transfer of a caller-owned buffer? - no request involved
+    if (engine->direct.busy) {
+        EngineProcessDirect(engine);
+        return;
+    }
+
+    // small transfer via the bounce buffer? - no dma transaction involved
+    if (engine->bounce.request != NULL) {
+        EngineProcessBounce(engine);
+        return;
+    }
+
     TraceInfo(DBG_DMA, "%s_%u processing transfer completion",
               DirectionToString(engine->dir), engine->channel);
 
@@ -153,6 +173,7 @@ static void EngineProcessTransfer(IN XDMA_ENGINE *engine)
             if (!NT_SUCCESS(status)) {
                 TraceError(DBG_DMA, "WdfDmaTransactionRelease failed: %!STATUS!", status);
             }
+            EngineTraceEnd(engine, status, bytesTransferred);
             WdfRequestCompleteWithInformation(request, status, bytesTransferred);
         }
         break;
@@ -170,19 +191,16 @@ static void EngineProcessTransfer(IN XDMA_ENGINE *engine)
         if (!NT_SUCCESS(status)) {
             TraceError(DBG_DMA, "WdfDmaTransactionRelease failed: %!STATUS!", status);
         }
+        EngineTraceEnd(engine, STATUS_INTERNAL_ERROR, 0);
         WdfRequestComplete(request, STATUS_INTERNAL_ERROR);
     }
 
     // clear descriptor buffer
-    DMA_DESCRIPTOR* descriptorBuffer = (DMA_DESCRIPTOR*)WdfCommonBufferGetAlignedVirtualAddress(engine->descBuffer);
-    size_t descBufferLength = WdfCommonBufferGetLength(engine->descBuffer);
-    RtlZeroMemory(descriptorBuffer, descBufferLength);
+    RtlZeroMemory(engine->descBuffer.va, engine->descBuffer.length);
 
     // clear poll writeback buffer
     if (engine->poll) {
-        XDMA_POLL_WB* wbBuffer = (XDMA_POLL_WB*)WdfCommonBufferGetAlignedVirtualAddress(engine->pollWbBuffer);
-        size_t wbBufferLength = WdfCommonBufferGetLength(engine->pollWbBuffer);
-        RtlZeroMemory(wbBuffer, wbBufferLength);
+        RtlZeroMemory(engine->pollWbBuffer.va, engine->pollWbBuffer.length);
     }
 }
 
@@ -201,90 +219,25 @@ static void DumpDescriptor(IN const DMA_DESCRIPTOR* const desc) {
 static BOOLEAN DescriptorIsAligned(IN XDMA_ENGINE *engine, IN DMA_DESCRIPTOR *desc)
 // For alignment requirements see product guide [1] page 23 table 2-9
 {
-    if (engine->addressMode == AddressMode_Fixed) {
-        const UINT32 dataPathWidth = (1 << (6 + engine->parentDevice->configRegs->pcieWidth)) / 8;
-        const UINT32 addrMask = dataPathWidth - 1;
-
-        if ((desc->dstAddrLo & addrMask) != (desc->srcAddrLo & addrMask) != 0) {
-            TraceError(DBG_DESC, "misalignment detected! dataWidth=%u, src=0x%08llx, dst=0x%08llx, bytes=%llu",
-                       dataPathWidth, desc->srcAddrLo, desc->dstAddrLo, desc->numBytes);
-            return FALSE;
-        }
-        // todo length alignment requirement??
-
-    } else { // AddressMode_Contiguous (i.e. incremental mode)
-        BOOLEAN dstAddrMisaligned = (desc->dstAddrLo % engine->alignAddr) != 0;
-        BOOLEAN lengthMisaligned = (desc->numBytes % engine->alignLength) != 0;
-        BOOLEAN srcAddrMisaligned = (desc->srcAddrLo % engine->alignAddr) != 0;
-
-        if (dstAddrMisaligned || lengthMisaligned || srcAddrMisaligned) {
-            TraceVerbose(DBG_DESC, "descriptor alignments: src=0x%08llx, dst=0x%08llx, bytes=%llu",
-                         desc->srcAddrLo, desc->dstAddrLo, desc->numBytes);
-            TraceError(DBG_DESC, "misalignment detected! src?=%u dst?=%u length?=%u",
-                       srcAddrMisaligned, dstAddrMisaligned, lengthMisaligned);
-            return FALSE;
-        }
+    const UINT32 dataPathWidth = (1 << (6 + engine->parentDevice->configRegs->pcieWidth)) / 8;
+    if (CoreDescriptorIsAligned(desc, engine->addressMode, &engine->alignment, dataPathWidth)) {
+        return TRUE;
     }
-    return TRUE;
+    TraceError(DBG_DESC, "misalignment detected! mode=%u, src=0x%08x, dst=0x%08x, bytes=%u",
+               engine->addressMode, desc->srcAddrLo, desc->dstAddrLo, desc->numBytes);
+    return FALSE;
 }
 
 static void OptimizeDescriptors(IN XDMA_ENGINE *engine, IN DMA_DESCRIPTOR * const desc,
                                 IN const ULONG numDesc)
-    // Optimize descriptors for PCIe block fetches.
-    // Multiple descriptors which reside in host memory can be fetched in a single PCIe transaction
-    // by the device. This is achieved as follows:
-    //      - For the first fetch, the number of additional (adjacent) descriptors to fetch is 
-    //        specified by writing to engine->sgdma->firstDescAdj register. 
-    //      - For subsequent fetches, the last descriptor of the previous fetch specifies the number of
-    //        additional (adjacent) descriptors in the control->nextAdj field 
-    // There are several factors which limit the amount of descriptors which can be fetched together:
-    //      1. The PCIe Max Read Request Size
-    //      2. The physical address of the descriptors within a block must not cross a 4K address 
-    //         boundary
-    //      3. The number of descriptors remaining in the transfer
+// Optimize descriptors for PCIe block fetches - limited by the PCIe Max Read Request Size
 {
     const ULONG mrrsBytes = 1 << (engine->parentDevice->configRegs->pcieMRRS + 7);
-    const ULONG adjMax = mrrsBytes / sizeof(DMA_DESCRIPTOR) - 1;
-    const ULONG adjTotal = numDesc - 1;
-    const ULONG adjTo4k = (0x1000 - (engine->sgdma->firstDescLo & 0xFFF)) / sizeof(DMA_DESCRIPTOR) - 1;
-
-    // set the number of adjacent descriptors for the first fetch
-    ULONG firstAdj = adjTotal < adjMax ? adjTotal : adjMax;
-    engine->sgdma->firstDescAdj = adjTo4k < firstAdj ? adjTo4k : firstAdj;
-    //TraceVerbose(DBG_DMA, "first: PA=%04u, this4k=%04u, total=%04u, thisBlock=%04u",
-    //             engine->sgdma->firstDescLo & 0xFFF, adjTo4k, adjTotal, engine->sgdma->firstDescAdj);
-
-    // set the number of adjacent descriptors for subsequent fetches
-    ULONG nextAdjMax = adjMax - 1;
-    for (UINT i = 0; i < numDesc; i++) {
-        // if not last desc then get total desc adj to next desc, else last desc has no next desc
-        const ULONG nextAdjTotal = (i != adjTotal) ? adjTotal - (i + 1) : 0;
-        const ULONG nextAdjTo4k = (0x1000 - (desc[i].nextLo & 0xFFF)) / sizeof(DMA_DESCRIPTOR) - 1;
-
-        ULONG nextAdj = nextAdjTotal < nextAdjMax ? nextAdjTotal : nextAdjMax;
-        if (nextAdj > nextAdjTo4k) {
-            nextAdj = nextAdjTo4k;
-        }
-
-        desc[i].control |= (nextAdj << 8);
-        //TraceVerbose(DBG_DMA, "next: PA=%04u, this4k=%04u, total=%04u, thisBlock=%04u",
-        //             desc[i].nextLo & 0xFFF, nextAdjTo4k, nextAdjTotal, nextAdj);
-
-        // update current max adj count for this block
-        if (nextAdjMax != 0) {
-            nextAdjMax--;
-        } else { // wrap-around
-            nextAdjMax = adjMax;
-        }
-    }
+    CoreDescriptorOptimize(engine->sgdma, desc, numDesc, mrrsBytes);
 }
 
 static BOOLEAN EngineExists(PXDMA_DEVICE xdma, DirToDev dir, ULONG channel) {
-    PUCHAR configBarAddr = (PUCHAR)xdma->bar[xdma->configBarIdx];
-    const ULONG offset = (dir * BLOCK_OFFSET) + (channel * ENGINE_OFFSET);
-    XDMA_ENGINE_REGS* engineRegs = (XDMA_ENGINE_REGS*)(configBarAddr + offset);
-    UINT32 engineID = engineRegs->identifier;
-    return (engineID & XDMA_ID_MASK) == XDMA_ID;
+    return CoreEngineExists((PUCHAR)xdma->bar[xdma->configBarIdx], dir, channel);
 }
 
 static NTSTATUS EngineCreate(PXDMA_DEVICE xdma, XDMA_ENGINE* engine, DirToDev dir, ULONG channel,
@@ -295,10 +248,9 @@ static NTSTATUS EngineCreate(PXDMA_DEVICE xdma, XDMA_ENGINE* engine, DirToDev di
     engine->parentDevice = xdma;
     engine->channel = channel;
     engine->dir = dir;
-    const ULONG offset = (dir * BLOCK_OFFSET) + (channel * ENGINE_OFFSET);
     PUCHAR configBarAddr = (PUCHAR)xdma->bar[xdma->configBarIdx];
-    engine->regs = (XDMA_ENGINE_REGS*)(configBarAddr + offset);
-    engine->sgdma = (XDMA_SGDMA_REGS*)(configBarAddr + offset + SGDMA_BLOCK_OFFSET);
+    engine->regs = CoreEngineRegs(configBarAddr, dir, channel);
+    engine->sgdma = CoreEngineSgdmaRegs(configBarAddr, dir, channel);
 
     // AXI-MM or AXI-ST? 0 = MM, 1 = ST
     engine->type = (engine->regs->identifier & XDMA_ID_ST_BIT) != 0;
@@ -347,6 +299,11 @@ static NTSTATUS EngineCreate(PXDMA_DEVICE xdma, XDMA_ENGINE* engine, DirToDev di
         TraceInfo(DBG_INIT, "creditModeEnable=0x%x", engine->parentDevice->sgdmaRegs->creditModeEnable);
     } else {
         engine->work = EngineProcessTransfer;
+        status = EngineCreateBounceBuffer(engine);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_INIT, "EngineCreateBounceBuffer() failed: %!STATUS!", status);
+            return status;
+        }
     }
 
     engine->enabled = TRUE;
@@ -356,24 +313,11 @@ static NTSTATUS EngineCreate(PXDMA_DEVICE xdma, XDMA_ENGINE* engine, DirToDev di
 
 static void EngineGetAlignments(IN OUT XDMA_ENGINE *engine) {
 
-    UINT32 alignments = engine->regs->alignments;
-    UINT32 align_bytes = (alignments & 0x00ff0000U) >> 16;
-    UINT32 granularity_bytes = (alignments & 0x0000ff00U) >> 8;
-    UINT32 address_bits = (alignments & 0x000000ffU);
-
-    if (alignments) {
-        engine->alignAddr = align_bytes;
-        engine->alignLength = granularity_bytes;
-        engine->alignAddrBits = address_bits;
-    } else { // Some default values if alignments are unspecified
-        engine->alignAddr = 1;
-        engine->alignLength = 1;
-        engine->alignAddrBits = 64;
-    }
+    CoreEngineAlignments(engine->regs, &engine->alignment);
 
     TraceVerbose(DBG_INIT, "engine[%u][%u] alignments: bytes=%u, granularity=%u, addrBits=%u",
-                 engine->channel, engine->dir, engine->alignAddr, engine->alignLength, engine->alignAddrBits);
-
+                 engine->channel, engine->dir, engine->alignment.addr, engine->alignment.length,
+                 engine->alignment.addrBits);
 }
 
 static UINT32 EngineStatus(IN XDMA_ENGINE *engine, IN BOOLEAN clear)
@@ -421,8 +365,8 @@ BOOLEAN XDMA_EngineProgramDma(IN WDFDMATRANSACTION Transaction, IN WDFDEVICE Dev
 
     // get virtual and physical pointers to descriptor buffer
     XDMA_ENGINE * engine = (XDMA_ENGINE*)context;
-    DMA_DESCRIPTOR *descriptor = (DMA_DESCRIPTOR*)WdfCommonBufferGetAlignedVirtualAddress(engine->descBuffer);
-    PHYSICAL_ADDRESS descBufferLA = WdfCommonBufferGetAlignedLogicalAddress(engine->descBuffer);
+    DMA_DESCRIPTOR *descriptor = (DMA_DESCRIPTOR*)engine->descBuffer.va;
+    PHYSICAL_ADDRESS descBufferLA = engine->descBuffer.la;
 
     // offset into the transaction (if it is split)
     deviceOffset += WdfDmaTransactionGetBytesTransferred(Transaction);
@@ -430,41 +374,19 @@ BOOLEAN XDMA_EngineProgramDma(IN WDFDMATRANSACTION Transaction, IN WDFDEVICE Dev
     TraceVerbose(DBG_DMA, "device addr=%lld, num descriptors=%d",
                  deviceOffset, SgList->NumberOfElements);
 
+    const DirToDev dir = (Direction == WdfDmaDirectionWriteToDevice) ? H2C : C2H;
     for (ULONG i = 0; i < SgList->NumberOfElements; i++) {
-        descriptor[i].control = XDMA_DESC_MAGIC;
-        descriptor[i].numBytes = SgList->Elements[i].Length;
-        ULONG hostAddrLo = SgList->Elements[i].Address.LowPart;
-        LONG hostAddrHi = SgList->Elements[i].Address.HighPart;
-        if (Direction == WdfDmaDirectionWriteToDevice) {
-            // source is host memory
-            descriptor[i].srcAddrLo = hostAddrLo;
-            descriptor[i].srcAddrHi = hostAddrHi;
-            descriptor[i].dstAddrLo = LIMIT_TO_32(deviceOffset);
-            descriptor[i].dstAddrHi = LIMIT_TO_32(deviceOffset >> 32);
-        } else {
-            // destination is host memory
-            descriptor[i].srcAddrLo = LIMIT_TO_32(deviceOffset);
-            descriptor[i].srcAddrHi = LIMIT_TO_32(deviceOffset >> 32);
-            descriptor[i].dstAddrLo = hostAddrLo;
-            descriptor[i].dstAddrHi = hostAddrHi;
-        }
 
         // next descriptor bus address 
         descBufferLA.QuadPart += sizeof(DMA_DESCRIPTOR);
 
-        // non-last descriptor(s)? 
-        if ((i + 1) < SgList->NumberOfElements) {
-            descriptor[i].nextLo = descBufferLA.LowPart;
-            descriptor[i].nextHi = descBufferLA.HighPart;
-        } else { // last descriptor
-            descriptor[i].nextLo = 0;
-            descriptor[i].nextHi = 0;
-            // stop engine and request an interrupt from the engine
-            descriptor[i].control |= (XDMA_DESC_STOP_BIT | XDMA_DESC_COMPLETED_BIT);
-            if (engine->type == EngineType_ST) {
-                descriptor[i].control |= XDMA_DESC_EOP_BIT;
-                TraceVerbose(DBG_DMA, "descriptor[i].control=0x%08x", descriptor[i].control);
-            }
+        CoreDescriptorSet(&descriptor[i], dir, SgList->Elements[i].Address.QuadPart, deviceOffset,
+                          SgList->Elements[i].Length, descBufferLA.QuadPart);
+
+        // last descriptor - stop engine and request an interrupt from the engine
+        if ((i + 1) == SgList->NumberOfElements) {
+            CoreDescriptorSetLast(&descriptor[i], engine->type);
+            TraceVerbose(DBG_DMA, "descriptor[i].control=0x%08x", descriptor[i].control);
         }
         if (engine->addressMode == AddressMode_Contiguous) { // incremental address mode
             deviceOffset += SgList->Elements[i].Length;
@@ -475,6 +397,11 @@ BOOLEAN XDMA_EngineProgramDma(IN WDFDMATRANSACTION Transaction, IN WDFDEVICE Dev
         }
     }
 
+    // (re-)bind the descriptor buffer, a bounce transfer may have pointed the engine elsewhere
+    if (engine->bounce.buffer.va != NULL) {
+        CoreEngineBindDescriptors(engine->sgdma, engine->descBuffer.la);
+    }
+
     OptimizeDescriptors(engine, descriptor, SgList->NumberOfElements);
 
     for (ULONG i = 0; i < SgList->NumberOfElements; i++) {
@@ -485,6 +412,8 @@ BOOLEAN XDMA_EngineProgramDma(IN WDFDMATRANSACTION Transaction, IN WDFDEVICE Dev
         engine->numDescriptors = SgList->NumberOfElements;
     }
 
+    XDMA_TIMELINE_ENGINE_LOG(engine, XDMA_TL_PROGRAM_DMA, SgList->NumberOfElements);
+
     MemoryBarrier();
 
     // start the engine
@@ -525,6 +454,7 @@ NTSTATUS ProbeEngines(IN PXDMA_DEVICE xdma) {
 }
 
 void EngineStart(IN XDMA_ENGINE *engine) {
+    XDMA_TIMELINE_ENGINE_LOG(engine, XDMA_TL_ENGINE_START, 0);
     engine->regs->controlW1S = XDMA_CTRL_RUN_BIT;
     TraceInfo(DBG_DMA, "%s_%u engine started (control=0x%08x)",
               DirectionToString(engine->dir), engine->channel, engine->regs->control);
@@ -565,18 +495,14 @@ static NTSTATUS EngineCreateRingBuffer(IN XDMA_ENGINE* engine) {
 
     // create dma result buffer
     size_t resultBufferSize = (XDMA_MAX_TRANSFER_SIZE / PAGE_SIZE + 2) * sizeof(DMA_RESULT);
-    NTSTATUS status = WdfCommonBufferCreate(engine->parentDevice->dmaEnabler, resultBufferSize,
-                                            WDF_NO_OBJECT_ATTRIBUTES, &engine->ring.results);
+    NTSTATUS status = XdmaOsDmaAlloc(engine->parentDevice->dmaEnabler, resultBufferSize,
+                                     &engine->ring.results);
     if (!NT_SUCCESS(status)) {
-        TraceError(DBG_INIT, "WdfCommonBufferCreate failed: %!STATUS!", status);
         return status;
     }
-    PUCHAR resultBufferVA = (PUCHAR)WdfCommonBufferGetAlignedVirtualAddress(engine->ring.results);
-    RtlZeroMemory(resultBufferVA, resultBufferSize);
 
     TraceVerbose(DBG_INIT, "engine[%u][%u] dma result buffer @ pa=0x%08llx",
-                 engine->channel, engine->dir,
-                 WdfCommonBufferGetAlignedLogicalAddress(engine->ring.results).QuadPart);
+                 engine->channel, engine->dir, engine->ring.results.la.QuadPart);
 
     // create dma data buffer
     PHYSICAL_ADDRESS low, high, skip;
@@ -613,9 +539,8 @@ static NTSTATUS EngineCreateRingBuffer(IN XDMA_ENGINE* engine) {
                      engine->ring.mdl[i]->Next);
     }
 
-    status = WdfSpinLockCreate(WDF_NO_OBJECT_ATTRIBUTES, &engine->ring.lock);
+    status = XdmaOsLockCreate(&engine->ring.lock);
     if (!NT_SUCCESS(status)) {
-        TraceError(DBG_INIT, "WdfSpinLockCreate failed: %!STATUS!", status);
         return status;
     }
 
@@ -632,22 +557,23 @@ static UINT EngineProcessRing(IN XDMA_ENGINE *engine) {
         TraceError(DBG_DMA, "Engine error during transfer! 0x%08x", engineStatus);
     }
     UINT eopCount = 0;
-    DMA_RESULT* results = (DMA_RESULT*)WdfCommonBufferGetAlignedVirtualAddress(engine->ring.results);
+    UINT numResults = 0;
+    DMA_RESULT* results = (DMA_RESULT*)engine->ring.results.va;
 
-    WdfSpinLockAcquire(engine->ring.lock);
+    // the dpc owns tail, head is only read for the trace
     UINT tail = engine->ring.tail;
-    UINT head = engine->ring.head;
-    WdfSpinLockRelease(engine->ring.lock);
+    const UINT head = XdmaOsLoadAcquire(&engine->ring.head);
 
     TraceInfo(DBG_DMA, "%s_%u ring head=%u, tail=%u, eop=%u, credits=%u",
               DirectionToString(engine->dir), engine->channel, head, tail, eopCount,
               engine->sgdma->descCredits);
 
-    for (; results[tail].status; EngineRingAdvance(&tail)) {
+    for (; results[tail].status; tail = CoreRingAdvance(tail, XDMA_RING_NUM_BLOCKS)) {
 
         if (results[tail].status & XDMA_RESULT_EOP_BIT) {
             eopCount++;
         }
+        numResults++;
 
         results[tail].status = 0; // mark current dma result as processed
     }
@@ -656,9 +582,15 @@ static UINT EngineProcessRing(IN XDMA_ENGINE *engine) {
               DirectionToString(engine->dir), engine->channel, head, tail, eopCount,
               engine->sgdma->descCredits);
 
-    WdfSpinLockAcquire(engine->ring.lock);
-    engine->ring.tail = tail;
-    WdfSpinLockRelease(engine->ring.lock);
+    // the processed results become visible to the reader together with tail
+    XdmaOsStoreRelease(&engine->ring.tail, tail);
+
+    // move the backlog out of the ring before the engine runs out of descriptor credits
+    if (engine->spill.va != NULL) {
+        EngineSpillRing(engine, tail);
+    }
+
+    XDMA_TIMELINE_ENGINE_LOG(engine, XDMA_TL_RING_BATCH, numResults);
 
     // If any packets are completed, start the Io Read queue 
     // also start the queue on an overflow since we need to tell the client that an overflow happened
@@ -670,8 +602,8 @@ static UINT EngineProcessRing(IN XDMA_ENGINE *engine) {
 
     // clear poll writeback buffer
     if (engine->poll) {
-        XDMA_POLL_WB* wbBuffer = (XDMA_POLL_WB*)WdfCommonBufferGetAlignedVirtualAddress(engine->pollWbBuffer);
-        size_t wbBufferLength = WdfCommonBufferGetLength(engine->pollWbBuffer);
+        XDMA_POLL_WB* wbBuffer = (XDMA_POLL_WB*)engine->pollWbBuffer.va;
+        size_t wbBufferLength = engine->pollWbBuffer.length;
         RtlZeroMemory(wbBuffer, wbBufferLength);
         engine->numDescriptors = 0;
     }
@@ -682,31 +614,26 @@ static UINT EngineProcessRing(IN XDMA_ENGINE *engine) {
 static void EngineRingProgramDma(IN XDMA_ENGINE* engine) {
 
     // get virtual and physical pointers to descriptor buffer
-    DMA_DESCRIPTOR *descriptor = (DMA_DESCRIPTOR*)WdfCommonBufferGetAlignedVirtualAddress(engine->descBuffer);
-    PHYSICAL_ADDRESS nextDescLA = WdfCommonBufferGetAlignedLogicalAddress(engine->descBuffer);
+    DMA_DESCRIPTOR *descriptor = (DMA_DESCRIPTOR*)engine->descBuffer.va;
+    PHYSICAL_ADDRESS nextDescLA = engine->descBuffer.la;
 
     // get physical address to dma result buffer
-    PHYSICAL_ADDRESS resultBufferLA = WdfCommonBufferGetAlignedLogicalAddress(engine->ring.results);
+    PHYSICAL_ADDRESS resultBufferLA = engine->ring.results.la;
 
     // fill descriptors 
     for (ULONG i = 0; i < XDMA_RING_NUM_BLOCKS; ++i) {
-        descriptor[i].control = (XDMA_DESC_MAGIC | XDMA_DESC_EOP_BIT | XDMA_DESC_COMPLETED_BIT);
-        descriptor[i].numBytes = XDMA_RING_BLOCK_SIZE;
-
-        // source address are unused, will be overwritten by hardware with dma result
-        descriptor[i].srcAddrLo = resultBufferLA.LowPart;
-        descriptor[i].srcAddrHi = resultBufferLA.HighPart;
-        resultBufferLA.QuadPart += sizeof(DMA_RESULT);
 
         // destination is host memory
         PHYSICAL_ADDRESS dst = MmGetPhysicalAddress(MmGetMdlVirtualAddress(engine->ring.mdl[i]));
-        descriptor[i].dstAddrLo = dst.LowPart;
-        descriptor[i].dstAddrHi = dst.HighPart;
 
         // next descriptor bus address 
         nextDescLA.QuadPart += sizeof(DMA_DESCRIPTOR);
-        descriptor[i].nextLo = nextDescLA.LowPart;
-        descriptor[i].nextHi = nextDescLA.HighPart;
+
+        // source address are unused, will be overwritten by hardware with dma result
+        CoreDescriptorSet(&descriptor[i], C2H, dst.QuadPart, resultBufferLA.QuadPart,
+                          XDMA_RING_BLOCK_SIZE, nextDescLA.QuadPart);
+        descriptor[i].control |= (XDMA_DESC_EOP_BIT | XDMA_DESC_COMPLETED_BIT);
+        resultBufferLA.QuadPart += sizeof(DMA_RESULT);
 
         if (FALSE == DescriptorIsAligned(engine, descriptor)) {
             TraceWarning(DBG_DMA, "Error: Dma Transfer is not aligned");
@@ -714,7 +641,7 @@ static void EngineRingProgramDma(IN XDMA_ENGINE* engine) {
     }
 
     // make the discriptor list circular
-    nextDescLA = WdfCommonBufferGetAlignedLogicalAddress(engine->descBuffer);
+    nextDescLA = engine->descBuffer.la;
     DMA_DESCRIPTOR* last = &descriptor[XDMA_RING_NUM_BLOCKS - 1];
     last->nextLo = nextDescLA.LowPart;
     last->nextHi = nextDescLA.HighPart;
@@ -749,39 +676,45 @@ static void EngineRingProgramDma(IN XDMA_ENGINE* engine) {
 
 static void EngineClearDmaResults(IN XDMA_ENGINE *engine) {
     TraceVerbose(DBG_DMA, "clearing DMA results...");
-    DMA_RESULT * results = (DMA_RESULT*)WdfCommonBufferGetAlignedVirtualAddress(engine->ring.results);
+    DMA_RESULT * results = (DMA_RESULT*)engine->ring.results.va;
     for (UINT i = 0; i < XDMA_RING_NUM_BLOCKS; ++i) {
         results[i].status = 0;
         results[i].length = 0;
     }
 }
 
-static void EngineRingAdvance(UINT* index) {
-    if (*index == XDMA_RING_NUM_BLOCKS - 1) { // wrap-around
-        *index = 0;
-    } else { // normal increment
-        ++(*index);
-    }
-}
-
 void EngineRingSetup(IN XDMA_ENGINE *engine) {
+    XdmaOsLockAcquire(&engine->ring.lock);
     engine->ring.head = 0;
     engine->ring.tail = 0;
+    EngineSpillReset(engine);
     KeClearEvent(&engine->ring.completionSignal);
     EngineRingProgramDma(engine);
+    XdmaOsLockRelease(&engine->ring.lock);
 }
 
 void EngineRingTeardown(IN XDMA_ENGINE *engine) {
     EngineStop(engine);
+
+    // a dpc which still sees results must publish its tail before the indices are reset
+    KeFlushQueuedDpcs();
+
+    XdmaOsLockAcquire(&engine->ring.lock);
     EngineClearDmaResults(engine);
     engine->ring.head = 0;
     engine->ring.tail = 0;
+    EngineSpillReset(engine);
+    XdmaOsLockRelease(&engine->ring.lock);
 }
 
 NTSTATUS EngineRingCopyBytesToMemory(IN XDMA_ENGINE *engine, WDFMEMORY outputMem, 
                                    size_t length, LARGE_INTEGER timeout, size_t* bytesRead ) {
     NTSTATUS status = 0;
-    if (engine->poll) { // poll mode - poll for completion
+    *bytesRead = 0;
+    if (engine->spill.level != 0) { // spilled data is available without waiting for the engine
+        TraceVerbose(DBG_DMA, "%s_%u %lldB spilled", DirectionToString(engine->dir),
+                     engine->channel, engine->spill.level);
+    } else if (engine->poll) { // poll mode - poll for completion
         status = EnginePollRing(engine);
         if (!NT_SUCCESS(status)) {
             goto ErrorExit;
@@ -793,14 +726,23 @@ NTSTATUS EngineRingCopyBytesToMemory(IN XDMA_ENGINE *engine, WDFMEMORY outputMem
         }
     }
 
-    DMA_RESULT* results = (DMA_RESULT*)WdfCommonBufferGetAlignedVirtualAddress(engine->ring.results);
+    // in spill mode the dpc may move blocks out of the ring as well, take over the ring head.
+    // The spill buffer holds the oldest data, drain it first.
     size_t offset = 0;
+    if (engine->spill.va != NULL) {
+        EngineSpillAcquire(engine);
+        status = EngineSpillCopyToMemory(engine, outputMem, length, &offset);
+        if (!NT_SUCCESS(status)) {
+            goto ReleaseExit;
+        }
+    }
+
+    DMA_RESULT* results = (DMA_RESULT*)engine->ring.results.va;
     UINT32 numDescProcessed = 0;
-    size_t numBytesRemaining = length;
-    WdfSpinLockAcquire(engine->ring.lock);
+    size_t numBytesRemaining = length - offset;
+    // the reader owns head, the results up to tail were published by EngineProcessRing()
     UINT head = engine->ring.head;
-    UINT tail = engine->ring.tail;
-    WdfSpinLockRelease(engine->ring.lock);
+    const UINT tail = XdmaOsLoadAcquire(&engine->ring.tail);
 
     TraceVerbose(DBG_DMA, "%s_%u head=%u, tail=%u, credits=%u",
                  DirectionToString(engine->dir), engine->channel, head, tail, engine->sgdma->descCredits);
@@ -815,7 +757,6 @@ NTSTATUS EngineRingCopyBytesToMemory(IN XDMA_ENGINE *engine, WDFMEMORY outputMem
         if (numBytesReceived > numBytesRemaining) {
             numBytesReceived = numBytesRemaining;
         } else if (numBytesReceived == 0) {
-            KeClearEvent(&engine->ring.completionSignal);
             break;
         }
 
@@ -823,7 +764,7 @@ NTSTATUS EngineRingCopyBytesToMemory(IN XDMA_ENGINE *engine, WDFMEMORY outputMem
         status = WdfMemoryCopyFromBuffer(outputMem, offset, rxBufferVa, numBytesReceived);
         if (!NT_SUCCESS(status)) {
             TraceError(DBG_DMA, "WdfMemoryCopyFromBuffer failed: %!STATUS!", status);
-            goto ErrorExit;
+            goto ReleaseExit;
         }
 
         numDescProcessed++;
@@ -831,17 +772,17 @@ NTSTATUS EngineRingCopyBytesToMemory(IN XDMA_ENGINE *engine, WDFMEMORY outputMem
         numBytesRemaining -= numBytesReceived;
 
         results[head].length = 0;
-        EngineRingAdvance(&head);
+        head = CoreRingAdvance(head, XDMA_RING_NUM_BLOCKS);
     }
 
-    if (results[head].length == 0) {
+    // keep the signal set while spilled data is waiting
+    if ((results[head].length == 0) && (engine->spill.level == 0)) {
         KeClearEvent(&engine->ring.completionSignal);
     }
 
-    WdfSpinLockAcquire(engine->ring.lock);
-    engine->ring.head = head;
+    // hand the blocks back before the engine gets their credits
+    XdmaOsStoreRelease(&engine->ring.head, head);
     engine->sgdma->descCredits = numDescProcessed;
-    WdfSpinLockRelease(engine->ring.lock);
 
     *bytesRead = length - numBytesRemaining;
 
@@ -849,25 +790,163 @@ NTSTATUS EngineRingCopyBytesToMemory(IN XDMA_ENGINE *engine, WDFMEMORY outputMem
                  DirectionToString(engine->dir), engine->channel, *bytesRead, head, tail,
                  engine->sgdma->descCredits);
 
+ReleaseExit:
+    if (engine->spill.va != NULL) {
+        EngineSpillRelease(engine);
+    }
 ErrorExit:
     return status;
 }
 
+//========================= overflow buffering of the streaming ring ==============================
+
+// Take the ring head away from the dpc. The dpc only holds it while it moves blocks, so wait.
+static void EngineSpillAcquire(IN XDMA_ENGINE *engine) {
+    while (InterlockedCompareExchange(&engine->spill.owner, XDMA_SPILL_OWNER_READER,
+                                      XDMA_SPILL_OWNER_NONE) != XDMA_SPILL_OWNER_NONE) {
+        YieldProcessor();
+    }
+}
+
+static void EngineSpillRelease(IN XDMA_ENGINE *engine) {
+    InterlockedExchange(&engine->spill.owner, XDMA_SPILL_OWNER_NONE);
+}
+
+// Called with the ring lock held and the dpc flushed or the engine not yet started
+static void EngineSpillReset(IN XDMA_ENGINE *engine) {
+    engine->spill.owner = XDMA_SPILL_OWNER_NONE;
+    engine->spill.head = 0;
+    engine->spill.tail = 0;
+    engine->spill.level = 0;
+    RtlZeroMemory(&engine->spill.stats, sizeof(engine->spill.stats));
+}
+
+// Move filled ring blocks from head up to tail into the spill fifo, called from the dpc
+static void EngineSpillRing(IN XDMA_ENGINE *engine, IN UINT tail) {
+    XDMA_SPILL* spill = &engine->spill;
+    UINT head = XdmaOsLoadAcquire(&engine->ring.head);
+    const UINT numFilled = CoreRingCount(head, tail, XDMA_RING_NUM_BLOCKS);
+
+    if (numFilled > spill->stats.ringHighWater) {
+        spill->stats.ringHighWater = numFilled;
+    }
+    if (numFilled < spill->highWater) {
+        return;
+    }
+
+    // a reader copying out frees blocks itself, never wait for it at dispatch level
+    if (InterlockedCompareExchange(&spill->owner, XDMA_SPILL_OWNER_DPC,
+                                   XDMA_SPILL_OWNER_NONE) != XDMA_SPILL_OWNER_NONE) {
+        spill->stats.contended++;
+        return;
+    }
+
+    DMA_RESULT* results = (DMA_RESULT*)engine->ring.results.va;
+    head = engine->ring.head; // the reader may have moved it before giving up ownership
+    UINT32 numBlocks = 0;
+    while (head != tail) {
+        const size_t length = results[head].length;
+        if (length == 0) {
+            break;
+        }
+        if (length > spill->size - (size_t)(spill->tail - spill->head)) {
+            spill->stats.overflows++;
+            break;
+        }
+
+        // the fifo may wrap inside the block
+        const PUCHAR src = (PUCHAR)MmGetMdlVirtualAddress(engine->ring.mdl[head]);
+        const size_t pos = (size_t)(spill->tail % spill->size);
+        const size_t first = min(length, spill->size - pos);
+        RtlCopyMemory(spill->va + pos, src, first);
+        RtlCopyMemory(spill->va, src + first, length - first);
+        spill->tail += length;
+
+        spill->stats.spilledBytes += length;
+        results[head].length = 0;
+        head = CoreRingAdvance(head, XDMA_RING_NUM_BLOCKS);
+        numBlocks++;
+    }
+
+    if (numBlocks > 0) {
+        spill->stats.spilledBlocks += numBlocks;
+        spill->level = (LONGLONG)(spill->tail - spill->head);
+        if ((UINT64)spill->level > spill->stats.levelHighWater) {
+            spill->stats.levelHighWater = spill->level;
+        }
+
+        // hand the blocks back before the engine gets their credits
+        XdmaOsStoreRelease(&engine->ring.head, head);
+        engine->sgdma->descCredits = numBlocks;
+
+        TraceVerbose(DBG_DMA, "%s_%u spilled %u blocks, level=%lld, credits=%u",
+                     DirectionToString(engine->dir), engine->channel, numBlocks, spill->level,
+                     engine->sgdma->descCredits);
+    }
+
+    EngineSpillRelease(engine);
+}
+
+// Copy up to length bytes out of the spill fifo, called by the reader holding the ring head
+static NTSTATUS EngineSpillCopyToMemory(IN XDMA_ENGINE *engine, IN WDFMEMORY outputMem,
+                                        IN size_t length, OUT size_t* bytesCopied) {
+    XDMA_SPILL* spill = &engine->spill;
+    const size_t numBytes = (size_t)min((ULONGLONG)length, spill->tail - spill->head);
+    *bytesCopied = 0;
+    if (numBytes == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    const size_t pos = (size_t)(spill->head % spill->size);
+    const size_t first = min(numBytes, spill->size - pos);
+    NTSTATUS status = WdfMemoryCopyFromBuffer(outputMem, 0, spill->va + pos, first);
+    if (NT_SUCCESS(status) && (numBytes > first)) {
+        status = WdfMemoryCopyFromBuffer(outputMem, first, spill->va, numBytes - first);
+    }
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_DMA, "WdfMemoryCopyFromBuffer failed: %!STATUS!", status);
+        return status;
+    }
+
+    spill->head += numBytes;
+    spill->level = (LONGLONG)(spill->tail - spill->head);
+    *bytesCopied = numBytes;
+    return status;
+}
+
+VOID EngineFreeSpill(IN XDMA_ENGINE *engine) {
+    if (engine->spill.va != NULL) {
+        MmUnmapLockedPages(engine->spill.va, engine->spill.mdl);
+        MmFreePagesFromMdl(engine->spill.mdl);
+        ExFreePool(engine->spill.mdl);
+        engine->spill.va = NULL;
+        engine->spill.mdl = NULL;
+        engine->spill.size = 0;
+    }
+}
+
+VOID EngineGetSpillStats(IN XDMA_ENGINE *engine, OUT XDMA_SPILL_STATS* stats) {
+    ASSERTMSG("argument engine is NULL!", engine != NULL);
+    ASSERTMSG("argument stats is NULL!", stats != NULL);
+
+    *stats = engine->spill.stats;
+    stats->capacity = (engine->spill.va != NULL) ? engine->spill.size : 0;
+    stats->level = engine->spill.level;
+    stats->highWaterMark = engine->spill.highWater;
+}
+
 //========================= polling interface =====================================================
 
 static NTSTATUS EngineCreatePollWriteBackBuffer(IN OUT XDMA_ENGINE *engine) {
     // allocate host-side buffer for poll mode descriptor write back info
 
-    NTSTATUS status = WdfCommonBufferCreate(engine->parentDevice->dmaEnabler, sizeof(XDMA_POLL_WB),
-                                            WDF_NO_OBJECT_ATTRIBUTES, &engine->pollWbBuffer);
+    NTSTATUS status = XdmaOsDmaAlloc(engine->parentDevice->dmaEnabler, sizeof(XDMA_POLL_WB),
+                                     &engine->pollWbBuffer);
     if (!NT_SUCCESS(status)) {
-        TraceError(DBG_INIT, "WdfCommonBufferCreate failed: %!STATUS!", status);
         return status;
     }
 
-    PHYSICAL_ADDRESS wbBufferLA = WdfCommonBufferGetAlignedLogicalAddress(engine->pollWbBuffer);
-    PUCHAR wbBufferVA = (PUCHAR)WdfCommonBufferGetAlignedVirtualAddress(engine->pollWbBuffer);
-    RtlZeroMemory(wbBufferVA, sizeof(XDMA_POLL_WB));
+    PHYSICAL_ADDRESS wbBufferLA = engine->pollWbBuffer.la;
 
     engine->regs->pollModeWbLo = wbBufferLA.LowPart;
     engine->regs->pollModeWbHi = wbBufferLA.HighPart;
@@ -879,7 +958,7 @@ static NTSTATUS EngineCreatePollWriteBackBuffer(IN OUT XDMA_ENGINE *engine) {
 
 NTSTATUS EnginePollTransfer(IN XDMA_ENGINE* engine) {
 
-    XDMA_POLL_WB* writeback_data = (XDMA_POLL_WB*)WdfCommonBufferGetAlignedVirtualAddress(engine->pollWbBuffer);
+    XDMA_POLL_WB* writeback_data = (XDMA_POLL_WB*)engine->pollWbBuffer.va;
     const ULONG expected = engine->numDescriptors;
     volatile ULONG actual = 0;
 
@@ -905,7 +984,7 @@ NTSTATUS EnginePollTransfer(IN XDMA_ENGINE* engine) {
 }
 
 NTSTATUS EnginePollRing(IN XDMA_ENGINE* engine) {
-    XDMA_POLL_WB* writeback_data = (XDMA_POLL_WB*)WdfCommonBufferGetAlignedVirtualAddress(engine->pollWbBuffer);
+    XDMA_POLL_WB* writeback_data = (XDMA_POLL_WB*)engine->pollWbBuffer.va;
     volatile ULONG completed = 0;
     volatile UINT eopCount = 0;
     UINT tryCount = 0;
@@ -933,6 +1012,364 @@ NTSTATUS EnginePollRing(IN XDMA_ENGINE* engine) {
     return STATUS_SUCCESS;
 }
 
+//========================= small transfer fast path ==============================================
+
+static NTSTATUS EngineCreateBounceBuffer(IN OUT XDMA_ENGINE *engine) {
+    // first page holds the descriptor, data area starts page aligned right after it
+    SIZE_T bufferSize = PAGE_SIZE + XDMA_BOUNCE_BUFFER_SIZE;
+
+    NTSTATUS status = XdmaOsDmaAlloc(engine->parentDevice->dmaEnabler, bufferSize,
+                                     &engine->bounce.buffer);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    PHYSICAL_ADDRESS bufferLA = engine->bounce.buffer.la;
+    PUCHAR bufferVA = (PUCHAR)engine->bounce.buffer.va;
+
+    engine->bounce.desc = (DMA_DESCRIPTOR*)bufferVA;
+    engine->bounce.data = bufferVA + PAGE_SIZE;
+    engine->bounce.request = NULL;
+    engine->bounce.length = 0;
+    engine->bounce.cancelled = FALSE;
+
+    // build the single descriptor once - only length and device address change per transfer
+    DMA_DESCRIPTOR* desc = engine->bounce.desc;
+    CoreDescriptorSet(desc, engine->dir, bufferLA.QuadPart + PAGE_SIZE, 0, 0, 0);
+    CoreDescriptorSetLast(desc, engine->type);
+
+    TraceVerbose(DBG_INIT, "%s_%u bounce buffer at 0x%08x%08x, size=%lld",
+                 DirectionToString(engine->dir), engine->channel,
+                 bufferLA.HighPart, bufferLA.LowPart, bufferSize);
+    return status;
+}
+
+static void EngineProcessBounce(IN XDMA_ENGINE *engine)
+// complete a request which was transferred via the bounce buffer
+{
+    // take the request, unless EngineBounceCancel() already did
+    WDFREQUEST request = (WDFREQUEST)InterlockedExchangePointer((PVOID volatile*)&engine->bounce.request,
+                                                                NULL);
+    size_t length = engine->bounce.length;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    if (request == NULL) {
+        TraceInfo(DBG_DMA, "%s_%u bounce transfer was cancelled",
+                  DirectionToString(engine->dir), engine->channel);
+        return;
+    }
+
+    TraceInfo(DBG_DMA, "%s_%u processing bounce transfer completion",
+              DirectionToString(engine->dir), engine->channel);
+
+    // read and clear engine status 
+    UINT32 engineStatus = EngineStatus(engine, TRUE);
+
+    EngineStop(engine);
+
+    // clear poll writeback buffer
+    if (engine->poll) {
+        XDMA_POLL_WB* wbBuffer = (XDMA_POLL_WB*)engine->pollWbBuffer.va;
+        size_t wbBufferLength = engine->pollWbBuffer.length;
+        RtlZeroMemory(wbBuffer, wbBufferLength);
+    }
+
+    status = WdfRequestUnmarkCancelable(request);
+    if (status == STATUS_CANCELLED) { // the cancel routine left the request to us
+        TraceInfo(DBG_DMA, "Request 0x%p was cancelled", request);
+        EngineTraceEnd(engine, STATUS_CANCELLED, 0);
+        WdfRequestComplete(request, STATUS_CANCELLED);
+        return;
+    }
+
+    if ((engineStatus & XDMA_STAT_EXPECTED_ZERO) != XDMA_ENGINE_STOPPED_OK) {
+        TraceError(DBG_DMA, "Unexpected engine status 0x%08x", engineStatus);
+        EngineTraceEnd(engine, STATUS_INTERNAL_ERROR, 0);
+        WdfRequestComplete(request, STATUS_INTERNAL_ERROR);
+        return;
+    }
+
+    if (engine->dir == C2H) { // copy received bytes into the request memory
+        WDFMEMORY requestMemory;
+        status = WdfRequestRetrieveOutputMemory(request, &requestMemory);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_DMA, "WdfRequestRetrieveOutputMemory failed: %!STATUS!", status);
+            EngineTraceEnd(engine, status, 0);
+            WdfRequestComplete(request, status);
+            return;
+        }
+        status = WdfMemoryCopyFromBuffer(requestMemory, 0, engine->bounce.data, length);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_DMA, "WdfMemoryCopyFromBuffer failed: %!STATUS!", status);
+            EngineTraceEnd(engine, status, 0);
+            WdfRequestComplete(request, status);
+            return;
+        }
+    }
+
+    TraceInfo(DBG_DMA, "%s_%u bounce transfer complete, bytesTransferred=%llu",
+              DirectionToString(engine->dir), engine->channel, length);
+    EngineTraceEnd(engine, STATUS_SUCCESS, length);
+    WdfRequestCompleteWithInformation(request, STATUS_SUCCESS, length);
+}
+
+static void EnginePatchBounceDescriptor(IN XDMA_ENGINE *engine, IN LONGLONG deviceOffset,
+                                        IN size_t length)
+// patch the prebuilt descriptor with length and device address
+{
+    DMA_DESCRIPTOR* desc = engine->bounce.desc;
+    desc->numBytes = (UINT32)length;
+    if (engine->dir == H2C) {
+        desc->dstAddrLo = LIMIT_TO_32(deviceOffset);
+        desc->dstAddrHi = LIMIT_TO_32(deviceOffset >> 32);
+    } else {
+        desc->srcAddrLo = LIMIT_TO_32(deviceOffset);
+        desc->srcAddrHi = LIMIT_TO_32(deviceOffset >> 32);
+    }
+    if (FALSE == DescriptorIsAligned(engine, desc)) {
+        TraceWarning(DBG_DMA, "Error: Dma Transfer is not aligned");
+    }
+    DumpDescriptor(desc);
+}
+
+NTSTATUS EngineBounceTransfer(IN XDMA_ENGINE *engine, IN WDFREQUEST request, IN size_t length) {
+
+    NTSTATUS status = STATUS_SUCCESS;
+
+    if ((engine->bounce.buffer.va == NULL) || (length > XDMA_BOUNCE_BUFFER_SIZE)) {
+        TraceError(DBG_DMA, "%s_%u cannot bounce %llu bytes",
+                   DirectionToString(engine->dir), engine->channel, length);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    WDF_REQUEST_PARAMETERS params;
+    WDF_REQUEST_PARAMETERS_INIT(&params);
+    WdfRequestGetParameters(request, &params);
+    LONGLONG deviceOffset = (engine->dir == H2C) ?
+        params.Parameters.Write.DeviceOffset :
+        params.Parameters.Read.DeviceOffset;
+
+    if (engine->dir == H2C) { // copy payload from the request memory
+        WDFMEMORY requestMemory;
+        status = WdfRequestRetrieveInputMemory(request, &requestMemory);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_DMA, "WdfRequestRetrieveInputMemory failed: %!STATUS!", status);
+            return status;
+        }
+        status = WdfMemoryCopyToBuffer(requestMemory, 0, engine->bounce.data, length);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_DMA, "WdfMemoryCopyToBuffer failed: %!STATUS!", status);
+            return status;
+        }
+    }
+
+    EnginePatchBounceDescriptor(engine, deviceOffset, length);
+
+    engine->bounce.request = request;
+    engine->bounce.length = length;
+    if (engine->poll) {
+        engine->numDescriptors = 1;
+    }
+
+    // point the engine at the bounce descriptor
+    CoreEngineBindDescriptors(engine->sgdma, engine->bounce.buffer.la);
+
+    MemoryBarrier();
+
+    // start the engine
+    EngineStart(engine);
+
+    MemoryBarrier();
+
+    return status;
+}
+
+BOOLEAN EngineBounceCancel(IN XDMA_ENGINE *engine, IN WDFREQUEST request) {
+
+    EngineStop(engine);
+
+    // the bounce buffer and descriptor may only be reused once the engine is idle. a transfer
+    // still running ends with its own interrupt, whose dpc completes the request as cancelled
+    UINT32 engineStatus = EngineStatus(engine, FALSE);
+    if (engineStatus & XDMA_BUSY_BIT) {
+        TraceInfo(DBG_DMA, "%s_%u engine busy, leaving the request to the dpc",
+                  DirectionToString(engine->dir), engine->channel);
+        return FALSE;
+    }
+
+    // a completion already signalled has an interrupt on its way, mark it before the request is
+    // gone so that its dpc does not take the next transfer's state for it
+    if (engineStatus & (XDMA_DESCRIPTOR_STOPPED_BIT | XDMA_DESCRIPTOR_COMPLETED_BIT)) {
+        InterlockedExchange(&engine->bounce.cancelled, TRUE);
+    }
+
+    // the dpc may have taken the request while the engine stopped
+    if (InterlockedCompareExchangePointer((PVOID volatile*)&engine->bounce.request, NULL,
+                                          request) != request) {
+        return FALSE;
+    }
+
+    // read and clear the engine status of the stopped transfer
+    (void)EngineStatus(engine, TRUE);
+    return TRUE;
+}
+
+//========================= user event triggered transfers ========================================
+
+static void EngineProcessProgram(IN XDMA_ENGINE *engine)
+// record the result of a dma program transfer and hand it to the owner
+{
+    // read and clear engine status 
+    UINT32 engineStatus = EngineStatus(engine, TRUE);
+
+    EngineStop(engine);
+
+    engine->program.completeTime = XdmaOsTimestamp();
+    if ((engineStatus & XDMA_STAT_EXPECTED_ZERO) != XDMA_ENGINE_STOPPED_OK) {
+        TraceError(DBG_DMA, "Unexpected engine status 0x%08x", engineStatus);
+        engine->program.status = STATUS_INTERNAL_ERROR;
+    } else {
+        engine->program.status = STATUS_SUCCESS;
+    }
+
+    TraceInfo(DBG_DMA, "%s_%u program transfer complete, bytesTransferred=%llu",
+              DirectionToString(engine->dir), engine->channel, engine->program.length);
+
+    InterlockedExchange(&engine->program.state, XDMA_PROGRAM_DONE);
+    engine->program.done(engine, engine->program.userData);
+}
+
+NTSTATUS EngineProgramSetup(IN XDMA_ENGINE *engine, IN LONGLONG deviceOffset, IN size_t length,
+                            IN const void* payload, IN PFN_XDMA_TRANSFER_DONE done, IN void* userData) {
+
+    if ((engine->bounce.buffer.va == NULL) || (length == 0) || (length > XDMA_BOUNCE_BUFFER_SIZE)) {
+        TraceError(DBG_DMA, "%s_%u cannot program %llu bytes",
+                   DirectionToString(engine->dir), engine->channel, length);
+        return STATUS_INVALID_PARAMETER;
+    }
+    if (engine->program.state != XDMA_PROGRAM_NONE) {
+        TraceError(DBG_DMA, "%s_%u already has a program",
+                   DirectionToString(engine->dir), engine->channel);
+        return STATUS_DEVICE_BUSY;
+    }
+
+    if ((engine->dir == H2C) && (payload != NULL)) {
+        RtlCopyMemory(engine->bounce.data, payload, length);
+    }
+    EnginePatchBounceDescriptor(engine, deviceOffset, length);
+
+    engine->program.length = length;
+    engine->program.status = STATUS_SUCCESS;
+    engine->program.triggerTime = 0;
+    engine->program.completeTime = 0;
+    engine->program.done = done;
+    engine->program.userData = userData;
+    InterlockedExchange(&engine->program.state, XDMA_PROGRAM_ARMED);
+
+    return STATUS_SUCCESS;
+}
+
+BOOLEAN EngineProgramTrigger(IN XDMA_ENGINE *engine) {
+
+    if (InterlockedCompareExchange(&engine->program.state, XDMA_PROGRAM_RUNNING,
+                                   XDMA_PROGRAM_ARMED) != XDMA_PROGRAM_ARMED) {
+        return FALSE;
+    }
+    engine->program.triggerTime = XdmaOsTimestamp();
+
+    // point the engine at the prebuilt bounce descriptor
+    CoreEngineBindDescriptors(engine->sgdma, engine->bounce.buffer.la);
+
+    MemoryBarrier();
+
+    // start the engine
+    EngineStart(engine);
+
+    MemoryBarrier();
+
+    return TRUE;
+}
+
+void EngineProgramTeardown(IN XDMA_ENGINE *engine) {
+
+    PAGED_CODE();
+
+    LARGE_INTEGER delay;
+    delay.QuadPart = -10 * 1000; // 1ms
+    for (ULONG retries = 0; engine->program.state != XDMA_PROGRAM_NONE; ++retries) {
+        LONG state = engine->program.state;
+        if ((state == XDMA_PROGRAM_ARMED) || (state == XDMA_PROGRAM_DONE)) {
+            InterlockedCompareExchange(&engine->program.state, XDMA_PROGRAM_NONE, state);
+            continue;
+        }
+        if (retries >= 1000) { // transfer did not finish within ~1s
+            TraceError(DBG_DMA, "%s_%u program transfer timed out, stopping engine",
+                       DirectionToString(engine->dir), engine->channel);
+            EngineStop(engine);
+            InterlockedExchange(&engine->program.state, XDMA_PROGRAM_NONE);
+            break;
+        }
+        KeDelayExecutionThread(KernelMode, FALSE, &delay);
+    }
+}
+
+//========================= direct transfers ======================================================
+
+static void EngineProcessDirect(IN XDMA_ENGINE *engine)
+// record the result of a direct transfer and hand it to the owner
+{
+    // read and clear engine status 
+    UINT32 engineStatus = EngineStatus(engine, TRUE);
+
+    EngineStop(engine);
+
+    if ((engineStatus & XDMA_STAT_EXPECTED_ZERO) != XDMA_ENGINE_STOPPED_OK) {
+        TraceError(DBG_DMA, "Unexpected engine status 0x%08x", engineStatus);
+        engine->direct.status = STATUS_INTERNAL_ERROR;
+    } else {
+        engine->direct.status = STATUS_SUCCESS;
+    }
+
+    InterlockedExchange(&engine->direct.busy, FALSE);
+    engine->direct.done(engine, engine->direct.userData);
+}
+
+NTSTATUS EngineDirectTransfer(IN XDMA_ENGINE *engine, IN DMA_DESCRIPTOR* desc,
+                              IN PHYSICAL_ADDRESS descLA, IN PHYSICAL_ADDRESS hostLA,
+                              IN LONGLONG deviceOffset, IN size_t length,
+                              IN PFN_XDMA_TRANSFER_DONE done, IN void* userData) {
+
+    if ((length == 0) || (length > XDMA_MAX_TRANSFER_SIZE)) {
+        TraceError(DBG_DMA, "%s_%u invalid direct transfer length %llu",
+                   DirectionToString(engine->dir), engine->channel, length);
+        return STATUS_INVALID_PARAMETER;
+    }
+    if (InterlockedCompareExchange(&engine->direct.busy, TRUE, FALSE) != FALSE) {
+        return STATUS_DEVICE_BUSY;
+    }
+
+    CoreDescriptorSet(desc, engine->dir, hostLA.QuadPart, deviceOffset, (UINT32)length, 0);
+    CoreDescriptorSetLast(desc, engine->type);
+    if (FALSE == DescriptorIsAligned(engine, desc)) {
+        TraceWarning(DBG_DMA, "Error: Dma Transfer is not aligned");
+    }
+    DumpDescriptor(desc);
+
+    engine->direct.done = done;
+    engine->direct.userData = userData;
+
+    CoreEngineBindDescriptors(engine->sgdma, descLA);
+
+    MemoryBarrier();
+
+    // start the engine
+    EngineStart(engine);
+
+    MemoryBarrier();
+
+    return STATUS_SUCCESS;
+}
+
 //========================= performance counters interface ========================================
 
 void EngineStartPerf(IN XDMA_ENGINE* engine) {
@@ -973,4 +1410,63 @@ void XDMA_EngineSetPollMode(XDMA_ENGINE* engine, BOOLEAN pollMode) {
         }
         engine->poll = pollMode;
     }
-}
\ No newline at end of file
+}
+
+void XDMA_EngineSetBounceThreshold(XDMA_ENGINE* engine, size_t threshold) {
+
+    EXPECT(engine != NULL);
+
+    if ((engine->enabled == TRUE) && (engine->bounce.buffer.va != NULL)) {
+        engine->bounce.threshold = min(threshold, XDMA_BOUNCE_BUFFER_SIZE);
+        TraceInfo(DBG_INIT, "%s_%u bounce threshold=%llu",
+                  DirectionToString(engine->dir), engine->channel, engine->bounce.threshold);
+    }
+}
+
+NTSTATUS XDMA_EngineSetSpill(XDMA_ENGINE* engine, size_t size, ULONG highWater) {
+
+    EXPECT(engine != NULL);
+
+    // release a previous buffer, the ring must not be running
+    EngineFreeSpill(engine);
+
+    if ((size == 0) || (engine->enabled == FALSE) || (engine->type != EngineType_ST) ||
+        (engine->dir != C2H)) {
+        return STATUS_SUCCESS;
+    }
+
+    // the pages are only touched by the cpu, they need not be contiguous nor below 4 GB
+    PHYSICAL_ADDRESS low, high, skip;
+    low.QuadPart = 0;
+    high.QuadPart = 0xFFFFFFFFFFFFFFFF;
+    skip.QuadPart = 0;
+    size = ROUND_TO_PAGES(min(size, XDMA_SPILL_MAX_SIZE));
+    PMDL mdl = MmAllocatePagesForMdlEx(low, high, skip, size, MmCached, MM_ALLOCATE_FULLY_REQUIRED);
+    if (!mdl) {
+        TraceError(DBG_INIT, "MmAllocatePagesForMdlEx(%llu) failed!", size);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    PUCHAR va = (PUCHAR)MmMapLockedPagesSpecifyCache(mdl, KernelMode, MmCached, NULL, FALSE,
+                                                     NormalPagePriority);
+    if (!va) {
+        TraceError(DBG_INIT, "MmMapLockedPagesSpecifyCache failed!");
+        MmFreePagesFromMdl(mdl);
+        ExFreePool(mdl);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    if ((highWater == 0) || (highWater >= XDMA_RING_NUM_BLOCKS)) {
+        highWater = XDMA_SPILL_DEFAULT_HIGH_WATER;
+    }
+
+    engine->spill.mdl = mdl;
+    engine->spill.size = size;
+    engine->spill.highWater = highWater;
+    EngineSpillReset(engine);
+    engine->spill.va = va;
+
+    TraceInfo(DBG_INIT, "%s_%u spill buffer %lluB, high-water mark %u blocks",
+              DirectionToString(engine->dir), engine->channel, size, highWater);
+    return STATUS_SUCCESS;
+}
@@ -20,7 +20,11 @@
 #include <ntintsafe.h>
 #include <wdf.h>
 #include "reg.h"
+#include "xdma_os.h"
+#include "xdma_core.h"
 #include "xdma_public.h"
+#include "io_trace.h"
+#include "timeline.h"
 
 // ========================= constants ============================================================
 
@@ -30,6 +34,26 @@
 #define XDMA_RING_NUM_BLOCKS    (258U)
 #define XDMA_RING_BLOCK_SIZE    (PAGE_SIZE)
 #define XDMA_MAX_TRANSFER_SIZE  (8UL * 1024UL * 1024UL)
+#define XDMA_BOUNCE_BUFFER_SIZE (64UL * 1024UL)
+#define XDMA_BOUNCE_DEFAULT_THRESHOLD (4UL * 1024UL)
+#define XDMA_SPILL_MAX_SIZE     (2048ULL * 1024ULL * 1024ULL)
+#define XDMA_SPILL_DEFAULT_HIGH_WATER (XDMA_RING_NUM_BLOCKS / 2)
+
+// consumer of the streaming ring while spill mode is enabled, see XDMA_SPILL
+#define XDMA_SPILL_OWNER_NONE   (0)
+#define XDMA_SPILL_OWNER_READER (1) // EngineRingCopyBytesToMemory()
+#define XDMA_SPILL_OWNER_DPC    (2) // EngineProcessRing()
+
+// dma program states, see XDMA_PROGRAM
+#define XDMA_PROGRAM_NONE       (0) // no program registered
+#define XDMA_PROGRAM_ARMED      (1) // waiting for the user event
+#define XDMA_PROGRAM_RUNNING    (2) // transfer started by the user event is in flight
+#define XDMA_PROGRAM_DONE       (3) // transfer finished, result not yet collected
+#define XDMA_PROGRAM_COLLECT    (4) // result is being collected, re-armed afterwards
+
+/// Record a timeline event of an engine, see timeline.h
+#define XDMA_TIMELINE_ENGINE_LOG(engine, type, arg) \
+    XDMA_TIMELINE_LOG(&(engine)->parentDevice->timeline, (type), (engine)->dir, (engine)->channel, (arg))
 
 // ========================= forward declarations =================================================
 
@@ -39,116 +63,129 @@ struct XDMA_ENGINE_T;
 
 // ========================= type declarations ====================================================
 
-/// Direction of the DMA transfer/engine
-typedef enum DirToDev_t {
-    H2C = 0, // Host-to-Card - write to device
-    C2H = 1  // Card-to-Host - read from device
-} DirToDev;
-
 /// Ring buffer abstraction for streaming DMA
+/// A single-producer/single-consumer ring: only the engine dpc (EngineProcessRing()) writes tail
+/// and only the reader (EngineRingCopyBytesToMemory()) writes head. Each side publishes its index
+/// with XdmaOsStoreRelease() and reads the other one with XdmaOsLoadAcquire(), no lock is taken on
+/// the data path. Each index has a cache line of its own so the dpc and the reader do not
+/// invalidate each other's line on every update.
 typedef struct XDMA_RING_T {
-    WDFCOMMONBUFFER results;
-    PMDL mdl[XDMA_RING_NUM_BLOCKS]; // memory descriptor list - host side
-    CHAR dmaTransferContext[DMA_TRANSFER_CONTEXT_SIZE_V1];
-    UINT head;
-    UINT tail;
-    WDFSPINLOCK lock;
+    XDMA_CACHE_ALIGN volatile ULONG tail;   // next result to process - written by the dpc
+    XDMA_CACHE_ALIGN volatile ULONG head;   // next block to copy out - written by the reader
+    XDMA_CACHE_ALIGN XDMA_OS_LOCK lock;     // serializes EngineRingSetup() and EngineRingTeardown()
     KEVENT completionSignal;
+    XDMA_OS_DMA_BUFFER results;
+
+    // cold - written once when the ring buffer is created
+    XDMA_CACHE_ALIGN PMDL mdl[XDMA_RING_NUM_BLOCKS]; // memory descriptor list - host side
+    CHAR dmaTransferContext[DMA_TRANSFER_CONTEXT_SIZE_V1];
 }XDMA_RING, *PXDMA_RING;
 
+/// Elastic overflow buffer behind the streaming ring
+/// When the ring holds highWater or more filled blocks the dpc moves them, oldest first, into this
+/// byte fifo and hands their credits back to the engine, so a slow reader does not back-pressure
+/// the card. The reader drains the fifo before the ring. While spill mode is enabled the ring head
+/// is written by whichever side holds owner; the dpc only tries to take it and never waits.
+typedef struct XDMA_SPILL_T {
+    volatile LONG owner;    // XDMA_SPILL_OWNER_*
+    ULONGLONG head;         // bytes read out of the fifo, written by the owner
+    ULONGLONG tail;         // bytes written into the fifo, written by the owner
+    volatile LONGLONG level; // tail - head, read by the reader without taking owner
+    XDMA_SPILL_STATS stats; // written by the owner, ringHighWater and contended by the dpc
+
+    // cold - set up once by XDMA_EngineSetSpill()
+    PUCHAR va;              // virtual address of the fifo, NULL = spill mode disabled
+    PMDL mdl;               // pages backing the fifo
+    size_t size;            // capacity in bytes
+    ULONG highWater;        // ring occupancy in blocks at which blocks are spilled
+}XDMA_SPILL, *PXDMA_SPILL;
+
+/// Pre-mapped buffer for small transfers which bypass the WDF dma transaction
+typedef struct XDMA_BOUNCE_T {
+    XDMA_OS_DMA_BUFFER buffer; // one descriptor page followed by XDMA_BOUNCE_BUFFER_SIZE data bytes
+    struct xdma_descriptor_t* desc; // permanently built descriptor pointing at the data area
+    PUCHAR data;            // virtual address of the data area
+    size_t threshold;       // transfers up to this size use the bounce buffer, 0 = disabled
+    WDFREQUEST request;     // request currently in flight via the bounce buffer
+    size_t length;          // number of bytes of the in-flight request
+    volatile LONG cancelled; // a cancelled transfer had signalled completion, its dpc is stale
+}XDMA_BOUNCE, *PXDMA_BOUNCE;
+
 /// engine specific work to perform after dma transfer completion is detected
 typedef VOID(*PFN_XDMA_ENGINE_WORK)(IN struct XDMA_ENGINE_T *engine);
 
-/// Engine address mode. 
-/// Determines how the DMA engine interprets the device address (destination address on H2C and 
-/// source address on C2H).
-/// When AddressMode_Contiguous is chosen, the device address only needs to be set for the first 
-/// descriptor and the engine assumes that all subsequent descriptors device addresses follow
-/// sequentially. 
-/// When AddressMode_Fixed is selected, the device addresses of each descriptor must be explicitly
-/// set.
-typedef enum AddressMode_T {
-    AddressMode_Contiguous,  // incremental
-    AddressMode_Fixed,       // non-incremental
-} AddressMode;
-
-typedef enum EngineType_t {
-    EngineType_MM,      // Memory Mapped
-    EngineType_ST,      // Streaming
-} EngineType;
+/// Called from the engine DPC when a dma program or direct transfer has finished
+typedef VOID(*PFN_XDMA_TRANSFER_DONE)(IN struct XDMA_ENGINE_T *engine, IN void* userData);
+
+/// Transfer through the bounce buffer which is started directly from a user event interrupt
+typedef struct XDMA_PROGRAM_T {
+    volatile LONG state;    // XDMA_PROGRAM_*
+    size_t length;          // number of bytes per transfer
+    NTSTATUS status;        // result of the last transfer
+    LONGLONG triggerTime;   // performance counter value when the last transfer was started
+    LONGLONG completeTime;  // performance counter value when the last transfer finished
+    PFN_XDMA_TRANSFER_DONE done; // completion callback
+    void* userData;         // passed into the completion callback
+}XDMA_PROGRAM, *PXDMA_PROGRAM;
+
+/// Single descriptor transfer started outside of the WDF request flow, e.g. from a shared queue
+typedef struct XDMA_DIRECT_T {
+    volatile LONG busy;         // transfer in flight
+    NTSTATUS status;            // result of the last transfer
+    PFN_XDMA_TRANSFER_DONE done; // completion callback
+    void* userData;             // passed into the completion callback
+}XDMA_DIRECT;
 
 /// DMA engine abstraction
+/// The members are grouped by who writes them and each group starts on a cache line, so the
+/// submitting thread, the dpc of the engine and the engines next to it in XDMA_DEVICE::engines
+/// do not false-share. Keep new members in the group matching their access pattern.
 typedef struct XDMA_ENGINE_T {
 
-    XDMA_DEVICE *parentDevice; // the xdma device to which this engine belongs
-
-    // register access
-    volatile XDMA_ENGINE_REGS *regs; // control regs
+    // ---- hot, read-mostly: set up by ProbeEngines(), read on every transfer and interrupt
+    XDMA_CACHE_ALIGN volatile XDMA_ENGINE_REGS *regs; // control regs
     volatile XDMA_SGDMA_REGS *sgdma;
-
-    // engine configuration
+    XDMA_DEVICE *parentDevice; // the xdma device to which this engine belongs
+    PFN_XDMA_ENGINE_WORK work; // engine work for interrupt processing
+    WDFDMATRANSACTION dmaTransaction;
     UINT32 irqBitMask;
-    UINT32 alignAddr;
-    UINT32 alignLength;
-    UINT32 alignAddrBits;
     DWORD channel;
     DirToDev dir;               // data flow direction (H2C or C2H)
-    BOOLEAN enabled;
     EngineType type;            // MemoryMapped or Streaming
     AddressMode addressMode;    // incremental (contiguous) or non-incremental (fixed)
+    ULONG poll;                 // poll mode instead of interrupts
+    BOOLEAN enabled;
+    XDMA_ALIGNMENT alignment;
+    XDMA_OS_DMA_BUFFER descBuffer;
+    XDMA_OS_DMA_BUFFER pollWbBuffer; // buffer for holding poll mode descriptor writeback data
 
-    // dma transfer related
-    WDFCOMMONBUFFER descBuffer;
-    WDFDMATRANSACTION dmaTransaction;
-    PFN_XDMA_ENGINE_WORK work; // engine work for interrupt processing
+    // ---- hot, per transfer: written by the submitting thread and the completing dpc
+    XDMA_CACHE_ALIGN ULONG numDescriptors; // keep count of descriptors in transfer for poll mode
+    XDMA_IO_TRACE_PENDING tracePending; // i/o trace capture of the request in flight
+    XDMA_BOUNCE bounce;         // small transfer fast path
+
+    // ---- transfers started outside of the request flow
+    // transfer triggered by a user event, uses the bounce buffer
+    XDMA_CACHE_ALIGN XDMA_PROGRAM program;
 
-    // specific to streaming interface
+    // transfer of a caller-owned contiguous buffer
+    XDMA_DIRECT direct;
+
+    // ---- specific to streaming interface, keeps its producer and consumer lines apart
     XDMA_RING ring;
 
-    // specific to poll mode
-    ULONG poll;
-    WDFCOMMONBUFFER pollWbBuffer; // buffer for holding poll mode descriptor writeback data
-    ULONG numDescriptors; // keep count of descriptors in transfer for poll mode
+    // ---- overflow buffering of the streaming ring, written by the current ring consumer
+    XDMA_CACHE_ALIGN XDMA_SPILL spill;
 } XDMA_ENGINE;
 
-#pragma pack(1)
-
-/// \brief Descriptor for a single contiguous memory block transfer.
-///
-/// Multiple descriptors are linked a 'next' pointer. An additional extra adjacent number gives the 
-/// amount of subsequent contiguous descriptors. The descriptors are in root complex memory, and the
-/// bytes in the 32-bit words must be in little-endian byte ordering.
-typedef struct xdma_descriptor_t {
-    UINT32 control;
-    UINT32 numBytes;  // transfer length in bytes
-    UINT32 srcAddrLo; // source address (low 32-bit)
-    UINT32 srcAddrHi; // source address (high 32-bit)
-    UINT32 dstAddrLo; // destination address (low 32-bit)
-    UINT32 dstAddrHi; // destination address (high 32-bit)
-                      // next descriptor in the single-linked list of descriptors, 
-                      // this is the bus address of the next descriptor in the root complex memory.
-    UINT32 nextLo;    // next desc address (low 32-bit)
-    UINT32 nextHi;    // next desc address (high 32-bit)
-} DMA_DESCRIPTOR;
-
-/// Result buffer of the streaming DMA operation. 
-/// The XDMA IP core writes the result of the DMA transfer to the host memory
-typedef struct {
-    UINT32 status;
-    UINT32 length;
-    UINT32 reserved_1[6]; // padding
-} DMA_RESULT;
-
-/// \brief Structure for polled mode descriptor writeback
-///
-/// XDMA IP core writes number of completed descriptors to this memory, which the driver can then
-/// poll to detect transfer completion
-typedef struct {
-    UINT32 completedDescCount;
-    UINT32 reserved_1[7];
-} XDMA_POLL_WB;
-
-#pragma pack()
+C_ASSERT(FIELD_OFFSET(XDMA_ENGINE, regs) == 0);
+C_ASSERT((FIELD_OFFSET(XDMA_ENGINE, numDescriptors) % XDMA_CACHE_LINE_SIZE) == 0);
+C_ASSERT((FIELD_OFFSET(XDMA_ENGINE, program) % XDMA_CACHE_LINE_SIZE) == 0);
+C_ASSERT((FIELD_OFFSET(XDMA_ENGINE, ring) % XDMA_CACHE_LINE_SIZE) == 0);
+C_ASSERT((FIELD_OFFSET(XDMA_RING, head) - FIELD_OFFSET(XDMA_RING, tail)) >= XDMA_CACHE_LINE_SIZE);
+C_ASSERT((FIELD_OFFSET(XDMA_RING, lock) - FIELD_OFFSET(XDMA_RING, head)) >= XDMA_CACHE_LINE_SIZE);
+C_ASSERT((FIELD_OFFSET(XDMA_ENGINE, spill) % XDMA_CACHE_LINE_SIZE) == 0);
+C_ASSERT((sizeof(XDMA_ENGINE) % XDMA_CACHE_LINE_SIZE) == 0);
 
 // ========================= function declarations ================================================
 
@@ -168,7 +205,7 @@ VOID EngineStop(IN XDMA_ENGINE *engine);
 /// Configure the streaming ring buffer and start the cyclic DMA transfer
 VOID EngineRingSetup(IN XDMA_ENGINE *engine);
 
-/// Reset the streaming ring buffer and stop the cyclic DMA transfer
+/// Reset the streaming ring buffer and stop the cyclic DMA transfer, called at PASSIVE_LEVEL
 VOID EngineRingTeardown(IN XDMA_ENGINE *engine);
 
 /// Poll the write-back buffer for DMA transfer completion
@@ -193,6 +230,41 @@ VOID EngineGetPerf(IN XDMA_ENGINE* engine, OUT XDMA_PERF_DATA* perfData);
 /// Stringify the Engine direction (H2C/C2H)
 char* DirectionToString(DirToDev dir);
 
-/// Copy data from the ring buffer directly into a WDFMEMORY object
+/// Start a small transfer via the engine's pre-mapped bounce buffer
+/// The request is completed by the engine work function like a regular dma transfer
+NTSTATUS EngineBounceTransfer(IN XDMA_ENGINE *engine, IN WDFREQUEST request, IN size_t length);
+
+/// Stop the bounce transfer of a request being cancelled, without waiting for the engine.
+/// Returns TRUE if the engine was idle and the caller now owns the request and completes it, FALSE
+/// if the engine is still busy or the engine work function has taken the request, which then
+/// completes it as cancelled.
+BOOLEAN EngineBounceCancel(IN XDMA_ENGINE *engine, IN WDFREQUEST request);
+
+/// Prebuild the bounce descriptor for a dma program and arm it. On H2C the payload is copied into
+/// the bounce buffer once and sent on every trigger. Regular transfers must not be issued on the
+/// engine until EngineProgramTeardown() returns.
+NTSTATUS EngineProgramSetup(IN XDMA_ENGINE *engine, IN LONGLONG deviceOffset, IN size_t length,
+                            IN const void* payload, IN PFN_XDMA_TRANSFER_DONE done, IN void* userData);
+
+/// Start the armed dma program, callable from DPC level. Returns FALSE if it was not armed.
+BOOLEAN EngineProgramTrigger(IN XDMA_ENGINE *engine);
+
+/// Disarm the dma program, waiting for an in-flight transfer to finish. PASSIVE_LEVEL only.
+void EngineProgramTeardown(IN XDMA_ENGINE *engine);
+
+/// Build a single descriptor at desc/descLA for a physically contiguous host buffer and start the
+/// engine. done is called from the engine DPC. The caller must own the engine exclusively.
+NTSTATUS EngineDirectTransfer(IN XDMA_ENGINE *engine, IN struct xdma_descriptor_t* desc,
+                              IN PHYSICAL_ADDRESS descLA, IN PHYSICAL_ADDRESS hostLA,
+                              IN LONGLONG deviceOffset, IN size_t length,
+                              IN PFN_XDMA_TRANSFER_DONE done, IN void* userData);
+
+/// Release the spill buffer of the engine, the ring must not be running
+VOID EngineFreeSpill(IN XDMA_ENGINE *engine);
+
+/// Get the spill counters of a streaming C2H engine
+VOID EngineGetSpillStats(IN XDMA_ENGINE *engine, OUT XDMA_SPILL_STATS* stats);
+
+/// Copy data from the spill buffer and the ring buffer directly into a WDFMEMORY object
 NTSTATUS EngineRingCopyBytesToMemory(IN XDMA_ENGINE *engine, WDFMEMORY outputMem,
                                      size_t length, LARGE_INTEGER timeout, size_t* bytesRead);
\ No newline at end of file
@@ -47,15 +47,6 @@ EVT_WDF_INTERRUPT_DISABLE    EvtUserInterruptDisable;
 
 // ====================== static setup functions =================================================
 
-static UINT32 BuildVectorReg(UINT32 a, UINT32 b, UINT32 c, UINT32 d) {
-    UINT32 reg_val = 0;
-    reg_val |= (a & 0x1f) << 0;
-    reg_val |= (b & 0x1f) << 8;
-    reg_val |= (c & 0x1f) << 16;
-    reg_val |= (d & 0x1f) << 24;
-    return reg_val;
-}
-
 static NTSTATUS SetupUserInterrupt(IN PXDMA_DEVICE xdma, IN ULONG index,
                                    IN PCM_PARTIAL_RESOURCE_DESCRIPTOR resource,
                                    IN PCM_PARTIAL_RESOURCE_DESCRIPTOR translatedResource) {
@@ -219,14 +210,14 @@ static NTSTATUS SetupMsixInterrupts(IN PXDMA_DEVICE xdma, IN WDFCMRESLIST Resour
     }
 
     // first 16 msg IDs are user irq
-    xdma->interruptRegs->userVector[0] = BuildVectorReg(0, 1, 2, 3);
-    xdma->interruptRegs->userVector[1] = BuildVectorReg(4, 5, 6, 7);
-    xdma->interruptRegs->userVector[2] = BuildVectorReg(8, 9, 10, 11);
-    xdma->interruptRegs->userVector[3] = BuildVectorReg(12, 13, 14, 15);
+    xdma->interruptRegs->userVector[0] = CoreIrqVectorReg(0, 1, 2, 3);
+    xdma->interruptRegs->userVector[1] = CoreIrqVectorReg(4, 5, 6, 7);
+    xdma->interruptRegs->userVector[2] = CoreIrqVectorReg(8, 9, 10, 11);
+    xdma->interruptRegs->userVector[3] = CoreIrqVectorReg(12, 13, 14, 15);
 
     // next 8 are dma channel
-    xdma->interruptRegs->channelVector[0] = BuildVectorReg(16, 17, 18, 19);
-    xdma->interruptRegs->channelVector[1] = BuildVectorReg(20, 21, 22, 23);
+    xdma->interruptRegs->channelVector[0] = CoreIrqVectorReg(16, 17, 18, 19);
+    xdma->interruptRegs->channelVector[1] = CoreIrqVectorReg(20, 21, 22, 23);
 
     return status;
 }
@@ -275,14 +266,14 @@ static NTSTATUS SetupMultiMsiInterrupts(IN PXDMA_DEVICE xdma, IN WDFCMRESLIST Re
     TraceVerbose(DBG_INIT, "Channel interrupt msg ids = H2C[1,2,3,4], C2H[5,6,7,8]");
 
     // first 16 msg IDs are user irq
-    xdma->interruptRegs->userVector[0] = BuildVectorReg(0, 1, 2, 3);
-    xdma->interruptRegs->userVector[1] = BuildVectorReg(4, 5, 6, 7);
-    xdma->interruptRegs->userVector[2] = BuildVectorReg(8, 9, 10, 11);
-    xdma->interruptRegs->userVector[3] = BuildVectorReg(12, 13, 14, 15);
+    xdma->interruptRegs->userVector[0] = CoreIrqVectorReg(0, 1, 2, 3);
+    xdma->interruptRegs->userVector[1] = CoreIrqVectorReg(4, 5, 6, 7);
+    xdma->interruptRegs->userVector[2] = CoreIrqVectorReg(8, 9, 10, 11);
+    xdma->interruptRegs->userVector[3] = CoreIrqVectorReg(12, 13, 14, 15);
 
     // next 8 are dma channel
-    xdma->interruptRegs->channelVector[0] = BuildVectorReg(16, 17, 18, 19);
-    xdma->interruptRegs->channelVector[1] = BuildVectorReg(20, 21, 22, 23);
+    xdma->interruptRegs->channelVector[0] = CoreIrqVectorReg(16, 17, 18, 19);
+    xdma->interruptRegs->channelVector[1] = CoreIrqVectorReg(20, 21, 22, 23);
 
     return status;
 }
@@ -334,36 +325,22 @@ BOOLEAN EvtInterruptIsr(IN WDFINTERRUPT Interrupt, IN ULONG MessageID)
 // interrupt service routine - handle line interrupts
 {
     PIRQ_CONTEXT irq = GetIrqContext(Interrupt);
-    UINT32 chIrq = 0;
-    UINT32 userIrq = 0;
 
     TraceInfo(DBG_IRQ, "irq messageId = %u", MessageID);
 
     EXPECT(irq != NULL);
     EXPECT(irq->regs != NULL);
+    XDMA_TIMELINE_LOG(&irq->xdma->timeline, XDMA_TL_ISR, XDMA_TL_NO_ENGINE, XDMA_TL_NO_ENGINE,
+                      MessageID);
 
-    // read channel interrupt request registers
-    // channel interrupt(s) requested?
-    chIrq = irq->regs->channelIntRequest;
     TraceVerbose(DBG_IRQ, "chan EN=0x%08X RQ=0x%08X PE=0x%08X",
                  irq->regs->channelIntEnable, irq->regs->channelIntRequest, irq->regs->channelIntPending);
-    if (chIrq) {
-        irq->channelIrqPending |= chIrq; // remember fired channel interrupts
-        irq->regs->channelIntEnableW1C = chIrq; // disable fired channel interrupts
-    }
-
-    // read user interrupts that are pending in the controller - flushes previous write
-    // user interrupt(s) requested?
-    userIrq = irq->regs->userIntRequest;
     TraceVerbose(DBG_IRQ, "user EN=0x%08X RQ=0x%08X PE=0x%08X",
                  irq->regs->userIntEnable, irq->regs->userIntRequest, irq->regs->userIntPending);
-    if (userIrq) {
-        irq->userIrqPending |= userIrq; // remember fired user interrupts
-        irq->regs->userIntEnableW1C = userIrq; // disable fired user interrupts
-    }
 
+    // latch and mask the requested channel and user interrupts
     // was the interrupt handled correctly?
-    if (!chIrq && !userIrq) {
+    if (!CoreIrqLatch(irq->regs, &irq->channelIrqPending, &irq->userIrqPending)) {
         TraceWarning(DBG_IRQ, "Spurious interrupt");
         return FALSE;
     }
@@ -378,6 +355,9 @@ VOID EvtInterruptDpc(IN WDFINTERRUPT interrupt, IN WDFOBJECT device)
 {
     UNREFERENCED_PARAMETER(device);
     PIRQ_CONTEXT irq = GetIrqContext(interrupt);
+    XDMA_TIMELINE* timeline = &irq->xdma->timeline;
+    XDMA_TIMELINE_LOG(timeline, XDMA_TL_DPC_BEGIN, XDMA_TL_NO_ENGINE, XDMA_TL_NO_ENGINE,
+                      irq->channelIrqPending);
 
     // dma engine interrupt pending?
     TraceVerbose(DBG_IRQ, "channelIrqPending=0x%08X", irq->channelIrqPending);
@@ -405,17 +385,9 @@ VOID EvtInterruptDpc(IN WDFINTERRUPT interrupt, IN WDFOBJECT device)
 
     // re-enable interrupts
     WdfInterruptAcquireLock(interrupt);
-    irq->regs->channelIntEnableW1S = irq->channelIrqPending;
-    irq->channelIrqPending = 0x0;
-
-    // FIXME - Remove the user interrupt source condition before reenabling the user interrupt
-    // This depends on user logic and how the interrupt has been triggered!
-    // This reference driver puts the responsibility on the user-space application to remove the 
-    // user event interrupt source condition.
-
-    irq->regs->userIntEnableW1S = irq->userIrqPending;
-    irq->userIrqPending = 0x0;
+    CoreIrqRearm(irq->regs, &irq->channelIrqPending, &irq->userIrqPending);
     WdfInterruptReleaseLock(interrupt);
+    XDMA_TIMELINE_LOG(timeline, XDMA_TL_DPC_END, XDMA_TL_NO_ENGINE, XDMA_TL_NO_ENGINE, 0);
     TraceVerbose(DBG_IRQ, "channel EN=0x%08X RQ=0x%08X PE=0x%08X",
                  irq->regs->channelIntEnable, irq->regs->channelIntRequest, irq->regs->channelIntPending);
     TraceVerbose(DBG_IRQ, "user EN=0x%08X RQ=0x%08X PE=0x%08X",
@@ -452,6 +424,7 @@ BOOLEAN EvtChannelInterruptIsr(IN WDFINTERRUPT Interrupt, IN ULONG MessageID)
 
     TraceVerbose(DBG_IRQ, "%s_%u interrupt occurred! messageId=%u",
                  DirectionToString(irq->engine->dir), irq->engine->channel, MessageID);
+    XDMA_TIMELINE_ENGINE_LOG(irq->engine, XDMA_TL_ISR, MessageID);
 
     EngineDisableInterrupt(irq->engine);
 
@@ -463,6 +436,7 @@ VOID EvtChannelInterruptDpc(IN WDFINTERRUPT interrupt, IN WDFOBJECT device)
 {
     UNREFERENCED_PARAMETER(device);
     PIRQ_CONTEXT irq = GetIrqContext(interrupt);
+    XDMA_TIMELINE_ENGINE_LOG(irq->engine, XDMA_TL_DPC_BEGIN, irq->engine->irqBitMask);
 
     // do engine specific work (either EngineProcessTransfer (MM) or EngineProcessRing (ST))
     irq->engine->work(irq->engine);
@@ -471,6 +445,7 @@ VOID EvtChannelInterruptDpc(IN WDFINTERRUPT interrupt, IN WDFOBJECT device)
     WdfInterruptAcquireLock(interrupt);
     EngineEnableInterrupt(irq->engine);
     WdfInterruptReleaseLock(interrupt);
+    XDMA_TIMELINE_ENGINE_LOG(irq->engine, XDMA_TL_DPC_END, 0);
 }
 
 NTSTATUS EvtUserInterruptEnable(IN WDFINTERRUPT Interrupt, IN WDFDEVICE device) {
@@ -0,0 +1,154 @@
+/*
+* XDMA I/O Trace Capture
+* ======================
+*
+* Copyright 2017 Xilinx Inc.
+* Copyright 2010-2012 Sidebranch
+* Copyright 2010-2012 Leon Woestenberg <leon@sidebranch.com>
+*
+* Maintainer:
+* -----------
+* Alexander Hornburg <alexander.hornburg@xilinx.com>
+*
+*/
+
+// ========================= include dependencies =================================================
+
+#include "device.h"
+#include "io_trace.h"
+#include "trace.h"
+
+#ifdef DBG
+// The trace message header (.tmh) file must be included in a source file before any WPP macro
+// calls and after defining a WPP_CONTROL_GUIDS macro (defined in trace.h). see trace.h
+#include "io_trace.tmh"
+#endif
+
+// ========================= constants ============================================================
+
+#define XDMA_TRACE_INDEX_MASK   (XDMA_TRACE_MAX_RECORDS - 1)
+
+// ========================= public functions =====================================================
+
+NTSTATUS TraceStart(IN WDFDEVICE wdfDevice, IN OUT XDMA_IO_TRACE* trace) {
+    NTSTATUS status = STATUS_SUCCESS;
+
+    if (trace->records == NULL) {
+        WDF_OBJECT_ATTRIBUTES attribs;
+        WDF_OBJECT_ATTRIBUTES_INIT(&attribs);
+        attribs.ParentObject = wdfDevice;
+        WDFMEMORY memory;
+        PVOID records;
+        status = WdfMemoryCreate(&attribs, NonPagedPoolNx, 0,
+                                 XDMA_TRACE_MAX_RECORDS * sizeof(XDMA_TRACE_RECORD), &memory,
+                                 &records);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_IO, "WdfMemoryCreate failed: %!STATUS!", status);
+            return status;
+        }
+        RtlZeroMemory(records, XDMA_TRACE_MAX_RECORDS * sizeof(XDMA_TRACE_RECORD));
+        if (InterlockedCompareExchangePointer((PVOID*)&trace->records, records, NULL) != NULL) {
+            WdfObjectDelete(memory); // concurrent start won
+        }
+        trace->frequency = XdmaOsTimestampFrequency();
+    }
+
+    // requests completing meanwhile may still write into the cleared log, that is harmless
+    InterlockedExchange(&trace->enabled, FALSE);
+    InterlockedExchange64(&trace->next, 0);
+    InterlockedExchange(&trace->enabled, TRUE);
+    TraceInfo(DBG_IO, "i/o trace capture started");
+    return status;
+}
+
+VOID TraceStop(IN OUT XDMA_IO_TRACE* trace) {
+    InterlockedExchange(&trace->enabled, FALSE);
+    TraceInfo(DBG_IO, "i/o trace capture stopped after %lld requests", trace->next);
+}
+
+size_t TraceDump(IN const XDMA_IO_TRACE* trace, OUT XDMA_TRACE_INFO* info, IN size_t length) {
+    ASSERT(length >= sizeof(XDMA_TRACE_INFO));
+
+    const LONG64 next = trace->next;
+    const size_t fit = (length - sizeof(XDMA_TRACE_INFO)) / sizeof(XDMA_TRACE_RECORD);
+    LONG64 count = min(next, (LONG64)XDMA_TRACE_MAX_RECORDS);
+    count = min(count, (LONG64)fit);
+
+    XDMA_TRACE_RECORD* out = (XDMA_TRACE_RECORD*)(info + 1);
+    UINT32 numRecords = 0;
+    for (LONG64 seq = next - count + 1; (seq <= next) && (trace->records != NULL); ++seq) {
+        const XDMA_TRACE_RECORD* record = &trace->records[(seq - 1) & XDMA_TRACE_INDEX_MASK];
+        const volatile UINT32* sequence = &record->sequence;
+        // skip records which are still being written or were overwritten meanwhile, the writer
+        // clears the sequence number before and sets it after the other members
+        if (*sequence != (UINT32)seq) {
+            continue;
+        }
+        KeMemoryBarrier();
+        out[numRecords] = *record;
+        KeMemoryBarrier();
+        if (*sequence == (UINT32)seq) {
+            numRecords++;
+        }
+    }
+
+    info->frequency = (UINT64)trace->frequency;
+    info->captured = (UINT64)next;
+    info->numRecords = numRecords;
+    info->enabled = trace->enabled ? 1 : 0;
+    return sizeof(XDMA_TRACE_INFO) + numRecords * sizeof(XDMA_TRACE_RECORD);
+}
+
+VOID EngineTraceBegin(IN XDMA_ENGINE* engine, IN LONGLONG arrival, IN LONGLONG offset,
+                      IN size_t length) {
+    XDMA_IO_TRACE_PENDING* pending = &engine->tracePending;
+    pending->active = engine->parentDevice->ioTrace.enabled ? TRUE : FALSE;
+    if (!pending->active) {
+        return;
+    }
+    pending->start = XdmaOsTimestamp();
+    pending->arrival = arrival ? arrival : pending->start;
+    pending->offset = offset;
+    pending->length = length;
+    pending->flags = 0;
+    if (length <= engine->bounce.threshold) {
+        pending->flags |= XDMA_TRACE_FLAG_BOUNCE;
+    }
+    if (engine->poll) {
+        pending->flags |= XDMA_TRACE_FLAG_POLL;
+    }
+}
+
+VOID EngineTraceEnd(IN XDMA_ENGINE* engine, IN NTSTATUS status, IN size_t bytes) {
+    XDMA_IO_TRACE_PENDING* pending = &engine->tracePending;
+    XDMA_IO_TRACE* trace = &engine->parentDevice->ioTrace;
+    XDMA_TIMELINE_ENGINE_LOG(engine, XDMA_TL_COMPLETE, bytes);
+    if (!pending->active) {
+        return;
+    }
+    pending->active = FALSE;
+    if (!trace->enabled) {
+        return;
+    }
+
+    const LONGLONG complete = XdmaOsTimestamp();
+    const LONG64 seq = InterlockedIncrement64(&trace->next);
+    XDMA_TRACE_RECORD* record = &trace->records[(seq - 1) & XDMA_TRACE_INDEX_MASK];
+
+    // the sequence number is written last, see TraceDump()
+    record->sequence = 0;
+    KeMemoryBarrier();
+    record->dir = (UINT8)engine->dir;
+    record->channel = (UINT8)engine->channel;
+    record->flags = pending->flags;
+    record->status = status;
+    record->length = (UINT32)pending->length;
+    record->bytes = (UINT32)bytes;
+    record->reserved = 0;
+    record->offset = (UINT64)pending->offset;
+    record->arrival = (UINT64)pending->arrival;
+    record->start = (UINT64)pending->start;
+    record->complete = (UINT64)complete;
+    KeMemoryBarrier();
+    record->sequence = (UINT32)seq;
+}
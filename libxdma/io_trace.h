@@ -0,0 +1,70 @@
+/*
+* XDMA I/O Trace Capture
+* ======================
+*
+* Copyright 2017 Xilinx Inc.
+* Copyright 2010-2012 Sidebranch
+* Copyright 2010-2012 Leon Woestenberg <leon@sidebranch.com>
+*
+* Maintainer:
+* -----------
+* Alexander Hornburg <alexander.hornburg@xilinx.com>
+*
+* Description:
+* ------------
+* Bounded in-memory log of the read and write requests of all engines. The request in flight on
+* an engine is described by XDMA_IO_TRACE_PENDING and written into the device wide log as one
+* XDMA_TRACE_RECORD when it completes, so the fast path costs a timestamp and a few stores.
+*/
+
+#pragma once
+
+// ========================= include dependencies =================================================
+
+#include <ntddk.h>
+#include <wdf.h>
+#include "xdma_public.h"
+
+// ========================= type declarations ====================================================
+
+struct XDMA_ENGINE_T;
+
+/// Device wide request log, see IOCTL_XDMA_TRACE_CONTROL
+typedef struct XDMA_IO_TRACE_T {
+    XDMA_TRACE_RECORD* records;     // XDMA_TRACE_MAX_RECORDS entries, allocated by the first start
+    volatile LONG enabled;
+    volatile LONG64 next;           // records reserved since the capture was started
+    LONGLONG frequency;             // performance counter frequency
+} XDMA_IO_TRACE;
+
+/// Capture state of the request in flight on an engine
+typedef struct XDMA_IO_TRACE_PENDING_T {
+    BOOLEAN active;                 // EngineTraceBegin() was called while the capture was running
+    UINT16 flags;                   // XDMA_TRACE_FLAG_*
+    LONGLONG arrival;
+    LONGLONG start;
+    LONGLONG offset;
+    size_t length;
+} XDMA_IO_TRACE_PENDING;
+
+// ========================= function declarations ================================================
+
+/// Clear the log and start capturing. The log memory is allocated on the first start and belongs
+/// to wdfDevice. PASSIVE_LEVEL only.
+NTSTATUS TraceStart(IN WDFDEVICE wdfDevice, IN OUT XDMA_IO_TRACE* trace);
+
+/// Stop capturing, the log is kept until the next start
+VOID TraceStop(IN OUT XDMA_IO_TRACE* trace);
+
+/// Copy the latest records which fit into length bytes after the XDMA_TRACE_INFO header.
+/// Returns the number of bytes written to info.
+size_t TraceDump(IN const XDMA_IO_TRACE* trace, OUT XDMA_TRACE_INFO* info, IN size_t length);
+
+/// Remember a read/write request dispatched to the engine. arrival is the performance counter
+/// value when the request entered the driver.
+VOID EngineTraceBegin(IN struct XDMA_ENGINE_T* engine, IN LONGLONG arrival, IN LONGLONG offset,
+                      IN size_t length);
+
+/// Log the request in flight on the engine and record its XDMA_TL_COMPLETE timeline event, call
+/// right before completing it. Callable at DPC level.
+VOID EngineTraceEnd(IN struct XDMA_ENGINE_T* engine, IN NTSTATUS status, IN size_t bytes);
@@ -0,0 +1,412 @@
+/*
+* XDMA Software Model
+* ===================
+*
+* Copyright 2017 Xilinx Inc.
+* Copyright 2010-2012 Sidebranch
+* Copyright 2010-2012 Leon Woestenberg <leon@sidebranch.com>
+*
+* Maintainer:
+* -----------
+* Alexander Hornburg <alexander.hornburg@xilinx.com>
+*
+* References:
+* -----------
+*	[1] pg195-pcie-dma.pdf - DMA/Bridge Subsystem for PCI Express v4.0 - Product Guide
+*/
+
+// ========================= include dependencies =================================================
+
+#include <sched.h>
+#include <stdlib.h>
+
+#include "xdma_model.h"
+
+// ========================= constants ============================================================
+
+#define XDMA_MODEL_MAX_STEP_DESC    (256)   // descriptors per engine and step
+#define XDMA_MODEL_NEXT_ADJ(control) (((control) >> 8) & 0x3fU)
+#define XDMA_MODEL_DESC_MAGIC_MASK  (0xffff0000UL)
+
+// ========================= helpers ==============================================================
+
+static UINT32 Consume(IN volatile UINT32* reg)
+// take the value written to a W1S/W1C register since the last step
+{
+    return __atomic_exchange_n(reg, 0, __ATOMIC_ACQ_REL);
+}
+
+static PVOID HostPointer(IN UINT32 hi, IN UINT32 lo) {
+    return (PVOID)(uintptr_t)(((UINT64)hi << 32) | lo);
+}
+
+static BOOLEAN CreditMode(IN XDMA_MODEL* model, IN XDMA_MODEL_ENGINE* e) {
+    return (model->sgdmaRegs->creditModeEnable & e->creditBit) != 0;
+}
+
+static VOID RaiseEvent(IN XDMA_MODEL* model, IN XDMA_MODEL_ENGINE* e, IN UINT32 source)
+// raise the channel interrupt if the engine has the source enabled
+{
+    if (e->regs->intEnableMask & source) {
+        model->channelEvents |= e->irqBitMask;
+    }
+}
+
+static VOID EngineHalt(IN XDMA_MODEL* model, IN XDMA_MODEL_ENGINE* e, IN UINT32 statusBits,
+                       IN UINT32 source)
+// the engine stops by itself - descriptor stop bit or error
+{
+    e->running = FALSE;
+    e->inflight = FALSE;
+    e->regs->status = (e->regs->status & ~XDMA_BUSY_BIT) | statusBits;
+    e->regs->statusRC = e->regs->status;
+    RaiseEvent(model, e, source);
+}
+
+// ========================= register writes ======================================================
+
+static VOID ApplyEngineWrites(IN XDMA_MODEL* model, IN XDMA_MODEL_ENGINE* e, IN LONGLONG now) {
+
+    UINT32 value = Consume(&e->regs->intEnableMaskW1S);
+    e->regs->intEnableMask |= value;
+    value = Consume(&e->regs->intEnableMaskW1C);
+    e->regs->intEnableMask &= ~value;
+
+    e->credits += Consume(&e->sgdma->descCredits);
+
+    // stop before start - the driver always stops an engine before programming it again
+    value = Consume(&e->regs->controlW1C);
+    if (value) {
+        e->regs->control &= ~value;
+        if (value & XDMA_CTRL_RUN_BIT) { // stopping clears the status and the interrupt source
+            e->running = FALSE;
+            e->inflight = FALSE;
+            e->regs->status = 0;
+            e->regs->statusRC = 0;
+            model->channelEvents &= ~e->irqBitMask;
+        }
+    }
+
+    value = Consume(&e->regs->controlW1S);
+    if (value) {
+        e->regs->control |= value;
+        if ((value & XDMA_CTRL_RUN_BIT) && !e->running) {
+            e->running = TRUE;
+            e->inflight = FALSE;
+            e->nextLA = ((UINT64)e->sgdma->firstDescHi << 32) | e->sgdma->firstDescLo;
+            e->nextAdj = e->sgdma->firstDescAdj;
+            e->blockRemaining = 0;
+            e->busyUntil = now;
+            e->completed = 0;
+            e->packetRemaining = 0;
+            e->regs->completedDescCount = 0;
+            e->regs->status = XDMA_BUSY_BIT;
+            e->regs->statusRC = XDMA_BUSY_BIT;
+        }
+    }
+}
+
+static VOID ApplyIrqWrites(IN XDMA_MODEL* model) {
+    volatile XDMA_IRQ_REGS* regs = model->irqRegs;
+
+    regs->channelIntEnable |= Consume(&regs->channelIntEnableW1S);
+    UINT32 value = Consume(&regs->channelIntEnableW1C);
+    regs->channelIntEnable &= ~value;
+    model->channelEvents &= ~value; // masking acknowledges the request
+
+    regs->userIntEnable |= Consume(&regs->userIntEnableW1S);
+    value = Consume(&regs->userIntEnableW1C);
+    regs->userIntEnable &= ~value;
+    __atomic_fetch_and(&model->userEvents, ~value, __ATOMIC_ACQ_REL);
+}
+
+static VOID UpdateIrqRequests(IN XDMA_MODEL* model) {
+    volatile XDMA_IRQ_REGS* regs = model->irqRegs;
+
+    UINT32 channelRequest = model->channelEvents & regs->channelIntEnable;
+    UINT32 userRequest = __atomic_load_n(&model->userEvents, __ATOMIC_ACQUIRE) &
+        regs->userIntEnable;
+    regs->channelIntRequest = channelRequest;
+    regs->channelIntPending = channelRequest;
+    regs->userIntRequest = userRequest;
+    regs->userIntPending = userRequest;
+
+    BOOLEAN raised = ((channelRequest & ~model->signalledChannel) != 0) ||
+        ((userRequest & ~model->signalledUser) != 0);
+    model->signalledChannel = channelRequest;
+    model->signalledUser = userRequest;
+
+    if (raised && (model->config.irq != NULL)) {
+        MemoryBarrier();
+        model->config.irq(model, model->config.irqContext);
+    }
+}
+
+// ========================= descriptor processing ================================================
+
+static BOOLEAN EngineFetch(IN XDMA_MODEL* model, IN XDMA_MODEL_ENGINE* e)
+// fetch the next descriptor and compute when its transfer completes
+{
+    if (e->nextLA == 0) {
+        EngineHalt(model, e, XDMA_MAGIC_STOPPED_BIT, XDMA_CTRL_IE_MAGIC_STOPPED);
+        return FALSE;
+    }
+
+    LONGLONG start = e->busyUntil;
+    if (e->blockRemaining == 0) { // new block fetch - one PCIe read for nextAdj + 1 descriptors
+        start += (LONGLONG)model->config.fetchLatencyNs;
+        e->blockRemaining = e->nextAdj + 1;
+        e->fetches++;
+    }
+
+    e->descLA = e->nextLA;
+    e->desc = *(volatile DMA_DESCRIPTOR*)HostPointer((UINT32)(e->nextLA >> 32),
+                                                     (UINT32)e->nextLA);
+    if ((e->desc.control & XDMA_MODEL_DESC_MAGIC_MASK) != XDMA_DESC_MAGIC) {
+        EngineHalt(model, e, XDMA_MAGIC_STOPPED_BIT, XDMA_CTRL_IE_MAGIC_STOPPED);
+        return FALSE;
+    }
+
+    LONGLONG duration = 0;
+    if (model->config.bandwidth) {
+        duration = (LONGLONG)((e->desc.numBytes * 1000000000ULL) / model->config.bandwidth);
+    }
+    e->busyUntil = start + duration;
+    e->inflight = TRUE;
+    return TRUE;
+}
+
+static BOOLEAN EngineTransfer(IN XDMA_MODEL* model, IN XDMA_MODEL_ENGINE* e, OUT UINT32* bytes)
+// move the data of the descriptor in flight
+{
+    const DMA_DESCRIPTOR* desc = &e->desc;
+    UINT64 src = ((UINT64)desc->srcAddrHi << 32) | desc->srcAddrLo;
+    UINT64 dst = ((UINT64)desc->dstAddrHi << 32) | desc->dstAddrLo;
+    UINT32 length = desc->numBytes;
+    *bytes = length;
+
+    if (!model->config.streaming) { // AXI-MM - card memory at the device address
+        UINT64 cardOffset = (e->dir == H2C) ? dst : src;
+        if ((cardOffset > model->config.cardMemorySize) ||
+            (length > model->config.cardMemorySize - cardOffset)) {
+            return FALSE;
+        }
+        if (e->dir == H2C) {
+            memcpy(model->cardMemory + cardOffset, (PVOID)(uintptr_t)src, length);
+        } else {
+            memcpy((PVOID)(uintptr_t)dst, model->cardMemory + cardOffset, length);
+        }
+        return TRUE;
+    }
+
+    if (e->dir == H2C) { // AXI-ST sink
+        return TRUE;
+    }
+
+    // AXI-ST source - the descriptor source address receives the DMA_RESULT
+    BOOLEAN eop = TRUE;
+    if (model->config.c2hPacketLength) {
+        if (e->packetRemaining == 0) {
+            e->packetRemaining = model->config.c2hPacketLength;
+        }
+        length = min(length, e->packetRemaining);
+        e->packetRemaining -= length;
+        eop = (e->packetRemaining == 0);
+    }
+    PUCHAR data = (PUCHAR)(uintptr_t)dst;
+    for (UINT32 i = 0; i < length; ++i) {
+        data[i] = model->pattern++;
+    }
+    volatile DMA_RESULT* result = (volatile DMA_RESULT*)(uintptr_t)src;
+    result->length = length;
+    MemoryBarrier();
+    result->status = XDMA_MODEL_C2H_WB_MAGIC | (eop ? XDMA_RESULT_EOP_BIT : 0);
+    *bytes = length;
+    return TRUE;
+}
+
+static VOID EngineComplete(IN XDMA_MODEL* model, IN XDMA_MODEL_ENGINE* e) {
+    const DMA_DESCRIPTOR* desc = &e->desc;
+    e->inflight = FALSE;
+
+    UINT32 bytes = 0;
+    if (!EngineTransfer(model, e, &bytes)) {
+        EngineHalt(model, e, BIT_N(19), XDMA_CTRL_IE_DESCRIPTOR_ERROR);
+        return;
+    }
+    MemoryBarrier();
+
+    e->bytes += bytes;
+    e->descriptors++;
+    e->completed++;
+    e->regs->completedDescCount = e->completed;
+    if (CreditMode(model, e) && e->credits) {
+        e->credits--;
+    }
+    if (e->regs->control & XDMA_CTRL_POLL_MODE) {
+        volatile XDMA_POLL_WB* wb = HostPointer(e->regs->pollModeWbHi, e->regs->pollModeWbLo);
+        if (wb != NULL) {
+            wb->completedDescCount = e->completed;
+        }
+    }
+
+    // within a block the engine reads the adjacent descriptors, the next pointer is not used
+    e->blockRemaining--;
+    UINT64 next = ((UINT64)desc->nextHi << 32) | desc->nextLo;
+    if (e->blockRemaining > 0) {
+        if (next != e->descLA + sizeof(DMA_DESCRIPTOR)) {
+            e->adjMismatches++;
+        }
+        e->nextLA = e->descLA + sizeof(DMA_DESCRIPTOR);
+    } else {
+        e->nextAdj = XDMA_MODEL_NEXT_ADJ(desc->control);
+        e->nextLA = next;
+    }
+
+    if (desc->control & XDMA_DESC_COMPLETED_BIT) {
+        e->regs->status |= XDMA_DESCRIPTOR_COMPLETED_BIT;
+        e->regs->statusRC = e->regs->status;
+        RaiseEvent(model, e, XDMA_CTRL_IE_DESC_COMPLETED);
+    }
+    if (desc->control & XDMA_DESC_STOP_BIT) {
+        EngineHalt(model, e, XDMA_DESCRIPTOR_STOPPED_BIT, XDMA_CTRL_IE_DESC_STOPPED);
+    }
+}
+
+static BOOLEAN EngineStep(IN XDMA_MODEL* model, IN XDMA_MODEL_ENGINE* e, IN LONGLONG now) {
+    BOOLEAN progress = FALSE;
+    for (UINT n = 0; (n < XDMA_MODEL_MAX_STEP_DESC) && e->running; ++n) {
+        if (!e->inflight) {
+            if (CreditMode(model, e) && (e->credits == 0)) {
+                e->busyUntil = now; // starved - time continues when credits arrive
+                break;
+            }
+            if (!EngineFetch(model, e)) {
+                return TRUE;
+            }
+            progress = TRUE;
+        }
+        if (now < e->busyUntil) {
+            break;
+        }
+        EngineComplete(model, e);
+        progress = TRUE;
+    }
+    return progress;
+}
+
+// ========================= public functions =====================================================
+
+NTSTATUS XdmaModelCreate(IN const XDMA_MODEL_CONFIG* config, OUT XDMA_MODEL* model) {
+
+    memset(model, 0, sizeof(XDMA_MODEL));
+    if ((config->numH2C > XDMA_MODEL_MAX_CHANNELS) || (config->numC2H > XDMA_MODEL_MAX_CHANNELS)) {
+        return STATUS_INVALID_PARAMETER;
+    }
+    model->config = *config;
+
+    model->bar = aligned_alloc(PAGE_SIZE, XDMA_MODEL_BAR_SIZE);
+    if (model->bar == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    model->barLength = XDMA_MODEL_BAR_SIZE;
+    memset(model->bar, 0, XDMA_MODEL_BAR_SIZE);
+    if (!config->streaming && config->cardMemorySize) {
+        model->cardMemory = calloc(1, config->cardMemorySize);
+        if (model->cardMemory == NULL) {
+            XdmaModelDestroy(model);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
+    model->irqRegs = (volatile XDMA_IRQ_REGS*)(model->bar + IRQ_BLOCK_OFFSET);
+    model->configRegs = (volatile XDMA_CONFIG_REGS*)(model->bar + CONFIG_BLOCK_OFFSET);
+    model->sgdmaRegs = (volatile XDMA_SGDMA_COMMON_REGS*)(model->bar + SGDMA_COMMON_BLOCK_OFFSET);
+    model->irqRegs->identifier = IRQ_BLOCK_ID | XDMA_MODEL_IP_VERSION;
+    model->configRegs->identifier = CONFIG_BLOCK_ID | XDMA_MODEL_IP_VERSION;
+    model->configRegs->pcieMRRS = config->pcieMRRS;
+    model->configRegs->pcieWidth = config->pcieWidth;
+    model->sgdmaRegs->identifier = XDMA_ID | (SGDMA_COMMON_BLOCK_OFFSET << 4) |
+        XDMA_MODEL_IP_VERSION;
+
+    // engines are numbered like the driver probes them: H2C channels first, then C2H
+    ULONG engineIndex = 0;
+    for (UINT dir = H2C; dir < 2; dir++) {
+        UINT numChannels = (dir == H2C) ? config->numH2C : config->numC2H;
+        for (ULONG ch = 0; ch < numChannels; ch++) {
+            XDMA_MODEL_ENGINE* e = &model->engines[dir][ch];
+            e->dir = dir;
+            e->channel = ch;
+            e->regs = CoreEngineRegs(model->bar, dir, ch);
+            e->sgdma = CoreEngineSgdmaRegs(model->bar, dir, ch);
+            e->irqBitMask = CoreEngineIrqBitMask(engineIndex++);
+            e->creditBit = BIT_N(ch) << (dir == C2H ? 16 : 0);
+            e->regs->identifier = XDMA_ID | (dir << 16) | (ch << 8) |
+                (config->streaming ? XDMA_ID_ST_BIT : 0) | XDMA_MODEL_IP_VERSION;
+            e->regs->alignments = config->alignments ? config->alignments : 0x00010140U;
+            e->sgdma->identifier = XDMA_ID | ((4 + dir) << 16) | (ch << 8) |
+                XDMA_MODEL_IP_VERSION;
+        }
+    }
+    return STATUS_SUCCESS;
+}
+
+VOID XdmaModelDestroy(IN OUT XDMA_MODEL* model) {
+    XdmaModelStop(model);
+    free(model->cardMemory);
+    free(model->bar);
+    memset(model, 0, sizeof(XDMA_MODEL));
+}
+
+BOOLEAN XdmaModelStep(IN OUT XDMA_MODEL* model, IN LONGLONG now) {
+    BOOLEAN progress = FALSE;
+
+    ApplyIrqWrites(model);
+    for (UINT dir = H2C; dir < 2; dir++) {
+        for (ULONG ch = 0; ch < XDMA_MODEL_MAX_CHANNELS; ch++) {
+            XDMA_MODEL_ENGINE* e = &model->engines[dir][ch];
+            if (e->regs == NULL) {
+                continue;
+            }
+            ApplyEngineWrites(model, e, now);
+            progress |= EngineStep(model, e, now);
+        }
+    }
+    UpdateIrqRequests(model);
+    return progress;
+}
+
+static void* ModelThread(void* context) {
+    XDMA_MODEL* model = (XDMA_MODEL*)context;
+    while (!model->stop) {
+        if (!XdmaModelStep(model, XdmaOsTimestamp())) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+NTSTATUS XdmaModelStart(IN OUT XDMA_MODEL* model) {
+    if (model->threadRunning) {
+        return STATUS_DEVICE_BUSY;
+    }
+    model->stop = FALSE;
+    if (pthread_create(&model->thread, NULL, ModelThread, model) != 0) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    model->threadRunning = TRUE;
+    return STATUS_SUCCESS;
+}
+
+VOID XdmaModelStop(IN OUT XDMA_MODEL* model) {
+    if (!model->threadRunning) {
+        return;
+    }
+    model->stop = TRUE;
+    pthread_join(model->thread, NULL);
+    model->threadRunning = FALSE;
+}
+
+VOID XdmaModelRaiseUser(IN OUT XDMA_MODEL* model, IN UINT32 mask) {
+    __atomic_fetch_or(&model->userEvents, mask, __ATOMIC_ACQ_REL);
+}
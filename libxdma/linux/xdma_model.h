@@ -0,0 +1,135 @@
+/*
+* XDMA Software Model
+* ===================
+*
+* Copyright 2017 Xilinx Inc.
+* Copyright 2010-2012 Sidebranch
+* Copyright 2010-2012 Leon Woestenberg <leon@sidebranch.com>
+*
+* Maintainer:
+* -----------
+* Alexander Hornburg <alexander.hornburg@xilinx.com>
+*
+* Description:
+* ------------
+* Host memory model of the XDMA config BAR: engine, SGDMA, IRQ and config blocks. The model walks
+* descriptor chains the way the IP core does - adjacent descriptor blocks, stop/completed/EOP bits,
+* descriptor credits - moves data between host memory and a card memory (AXI-MM) or a packet
+* source/sink (AXI-ST), and writes DMA_RESULT and XDMA_POLL_WB. Transfer time is derived from a
+* configurable bandwidth and descriptor fetch latency so the driver side throughput and CPU cost
+* can be measured without a card.
+*
+* The config BAR is plain memory, so the model cannot see individual accesses:
+*  - W1S/W1C registers and descCredits are consumed on the next step, two writes to the same one
+*    in between are merged into the last one. The model zeroes a consumed register, a writer
+*    which cannot tolerate merging waits for it to read 0 first.
+*  - status is cleared when the engine is started or stopped instead of on reading statusRC.
+*  - A channel or user interrupt request is acknowledged by masking it (channel/userIntEnableW1C)
+*    which is what the interrupt service routine does, see CoreIrqLatch(). Stopping an engine
+*    also removes its channel interrupt request.
+* DMA addresses are process virtual addresses, see XdmaOsLinuxOpenModel().
+*/
+
+#pragma once
+
+// ========================= include dependencies =================================================
+
+#include "xdma_core.h"
+
+// ========================= constants ============================================================
+
+#define XDMA_MODEL_MAX_CHANNELS     (4)
+#define XDMA_MODEL_BAR_SIZE         (0x10000UL)     // size of the config BAR
+#define XDMA_MODEL_C2H_WB_MAGIC     (0x52B40000UL)  // upper half of DMA_RESULT.status
+#define XDMA_MODEL_IP_VERSION       (8)             // reported as v2017.3
+
+// ========================= type declarations ====================================================
+
+struct XDMA_MODEL_T;
+
+/// Called from XdmaModelStep() when a new interrupt request is raised - the model's MSI
+typedef VOID(*PFN_XDMA_MODEL_IRQ)(IN struct XDMA_MODEL_T* model, IN void* context);
+
+typedef struct XDMA_MODEL_CONFIG_T {
+    UINT numH2C;                // H2C channels present, up to XDMA_MODEL_MAX_CHANNELS
+    UINT numC2H;                // C2H channels present, up to XDMA_MODEL_MAX_CHANNELS
+    BOOLEAN streaming;          // AXI-ST engines instead of AXI-MM
+    UINT64 bandwidth;           // bytes per second per engine, 0 = unlimited
+    UINT64 fetchLatencyNs;      // latency of each descriptor block fetch
+    size_t cardMemorySize;      // AXI-MM card memory in bytes
+    UINT32 c2hPacketLength;     // AXI-ST C2H packet length, 0 = one packet per descriptor
+    UINT32 alignments;          // engine alignments register, 0 = byte aligned
+    UINT32 pcieMRRS;            // config block register values
+    UINT32 pcieWidth;
+    PFN_XDMA_MODEL_IRQ irq;     // optional interrupt callback
+    void* irqContext;
+} XDMA_MODEL_CONFIG;
+
+/// State of one modelled engine
+typedef struct XDMA_MODEL_ENGINE_T {
+    volatile XDMA_ENGINE_REGS* regs;
+    volatile XDMA_SGDMA_REGS* sgdma;
+    DirToDev dir;
+    ULONG channel;
+    UINT32 irqBitMask;          // channel interrupt request bit
+    UINT32 creditBit;           // bit in the SGDMA common creditModeEnable register
+
+    BOOLEAN running;
+    BOOLEAN inflight;           // desc is being transferred until busyUntil
+    DMA_DESCRIPTOR desc;        // copy of the descriptor in flight
+    UINT64 descLA;              // address of the descriptor in flight
+    UINT64 nextLA;              // next descriptor to fetch
+    UINT32 blockRemaining;      // descriptors left in the current adjacent block
+    UINT32 nextAdj;             // adjacent descriptors of the next block fetch
+    LONGLONG busyUntil;
+    UINT32 credits;
+    UINT32 completed;           // completed descriptors since start
+    UINT32 packetRemaining;     // AXI-ST C2H bytes left in the current packet
+
+    // statistics
+    UINT64 bytes;
+    UINT64 descriptors;
+    UINT64 fetches;             // descriptor block fetches
+    UINT64 adjMismatches;       // adjacent descriptors whose next pointer is not contiguous
+} XDMA_MODEL_ENGINE;
+
+typedef struct XDMA_MODEL_T {
+    XDMA_MODEL_CONFIG config;
+    PUCHAR bar;                 // config BAR memory, XDMA_MODEL_BAR_SIZE bytes
+    size_t barLength;
+    PUCHAR cardMemory;          // AXI-MM card memory
+    volatile XDMA_IRQ_REGS* irqRegs;
+    volatile XDMA_CONFIG_REGS* configRegs;
+    volatile XDMA_SGDMA_COMMON_REGS* sgdmaRegs;
+    XDMA_MODEL_ENGINE engines[2][XDMA_MODEL_MAX_CHANNELS];
+
+    UINT32 channelEvents;       // raised channel interrupts not yet acknowledged
+    UINT32 userEvents;          // raised user interrupts not yet acknowledged
+    UINT32 signalledChannel;    // request bits already signalled to config.irq
+    UINT32 signalledUser;
+    UCHAR pattern;              // AXI-ST C2H data source
+
+    pthread_t thread;
+    volatile BOOLEAN stop;
+    volatile BOOLEAN threadRunning;
+} XDMA_MODEL;
+
+// ========================= function declarations ================================================
+
+/// Allocate the BAR and card memory and reset all registers
+NTSTATUS XdmaModelCreate(IN const XDMA_MODEL_CONFIG* config, OUT XDMA_MODEL* model);
+
+/// Stop the model thread and free the model memory
+VOID XdmaModelDestroy(IN OUT XDMA_MODEL* model);
+
+/// Apply register writes and advance all engines to time now (nanoseconds, XdmaOsTimestamp()).
+/// Returns TRUE if anything changed.
+BOOLEAN XdmaModelStep(IN OUT XDMA_MODEL* model, IN LONGLONG now);
+
+/// Run XdmaModelStep() continuously in a background thread
+NTSTATUS XdmaModelStart(IN OUT XDMA_MODEL* model);
+
+VOID XdmaModelStop(IN OUT XDMA_MODEL* model);
+
+/// Raise user interrupt requests (bit n = user interrupt n)
+VOID XdmaModelRaiseUser(IN OUT XDMA_MODEL* model, IN UINT32 mask);
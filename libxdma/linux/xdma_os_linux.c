@@ -0,0 +1,317 @@
+/*
+* XDMA OS Abstraction Layer - Linux User-Space Implementation
+* ============================================================
+*
+* Copyright 2017 Xilinx Inc.
+* Copyright 2010-2012 Sidebranch
+* Copyright 2010-2012 Leon Woestenberg <leon@sidebranch.com>
+*
+* Maintainer:
+* -----------
+* Alexander Hornburg <alexander.hornburg@xilinx.com>
+*
+* References:
+* -----------
+*	[1] Documentation/driver-api/vfio.rst - VFIO - "Virtual Function I/O"
+*/
+
+// ========================= include dependencies =================================================
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // sched_getcpu()
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/pci_regs.h>
+#include <linux/vfio.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "xdma_os_linux.h"
+
+// ========================= constants ============================================================
+
+#define XDMA_OS_LINUX_IOVA_BASE (0x100000000ULL) // keep DMA buffers clear of the low 4GB
+
+// ========================= helpers ==============================================================
+
+static size_t PageAlign(size_t length) {
+    return (length + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+}
+
+static VOID DeviceInit(OUT XDMA_OS_LINUX_DEVICE* dev) {
+    memset(dev, 0, sizeof(XDMA_OS_LINUX_DEVICE));
+    dev->container = -1;
+    dev->group = -1;
+    dev->device = -1;
+    dev->nextIova = XDMA_OS_LINUX_IOVA_BASE;
+}
+
+static NTSTATUS EnableBusMaster(IN XDMA_OS_LINUX_DEVICE* dev) {
+    struct vfio_region_info config = { .argsz = sizeof(config),
+                                       .index = VFIO_PCI_CONFIG_REGION_INDEX };
+    if (ioctl(dev->device, VFIO_DEVICE_GET_REGION_INFO, &config) < 0) {
+        fprintf(stderr, "VFIO_DEVICE_GET_REGION_INFO(config) failed: %s\n", strerror(errno));
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    uint16_t command = 0;
+    if (pread(dev->device, &command, sizeof(command), config.offset + PCI_COMMAND) !=
+        sizeof(command)) {
+        fprintf(stderr, "reading PCI command register failed: %s\n", strerror(errno));
+        return STATUS_UNSUCCESSFUL;
+    }
+    command |= PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER;
+    if (pwrite(dev->device, &command, sizeof(command), config.offset + PCI_COMMAND) !=
+        sizeof(command)) {
+        fprintf(stderr, "writing PCI command register failed: %s\n", strerror(errno));
+        return STATUS_UNSUCCESSFUL;
+    }
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS MapBars(IN OUT XDMA_OS_LINUX_DEVICE* dev) {
+    for (UINT i = 0; i < XDMA_OS_LINUX_MAX_BARS; ++i) {
+        struct vfio_region_info region = { .argsz = sizeof(region),
+                                           .index = VFIO_PCI_BAR0_REGION_INDEX + i };
+        if (ioctl(dev->device, VFIO_DEVICE_GET_REGION_INFO, &region) < 0) {
+            fprintf(stderr, "VFIO_DEVICE_GET_REGION_INFO(bar%u) failed: %s\n", i,
+                    strerror(errno));
+            return STATUS_UNSUCCESSFUL;
+        }
+        if ((region.size == 0) || !(region.flags & VFIO_REGION_INFO_FLAG_MMAP)) {
+            continue; // BAR not present or not mappable (e.g. i/o space)
+        }
+        void* va = mmap(NULL, region.size, PROT_READ | PROT_WRITE, MAP_SHARED, dev->device,
+                        region.offset);
+        if (va == MAP_FAILED) {
+            fprintf(stderr, "mmap(bar%u) failed: %s\n", i, strerror(errno));
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+        dev->bar[i] = (PUCHAR)va;
+        dev->barLength[i] = region.size;
+        dev->numBars++;
+    }
+    return dev->numBars ? STATUS_SUCCESS : STATUS_NO_SUCH_DEVICE;
+}
+
+// ========================= device =================================================================
+
+NTSTATUS XdmaOsLinuxOpenVfio(IN const char* groupPath, IN const char* bdf,
+                             OUT XDMA_OS_LINUX_DEVICE* dev) {
+
+    NTSTATUS status = STATUS_UNSUCCESSFUL;
+    DeviceInit(dev);
+
+    dev->container = open("/dev/vfio/vfio", O_RDWR);
+    if (dev->container < 0) {
+        fprintf(stderr, "opening /dev/vfio/vfio failed: %s\n", strerror(errno));
+        status = STATUS_NO_SUCH_DEVICE;
+        goto ErrExit;
+    }
+    if ((ioctl(dev->container, VFIO_GET_API_VERSION) != VFIO_API_VERSION) ||
+        !ioctl(dev->container, VFIO_CHECK_EXTENSION, VFIO_TYPE1_IOMMU)) {
+        fprintf(stderr, "VFIO type1 IOMMU not supported\n");
+        status = STATUS_NOT_SUPPORTED;
+        goto ErrExit;
+    }
+
+    dev->group = open(groupPath, O_RDWR);
+    if (dev->group < 0) {
+        fprintf(stderr, "opening %s failed: %s\n", groupPath, strerror(errno));
+        status = STATUS_NO_SUCH_DEVICE;
+        goto ErrExit;
+    }
+    struct vfio_group_status groupStatus = { .argsz = sizeof(groupStatus) };
+    if ((ioctl(dev->group, VFIO_GROUP_GET_STATUS, &groupStatus) < 0) ||
+        !(groupStatus.flags & VFIO_GROUP_FLAGS_VIABLE)) {
+        fprintf(stderr, "%s is not viable - are all devices of the group bound to vfio-pci?\n",
+                groupPath);
+        goto ErrExit;
+    }
+    if (ioctl(dev->group, VFIO_GROUP_SET_CONTAINER, &dev->container) < 0) {
+        fprintf(stderr, "VFIO_GROUP_SET_CONTAINER failed: %s\n", strerror(errno));
+        goto ErrExit;
+    }
+    if (ioctl(dev->container, VFIO_SET_IOMMU, VFIO_TYPE1_IOMMU) < 0) {
+        fprintf(stderr, "VFIO_SET_IOMMU failed: %s\n", strerror(errno));
+        goto ErrExit;
+    }
+
+    dev->device = ioctl(dev->group, VFIO_GROUP_GET_DEVICE_FD, bdf);
+    if (dev->device < 0) {
+        fprintf(stderr, "VFIO_GROUP_GET_DEVICE_FD(%s) failed: %s\n", bdf, strerror(errno));
+        status = STATUS_NO_SUCH_DEVICE;
+        goto ErrExit;
+    }
+
+    status = MapBars(dev);
+    if (!NT_SUCCESS(status)) {
+        goto ErrExit;
+    }
+    status = EnableBusMaster(dev);
+    if (!NT_SUCCESS(status)) {
+        goto ErrExit;
+    }
+    return STATUS_SUCCESS;
+
+ErrExit:
+    XdmaOsLinuxClose(dev);
+    return status;
+}
+
+NTSTATUS XdmaOsLinuxOpenModel(IN PUCHAR* bars, IN const size_t* barLengths, IN UINT numBars,
+                              OUT XDMA_OS_LINUX_DEVICE* dev) {
+    DeviceInit(dev);
+    if (numBars > XDMA_OS_LINUX_MAX_BARS) {
+        return STATUS_INVALID_PARAMETER;
+    }
+    for (UINT i = 0; i < numBars; ++i) {
+        dev->bar[i] = bars[i];
+        dev->barLength[i] = barLengths[i];
+    }
+    dev->numBars = numBars;
+    dev->model = TRUE;
+    return STATUS_SUCCESS;
+}
+
+VOID XdmaOsLinuxClose(IN OUT XDMA_OS_LINUX_DEVICE* dev) {
+    if (!dev->model) {
+        for (UINT i = 0; i < XDMA_OS_LINUX_MAX_BARS; ++i) {
+            if (dev->bar[i] != NULL) {
+                munmap(dev->bar[i], dev->barLength[i]);
+            }
+        }
+    }
+    if (dev->device >= 0) {
+        close(dev->device);
+    }
+    if (dev->group >= 0) {
+        close(dev->group);
+    }
+    if (dev->container >= 0) {
+        close(dev->container);
+    }
+    DeviceInit(dev);
+}
+
+// ========================= dma memory ===========================================================
+
+NTSTATUS XdmaOsDmaAlloc(IN XDMA_OS_DMA_ADAPTER adapter, IN size_t length,
+                        OUT XDMA_OS_DMA_BUFFER* buffer) {
+
+    memset(buffer, 0, sizeof(XDMA_OS_DMA_BUFFER));
+    size_t mapLength = PageAlign(length);
+
+    // anonymous mappings are zeroed and page aligned, locked so the IOVA mapping stays valid
+    void* va = mmap(NULL, mapLength, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_LOCKED, -1, 0);
+    if (va == MAP_FAILED) {
+        fprintf(stderr, "mmap(%zu) failed: %s\n", mapLength, strerror(errno));
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    if (adapter->model) { // the register model accesses host memory by virtual address
+        buffer->la.QuadPart = (LONGLONG)(uintptr_t)va;
+    } else {
+        struct vfio_iommu_type1_dma_map map = {
+            .argsz = sizeof(map),
+            .flags = VFIO_DMA_MAP_FLAG_READ | VFIO_DMA_MAP_FLAG_WRITE,
+            .vaddr = (uint64_t)(uintptr_t)va,
+            .iova = adapter->nextIova,
+            .size = mapLength,
+        };
+        if (ioctl(adapter->container, VFIO_IOMMU_MAP_DMA, &map) < 0) {
+            fprintf(stderr, "VFIO_IOMMU_MAP_DMA failed: %s\n", strerror(errno));
+            munmap(va, mapLength);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+        buffer->la.QuadPart = (LONGLONG)map.iova;
+        adapter->nextIova += mapLength;
+    }
+
+    buffer->va = va;
+    buffer->length = length;
+    buffer->handle = adapter;
+    return STATUS_SUCCESS;
+}
+
+VOID XdmaOsDmaFree(IN OUT XDMA_OS_DMA_BUFFER* buffer) {
+    if (buffer->va == NULL) {
+        return;
+    }
+    size_t mapLength = PageAlign(buffer->length);
+    XDMA_OS_LINUX_DEVICE* dev = (XDMA_OS_LINUX_DEVICE*)buffer->handle;
+    if (!dev->model) {
+        struct vfio_iommu_type1_dma_unmap unmap = {
+            .argsz = sizeof(unmap),
+            .iova = (uint64_t)buffer->la.QuadPart,
+            .size = mapLength,
+        };
+        if (ioctl(dev->container, VFIO_IOMMU_UNMAP_DMA, &unmap) < 0) {
+            fprintf(stderr, "VFIO_IOMMU_UNMAP_DMA failed: %s\n", strerror(errno));
+        }
+    }
+    munmap(buffer->va, mapLength);
+    memset(buffer, 0, sizeof(XDMA_OS_DMA_BUFFER));
+}
+
+// ========================= synchronization ======================================================
+
+NTSTATUS XdmaOsLockCreate(OUT XDMA_OS_LOCK* lock) {
+    int err = pthread_spin_init(lock, PTHREAD_PROCESS_PRIVATE);
+    if (err) {
+        fprintf(stderr, "pthread_spin_init failed: %s\n", strerror(err));
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    return STATUS_SUCCESS;
+}
+
+VOID XdmaOsLockAcquire(IN XDMA_OS_LOCK* lock) {
+    pthread_spin_lock(lock);
+}
+
+VOID XdmaOsLockRelease(IN XDMA_OS_LOCK* lock) {
+    pthread_spin_unlock(lock);
+}
+
+// ========================= time =================================================================
+
+LONGLONG XdmaOsTimestamp(VOID) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (LONGLONG)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+LONGLONG XdmaOsTimestampFrequency(VOID) {
+    return 1000000000LL; // nanoseconds
+}
+
+ULONGLONG XdmaOsCycles(VOID) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return (ULONGLONG)XdmaOsTimestamp();
+#endif
+}
+
+ULONG XdmaOsCurrentCpu(VOID) {
+    const int cpu = sched_getcpu();
+    return (cpu < 0) ? 0 : (ULONG)cpu;
+}
+
+VOID XdmaOsStallUs(IN ULONG us) {
+    const LONGLONG end = XdmaOsTimestamp() + (LONGLONG)us * 1000;
+    while (XdmaOsTimestamp() < end) {
+        // busy wait like KeStallExecutionProcessor()
+    }
+}
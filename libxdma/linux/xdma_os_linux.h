@@ -0,0 +1,53 @@
+/*
+* XDMA OS Abstraction Layer - Linux User-Space Implementation
+* ============================================================
+*
+* Copyright 2017 Xilinx Inc.
+* Copyright 2010-2012 Sidebranch
+* Copyright 2010-2012 Leon Woestenberg <leon@sidebranch.com>
+*
+* Maintainer:
+* -----------
+* Alexander Hornburg <alexander.hornburg@xilinx.com>
+*
+* Description:
+* ------------
+* Runs the OS independent engine core (xdma_core.h) in a Linux process. The device is either a
+* real XDMA core bound to vfio-pci - BARs are mmap'ed and DMA memory is mapped into the IOMMU - or
+* a software register model, in which case the BARs are plain memory supplied by the caller and
+* DMA addresses are process virtual addresses.
+*/
+
+#pragma once
+
+// ========================= include dependencies =================================================
+
+#include "xdma_os.h"
+
+// ========================= declarations =========================================================
+
+#define XDMA_OS_LINUX_MAX_BARS (6)
+
+/// A device opened through VFIO or a software register model, used as XDMA_OS_DMA_ADAPTER
+typedef struct XDMA_OS_LINUX_DEVICE_T {
+    int container;                          // /dev/vfio/vfio, -1 for a register model
+    int group;                              // /dev/vfio/<group>
+    int device;                             // vfio device fd
+    PUCHAR bar[XDMA_OS_LINUX_MAX_BARS];     // mapped BARs, NULL if not present
+    size_t barLength[XDMA_OS_LINUX_MAX_BARS];
+    UINT numBars;                           // number of present BARs
+    UINT64 nextIova;                        // next free IOMMU address for DMA buffers
+    BOOLEAN model;                          // BARs are a software register model
+} XDMA_OS_LINUX_DEVICE;
+
+/// Open a device bound to vfio-pci, e.g. groupPath="/dev/vfio/12", bdf="0000:01:00.0".
+/// Maps all mappable BARs and enables bus mastering.
+NTSTATUS XdmaOsLinuxOpenVfio(IN const char* groupPath, IN const char* bdf,
+                             OUT XDMA_OS_LINUX_DEVICE* dev);
+
+/// Use numBars caller owned memory blocks as the BARs of a software register model
+NTSTATUS XdmaOsLinuxOpenModel(IN PUCHAR* bars, IN const size_t* barLengths, IN UINT numBars,
+                              OUT XDMA_OS_LINUX_DEVICE* dev);
+
+/// Unmap the BARs and close the VFIO file descriptors. DMA buffers must have been freed before.
+VOID XdmaOsLinuxClose(IN OUT XDMA_OS_LINUX_DEVICE* dev);
@@ -0,0 +1,135 @@
+/*
+* XDMA Event Timeline
+* ===================
+*
+* Copyright 2017 Xilinx Inc.
+* Copyright 2010-2012 Sidebranch
+* Copyright 2010-2012 Leon Woestenberg <leon@sidebranch.com>
+*
+* Maintainer:
+* -----------
+* Alexander Hornburg <alexander.hornburg@xilinx.com>
+*
+*/
+
+// ========================= include dependencies =================================================
+
+#include "timeline.h"
+
+// ========================= constants ============================================================
+
+#define XDMA_TIMELINE_INDEX_MASK    (XDMA_TIMELINE_RING_ENTRIES - 1)
+
+// ========================= public functions =====================================================
+
+size_t XdmaTimelineSize(IN ULONG numCpus) {
+    return (size_t)numCpus * sizeof(XDMA_TIMELINE_RING);
+}
+
+BOOLEAN XdmaTimelineInit(IN OUT XDMA_TIMELINE* timeline, IN PVOID memory, IN ULONG numCpus) {
+    ASSERT((numCpus > 0) && (numCpus <= XDMA_TIMELINE_MAX_CPUS));
+
+    if (timeline->rings != NULL) {
+        return FALSE;
+    }
+    RtlZeroMemory(memory, XdmaTimelineSize(numCpus));
+    timeline->numCpus = numCpus;
+    MemoryBarrier();
+    return InterlockedCompareExchangePointer((PVOID*)&timeline->rings, memory, NULL) == NULL;
+}
+
+VOID XdmaTimelineStart(IN OUT XDMA_TIMELINE* timeline) {
+    ASSERT(timeline->rings != NULL);
+
+    // events recorded meanwhile may land in the cleared rings, the drain skips them
+    InterlockedExchange(&timeline->enabled, FALSE);
+    for (ULONG cpu = 0; cpu < timeline->numCpus; ++cpu) {
+        XDMA_TIMELINE_RING* ring = &timeline->rings[cpu];
+        InterlockedExchange(&ring->head, 0);
+        ring->tail = 0;
+        ring->dropped = 0;
+    }
+    timeline->startCycles = XdmaOsCycles();
+    timeline->startTimestamp = XdmaOsTimestamp();
+    MemoryBarrier();
+    InterlockedExchange(&timeline->enabled, TRUE);
+}
+
+VOID XdmaTimelineStop(IN OUT XDMA_TIMELINE* timeline) {
+    InterlockedExchange(&timeline->enabled, FALSE);
+}
+
+VOID XdmaTimelineLog(IN XDMA_TIMELINE* timeline, IN UINT8 type, IN UINT8 dir, IN UINT8 channel,
+                     IN UINT64 arg) {
+    const ULONG cpu = XdmaOsCurrentCpu() % timeline->numCpus;
+    XDMA_TIMELINE_RING* ring = &timeline->rings[cpu];
+
+    // a producer preempted on this cpu or one which migrated here may race for the ring,
+    // the interlocked reservation keeps them apart
+    const ULONG index = (ULONG)InterlockedIncrement(&ring->head) - 1;
+    XDMA_TIMELINE_EVENT* event = &ring->events[index & XDMA_TIMELINE_INDEX_MASK];
+
+    event->sequence = 0;
+    MemoryBarrier();
+    event->cycles = XdmaOsCycles();
+    event->type = type;
+    event->dir = dir;
+    event->channel = channel;
+    event->cpu = (UINT8)cpu;
+    event->arg = arg;
+    MemoryBarrier();
+    event->sequence = index + 1;
+}
+
+NTSTATUS XdmaTimelineDrain(IN OUT XDMA_TIMELINE* timeline, OUT XDMA_TIMELINE_INFO* info,
+                           OUT XDMA_TIMELINE_EVENT* events, IN ULONG maxEvents) {
+    if (InterlockedCompareExchange(&timeline->draining, TRUE, FALSE) != FALSE) {
+        return STATUS_DEVICE_BUSY;
+    }
+
+    ULONG numEvents = 0;
+    ULONG dropped = 0;
+    for (ULONG cpu = 0; (timeline->rings != NULL) && (cpu < timeline->numCpus); ++cpu) {
+        XDMA_TIMELINE_RING* ring = &timeline->rings[cpu];
+        const ULONG head = (ULONG)ring->head;
+        ULONG tail = (ULONG)ring->tail;
+        MemoryBarrier();
+
+        // the producers lapped the consumer
+        if (head - tail > XDMA_TIMELINE_RING_ENTRIES) {
+            ring->dropped += (LONG)(head - tail - XDMA_TIMELINE_RING_ENTRIES);
+            tail = head - XDMA_TIMELINE_RING_ENTRIES;
+        }
+
+        for (; (tail != head) && (numEvents < maxEvents); ++tail) {
+            const XDMA_TIMELINE_EVENT* event = &ring->events[tail & XDMA_TIMELINE_INDEX_MASK];
+            const UINT32 sequence = event->sequence;
+            MemoryBarrier();
+            if ((sequence == 0) || ((LONG)(sequence - (tail + 1)) < 0)) {
+                break; // still being written - take it with the next drain
+            }
+            events[numEvents] = *event;
+            MemoryBarrier();
+            if ((sequence != tail + 1) || (event->sequence != sequence)) {
+                ring->dropped++; // overwritten before or while it was copied
+                continue;
+            }
+            numEvents++;
+        }
+        ring->tail = (LONG)tail;
+        dropped += (ULONG)ring->dropped;
+    }
+
+    info->frequency = (UINT64)XdmaOsTimestampFrequency();
+    info->startCycles = timeline->startCycles;
+    info->startCounter = (UINT64)timeline->startTimestamp;
+    info->cycles = XdmaOsCycles();
+    info->counter = (UINT64)XdmaOsTimestamp();
+    info->numEvents = numEvents;
+    info->dropped = dropped;
+    info->numCpus = timeline->numCpus;
+    info->enabled = timeline->enabled ? 1 : 0;
+
+    InterlockedExchange(&timeline->draining, FALSE);
+    return STATUS_SUCCESS;
+}
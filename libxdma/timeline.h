@@ -0,0 +1,90 @@
+/*
+* XDMA Event Timeline
+* ===================
+*
+* Copyright 2017 Xilinx Inc.
+* Copyright 2010-2012 Sidebranch
+* Copyright 2010-2012 Leon Woestenberg <leon@sidebranch.com>
+*
+* Maintainer:
+* -----------
+* Alexander Hornburg <alexander.hornburg@xilinx.com>
+*
+* Description:
+* ------------
+* Per-cpu rings of binary events (xdma_timeline.h) which show how requests, engines, interrupts
+* and dpcs overlap. Recording an event takes a cycle counter stamp and one interlocked increment on
+* a cache line which is local to the cpu, no lock. Producers never wait: a full ring overwrites its
+* oldest events, which the drain then reports as dropped. Only depends on xdma_os.h, so it builds
+* both into the KMDF library and on Linux.
+*
+* Protocol:
+* ---------
+* head is a free running count of the events reserved on a ring, the slot of an event is
+* (index & (XDMA_TIMELINE_RING_ENTRIES - 1)). A producer reserves an index, clears the sequence of
+* the slot, writes the event and publishes it by writing sequence = index + 1 last. The single
+* consumer (XdmaTimelineDrain) takes events from tail on while their sequence matches.
+*/
+
+#pragma once
+
+// ========================= include dependencies =================================================
+
+#include "xdma_os.h"
+#include "xdma_timeline.h"
+
+// ========================= type declarations ====================================================
+
+/// Event ring of one cpu
+typedef struct XDMA_TIMELINE_RING_T {
+    volatile LONG head;         // events reserved by producers, see protocol above
+    LONG reserved0[15];         // keep the producer index in its own cache line
+    LONG tail;                  // next event to drain
+    LONG dropped;               // events overwritten before they were drained
+    LONG reserved1[14];
+    XDMA_TIMELINE_EVENT events[XDMA_TIMELINE_RING_ENTRIES];
+} XDMA_TIMELINE_RING;
+
+/// Device wide timeline, see IOCTL_XDMA_TIMELINE_CONTROL
+typedef struct XDMA_TIMELINE_T {
+    XDMA_TIMELINE_RING* rings;  // numCpus rings, installed by the first XdmaTimelineInit()
+    ULONG numCpus;
+    volatile LONG enabled;
+    volatile LONG draining;     // a drain is in progress
+    ULONGLONG startCycles;      // calibration point of the cycle counter
+    LONGLONG startTimestamp;
+} XDMA_TIMELINE;
+
+// ========================= function declarations ================================================
+
+/// Bytes of memory the rings of numCpus cpus need
+size_t XdmaTimelineSize(IN ULONG numCpus);
+
+/// Install memory of XdmaTimelineSize(numCpus) bytes as the rings. Returns FALSE if rings were
+/// installed already, the memory is unused then and can be freed.
+BOOLEAN XdmaTimelineInit(IN OUT XDMA_TIMELINE* timeline, IN PVOID memory, IN ULONG numCpus);
+
+/// Discard all events and start recording. The rings must be installed.
+VOID XdmaTimelineStart(IN OUT XDMA_TIMELINE* timeline);
+
+/// Stop recording, events not drained yet are kept
+VOID XdmaTimelineStop(IN OUT XDMA_TIMELINE* timeline);
+
+/// Record an event on the ring of the current cpu, callable at any IRQL.
+/// Use XDMA_TIMELINE_LOG() which skips the call while the timeline is stopped.
+VOID XdmaTimelineLog(IN XDMA_TIMELINE* timeline, IN UINT8 type, IN UINT8 dir, IN UINT8 channel,
+                     IN UINT64 arg);
+
+/// Move up to maxEvents events out of the rings and fill in info. Returns STATUS_DEVICE_BUSY if
+/// another drain is in progress.
+NTSTATUS XdmaTimelineDrain(IN OUT XDMA_TIMELINE* timeline, OUT XDMA_TIMELINE_INFO* info,
+                           OUT XDMA_TIMELINE_EVENT* events, IN ULONG maxEvents);
+
+#define XDMA_TIMELINE_LOG(timeline, type, dir, channel, arg)                                \
+    do {                                                                                    \
+        if ((timeline)->enabled) {                                                          \
+            XdmaTimelineLog((timeline), (UINT8)(type), (UINT8)(dir), (UINT8)(channel),      \
+                            (UINT64)(arg));                                                 \
+        }                                                                                   \
+    } while (0)
+
@@ -44,6 +44,16 @@ NTSTATUS XDMA_DeviceOpen(WDFDEVICE wdfDevice,
                          WDFCMRESLIST ResourcesRaw,
                          WDFCMRESLIST ResourcesTranslated);
 
+/**
+ * \brief Select the cache type of the bypass BAR. The kernel mapping is replaced, so this must be
+ *        called after XDMA_DeviceOpen() and before the BAR is accessed or mapped into a process.
+ *        IOCTL_XDMA_MAP_BAR maps the bypass BAR with the same cache type.
+ * \param xdma          [IN]        The XDMA device context
+ * \param writeCombined [IN]        TRUE = write-combined, FALSE = non-cached (default)
+ * \return STATUS_SUCCESS on successful completion. All other return values indicate error conditions.
+ */
+NTSTATUS XDMA_SetBypassWriteCombined(PXDMA_DEVICE xdma, BOOLEAN writeCombined);
+
 /**
  * \brief Close and cleanup the XDMA device.
  * \param xdma          [IN]        The XDMA device context
@@ -97,4 +107,24 @@ EVT_WDF_PROGRAM_DMA XDMA_EngineProgramDma;
  * \param engine        [IN]        The DMA engine context
  * \param pollMode      [IN]        true = use polling, false = use interrupts
  */
-void XDMA_EngineSetPollMode(XDMA_ENGINE* engine, BOOLEAN pollMode);
\ No newline at end of file
+void XDMA_EngineSetPollMode(XDMA_ENGINE* engine, BOOLEAN pollMode);
+
+/**
+ * \brief Set the transfer size up to which DMA requests are copied through the engine's 
+ *        pre-mapped bounce buffer instead of building a scatter-gather transaction.
+ * \param engine        [IN]        The DMA engine context
+ * \param threshold     [IN]        Size in bytes, 0 = disabled. Clamped to XDMA_BOUNCE_BUFFER_SIZE
+ */
+void XDMA_EngineSetBounceThreshold(XDMA_ENGINE* engine, size_t threshold);
+
+/**
+ * \brief Allocate the spill buffer of a streaming C2H engine. When highWater blocks of the receive
+ *        ring are filled the completion path moves them into this buffer and returns their
+ *        descriptor credits, reads drain it before the ring. Must not be called while the c2h
+ *        file is open.
+ * \param engine        [IN]        The DMA engine context
+ * \param size          [IN]        Size in bytes, 0 = disabled. Clamped to XDMA_SPILL_MAX_SIZE
+ * \param highWater     [IN]        Filled ring blocks at which blocks are spilled, 0 = default
+ * \return STATUS_SUCCESS on successful completion or if the engine does not stream to the host.
+ */
+NTSTATUS XDMA_EngineSetSpill(XDMA_ENGINE* engine, size_t size, ULONG highWater);
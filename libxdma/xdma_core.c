@@ -0,0 +1,218 @@
+/*
+* XDMA Engine Core
+* ================
+*
+* Copyright 2017 Xilinx Inc.
+* Copyright 2010-2012 Sidebranch
+* Copyright 2010-2012 Leon Woestenberg <leon@sidebranch.com>
+*
+* Maintainer:
+* -----------
+* Alexander Hornburg <alexander.hornburg@xilinx.com>
+*
+* References:
+* -----------
+*	[1] pg195-pcie-dma.pdf - DMA/Bridge Subsystem for PCI Express v4.0 - Product Guide
+*/
+
+// ========================= include dependencies =================================================
+
+#include "xdma_core.h"
+
+// ========================= engine probing =======================================================
+
+volatile XDMA_ENGINE_REGS* CoreEngineRegs(IN PUCHAR configBar, IN DirToDev dir, IN ULONG channel) {
+    const ULONG offset = (dir * BLOCK_OFFSET) + (channel * ENGINE_OFFSET);
+    return (volatile XDMA_ENGINE_REGS*)(configBar + offset);
+}
+
+volatile XDMA_SGDMA_REGS* CoreEngineSgdmaRegs(IN PUCHAR configBar, IN DirToDev dir,
+                                              IN ULONG channel) {
+    const ULONG offset = (dir * BLOCK_OFFSET) + (channel * ENGINE_OFFSET);
+    return (volatile XDMA_SGDMA_REGS*)(configBar + offset + SGDMA_BLOCK_OFFSET);
+}
+
+BOOLEAN CoreEngineExists(IN PUCHAR configBar, IN DirToDev dir, IN ULONG channel) {
+    UINT32 engineID = CoreEngineRegs(configBar, dir, channel)->identifier;
+    return (engineID & XDMA_ID_MASK) == XDMA_ID;
+}
+
+VOID CoreEngineAlignments(IN volatile XDMA_ENGINE_REGS* regs, OUT XDMA_ALIGNMENT* alignment) {
+
+    UINT32 alignments = regs->alignments;
+
+    if (alignments) {
+        alignment->addr = (alignments & 0x00ff0000U) >> 16;
+        alignment->length = (alignments & 0x0000ff00U) >> 8;
+        alignment->addrBits = (alignments & 0x000000ffU);
+    } else { // Some default values if alignments are unspecified
+        alignment->addr = 1;
+        alignment->length = 1;
+        alignment->addrBits = 64;
+    }
+}
+
+UINT32 CoreEngineIrqBitMask(IN ULONG engineIndex) {
+    // engine interrupt request bit(s) - interrupt bit depends on number of engines present
+    // see Figure 2-4 on page 46 of pcie dma product guide [1]
+    UINT32 mask = (1 << XDMA_ENG_IRQ_NUM) - 1;
+    return mask << (engineIndex * XDMA_ENG_IRQ_NUM);
+}
+
+UINT32 CoreEngineIrqSources(IN EngineType type, IN DirToDev dir) {
+    UINT32 sources = XDMA_CTRL_IE_ALL;
+    if ((type == EngineType_ST) && (dir == C2H)) {
+        sources |= XDMA_CTRL_IE_IDLE_STOPPED;
+    }
+    return sources;
+}
+
+// ========================= descriptors ==========================================================
+
+VOID CoreDescriptorSet(OUT DMA_DESCRIPTOR* desc, IN DirToDev dir, IN UINT64 hostLA,
+                       IN UINT64 deviceOffset, IN UINT32 length, IN UINT64 nextLA) {
+    desc->control = XDMA_DESC_MAGIC;
+    desc->numBytes = length;
+    if (dir == H2C) { // source is host memory
+        desc->srcAddrLo = (UINT32)LIMIT_TO_32(hostLA);
+        desc->srcAddrHi = (UINT32)(hostLA >> 32);
+        desc->dstAddrLo = (UINT32)LIMIT_TO_32(deviceOffset);
+        desc->dstAddrHi = (UINT32)(deviceOffset >> 32);
+    } else { // destination is host memory
+        desc->srcAddrLo = (UINT32)LIMIT_TO_32(deviceOffset);
+        desc->srcAddrHi = (UINT32)(deviceOffset >> 32);
+        desc->dstAddrLo = (UINT32)LIMIT_TO_32(hostLA);
+        desc->dstAddrHi = (UINT32)(hostLA >> 32);
+    }
+    desc->nextLo = (UINT32)LIMIT_TO_32(nextLA);
+    desc->nextHi = (UINT32)(nextLA >> 32);
+}
+
+VOID CoreDescriptorSetLast(IN OUT DMA_DESCRIPTOR* desc, IN EngineType type) {
+    desc->nextLo = 0;
+    desc->nextHi = 0;
+    desc->control |= (XDMA_DESC_STOP_BIT | XDMA_DESC_COMPLETED_BIT);
+    if (type == EngineType_ST) {
+        desc->control |= XDMA_DESC_EOP_BIT;
+    }
+}
+
+BOOLEAN CoreDescriptorIsAligned(IN const DMA_DESCRIPTOR* desc, IN AddressMode addressMode,
+                                IN const XDMA_ALIGNMENT* alignment, IN UINT32 dataPathWidth)
+// For alignment requirements see product guide [1] page 23 table 2-9
+{
+    if (addressMode == AddressMode_Fixed) {
+        const UINT32 addrMask = dataPathWidth - 1;
+        // todo length alignment requirement??
+        return (desc->dstAddrLo & addrMask) == (desc->srcAddrLo & addrMask);
+    }
+
+    // AddressMode_Contiguous (i.e. incremental mode)
+    return ((desc->dstAddrLo % alignment->addr) == 0) &&
+        ((desc->numBytes % alignment->length) == 0) &&
+        ((desc->srcAddrLo % alignment->addr) == 0);
+}
+
+VOID CoreDescriptorOptimize(IN volatile XDMA_SGDMA_REGS* sgdma, IN OUT DMA_DESCRIPTOR* desc,
+                            IN ULONG numDesc, IN ULONG mrrsBytes)
+    // Optimize descriptors for PCIe block fetches.
+    // Multiple descriptors which reside in host memory can be fetched in a single PCIe transaction
+    // by the device. This is achieved as follows:
+    //      - For the first fetch, the number of additional (adjacent) descriptors to fetch is
+    //        specified by writing to engine->sgdma->firstDescAdj register.
+    //      - For subsequent fetches, the last descriptor of the previous fetch specifies the number of
+    //        additional (adjacent) descriptors in the control->nextAdj field
+    // There are several factors which limit the amount of descriptors which can be fetched together:
+    //      1. The PCIe Max Read Request Size
+    //      2. The physical address of the descriptors within a block must not cross a 4K address
+    //         boundary
+    //      3. The number of descriptors remaining in the transfer
+{
+    const ULONG adjMax = mrrsBytes / sizeof(DMA_DESCRIPTOR) - 1;
+    const ULONG adjTotal = numDesc - 1;
+    const ULONG adjTo4k = (0x1000 - (sgdma->firstDescLo & 0xFFF)) / sizeof(DMA_DESCRIPTOR) - 1;
+
+    // set the number of adjacent descriptors for the first fetch
+    ULONG firstAdj = adjTotal < adjMax ? adjTotal : adjMax;
+    sgdma->firstDescAdj = adjTo4k < firstAdj ? adjTo4k : firstAdj;
+
+    // set the number of adjacent descriptors for subsequent fetches
+    ULONG nextAdjMax = adjMax - 1;
+    for (UINT i = 0; i < numDesc; i++) {
+        // if not last desc then get total desc adj to next desc, else last desc has no next desc
+        const ULONG nextAdjTotal = (i != adjTotal) ? adjTotal - (i + 1) : 0;
+        const ULONG nextAdjTo4k = (0x1000 - (desc[i].nextLo & 0xFFF)) / sizeof(DMA_DESCRIPTOR) - 1;
+
+        ULONG nextAdj = nextAdjTotal < nextAdjMax ? nextAdjTotal : nextAdjMax;
+        if (nextAdj > nextAdjTo4k) {
+            nextAdj = nextAdjTo4k;
+        }
+
+        desc[i].control |= (nextAdj << 8);
+
+        // update current max adj count for this block
+        if (nextAdjMax != 0) {
+            nextAdjMax--;
+        } else { // wrap-around
+            nextAdjMax = adjMax;
+        }
+    }
+}
+
+VOID CoreEngineBindDescriptors(IN volatile XDMA_SGDMA_REGS* sgdma, IN PHYSICAL_ADDRESS descLA) {
+    sgdma->firstDescLo = descLA.LowPart;
+    sgdma->firstDescHi = descLA.HighPart;
+    sgdma->firstDescAdj = 0;
+}
+
+// ========================= rings and interrupts =================================================
+
+UINT CoreRingAdvance(IN UINT index, IN UINT numEntries) {
+    return (index == numEntries - 1) ? 0 : index + 1; // wrap-around or normal increment
+}
+
+UINT CoreRingCount(IN UINT head, IN UINT tail, IN UINT numEntries) {
+    return (tail >= head) ? (tail - head) : (numEntries - head + tail);
+}
+
+UINT32 CoreIrqVectorReg(IN UINT32 a, IN UINT32 b, IN UINT32 c, IN UINT32 d) {
+    UINT32 reg_val = 0;
+    reg_val |= (a & 0x1f) << 0;
+    reg_val |= (b & 0x1f) << 8;
+    reg_val |= (c & 0x1f) << 16;
+    reg_val |= (d & 0x1f) << 24;
+    return reg_val;
+}
+
+BOOLEAN CoreIrqLatch(IN volatile XDMA_IRQ_REGS* regs, IN OUT UINT32* channelPending,
+                     IN OUT UINT32* userPending) {
+
+    // channel interrupt(s) requested?
+    UINT32 chIrq = regs->channelIntRequest;
+    if (chIrq) {
+        *channelPending |= chIrq; // remember fired channel interrupts
+        regs->channelIntEnableW1C = chIrq; // disable fired channel interrupts
+    }
+
+    // read user interrupts that are pending in the controller - flushes previous write
+    UINT32 userIrq = regs->userIntRequest;
+    if (userIrq) {
+        *userPending |= userIrq; // remember fired user interrupts
+        regs->userIntEnableW1C = userIrq; // disable fired user interrupts
+    }
+
+    return (chIrq != 0) || (userIrq != 0);
+}
+
+VOID CoreIrqRearm(IN volatile XDMA_IRQ_REGS* regs, IN OUT UINT32* channelPending,
+                  IN OUT UINT32* userPending) {
+    regs->channelIntEnableW1S = *channelPending;
+    *channelPending = 0x0;
+
+    // FIXME - Remove the user interrupt source condition before reenabling the user interrupt
+    // This depends on user logic and how the interrupt has been triggered!
+    // This reference driver puts the responsibility on the user-space application to remove the
+    // user event interrupt source condition.
+    regs->userIntEnableW1S = *userPending;
+    *userPending = 0x0;
+}
@@ -0,0 +1,171 @@
+/*
+* XDMA Engine Core
+* ================
+*
+* Copyright 2017 Xilinx Inc.
+* Copyright 2010-2012 Sidebranch
+* Copyright 2010-2012 Leon Woestenberg <leon@sidebranch.com>
+*
+* Maintainer:
+* -----------
+* Alexander Hornburg <alexander.hornburg@xilinx.com>
+*
+* Description:
+* ------------
+* OS independent part of the engine handling: engine probing, descriptor building, descriptor
+* block fetch optimization, ring index management and interrupt request bit handling. Only depends
+* on xdma_os.h and the register map, so it builds both into the KMDF library and on Linux.
+*
+* References:
+* -----------
+*	[1] pg195-pcie-dma.pdf - DMA/Bridge Subsystem for PCI Express v4.0 - Product Guide
+*/
+
+#pragma once
+
+// ========================= include dependencies =================================================
+
+#include "xdma_os.h"
+#include "reg.h"
+
+// ========================= constants ============================================================
+
+#define XDMA_ENG_IRQ_NUM        (1)
+#define XDMA_DESC_MAGIC         (0xAD4B0000)
+#define XDMA_WB_COUNT_MASK      (0x00ffffffUL)
+#define XDMA_WB_ERR_MASK        (BIT_N(31))
+
+// ========================= type declarations ====================================================
+
+/// Direction of the DMA transfer/engine
+typedef enum DirToDev_t {
+    H2C = 0, // Host-to-Card - write to device
+    C2H = 1  // Card-to-Host - read from device
+} DirToDev;
+
+/// Engine address mode.
+/// Determines how the DMA engine interprets the device address (destination address on H2C and
+/// source address on C2H).
+/// When AddressMode_Contiguous is chosen, the device address only needs to be set for the first
+/// descriptor and the engine assumes that all subsequent descriptors device addresses follow
+/// sequentially.
+/// When AddressMode_Fixed is selected, the device addresses of each descriptor must be explicitly
+/// set.
+typedef enum AddressMode_T {
+    AddressMode_Contiguous,  // incremental
+    AddressMode_Fixed,       // non-incremental
+} AddressMode;
+
+typedef enum EngineType_t {
+    EngineType_MM,      // Memory Mapped
+    EngineType_ST,      // Streaming
+} EngineType;
+
+/// Alignment requirements of an engine, see product guide [1] table 2-9
+typedef struct XDMA_ALIGNMENT_T {
+    UINT32 addr;        // address alignment in bytes
+    UINT32 length;      // transfer length granularity in bytes
+    UINT32 addrBits;    // number of supported address bits
+} XDMA_ALIGNMENT;
+
+#pragma pack(1)
+
+/// \brief Descriptor for a single contiguous memory block transfer.
+///
+/// Multiple descriptors are linked a 'next' pointer. An additional extra adjacent number gives the
+/// amount of subsequent contiguous descriptors. The descriptors are in root complex memory, and the
+/// bytes in the 32-bit words must be in little-endian byte ordering.
+typedef struct xdma_descriptor_t {
+    UINT32 control;
+    UINT32 numBytes;  // transfer length in bytes
+    UINT32 srcAddrLo; // source address (low 32-bit)
+    UINT32 srcAddrHi; // source address (high 32-bit)
+    UINT32 dstAddrLo; // destination address (low 32-bit)
+    UINT32 dstAddrHi; // destination address (high 32-bit)
+                      // next descriptor in the single-linked list of descriptors,
+                      // this is the bus address of the next descriptor in the root complex memory.
+    UINT32 nextLo;    // next desc address (low 32-bit)
+    UINT32 nextHi;    // next desc address (high 32-bit)
+} DMA_DESCRIPTOR;
+
+/// Result buffer of the streaming DMA operation.
+/// The XDMA IP core writes the result of the DMA transfer to the host memory
+typedef struct {
+    UINT32 status;
+    UINT32 length;
+    UINT32 reserved_1[6]; // padding
+} DMA_RESULT;
+
+/// \brief Structure for polled mode descriptor writeback
+///
+/// XDMA IP core writes number of completed descriptors to this memory, which the driver can then
+/// poll to detect transfer completion
+typedef struct {
+    UINT32 completedDescCount;
+    UINT32 reserved_1[7];
+} XDMA_POLL_WB;
+
+#pragma pack()
+
+// ========================= engine probing =======================================================
+
+/// Register blocks of an engine within the config BAR
+volatile XDMA_ENGINE_REGS* CoreEngineRegs(IN PUCHAR configBar, IN DirToDev dir, IN ULONG channel);
+volatile XDMA_SGDMA_REGS* CoreEngineSgdmaRegs(IN PUCHAR configBar, IN DirToDev dir,
+                                              IN ULONG channel);
+
+/// Is the engine present in the IP core?
+BOOLEAN CoreEngineExists(IN PUCHAR configBar, IN DirToDev dir, IN ULONG channel);
+
+/// Read the alignment requirements of an engine, defaults if the core does not specify them
+VOID CoreEngineAlignments(IN volatile XDMA_ENGINE_REGS* regs, OUT XDMA_ALIGNMENT* alignment);
+
+/// Channel interrupt request bit(s) of the engine with the given probe index
+UINT32 CoreEngineIrqBitMask(IN ULONG engineIndex);
+
+/// Engine interrupt sources to enable, streaming C2H engines also report idle
+UINT32 CoreEngineIrqSources(IN EngineType type, IN DirToDev dir);
+
+// ========================= descriptors ==========================================================
+
+/// Fill one descriptor for a transfer between host memory at hostLA and the card at deviceOffset.
+/// nextLA = 0 ends the chain.
+VOID CoreDescriptorSet(OUT DMA_DESCRIPTOR* desc, IN DirToDev dir, IN UINT64 hostLA,
+                       IN UINT64 deviceOffset, IN UINT32 length, IN UINT64 nextLA);
+
+/// Turn desc into the last descriptor of a chain: stop the engine and request the completion
+/// interrupt, end the packet on streaming engines
+VOID CoreDescriptorSetLast(IN OUT DMA_DESCRIPTOR* desc, IN EngineType type);
+
+/// Check the descriptor against the engine alignment requirements
+/// dataPathWidth is the AXI data path width in bytes, only used in AddressMode_Fixed
+BOOLEAN CoreDescriptorIsAligned(IN const DMA_DESCRIPTOR* desc, IN AddressMode addressMode,
+                                IN const XDMA_ALIGNMENT* alignment, IN UINT32 dataPathWidth);
+
+/// Set the adjacent descriptor counts of a chain (and of the first fetch in sgdma->firstDescAdj)
+/// so the engine fetches as many descriptors per PCIe read request as possible
+VOID CoreDescriptorOptimize(IN volatile XDMA_SGDMA_REGS* sgdma, IN OUT DMA_DESCRIPTOR* desc,
+                            IN ULONG numDesc, IN ULONG mrrsBytes);
+
+/// Point the engine at the first descriptor of a chain
+VOID CoreEngineBindDescriptors(IN volatile XDMA_SGDMA_REGS* sgdma, IN PHYSICAL_ADDRESS descLA);
+
+// ========================= rings and interrupts =================================================
+
+/// Advance a ring index with wrap-around
+UINT CoreRingAdvance(IN UINT index, IN UINT numEntries);
+
+/// Number of entries from head up to, but not including, tail
+UINT CoreRingCount(IN UINT head, IN UINT tail, IN UINT numEntries);
+
+/// Pack four 5 bit interrupt vector numbers into one vector register value
+UINT32 CoreIrqVectorReg(IN UINT32 a, IN UINT32 b, IN UINT32 c, IN UINT32 d);
+
+/// Latch and mask the requested channel and user interrupts, returns FALSE if none was requested.
+/// The latched bits are accumulated into *channelPending and *userPending.
+BOOLEAN CoreIrqLatch(IN volatile XDMA_IRQ_REGS* regs, IN OUT UINT32* channelPending,
+                     IN OUT UINT32* userPending);
+
+/// Unmask the interrupts latched by CoreIrqLatch() after they have been serviced
+VOID CoreIrqRearm(IN volatile XDMA_IRQ_REGS* regs, IN OUT UINT32* channelPending,
+                  IN OUT UINT32* userPending);
@@ -0,0 +1,210 @@
+/*
+* XDMA OS Abstraction Layer
+* =========================
+*
+* Copyright 2017 Xilinx Inc.
+* Copyright 2010-2012 Sidebranch
+* Copyright 2010-2012 Leon Woestenberg <leon@sidebranch.com>
+*
+* Maintainer:
+* -----------
+* Alexander Hornburg <alexander.hornburg@xilinx.com>
+*
+* Description:
+* ------------
+* The few OS services the OS independent engine core (xdma_core.h) and the engine buffers depend
+* on. The KMDF implementation is xdma_os_kmdf.c, the Linux user-space implementation (VFIO BAR
+* mapping and DMA memory, or a software register model) is linux/xdma_os_linux.c.
+* Outside of a Windows kernel build this header also provides the NT base types and status codes
+* the library is written in, so the core compiles unchanged.
+*/
+
+#pragma once
+
+// ========================= include dependencies =================================================
+
+#if defined(_KERNEL_MODE) // KMDF driver build
+
+#include <ntddk.h>
+#include <wdf.h>
+
+typedef WDFDMAENABLER XDMA_OS_DMA_ADAPTER;  // allocates common buffers
+typedef WDFCOMMONBUFFER XDMA_OS_DMA_HANDLE;
+typedef WDFSPINLOCK XDMA_OS_LOCK;
+
+#define XDMA_CACHE_ALIGN    __declspec(align(64))   // XDMA_CACHE_LINE_SIZE
+
+#else // Linux user-space build
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+// ========================= NT base types ========================================================
+
+typedef void VOID;
+typedef void* PVOID;
+typedef char CHAR;
+typedef uint8_t UCHAR;
+typedef uint8_t* PUCHAR;
+typedef uint8_t BOOLEAN;
+typedef uint32_t UINT32;
+typedef int32_t INT32;
+typedef uint64_t UINT64;
+typedef int64_t INT64;
+typedef unsigned int UINT;
+typedef int32_t LONG;
+typedef uint32_t ULONG;
+typedef uint32_t DWORD;
+typedef int64_t LONGLONG;
+typedef uint64_t ULONGLONG;
+typedef size_t SIZE_T;
+typedef int32_t NTSTATUS;
+
+typedef union _LARGE_INTEGER {
+    struct {
+        ULONG LowPart;
+        LONG HighPart;
+    };
+    LONGLONG QuadPart;
+} LARGE_INTEGER, PHYSICAL_ADDRESS;
+
+#define IN
+#define OUT
+#define TRUE    (1)
+#define FALSE   (0)
+
+#ifndef PAGE_SIZE
+#define PAGE_SIZE   (4096UL)
+#endif
+
+#define NT_SUCCESS(status)              (((NTSTATUS)(status)) >= 0)
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define STATUS_TIMEOUT                  ((NTSTATUS)0x00000102L)
+#define STATUS_DEVICE_BUSY              ((NTSTATUS)0x80000011L)
+#define STATUS_UNSUCCESSFUL             ((NTSTATUS)0xC0000001L)
+#define STATUS_INVALID_PARAMETER        ((NTSTATUS)0xC000000DL)
+#define STATUS_NO_SUCH_DEVICE           ((NTSTATUS)0xC000000EL)
+#define STATUS_INSUFFICIENT_RESOURCES   ((NTSTATUS)0xC000009AL)
+#define STATUS_IO_TIMEOUT               ((NTSTATUS)0xC00000B5L)
+#define STATUS_NOT_SUPPORTED            ((NTSTATUS)0xC00000BBL)
+#define STATUS_INTERNAL_ERROR           ((NTSTATUS)0xC00000E5L)
+
+#define UNREFERENCED_PARAMETER(p)   ((void)(p))
+#define ASSERT(exp)                 assert(exp)
+#define ASSERTMSG(msg, exp)         assert((msg) && (exp))
+#define MemoryBarrier()             __sync_synchronize()
+#define RtlZeroMemory(dst, length)  memset((dst), 0, (length))
+#define RtlCopyMemory(dst, src, length) memcpy((dst), (src), (length))
+
+#define InterlockedIncrement(target)    __sync_add_and_fetch((target), 1)
+#define InterlockedDecrement(target)    __sync_sub_and_fetch((target), 1)
+#define InterlockedExchange(target, value) __atomic_exchange_n((target), (value), __ATOMIC_SEQ_CST)
+#define InterlockedCompareExchange(target, exchange, comparand) \
+    __sync_val_compare_and_swap((target), (comparand), (exchange))
+#define InterlockedCompareExchangePointer(target, exchange, comparand) \
+    __sync_val_compare_and_swap((target), (comparand), (exchange))
+
+#ifndef min
+#define min(a, b)   (((a) < (b)) ? (a) : (b))
+#endif
+
+struct XDMA_OS_LINUX_DEVICE_T;
+typedef struct XDMA_OS_LINUX_DEVICE_T* XDMA_OS_DMA_ADAPTER; // see linux/xdma_os_linux.h
+typedef void* XDMA_OS_DMA_HANDLE;
+typedef pthread_spinlock_t XDMA_OS_LOCK;
+
+#define XDMA_CACHE_ALIGN    __attribute__((aligned(64)))    // XDMA_CACHE_LINE_SIZE
+
+#endif
+
+// ========================= constants ============================================================
+
+/// Members which are written by different cpus are kept this far apart, see XDMA_CACHE_ALIGN
+#define XDMA_CACHE_LINE_SIZE    (64)
+
+// ========================= type declarations ====================================================
+
+/// Host memory the engines can access - virtually and physically (IOVA) contiguous, zeroed
+typedef struct XDMA_OS_DMA_BUFFER_T {
+    PVOID va;                   // virtual address, NULL if not allocated
+    PHYSICAL_ADDRESS la;        // bus address as seen by the device
+    size_t length;              // length in bytes
+    XDMA_OS_DMA_HANDLE handle;  // OS specific allocation
+} XDMA_OS_DMA_BUFFER;
+
+// ========================= function declarations ================================================
+
+/// Allocate a DMA buffer of length bytes
+NTSTATUS XdmaOsDmaAlloc(IN XDMA_OS_DMA_ADAPTER adapter, IN size_t length,
+                        OUT XDMA_OS_DMA_BUFFER* buffer);
+
+/// Free a buffer allocated by XdmaOsDmaAlloc(), freeing an unallocated buffer is a no-op
+VOID XdmaOsDmaFree(IN OUT XDMA_OS_DMA_BUFFER* buffer);
+
+/// Create a spin lock which may be taken from interrupt deferred context
+NTSTATUS XdmaOsLockCreate(OUT XDMA_OS_LOCK* lock);
+
+VOID XdmaOsLockAcquire(IN XDMA_OS_LOCK* lock);
+
+VOID XdmaOsLockRelease(IN XDMA_OS_LOCK* lock);
+
+/// High resolution time stamp, see XdmaOsTimestampFrequency()
+LONGLONG XdmaOsTimestamp(VOID);
+
+/// Time stamp ticks per second
+LONGLONG XdmaOsTimestampFrequency(VOID);
+
+/// Cheapest cycle counter of the cpu (TSC on x86/x64), calibrate it against XdmaOsTimestamp()
+ULONGLONG XdmaOsCycles(VOID);
+
+/// Index of the cpu the caller runs on, 0 based
+ULONG XdmaOsCurrentCpu(VOID);
+
+/// Busy wait for the given number of microseconds
+VOID XdmaOsStallUs(IN ULONG us);
+
+// ========================= inline functions =====================================================
+
+// Acquire load and release store of an index which one side publishes and the other side reads,
+// e.g. the producer and consumer indices of a single-producer/single-consumer ring. Neither side
+// needs a lock or an interlocked operation.
+
+#if defined(_KERNEL_MODE)
+
+/// Read an index published by XdmaOsStoreRelease(), later accesses are not moved before it
+FORCEINLINE ULONG XdmaOsLoadAcquire(IN volatile ULONG* source) {
+    const ULONG value = *source;
+#if defined(_M_IX86) || defined(_M_AMD64)
+    KeMemoryBarrierWithoutFence(); // x86/x64 do not reorder a load with later accesses
+#else
+    KeMemoryBarrier();
+#endif
+    return value;
+}
+
+/// Publish an index, earlier accesses are visible before it
+FORCEINLINE VOID XdmaOsStoreRelease(OUT volatile ULONG* destination, IN ULONG value) {
+#if defined(_M_IX86) || defined(_M_AMD64)
+    KeMemoryBarrierWithoutFence(); // x86/x64 do not reorder a store with earlier accesses
+#else
+    KeMemoryBarrier();
+#endif
+    *destination = value;
+}
+
+#else
+
+/// Read an index published by XdmaOsStoreRelease(), later accesses are not moved before it
+static inline ULONG XdmaOsLoadAcquire(IN volatile ULONG* source) {
+    return __atomic_load_n(source, __ATOMIC_ACQUIRE);
+}
+
+/// Publish an index, earlier accesses are visible before it
+static inline VOID XdmaOsStoreRelease(OUT volatile ULONG* destination, IN ULONG value) {
+    __atomic_store_n(destination, value, __ATOMIC_RELEASE);
+}
+
+#endif
@@ -0,0 +1,96 @@
+/*
+* XDMA OS Abstraction Layer - KMDF Implementation
+* ===============================================
+*
+* Copyright 2017 Xilinx Inc.
+* Copyright 2010-2012 Sidebranch
+* Copyright 2010-2012 Leon Woestenberg <leon@sidebranch.com>
+*
+* Maintainer:
+* -----------
+* Alexander Hornburg <alexander.hornburg@xilinx.com>
+*
+*/
+
+// ========================= include dependencies =================================================
+
+#include "xdma_os.h"
+
+#include "trace.h"
+#ifdef DBG
+// The trace message header (.tmh) file must be included in a source file before any WPP macro
+// calls and after defining a WPP_CONTROL_GUIDS macro (defined in trace.h). see trace.h
+#include "xdma_os_kmdf.tmh"
+#endif
+
+// ========================= dma memory ===========================================================
+
+NTSTATUS XdmaOsDmaAlloc(IN XDMA_OS_DMA_ADAPTER adapter, IN size_t length,
+                        OUT XDMA_OS_DMA_BUFFER* buffer) {
+
+    RtlZeroMemory(buffer, sizeof(XDMA_OS_DMA_BUFFER));
+    NTSTATUS status = WdfCommonBufferCreate(adapter, length, WDF_NO_OBJECT_ATTRIBUTES,
+                                            &buffer->handle);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "WdfCommonBufferCreate failed: %!STATUS!", status);
+        return status;
+    }
+    buffer->va = WdfCommonBufferGetAlignedVirtualAddress(buffer->handle);
+    buffer->la = WdfCommonBufferGetAlignedLogicalAddress(buffer->handle);
+    buffer->length = length;
+    RtlZeroMemory(buffer->va, length);
+    return status;
+}
+
+VOID XdmaOsDmaFree(IN OUT XDMA_OS_DMA_BUFFER* buffer) {
+    if (buffer->handle != NULL) {
+        WdfObjectDelete(buffer->handle);
+    }
+    RtlZeroMemory(buffer, sizeof(XDMA_OS_DMA_BUFFER));
+}
+
+// ========================= synchronization ======================================================
+
+NTSTATUS XdmaOsLockCreate(OUT XDMA_OS_LOCK* lock) {
+    NTSTATUS status = WdfSpinLockCreate(WDF_NO_OBJECT_ATTRIBUTES, lock);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "WdfSpinLockCreate failed: %!STATUS!", status);
+    }
+    return status;
+}
+
+VOID XdmaOsLockAcquire(IN XDMA_OS_LOCK* lock) {
+    WdfSpinLockAcquire(*lock);
+}
+
+VOID XdmaOsLockRelease(IN XDMA_OS_LOCK* lock) {
+    WdfSpinLockRelease(*lock);
+}
+
+// ========================= time =================================================================
+
+LONGLONG XdmaOsTimestamp(VOID) {
+    return KeQueryPerformanceCounter(NULL).QuadPart;
+}
+
+LONGLONG XdmaOsTimestampFrequency(VOID) {
+    LARGE_INTEGER frequency;
+    KeQueryPerformanceCounter(&frequency);
+    return frequency.QuadPart;
+}
+
+ULONGLONG XdmaOsCycles(VOID) {
+#if defined(_M_AMD64) || defined(_M_IX86)
+    return ReadTimeStampCounter();
+#else
+    return (ULONGLONG)KeQueryPerformanceCounter(NULL).QuadPart;
+#endif
+}
+
+ULONG XdmaOsCurrentCpu(VOID) {
+    return KeGetCurrentProcessorNumberEx(NULL);
+}
+
+VOID XdmaOsStallUs(IN ULONG us) {
+    KeStallExecutionProcessor(us);
+}
@@ -87,6 +87,30 @@ static NTSTATUS GetPollModeParameter(IN PULONG pollMode) {
     return status;
 }
 
+// Get an optional ULONG driver parameter from the Windows registry, falls back to defaultValue
+static ULONG GetDriverParameter(IN PCUNICODE_STRING valueName, IN ULONG defaultValue) {
+    WDFDRIVER driver = WdfGetDriver();
+    WDFKEY key;
+    ULONG value = defaultValue;
+    NTSTATUS status = WdfDriverOpenParametersRegistryKey(driver, STANDARD_RIGHTS_ALL,
+                                                         WDF_NO_OBJECT_ATTRIBUTES, &key);
+    if (!NT_SUCCESS(status)) {
+        TraceWarning(DBG_INIT, "WdfDriverOpenParametersRegistryKey failed: %!STATUS!", status);
+        return defaultValue;
+    }
+
+    status = WdfRegistryQueryULong(key, valueName, &value);
+    if (!NT_SUCCESS(status)) {
+        TraceInfo(DBG_INIT, "%wZ not set, using default %u", valueName, defaultValue);
+        value = defaultValue;
+    }
+
+    TraceVerbose(DBG_INIT, "%wZ=%u", valueName, value);
+
+    WdfRegistryClose(key);
+    return value;
+}
+
 // main entry point - Called when driver is installed
 NTSTATUS DriverEntry(IN PDRIVER_OBJECT driverObject, IN PUNICODE_STRING registryPath) {
     NTSTATUS			status = STATUS_SUCCESS;
@@ -160,6 +184,9 @@ NTSTATUS EvtDeviceAdd(IN WDFDRIVER Driver, IN PWDFDEVICE_INIT DeviceInit) {
     WDF_OBJECT_ATTRIBUTES_SET_CONTEXT_TYPE(&fileAttributes, FILE_CONTEXT);
     WdfDeviceInitSetFileObjectConfig(DeviceInit, &fileConfig, &fileAttributes);
 
+    // BAR mapping requests must be handled in the context of the calling process
+    WdfDeviceInitSetIoInCallerContextCallback(DeviceInit, EvtIoInCallerContext);
+
     // Specify the context type and size for the device we are about to create.
     WDF_OBJECT_ATTRIBUTES deviceAttributes;
     WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&deviceAttributes, DeviceContext);
@@ -195,6 +222,51 @@ NTSTATUS EvtDeviceAdd(IN WDFDRIVER Driver, IN PWDFDEVICE_INIT DeviceInit) {
         return status;
     }
 
+    // pending user event reads, dma program waits and shared queue waits are parked in manual
+    // queues until the interrupt DPCs complete them. the queues are not power managed so waits can
+    // be issued at any time.
+    DeviceContext* ctx = GetDeviceContext(device);
+    WDF_IO_QUEUE_CONFIG_INIT(&queueConfig, WdfIoQueueDispatchManual);
+    queueConfig.PowerManaged = WdfFalse;
+    status = WdfIoQueueCreate(device, &queueConfig, WDF_NO_OBJECT_ATTRIBUTES, &ctx->eventQueue);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "WdfIoQueueCreate failed: %!STATUS!", status);
+        return status;
+    }
+    status = WdfIoQueueCreate(device, &queueConfig, WDF_NO_OBJECT_ATTRIBUTES, &ctx->programQueue);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "WdfIoQueueCreate failed: %!STATUS!", status);
+        return status;
+    }
+    status = WdfIoQueueCreate(device, &queueConfig, WDF_NO_OBJECT_ATTRIBUTES, &ctx->queueWaitQueue);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "WdfIoQueueCreate failed: %!STATUS!", status);
+        return status;
+    }
+    InitializeListHead(&ctx->sharedQueues);
+
+    WDF_OBJECT_ATTRIBUTES lockAttributes;
+    WDF_OBJECT_ATTRIBUTES_INIT(&lockAttributes);
+    lockAttributes.ParentObject = device;
+    status = WdfSpinLockCreate(&lockAttributes, &ctx->eventLock);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "WdfSpinLockCreate failed: %!STATUS!", status);
+        return status;
+    }
+
+    // user event notification page - pool allocations of a full page are page aligned
+    WDF_OBJECT_ATTRIBUTES pageAttributes;
+    WDF_OBJECT_ATTRIBUTES_INIT(&pageAttributes);
+    pageAttributes.ParentObject = device;
+    WDFMEMORY pageMemory;
+    status = WdfMemoryCreate(&pageAttributes, NonPagedPoolNx, 0, PAGE_SIZE, &pageMemory,
+                             (PVOID*)&ctx->eventPage);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_INIT, "WdfMemoryCreate failed: %!STATUS!", status);
+        return status;
+    }
+    RtlZeroMemory(ctx->eventPage, PAGE_SIZE);
+
     TraceVerbose(DBG_INIT, "returns %!STATUS!", status);
     return status;
 }
@@ -235,6 +307,38 @@ NTSTATUS EvtDevicePrepareHardware(IN WDFDEVICE device, IN WDFCMRESLIST Resources
         }
     }
 
+    // the bypass BAR is mapped write-combined everywhere or nowhere
+    DECLARE_CONST_UNICODE_STRING(bypassWcName, L"BYPASS_WRITE_COMBINED");
+    status = XDMA_SetBypassWriteCombined(xdma, GetDriverParameter(&bypassWcName, 0) ? TRUE : FALSE);
+    if (!NT_SUCCESS(status)) { // the bypass BAR stays non-cached
+        TraceWarning(DBG_INIT, "XDMA_SetBypassWriteCombined failed: %!STATUS!", status);
+        status = STATUS_SUCCESS;
+    }
+
+    // small transfers up to this size are copied through the engines' bounce buffers
+    DECLARE_CONST_UNICODE_STRING(bounceThresholdName, L"BOUNCE_THRESHOLD");
+    ULONG bounceThreshold = GetDriverParameter(&bounceThresholdName, XDMA_BOUNCE_DEFAULT_THRESHOLD);
+    for (UINT dir = H2C; dir < 2; dir++) { // 0=H2C, 1=C2H
+        for (ULONG ch = 0; ch < XDMA_MAX_NUM_CHANNELS; ch++) {
+            XDMA_ENGINE* engine = &(xdma->engines[ch][dir]);
+            XDMA_EngineSetBounceThreshold(engine, bounceThreshold);
+        }
+    }
+
+    // optional overflow buffering of the streaming receive rings, allocated once
+    DECLARE_CONST_UNICODE_STRING(spillSizeName, L"SPILL_BUFFER_MB");
+    DECLARE_CONST_UNICODE_STRING(spillHighWaterName, L"SPILL_HIGH_WATER");
+    ULONG spillSizeMb = GetDriverParameter(&spillSizeName, 0);
+    ULONG spillHighWater = GetDriverParameter(&spillHighWaterName, XDMA_SPILL_DEFAULT_HIGH_WATER);
+    for (ULONG ch = 0; ch < XDMA_MAX_NUM_CHANNELS; ch++) {
+        XDMA_ENGINE* engine = &(xdma->engines[ch][C2H]);
+        status = XDMA_EngineSetSpill(engine, (size_t)spillSizeMb * 1024 * 1024, spillHighWater);
+        if (!NT_SUCCESS(status)) { // the ring still works without it
+            TraceWarning(DBG_INIT, "XDMA_EngineSetSpill failed: %!STATUS!", status);
+            status = STATUS_SUCCESS;
+        }
+    }
+
     // create a queue for each engine
     for (UINT dir = H2C; dir < 2; dir++) { // 0=H2C, 1=C2H
         for (ULONG ch = 0; ch < XDMA_MAX_NUM_CHANNELS; ch++) {
@@ -250,8 +354,7 @@ NTSTATUS EvtDevicePrepareHardware(IN WDFDEVICE device, IN WDFCMRESLIST Resources
     }
 
     for (UINT i = 0; i < XDMA_MAX_USER_IRQ; ++i) {
-        KeInitializeEvent(&ctx->eventSignals[i], NotificationEvent, FALSE);
-        XDMA_UserIsrRegister(xdma, i, HandleUserEvent, &ctx->eventSignals[i]);
+        XDMA_UserIsrRegister(xdma, i, HandleUserEvent, ctx);
     }
 
     TraceVerbose(DBG_INIT, "<--Exit returning %!STATUS!", status);
@@ -302,6 +405,9 @@ NTSTATUS EngineCreateQueue(WDFDEVICE device, XDMA_ENGINE* engine, WDFQUEUE* queu
         }
     }
 
+    // engine-serialized control requests, e.g. dma program registration
+    config.EvtIoDeviceControl = EvtIoDeviceControlEngine;
+
     // serialize all callbacks related to this queue. see ref [2]
     WDF_OBJECT_ATTRIBUTES_INIT(&attribs);
     attribs.SynchronizationScope = WdfSynchronizationScopeQueue;
@@ -23,10 +23,24 @@
 
 #include "xdma.h"
 
+/// user event state - incremented by the user interrupt DPC, consumed by event reads
+typedef struct USER_EVENT_T {
+    volatile LONG count;            // occurrences not yet returned to user-space
+    volatile LONGLONG timestamp;    // performance counter value of the last occurrence
+} USER_EVENT;
+
 typedef struct DeviceContext_t {
     XDMA_DEVICE xdma;
     WDFQUEUE engineQueue[2][XDMA_MAX_NUM_CHANNELS];
-    KEVENT eventSignals[XDMA_MAX_USER_IRQ];
+    USER_EVENT userEvents[XDMA_MAX_USER_IRQ];
+    WDFQUEUE eventQueue;            // pending event reads, completed from the user interrupt DPC
+    WDFSPINLOCK eventLock;          // serializes event consumers against the DPC queue scan
+    XDMA_EVENT_PAGE* eventPage;     // page shared read-only with processes via IOCTL_XDMA_MAP_EVENTS
+    XDMA_ENGINE* programEngine[XDMA_MAX_USER_IRQ]; // engine with a dma program per user event
+    WDFQUEUE programQueue;          // pending IOCTL_XDMA_PROGRAM_WAIT requests
+    LIST_ENTRY sharedQueues;        // set up shared queues, protected by eventLock
+    WDFQUEUE queueWaitQueue;        // IOCTL_XDMA_QUEUE_ENTER requests waiting for completions
+    struct SHARED_QUEUE_T* queueOwner[2][XDMA_MAX_NUM_CHANNELS]; // shared queue per claimed engine
 
 }DeviceContext;
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(DeviceContext, GetDeviceContext)
\ No newline at end of file
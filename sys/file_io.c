@@ -14,11 +14,17 @@
 * ------------------------
 * User Operation (e.g. ReadFile())
 * |
+* |-> IO Request -> EvtIoInCallerContext()--> IoctlMapBar()        // map BAR into calling process
+* |                                       |--> IoctlMapEvents()     // map user event page into calling process
+* |                                       |--> StampArrival()       // i/o trace arrival time of reads/writes
+* |                                       |--> TimelineArrival()    // timeline arrival event of reads/writes
+* |                                       |--> (all other requests are queued as below)
+* |
 * |-> IO Request -> EvtIoRead()--> ReadBarToRequest()               // PCI BAR access
 *               |            |---> EvtIoReadDma()                   // normal dma c2h transfer
 *               |            |---> EvtIoReadEngineRing()            // for streaming interface
 *               |            |---> CopyDescriptorsToRequestMemory() // get dma descriptors to user-space
-*               |            |---> ServiceUserEvent()               // wait on user interrupt
+*               |            |---> EvtReadUserEvent()               // wait on user interrupt(s)
 *               |
 *               |-> EvtIoWrite()-> WriteBarFromRequest()            // PCI BAR access
 *                             |--> EvtIoWriteDma()                  // normal DMA H2C transfer
@@ -31,6 +37,7 @@
 #include "dma_engine.h"
 #include "xdma_public.h"
 #include "file_io.h"
+#include "shared_queue.h"
 
 #include "trace.h"
 #ifdef DBG
@@ -40,6 +47,13 @@
 #endif
 
 EVT_WDF_REQUEST_CANCEL      EvtCancelDma;
+EVT_WDF_REQUEST_CANCEL      EvtCancelBounce;
+
+static NTSTATUS IoctlEventWait(IN DeviceContext* ctx, IN WDFREQUEST request, IN PFILE_CONTEXT file,
+                               IN size_t outputLength);
+static VOID UnregisterProgram(IN DeviceContext* ctx, IN XDMA_ENGINE* engine);
+static NTSTATUS IoctlProgramWait(IN DeviceContext* ctx, IN WDFREQUEST request, IN XDMA_ENGINE* engine,
+                                 IN size_t outputLength);
 
 // ====================== device file nodes =======================================================
 
@@ -59,6 +73,7 @@ const static struct {
     { DEVNODE_TYPE_USER,        XDMA_FILE_USER,         0 },
     { DEVNODE_TYPE_CONTROL,     XDMA_FILE_CONTROL,      0 },
     { DEVNODE_TYPE_BYPASS,      XDMA_FILE_BYPASS,       0 },
+    { DEVNODE_TYPE_QUEUE,       XDMA_FILE_QUEUE,        0 },
     { DEVNODE_TYPE_EVENTS,      XDMA_FILE_EVENT_0,      0 },
     { DEVNODE_TYPE_EVENTS,      XDMA_FILE_EVENT_1,      1 },
     { DEVNODE_TYPE_EVENTS,      XDMA_FILE_EVENT_2,      2 },
@@ -115,6 +130,16 @@ VOID EvtDeviceFileCreate(IN WDFDEVICE device, IN WDFREQUEST Request, IN WDFFILEO
         goto ErrExit;
     }
 
+    // duplicated handles may map concurrently, see EvtIoInCallerContext()
+    WDF_OBJECT_ATTRIBUTES attribs;
+    WDF_OBJECT_ATTRIBUTES_INIT(&attribs);
+    attribs.ParentObject = WdfFile;
+    status = WdfWaitLockCreate(&attribs, &devNode->mapLock);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfWaitLockCreate failed: %!STATUS!", status);
+        goto ErrExit;
+    }
+
     // additional checks/setup for based on device type
     switch (devNode->devType) {
     case DEVNODE_TYPE_CONTROL:
@@ -166,6 +191,9 @@ VOID EvtDeviceFileCreate(IN WDFDEVICE device, IN WDFREQUEST Request, IN WDFFILEO
     case DEVNODE_TYPE_EVENTS:
         devNode->u.event = &(xdma->userEvents[index]);
         break;
+    case DEVNODE_TYPE_QUEUE:
+        devNode->u.sharedQueue = NULL; // created by IOCTL_XDMA_QUEUE_SETUP
+        break;
     default:
         break;
     }
@@ -189,9 +217,42 @@ VOID EvtFileCleanup(IN WDFFILEOBJECT FileObject) {
             EngineRingTeardown(file->u.engine);
         }
     }
+    if ((file->devType == DEVNODE_TYPE_H2C) || (file->devType == DEVNODE_TYPE_C2H)) {
+        if ((file->u.engine->program.state != XDMA_PROGRAM_NONE) &&
+            (file->u.engine->program.userData == FileObject)) {
+            UnregisterProgram(GetDeviceContext(WdfFileObjectGetDevice(FileObject)), file->u.engine);
+        }
+    }
+    // the last handle may be closed by another process than the one owning the mapping
+    if (file->userMdl != NULL) {
+        KAPC_STATE apcState;
+        const BOOLEAN attach = (PsGetCurrentProcess() != file->userProcess);
+        if (attach) {
+            KeStackAttachProcess(file->userProcess, &apcState);
+        }
+        MmUnmapLockedPages(file->userAddr, file->userMdl);
+        if (attach) {
+            KeUnstackDetachProcess(&apcState);
+        }
+        IoFreeMdl(file->userMdl);
+        ObDereferenceObject(file->userProcess);
+        file->userMdl = NULL;
+        file->userAddr = NULL;
+        file->userProcess = NULL;
+    }
+    if (file->devType == DEVNODE_TYPE_QUEUE) {
+        SharedQueueTeardown(GetDeviceContext(WdfFileObjectGetDevice(FileObject)), file);
+    }
     TraceVerbose(DBG_IO, "Cleanup %wZ", fileName);
 }
 
+VOID FileSetUserMapping(IN PFILE_CONTEXT file, IN PMDL mdl, IN PVOID userAddr) {
+    file->userMdl = mdl;
+    file->userAddr = userAddr;
+    file->userProcess = PsGetCurrentProcess();
+    ObReferenceObject(file->userProcess);
+}
+
 static NTSTATUS ValidateBarParams(IN PXDMA_DEVICE xdma, ULONG nBar, size_t offset, size_t length) {
     if (length == 0) {
         TraceError(DBG_IO, "Error: attempting to read 0 bytes");
@@ -204,8 +265,8 @@ static NTSTATUS ValidateBarParams(IN PXDMA_DEVICE xdma, ULONG nBar, size_t offse
         return STATUS_INVALID_DEVICE_REQUEST;
     }
 
-    // access outside valid BAR address range?
-    if (offset + length >= xdma->barLength[nBar]) {
+    // access outside valid BAR address range? - written so that a huge offset cannot wrap
+    if ((offset > xdma->barLength[nBar]) || (length > xdma->barLength[nBar] - offset)) {
         TraceError(DBG_IO, "Error: attempting to read BAR %u offset=%llu size=%llu",
                    nBar, offset, length);
         return STATUS_INVALID_DEVICE_REQUEST;
@@ -323,8 +384,8 @@ VOID EvtIoRead(IN WDFQUEUE queue, IN WDFREQUEST request, IN size_t length)
         break;
     case DEVNODE_TYPE_EVENTS:
         ASSERTMSG("no event attached to file context", file->u.event != NULL);
-        // forward request to engine queue - completed by EvtIoReadDma later
-        status = EvtReadUserEvent(request, length);
+        // completed now or parked in the event queue until the user interrupt DPC fires
+        status = EvtReadUserEvent(GetDeviceContext(WdfIoQueueGetDevice(queue)), request, length);
         break;
     case DEVNODE_TYPE_C2H:
     {
@@ -414,6 +475,33 @@ static NTSTATUS IoctlGetPerf(IN WDFREQUEST request, IN XDMA_ENGINE* engine) {
     return status;
 }
 
+static NTSTATUS IoctlGetSpill(IN WDFREQUEST request, IN XDMA_ENGINE* engine) {
+
+    ASSERT(engine != NULL);
+    if ((engine->type != EngineType_ST) || (engine->dir != C2H)) {
+        TraceError(DBG_IO, "IOCTL only supported on streaming c2h_* files");
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    XDMA_SPILL_STATS stats = { 0 };
+    EngineGetSpillStats(engine, &stats);
+
+    WDFMEMORY requestMemory;
+    NTSTATUS status = WdfRequestRetrieveOutputMemory(request, &requestMemory);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputMemory failed: %!STATUS!", status);
+        return status;
+    }
+
+    status = WdfMemoryCopyFromBuffer(requestMemory, 0, &stats, sizeof(stats));
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfMemoryCopyFromBuffer failed: %!STATUS!", status);
+        return status;
+    }
+
+    return status;
+}
+
 static NTSTATUS IoctlGetAddrMode(IN WDFREQUEST request, IN XDMA_ENGINE* engine) {
 
     ASSERT(engine != NULL);
@@ -470,18 +558,522 @@ static NTSTATUS IoctlSetAddrMode(IN WDFREQUEST request, IN XDMA_ENGINE* engine)
     return status;
 }
 
+static NTSTATUS IoctlMapBar(IN WDFREQUEST request, IN PXDMA_DEVICE xdma, IN PFILE_CONTEXT file)
+// Map the user or bypass BAR into the calling process. Must be called in the caller's context.
+{
+    LONG barIdx = -1;
+    if (file->devType == DEVNODE_TYPE_USER) {
+        barIdx = xdma->userBarIdx;
+    } else if (file->devType == DEVNODE_TYPE_BYPASS) {
+        barIdx = xdma->bypassBarIdx;
+    } else {
+        TraceError(DBG_IO, "BAR mapping only supported on user and bypass devices");
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    PULONG flags = NULL;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(request, sizeof(ULONG), (PVOID*)&flags, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+
+    XDMA_BAR_MAPPING* mapping = NULL;
+    status = WdfRequestRetrieveOutputBuffer(request, sizeof(XDMA_BAR_MAPPING), (PVOID*)&mapping, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+
+    // the user alias must have the cache type of the kernel mapping of the same BAR
+    MEMORY_CACHING_TYPE cacheType = MmNonCached;
+    if (file->devType == DEVNODE_TYPE_BYPASS) {
+        cacheType = xdma->bypassCacheType;
+    }
+    if (((*flags & XDMA_MAP_WRITE_COMBINED) != 0) != (cacheType == MmWriteCombined)) {
+        TraceError(DBG_IO, "BAR%d is %s, see BYPASS_WRITE_COMBINED", barIdx,
+                   (cacheType == MmWriteCombined) ? "write-combined" : "non-cached");
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    // the address is only valid in the process the mapping was made for, not in one which
+    // inherited or duplicated the handle
+    if ((file->userMdl != NULL) && (file->userProcess != PsGetCurrentProcess())) {
+        TraceError(DBG_IO, "BAR%d already mapped into another process", barIdx);
+        return STATUS_ACCESS_DENIED;
+    }
+    if ((file->userMdl != NULL) && (file->mapFlags != *flags)) {
+        TraceError(DBG_IO, "BAR%d already mapped with flags 0x%x", barIdx, file->mapFlags);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (file->userMdl == NULL) { // one mapping per device file
+        PMDL mdl = IoAllocateMdl(xdma->bar[barIdx], xdma->barLength[barIdx], FALSE, FALSE, NULL);
+        if (mdl == NULL) {
+            TraceError(DBG_IO, "IoAllocateMdl failed!");
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+        MmBuildMdlForNonPagedPool(mdl);
+
+        PVOID userAddr = NULL;
+        __try {
+            userAddr = MmMapLockedPagesSpecifyCache(mdl, UserMode, cacheType, NULL, FALSE,
+                                                    NormalPagePriority | MdlMappingNoExecute);
+        } __except (EXCEPTION_EXECUTE_HANDLER) {
+            userAddr = NULL;
+        }
+        if (userAddr == NULL) {
+            TraceError(DBG_IO, "MmMapLockedPagesSpecifyCache failed!");
+            IoFreeMdl(mdl);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+        FileSetUserMapping(file, mdl, userAddr);
+        file->mapFlags = *flags;
+    }
+
+    mapping->address = (UINT64)file->userAddr;
+    mapping->length = xdma->barLength[barIdx];
+    TraceInfo(DBG_IO, "BAR%d mapped at user address 0x%p, length=%u, cacheType=%d",
+              barIdx, file->userAddr, xdma->barLength[barIdx], cacheType);
+
+    return status;
+}
+
+static NTSTATUS IoctlMapEvents(IN WDFREQUEST request, IN DeviceContext* ctx, IN PFILE_CONTEXT file)
+// Map the user event notification page read-only into the calling process. Must be called in the
+// caller's context.
+{
+    if (file->devType != DEVNODE_TYPE_EVENTS) {
+        TraceError(DBG_IO, "event page mapping only supported on event devices");
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    XDMA_BAR_MAPPING* mapping = NULL;
+    NTSTATUS status = WdfRequestRetrieveOutputBuffer(request, sizeof(XDMA_BAR_MAPPING),
+                                                     (PVOID*)&mapping, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+
+    if ((file->userMdl != NULL) && (file->userProcess != PsGetCurrentProcess())) {
+        TraceError(DBG_IO, "event page already mapped into another process");
+        return STATUS_ACCESS_DENIED;
+    }
+    if (file->userMdl == NULL) { // one mapping per device file
+        PMDL mdl = IoAllocateMdl(ctx->eventPage, PAGE_SIZE, FALSE, FALSE, NULL);
+        if (mdl == NULL) {
+            TraceError(DBG_IO, "IoAllocateMdl failed!");
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+        MmBuildMdlForNonPagedPool(mdl);
+
+        PVOID userAddr = NULL;
+        __try {
+            userAddr = MmMapLockedPagesSpecifyCache(mdl, UserMode, MmCached, NULL, FALSE,
+                                                    NormalPagePriority | MdlMappingNoExecute |
+                                                    MdlMappingNoWrite);
+        } __except (EXCEPTION_EXECUTE_HANDLER) {
+            userAddr = NULL;
+        }
+        if (userAddr == NULL) {
+            TraceError(DBG_IO, "MmMapLockedPagesSpecifyCache failed!");
+            IoFreeMdl(mdl);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+        FileSetUserMapping(file, mdl, userAddr);
+    }
+
+    mapping->address = (UINT64)file->userAddr;
+    mapping->length = sizeof(XDMA_EVENT_PAGE);
+    TraceInfo(DBG_IO, "event page mapped at user address 0x%p", file->userAddr);
+
+    return status;
+}
+
+static VOID StampArrival(IN WDFREQUEST request)
+// remember when a read/write request entered the driver, see EngineTraceBegin()
+{
+    WDF_OBJECT_ATTRIBUTES attribs;
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attribs, REQUEST_TRACE_CONTEXT);
+    PREQUEST_TRACE_CONTEXT context;
+    NTSTATUS status = WdfObjectAllocateContext(request, &attribs, (PVOID*)&context);
+    if (NT_SUCCESS(status)) {
+        context->arrival = KeQueryPerformanceCounter(NULL).QuadPart;
+    }
+}
+
+static VOID TimelineArrival(IN WDFREQUEST request, IN size_t length)
+// record the arrival of a read/write request on an h2c_* or c2h_* file
+{
+    PFILE_CONTEXT file = GetFileContext(WdfRequestGetFileObject(request));
+    if ((file->devType == DEVNODE_TYPE_H2C) || (file->devType == DEVNODE_TYPE_C2H)) {
+        XDMA_TIMELINE_ENGINE_LOG(file->u.engine, XDMA_TL_ARRIVAL, length);
+    }
+}
+
+VOID EvtIoInCallerContext(IN WDFDEVICE device, IN WDFREQUEST request)
+// Handles requests which need the context of the calling process, all others are queued
+{
+    WDF_REQUEST_PARAMETERS params;
+    WDF_REQUEST_PARAMETERS_INIT(&params);
+    WdfRequestGetParameters(request, &params);
+
+    if ((params.Type == WdfRequestTypeRead) || (params.Type == WdfRequestTypeWrite)) {
+        PXDMA_DEVICE xdma = &(GetDeviceContext(device)->xdma);
+        if (xdma->ioTrace.enabled) {
+            StampArrival(request);
+        }
+        if (xdma->timeline.enabled) {
+            TimelineArrival(request, (params.Type == WdfRequestTypeRead) ?
+                            params.Parameters.Read.Length : params.Parameters.Write.Length);
+        }
+    }
+
+    ULONG ioControlCode = params.Parameters.DeviceIoControl.IoControlCode;
+    if ((params.Type != WdfRequestTypeDeviceControl) ||
+        ((ioControlCode != IOCTL_XDMA_MAP_BAR) && (ioControlCode != IOCTL_XDMA_MAP_EVENTS) &&
+         (ioControlCode != IOCTL_XDMA_QUEUE_SETUP))) {
+        NTSTATUS status = WdfDeviceEnqueueRequest(device, request);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_IO, "WdfDeviceEnqueueRequest failed: %!STATUS!", status);
+            WdfRequestComplete(request, status);
+        }
+        return;
+    }
+
+    // handles sharing the file object may call concurrently, each file takes one mapping
+    PFILE_CONTEXT file = GetFileContext(WdfRequestGetFileObject(request));
+    NTSTATUS status;
+    WdfWaitLockAcquire(file->mapLock, NULL);
+    if (ioControlCode == IOCTL_XDMA_MAP_BAR) {
+        status = IoctlMapBar(request, &(GetDeviceContext(device)->xdma), file);
+    } else if (ioControlCode == IOCTL_XDMA_QUEUE_SETUP) {
+        status = SharedQueueSetup(request, GetDeviceContext(device), file);
+    } else {
+        status = IoctlMapEvents(request, GetDeviceContext(device), file);
+    }
+    WdfWaitLockRelease(file->mapLock);
+    if (NT_SUCCESS(status)) {
+        WdfRequestCompleteWithInformation(request, status, sizeof(XDMA_BAR_MAPPING));
+    } else {
+        WdfRequestComplete(request, status);
+    }
+}
+
+static ULONG GetBarIndex(IN PXDMA_DEVICE xdma, IN PFILE_CONTEXT file) {
+    for (ULONG i = 0; i < xdma->numBars; ++i) {
+        if (xdma->bar[i] == file->u.bar) {
+            return i;
+        }
+    }
+    return xdma->numBars; // not found - return past-the-end index
+}
+
+NTSTATUS ExecuteRegOp(IN PXDMA_DEVICE xdma, IN ULONG fileBar, IN OUT XDMA_REG_OP* op,
+                      IN OUT ULONG* pollBudgetUs) {
+
+    ULONG nBar = (op->bar == XDMA_REG_BAR_SELF) ? fileBar : op->bar;
+    if (op->offset > MAXULONG) {
+        TraceError(DBG_IO, "Error: register offset 0x%llx out of range", op->offset);
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+    NTSTATUS status = ValidateBarParams(xdma, nBar, (size_t)op->offset, sizeof(UINT32));
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+    if (op->offset % sizeof(UINT32)) {
+        TraceError(DBG_IO, "Error: misaligned register offset 0x%llx", op->offset);
+        return STATUS_DATATYPE_MISALIGNMENT;
+    }
+
+    volatile ULONG* reg = (volatile ULONG*)((PUCHAR)xdma->bar[nBar] + op->offset);
+    switch (op->op) {
+    case XDMA_REG_OP_READ:
+        op->result = READ_REGISTER_ULONG(reg);
+        break;
+    case XDMA_REG_OP_WRITE:
+        WRITE_REGISTER_ULONG(reg, op->data);
+        op->result = op->data;
+        break;
+    case XDMA_REG_OP_RMW:
+        op->result = (READ_REGISTER_ULONG(reg) & ~op->mask) | (op->data & op->mask);
+        WRITE_REGISTER_ULONG(reg, op->result);
+        break;
+    case XDMA_REG_OP_POLL:
+    {
+        const ULONG timeoutUs = min(min(op->timeoutUs, XDMA_REG_POLL_MAX_TIMEOUT_US), *pollBudgetUs);
+        ULONG elapsedUs = 0;
+        for (;;) {
+            op->result = READ_REGISTER_ULONG(reg);
+            if ((op->result & op->mask) == (op->data & op->mask)) {
+                break;
+            }
+            if (elapsedUs >= timeoutUs) {
+                status = STATUS_IO_TIMEOUT;
+                break;
+            }
+            KeStallExecutionProcessor(1);
+            elapsedUs++;
+        }
+        *pollBudgetUs -= elapsedUs;
+        break;
+    }
+    default:
+        TraceError(DBG_IO, "Error: unknown register operation %u", op->op);
+        status = STATUS_INVALID_PARAMETER;
+        break;
+    }
+    return status;
+}
+
+static NTSTATUS IoctlRegBatch(IN WDFREQUEST request, IN PXDMA_DEVICE xdma, IN PFILE_CONTEXT file,
+                              OUT size_t* bytesReturned) {
+
+    XDMA_REG_OP* inOps = NULL;
+    size_t inLength = 0;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(request, sizeof(XDMA_REG_OP), (PVOID*)&inOps,
+                                                    &inLength);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+    if (inLength % sizeof(XDMA_REG_OP)) {
+        TraceError(DBG_IO, "Error: input length %llu is not a multiple of %llu",
+                   inLength, sizeof(XDMA_REG_OP));
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (inLength / sizeof(XDMA_REG_OP) > XDMA_REG_BATCH_MAX_OPS) {
+        TraceError(DBG_IO, "Error: %llu register operations, at most %u per batch",
+                   inLength / sizeof(XDMA_REG_OP), XDMA_REG_BATCH_MAX_OPS);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    // input and output share the same system buffer for METHOD_BUFFERED
+    XDMA_REG_OP* outOps = NULL;
+    status = WdfRequestRetrieveOutputBuffer(request, inLength, (PVOID*)&outOps, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+
+    const ULONG fileBar = GetBarIndex(xdma, file);
+    const size_t numOps = inLength / sizeof(XDMA_REG_OP);
+    NTSTATUS opStatus = STATUS_SUCCESS;
+    ULONG pollBudgetUs = XDMA_REG_BATCH_MAX_POLL_US;
+    for (size_t i = 0; i < numOps; ++i) {
+        XDMA_REG_OP op = inOps[i];
+        if (NT_SUCCESS(opStatus)) {
+            opStatus = ExecuteRegOp(xdma, fileBar, &op, &pollBudgetUs);
+            op.status = opStatus;
+        } else { // skip remaining operations after a failure
+            op.status = STATUS_CANCELLED;
+        }
+        outOps[i] = op;
+    }
+
+    TraceVerbose(DBG_IO, "executed %llu register operations, last status %!STATUS!", numOps, opStatus);
+    *bytesReturned = inLength;
+    return status;
+}
+
+static NTSTATUS IoctlTraceControl(IN WDFREQUEST request, IN PXDMA_DEVICE xdma) {
+    PVOID buffer;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(request, sizeof(UINT32), &buffer, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+
+    switch (*(UINT32*)buffer) {
+    case XDMA_TRACE_START:
+        status = TraceStart(xdma->wdfDevice, &xdma->ioTrace);
+        break;
+    case XDMA_TRACE_STOP:
+        TraceStop(&xdma->ioTrace);
+        break;
+    default:
+        TraceError(DBG_IO, "invalid trace control %u", *(UINT32*)buffer);
+        status = STATUS_INVALID_PARAMETER;
+        break;
+    }
+    return status;
+}
+
+static NTSTATUS IoctlTraceDump(IN WDFREQUEST request, IN PXDMA_DEVICE xdma,
+                               OUT size_t* bytesReturned) {
+    PVOID buffer;
+    size_t length;
+    NTSTATUS status = WdfRequestRetrieveOutputBuffer(request, sizeof(XDMA_TRACE_INFO), &buffer,
+                                                     &length);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+    *bytesReturned = TraceDump(&xdma->ioTrace, (XDMA_TRACE_INFO*)buffer, length);
+    TraceVerbose(DBG_IO, "dumped %llu bytes of i/o trace", *bytesReturned);
+    return status;
+}
+
+static NTSTATUS IoctlTimelineControl(IN WDFREQUEST request, IN PXDMA_DEVICE xdma) {
+    PVOID buffer;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(request, sizeof(UINT32), &buffer, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+
+    switch (*(UINT32*)buffer) {
+    case XDMA_TIMELINE_START:
+        if (xdma->timeline.rings == NULL) { // first start - allocate one ring per cpu
+            ULONG numCpus = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+            numCpus = min(numCpus, XDMA_TIMELINE_MAX_CPUS);
+            WDF_OBJECT_ATTRIBUTES attribs;
+            WDF_OBJECT_ATTRIBUTES_INIT(&attribs);
+            attribs.ParentObject = xdma->wdfDevice;
+            WDFMEMORY memory;
+            PVOID rings;
+            status = WdfMemoryCreate(&attribs, NonPagedPoolNx, 0, XdmaTimelineSize(numCpus),
+                                     &memory, &rings);
+            if (!NT_SUCCESS(status)) {
+                TraceError(DBG_IO, "WdfMemoryCreate failed: %!STATUS!", status);
+                return status;
+            }
+            if (!XdmaTimelineInit(&xdma->timeline, rings, numCpus)) {
+                WdfObjectDelete(memory); // concurrent start won
+            }
+        }
+        XdmaTimelineStart(&xdma->timeline);
+        TraceInfo(DBG_IO, "timeline started on %u cpus", xdma->timeline.numCpus);
+        break;
+    case XDMA_TIMELINE_STOP:
+        XdmaTimelineStop(&xdma->timeline);
+        TraceInfo(DBG_IO, "timeline stopped");
+        break;
+    default:
+        TraceError(DBG_IO, "invalid timeline control %u", *(UINT32*)buffer);
+        status = STATUS_INVALID_PARAMETER;
+        break;
+    }
+    return status;
+}
+
+static NTSTATUS IoctlTimelineDrain(IN WDFREQUEST request, IN PXDMA_DEVICE xdma,
+                                   OUT size_t* bytesReturned) {
+    PVOID buffer;
+    size_t length;
+    NTSTATUS status = WdfRequestRetrieveOutputBuffer(request, sizeof(XDMA_TIMELINE_INFO), &buffer,
+                                                     &length);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+    XDMA_TIMELINE_INFO* info = (XDMA_TIMELINE_INFO*)buffer;
+    const size_t maxEvents = (length - sizeof(XDMA_TIMELINE_INFO)) / sizeof(XDMA_TIMELINE_EVENT);
+    status = XdmaTimelineDrain(&xdma->timeline, info, (XDMA_TIMELINE_EVENT*)(info + 1),
+                               (ULONG)min(maxEvents, MAXULONG));
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "XdmaTimelineDrain failed: %!STATUS!", status);
+        return status;
+    }
+    *bytesReturned = sizeof(XDMA_TIMELINE_INFO) + info->numEvents * sizeof(XDMA_TIMELINE_EVENT);
+    TraceVerbose(DBG_IO, "drained %u timeline events", info->numEvents);
+    return status;
+}
+
 // todo separate ioctl functions for sgdma and other?
 VOID EvtIoDeviceControl(IN WDFQUEUE Queue, IN WDFREQUEST request, IN size_t OutputBufferLength,
                         IN size_t InputBufferLength, IN ULONG IoControlCode) {
 
-    UNREFERENCED_PARAMETER(Queue);
-    UNREFERENCED_PARAMETER(OutputBufferLength);
     UNREFERENCED_PARAMETER(InputBufferLength);
 
     PFILE_CONTEXT file = GetFileContext(WdfRequestGetFileObject(request));
-    PQUEUE_CONTEXT queue = GetQueueContext(file->queue);
     NTSTATUS status = STATUS_NOT_SUPPORTED;
 
+    // event device files have no engine queue either - waits complete from the DPC
+    if (file->devType == DEVNODE_TYPE_EVENTS) {
+        DeviceContext* ctx = GetDeviceContext(WdfIoQueueGetDevice(Queue));
+        switch (IoControlCode) {
+        case IOCTL_XDMA_EVENT_WAIT:
+            status = IoctlEventWait(ctx, request, file, OutputBufferLength);
+            break;
+        default:
+            TraceError(DBG_IO, "Unknown IOCTL code for event device!");
+            status = STATUS_NOT_SUPPORTED;
+            break;
+        }
+        goto exit;
+    }
+
+    // BAR device files have no engine queue - handle their IOCTLs here
+    if ((file->devType == DEVNODE_TYPE_USER) || (file->devType == DEVNODE_TYPE_CONTROL) ||
+        (file->devType == DEVNODE_TYPE_BYPASS)) {
+        PXDMA_DEVICE xdma = &(GetDeviceContext(WdfIoQueueGetDevice(Queue))->xdma);
+        size_t bytesReturned = 0;
+        switch (IoControlCode) {
+        case IOCTL_XDMA_REG_BATCH:
+            status = IoctlRegBatch(request, xdma, file, &bytesReturned);
+            if (NT_SUCCESS(status)) {
+                WdfRequestCompleteWithInformation(request, status, bytesReturned);
+            }
+            break;
+        case IOCTL_XDMA_TRACE_CONTROL:
+        case IOCTL_XDMA_TRACE_DUMP:
+            if (file->devType != DEVNODE_TYPE_CONTROL) { // device wide - only on the control file
+                TraceError(DBG_IO, "i/o trace IOCTLs are only supported on the control file");
+                status = STATUS_INVALID_DEVICE_REQUEST;
+                break;
+            }
+            if (IoControlCode == IOCTL_XDMA_TRACE_CONTROL) {
+                status = IoctlTraceControl(request, xdma);
+            } else {
+                status = IoctlTraceDump(request, xdma, &bytesReturned);
+            }
+            if (NT_SUCCESS(status)) {
+                WdfRequestCompleteWithInformation(request, status, bytesReturned);
+            }
+            break;
+        case IOCTL_XDMA_TIMELINE_CONTROL:
+        case IOCTL_XDMA_TIMELINE_DRAIN:
+            if (file->devType != DEVNODE_TYPE_CONTROL) { // device wide - only on the control file
+                TraceError(DBG_IO, "timeline IOCTLs are only supported on the control file");
+                status = STATUS_INVALID_DEVICE_REQUEST;
+                break;
+            }
+            if (IoControlCode == IOCTL_XDMA_TIMELINE_CONTROL) {
+                status = IoctlTimelineControl(request, xdma);
+            } else {
+                status = IoctlTimelineDrain(request, xdma, &bytesReturned);
+            }
+            if (NT_SUCCESS(status)) {
+                WdfRequestCompleteWithInformation(request, status, bytesReturned);
+            }
+            break;
+        default:
+            TraceError(DBG_IO, "Unknown IOCTL code for BAR device!");
+            status = STATUS_NOT_SUPPORTED;
+            break;
+        }
+        goto exit;
+    }
+
+    // shared queue device files - the doorbell is the only queued IOCTL
+    if (file->devType == DEVNODE_TYPE_QUEUE) {
+        DeviceContext* ctx = GetDeviceContext(WdfIoQueueGetDevice(Queue));
+        switch (IoControlCode) {
+        case IOCTL_XDMA_QUEUE_ENTER:
+            status = SharedQueueEnter(request, ctx, file);
+            break;
+        default:
+            TraceError(DBG_IO, "Unknown IOCTL code for queue device!");
+            status = STATUS_NOT_SUPPORTED;
+            break;
+        }
+        goto exit;
+    }
+
+    PQUEUE_CONTEXT queue = GetQueueContext(file->queue);
     ASSERT(queue != NULL);
     if (queue->engine == NULL) {
         TraceError(DBG_IO, "IOCTL only supported on DMA files (hc2_* or c2h_* devices)");
@@ -507,6 +1099,14 @@ VOID EvtIoDeviceControl(IN WDFQUEUE Queue, IN WDFREQUEST request, IN size_t Outp
             WdfRequestCompleteWithInformation(request, status, sizeof(XDMA_PERF_DATA));
         }
         break;
+    case IOCTL_XDMA_SPILL_GET:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_SPILL_GET",
+                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
+        status = IoctlGetSpill(request, queue->engine);
+        if (NT_SUCCESS(status)) {
+            WdfRequestCompleteWithInformation(request, status, sizeof(XDMA_SPILL_STATS));
+        }
+        break;
     case IOCTL_XDMA_ADDRMODE_GET:
         TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_ADDRMODE_GET",
                   queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
@@ -523,6 +1123,16 @@ VOID EvtIoDeviceControl(IN WDFQUEUE Queue, IN WDFREQUEST request, IN size_t Outp
             WdfRequestComplete(request, STATUS_SUCCESS);
         }
         break;
+    case IOCTL_XDMA_PROGRAM_REGISTER:
+        TraceInfo(DBG_IO, "%s_%u IOCTL_XDMA_PROGRAM_REGISTER",
+                  queue->engine->dir == H2C ? "H2C" : "C2H", queue->engine->channel);
+        // serialize with transfers - handled by EvtIoDeviceControlEngine once the engine is idle
+        status = WdfRequestForwardToIoQueue(request, file->queue);
+        break;
+    case IOCTL_XDMA_PROGRAM_WAIT:
+        status = IoctlProgramWait(GetDeviceContext(WdfIoQueueGetDevice(Queue)), request,
+                                  queue->engine, OutputBufferLength);
+        break;
     default:
         TraceError(DBG_IO, "Unknown IOCTL code!");
         status = STATUS_NOT_SUPPORTED;
@@ -536,6 +1146,52 @@ exit:
     TraceVerbose(DBG_IO, "exit with status: %!STATUS!", status);
 }
 
+static VOID TraceRequestBegin(IN XDMA_ENGINE* engine, IN WDFREQUEST request, IN size_t length)
+// hand a read/write request dispatched to the engine to the i/o trace capture
+{
+    LONGLONG arrival = 0;
+    LONGLONG offset = 0;
+    if (engine->parentDevice->ioTrace.enabled) {
+        WDF_REQUEST_PARAMETERS params;
+        WDF_REQUEST_PARAMETERS_INIT(&params);
+        WdfRequestGetParameters(request, &params);
+        offset = (engine->dir == H2C) ? params.Parameters.Write.DeviceOffset :
+            params.Parameters.Read.DeviceOffset;
+        PREQUEST_TRACE_CONTEXT context = GetRequestTraceContext(request);
+        arrival = (context != NULL) ? context->arrival : 0;
+    }
+    EngineTraceBegin(engine, arrival, offset, length);
+}
+
+static VOID EngineBounceRequest(IN XDMA_ENGINE* engine, IN WDFREQUEST request, IN size_t length)
+// start a small transfer via the engine's bounce buffer and poll for completion if required
+{
+    NTSTATUS status = WdfRequestMarkCancelableEx(request, EvtCancelBounce);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestMarkCancelableEx failed: %!STATUS!", status);
+        EngineTraceEnd(engine, status, 0);
+        WdfRequestComplete(request, status);
+        return;
+    }
+
+    status = EngineBounceTransfer(engine, request, length);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "EngineBounceTransfer failed: %!STATUS!", status);
+        // EvtCancelBounce() leaves a request that never reached the engine to us
+        (void)WdfRequestUnmarkCancelable(request);
+        EngineTraceEnd(engine, status, 0);
+        WdfRequestComplete(request, status);
+        return;
+    }
+
+    if (engine->poll) {
+        status = EnginePollTransfer(engine);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_IO, "EnginePollTransfer failed: %!STATUS!", status);
+        }
+    }
+}
+
 VOID EvtIoWriteDma(IN WDFQUEUE wdfQueue, IN WDFREQUEST Request, IN size_t length)
 // callback for when a write I/O request enters the SGDMA write queue
 {
@@ -550,6 +1206,19 @@ VOID EvtIoWriteDma(IN WDFQUEUE wdfQueue, IN WDFREQUEST Request, IN size_t length
     TraceInfo(DBG_IO, "%s_%u writing %llu bytes to device",
               DirectionToString(engine->dir), engine->channel, length);
 
+    if (engine->program.state != XDMA_PROGRAM_NONE) { // engine is reserved for a dma program
+        TraceError(DBG_IO, "engine busy with a user event dma program");
+        WdfRequestComplete(Request, STATUS_DEVICE_BUSY);
+        return;
+    }
+
+    TraceRequestBegin(engine, Request, length);
+
+    if (length <= engine->bounce.threshold) { // small transfer - bypass the dma transaction
+        EngineBounceRequest(engine, Request, length);
+        return;
+    }
+
     // initialize a DMA transaction from the request 
     status = WdfDmaTransactionInitializeUsingRequest(queue->engine->dmaTransaction, Request,
                                                      XDMA_EngineProgramDma,
@@ -582,6 +1251,7 @@ VOID EvtIoWriteDma(IN WDFQUEUE wdfQueue, IN WDFREQUEST Request, IN size_t length
     return; // success
 ErrExit:
     WdfDmaTransactionRelease(queue->engine->dmaTransaction);
+    EngineTraceEnd(queue->engine, status, 0);
     WdfRequestComplete(Request, status);
     TraceError(DBG_IO, "Error Request 0x%p: %!STATUS!", Request, status);
 }
@@ -599,6 +1269,19 @@ VOID EvtIoReadDma(IN WDFQUEUE wdfQueue, IN WDFREQUEST Request, IN size_t length)
     TraceInfo(DBG_IO, "%s_%u reading %llu bytes from device",
               DirectionToString(engine->dir), engine->channel, length);
 
+    if (engine->program.state != XDMA_PROGRAM_NONE) { // engine is reserved for a dma program
+        TraceError(DBG_IO, "engine busy with a user event dma program");
+        WdfRequestComplete(Request, STATUS_DEVICE_BUSY);
+        return;
+    }
+
+    TraceRequestBegin(engine, Request, length);
+
+    if (length <= engine->bounce.threshold) { // small transfer - bypass the dma transaction
+        EngineBounceRequest(engine, Request, length);
+        return;
+    }
+
     // initialize a DMA transaction from the request
     status = WdfDmaTransactionInitializeUsingRequest(queue->engine->dmaTransaction, Request,
                                                      XDMA_EngineProgramDma,
@@ -632,6 +1315,7 @@ VOID EvtIoReadDma(IN WDFQUEUE wdfQueue, IN WDFREQUEST Request, IN size_t length)
     return; // success
 ErrExit:
     WdfDmaTransactionRelease(queue->engine->dmaTransaction);
+    EngineTraceEnd(queue->engine, status, 0);
     WdfRequestComplete(Request, status);
     TraceError(DBG_IO, "Error Request 0x%p: %!STATUS!", Request, status);
 }
@@ -658,6 +1342,7 @@ VOID EvtIoReadEngineRing(IN WDFQUEUE wdfQueue, IN WDFREQUEST Request, IN size_t
     size_t numBytes = 0;
     status = EngineRingCopyBytesToMemory(engine, outputMem, length, timeout, &numBytes);
 
+    XDMA_TIMELINE_ENGINE_LOG(engine, XDMA_TL_COMPLETE, numBytes);
     WdfRequestCompleteWithInformation(Request, status, numBytes);
 }
 
@@ -673,86 +1358,409 @@ VOID EvtCancelDma(IN WDFREQUEST request) {
     if (!NT_SUCCESS(status)) {
         TraceError(DBG_IO, "WdfDmaTransactionRelease failed: %!STATUS!", status);
     }
+    EngineTraceEnd(queue->engine, STATUS_CANCELLED, 0);
     WdfRequestComplete(request, STATUS_CANCELLED);
 }
 
-VOID EvtCancelReadUserEvent(IN WDFREQUEST request) {
+VOID EvtCancelBounce(IN WDFREQUEST request)
+// bounce transfers own no dma transaction, the engine work function may be completing it already
+{
+    PQUEUE_CONTEXT queue = GetQueueContext(WdfRequestGetIoQueue(request));
+    TraceInfo(DBG_IO, "Request 0x%p from Queue 0x%p", request, queue);
+    if (!EngineBounceCancel(queue->engine, request)) {
+        return; // the engine work function completes the request
+    }
+    EngineTraceEnd(queue->engine, STATUS_CANCELLED, 0);
+    WdfRequestComplete(request, STATUS_CANCELLED);
+}
 
-    PFILE_CONTEXT file = GetFileContext(WdfRequestGetFileObject(request));
-    KEVENT* event = (KEVENT*)file->u.event->userData;
-    KePulseEvent(event, IO_NO_INCREMENT, FALSE);
+// Returns the subset of mask for which occurrences are waiting to be returned to user-space
+ULONG PendingUserEvents(IN DeviceContext* ctx, IN ULONG mask) {
+    ULONG pending = 0;
+    for (UINT i = 0; i < XDMA_MAX_USER_IRQ; ++i) {
+        if ((mask & BIT_N(i)) && (ctx->userEvents[i].count != 0)) {
+            pending |= BIT_N(i);
+        }
+    }
+    return pending;
+}
 
-    NTSTATUS status = WdfRequestUnmarkCancelable(request);
-    if (status != STATUS_CANCELLED) {
-        WdfRequestComplete(request, STATUS_CANCELLED);
+// Moves the occurrence counters selected by mask into info. Must hold ctx->eventLock.
+ULONG ConsumeUserEvents(IN DeviceContext* ctx, IN ULONG mask, OUT XDMA_EVENT_INFO* info) {
+    RtlZeroMemory(info, sizeof(XDMA_EVENT_INFO));
+    for (UINT i = 0; i < XDMA_MAX_USER_IRQ; ++i) {
+        if (mask & BIT_N(i)) {
+            LONG count = InterlockedExchange(&ctx->userEvents[i].count, 0);
+            if (count != 0) {
+                info->mask |= BIT_N(i);
+                info->count[i] = (UINT32)count;
+                info->timestamp[i] = (UINT64)ctx->userEvents[i].timestamp;
+            }
+        }
     }
+    return info->mask;
 }
 
-NTSTATUS EvtReadUserEvent(WDFREQUEST request, size_t length) {
+// Completes an event read with either the full XDMA_EVENT_INFO or the legacy single BOOLEAN
+static VOID CompleteUserEventRequest(IN WDFREQUEST request, IN XDMA_EVENT_INFO* info) {
+
+    WDFMEMORY outputMem;
+    NTSTATUS status = WdfRequestRetrieveOutputMemory(request, &outputMem);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputMemory failed: %!STATUS!", status);
+        WdfRequestComplete(request, status);
+        return;
+    }
 
-    NTSTATUS status = 0;
+    size_t bufSize = 0;
+    WdfMemoryGetBuffer(outputMem, &bufSize);
     BOOLEAN eventValue = TRUE;
+    if (bufSize >= sizeof(XDMA_EVENT_INFO)) {
+        bufSize = sizeof(XDMA_EVENT_INFO);
+        status = WdfMemoryCopyFromBuffer(outputMem, 0, info, bufSize);
+    } else {
+        bufSize = sizeof(BOOLEAN);
+        status = WdfMemoryCopyFromBuffer(outputMem, 0, &eventValue, bufSize);
+    }
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfMemoryCopyFromBuffer failed: %!STATUS!", status);
+        WdfRequestComplete(request, status);
+        return;
+    }
 
-    if (length != sizeof(BOOLEAN)) {
-        status = STATUS_INVALID_PARAMETER;
-        TraceError(DBG_IO, "Error: %!STATUS!", status);
-        goto Exit;
+    TraceInfo(DBG_IO, "user events returned is 0x%08X", info->mask);
+    WdfRequestCompleteWithInformation(request, STATUS_SUCCESS, bufSize);
+}
+
+// Completes the request immediately if any event in mask has fired since it was last returned,
+// otherwise parks it in the event queue until HandleUserEvent() finds a matching occurrence.
+static NTSTATUS WaitUserEvents(IN DeviceContext* ctx, IN WDFREQUEST request, IN ULONG mask,
+                               IN size_t length) {
+
+    if ((length != sizeof(BOOLEAN)) && (length < sizeof(XDMA_EVENT_INFO))) {
+        TraceError(DBG_IO, "Error: length is %llu but must be %llu or at least %llu",
+                   length, sizeof(BOOLEAN), sizeof(XDMA_EVENT_INFO));
+        return STATUS_INVALID_PARAMETER;
     }
+    mask &= BIT_N(XDMA_MAX_USER_IRQ) - 1;
+    if (mask == 0) {
+        TraceError(DBG_IO, "Error: empty user event mask");
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    // remember the mask for the DPC queue scan
+    WDF_OBJECT_ATTRIBUTES attribs;
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attribs, EVENT_WAIT_CONTEXT);
+    PEVENT_WAIT_CONTEXT wait;
+    NTSTATUS status = WdfObjectAllocateContext(request, &attribs, (PVOID*)&wait);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfObjectAllocateContext failed: %!STATUS!", status);
+        return status;
+    }
+    wait->mask = mask;
+
+    // the DPC increments counters before it takes the lock to scan the queue, so an occurrence
+    // is either consumed here or the request is already queued when the scan runs
+    XDMA_EVENT_INFO info;
+    WdfSpinLockAcquire(ctx->eventLock);
+    if (ConsumeUserEvents(ctx, mask, &info) == 0) {
+        status = WdfRequestForwardToIoQueue(request, ctx->eventQueue);
+        WdfSpinLockRelease(ctx->eventLock);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_IO, "WdfRequestForwardToIoQueue failed: %!STATUS!", status);
+        }
+        return status;
+    }
+    WdfSpinLockRelease(ctx->eventLock);
 
-    //status = WdfRequestMarkCancelableEx(request, EvtCancelReadUserEvent);
-    //if (!NT_SUCCESS(status)) {
-    //    TraceError(DBG_IO, "WdfRequestMarkCancelableEx failed: %!STATUS!", status);
-    //    goto Exit;
-    //}
+    CompleteUserEventRequest(request, &info);
+    return STATUS_SUCCESS;
+}
 
-    // wait for event to occur - return error on timeout
+NTSTATUS EvtReadUserEvent(IN DeviceContext* ctx, IN WDFREQUEST request, IN size_t length) {
     PFILE_CONTEXT file = GetFileContext(WdfRequestGetFileObject(request));
-    KEVENT* event = (KEVENT*)file->u.event->userData;
-    KeClearEvent(event);
-    LARGE_INTEGER timeout;
-    timeout.QuadPart = -3 * 10000000; // 3 second timeout
-    status = KeWaitForSingleObject(event, Executive, KernelMode, FALSE, &timeout);
-    if (status == STATUS_TIMEOUT) {
-        eventValue = FALSE;
+    ULONG eventId = (ULONG)(file->u.event - ctx->xdma.userEvents);
+    return WaitUserEvents(ctx, request, BIT_N(eventId), length);
+}
+
+static NTSTATUS IoctlEventWait(IN DeviceContext* ctx, IN WDFREQUEST request, IN PFILE_CONTEXT file,
+                               IN size_t outputLength) {
+    UINT32* mask = NULL;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(request, sizeof(UINT32), (PVOID*)&mask, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+    ULONG eventMask = *mask;
+    if (eventMask == 0) { // default to the event of this device file
+        eventMask = BIT_N((ULONG)(file->u.event - ctx->xdma.userEvents));
+    }
+    if (outputLength < sizeof(XDMA_EVENT_INFO)) {
+        TraceError(DBG_IO, "Error: output length is %llu but must be at least %llu",
+                   outputLength, sizeof(XDMA_EVENT_INFO));
+        return STATUS_BUFFER_TOO_SMALL;
     }
+    return WaitUserEvents(ctx, request, eventMask, outputLength);
+}
 
-    // get output buffer
+VOID HandleUserEvent(ULONG eventId, void* userData) {
+
+    ASSERTMSG("userData=NULL!", userData != NULL);
+    DeviceContext* ctx = (DeviceContext*)userData;
+
+    // start a registered dma program first - it is the latency critical part
+    XDMA_ENGINE* programEngine = ctx->programEngine[eventId];
+    if (programEngine != NULL) {
+        EngineProgramTrigger(programEngine);
+    }
+
+    // count the occurrence - never lost, even if no read is pending
+    LONGLONG timestamp = KeQueryPerformanceCounter(NULL).QuadPart;
+    ctx->userEvents[eventId].timestamp = timestamp;
+    InterlockedIncrement(&ctx->userEvents[eventId].count);
+
+    // publish to the mapped notification page - timestamp first, the sequence increment releases it
+    xdma_event_page_publish(ctx->eventPage, eventId, (UINT64)timestamp);
+    TraceInfo(DBG_IO, "event_%u signaling completion", eventId);
+
+    // complete every pending read that waits on an event with outstanding occurrences
+    for (;;) {
+        WDFREQUEST request = NULL;
+        WDFREQUEST tag = NULL;
+        WDFREQUEST found = NULL;
+        XDMA_EVENT_INFO info;
+
+        WdfSpinLockAcquire(ctx->eventLock);
+        while (NT_SUCCESS(WdfIoQueueFindRequest(ctx->eventQueue, tag, NULL, NULL, &found))) {
+            if (tag != NULL) {
+                WdfObjectDereference(tag);
+            }
+            tag = found;
+            if (PendingUserEvents(ctx, GetEventWaitContext(found)->mask) == 0) {
+                continue;
+            }
+            NTSTATUS status = WdfIoQueueRetrieveFoundRequest(ctx->eventQueue, found, &request);
+            if (NT_SUCCESS(status)) {
+                ConsumeUserEvents(ctx, GetEventWaitContext(request)->mask, &info);
+                break;
+            }
+            // request was cancelled in the meantime - restart the scan
+            WdfObjectDereference(tag);
+            tag = NULL;
+            request = NULL;
+        }
+        if (tag != NULL) {
+            WdfObjectDereference(tag);
+        }
+        WdfSpinLockRelease(ctx->eventLock);
+
+        if (request == NULL) {
+            break;
+        }
+        CompleteUserEventRequest(request, &info);
+    }
+
+    // parked event waits of shared queues
+    SharedQueueServiceEvents(ctx);
+}
+
+// ====================== user event triggered dma programs =======================================
+
+// Completes a program wait with the result of the last transfer and re-arms the program.
+// The caller must have moved the program state from DONE to COLLECT.
+static VOID CompleteProgramRequest(IN WDFREQUEST request, IN XDMA_ENGINE* engine) {
+
+    XDMA_PROGRAM_RESULT result;
+    result.status = engine->program.status;
+    result.length = (UINT32)engine->program.length;
+    result.triggerTime = (UINT64)engine->program.triggerTime;
+    result.completeTime = (UINT64)engine->program.completeTime;
+
+    size_t bytesReturned = sizeof(XDMA_PROGRAM_RESULT);
     WDFMEMORY outputMem;
-    status = WdfRequestRetrieveOutputMemory(request, &outputMem);
+    NTSTATUS status = WdfRequestRetrieveOutputMemory(request, &outputMem);
     if (!NT_SUCCESS(status)) {
         TraceError(DBG_IO, "WdfRequestRetrieveOutputMemory failed: %!STATUS!", status);
-        goto Exit;
+        goto ErrExit;
+    }
+    status = WdfMemoryCopyFromBuffer(outputMem, 0, &result, sizeof(XDMA_PROGRAM_RESULT));
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfMemoryCopyFromBuffer failed: %!STATUS!", status);
+        goto ErrExit;
+    }
+    if ((engine->dir == C2H) && NT_SUCCESS(result.status)) { // received data follows the result
+        status = WdfMemoryCopyFromBuffer(outputMem, sizeof(XDMA_PROGRAM_RESULT),
+                                         engine->bounce.data, engine->program.length);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_IO, "WdfMemoryCopyFromBuffer failed: %!STATUS!", status);
+            goto ErrExit;
+        }
+        bytesReturned += engine->program.length;
     }
 
-    // get buffer size
-    size_t bufSize = 0;
-    WdfMemoryGetBuffer(outputMem, &bufSize);
-    if (bufSize != sizeof(BOOLEAN)) {
-        TraceError(DBG_IO, "Error: length is %llu but must be %llu", bufSize, sizeof(UINT32));
-        status = STATUS_INVALID_PARAMETER;
-        goto Exit;
+    InterlockedExchange(&engine->program.state, XDMA_PROGRAM_ARMED);
+    WdfRequestCompleteWithInformation(request, STATUS_SUCCESS, bytesReturned);
+    return;
+ErrExit:
+    InterlockedExchange(&engine->program.state, XDMA_PROGRAM_ARMED);
+    WdfRequestComplete(request, status);
+}
+
+// Engine DPC callback - hands the result to a pending wait of the owning file, if any
+static VOID HandleProgramDone(IN XDMA_ENGINE* engine, IN void* userData) {
+
+    WDFFILEOBJECT fileObject = (WDFFILEOBJECT)userData;
+    DeviceContext* ctx = GetDeviceContext(engine->parentDevice->wdfDevice);
+    WDFREQUEST request = NULL;
+    WDFREQUEST found = NULL;
+
+    WdfSpinLockAcquire(ctx->eventLock);
+    if (NT_SUCCESS(WdfIoQueueFindRequest(ctx->programQueue, NULL, fileObject, NULL, &found))) {
+        if (InterlockedCompareExchange(&engine->program.state, XDMA_PROGRAM_COLLECT,
+                                       XDMA_PROGRAM_DONE) == XDMA_PROGRAM_DONE) {
+            NTSTATUS status = WdfIoQueueRetrieveFoundRequest(ctx->programQueue, found, &request);
+            if (!NT_SUCCESS(status)) { // cancelled in the meantime - keep the result
+                request = NULL;
+                InterlockedExchange(&engine->program.state, XDMA_PROGRAM_DONE);
+            }
+        }
+        WdfObjectDereference(found);
+    }
+    WdfSpinLockRelease(ctx->eventLock);
+
+    if (request != NULL) {
+        CompleteProgramRequest(request, engine);
+    }
+}
+
+static NTSTATUS IoctlProgramWait(IN DeviceContext* ctx, IN WDFREQUEST request, IN XDMA_ENGINE* engine,
+                                 IN size_t outputLength) {
+
+    if ((engine->program.state == XDMA_PROGRAM_NONE) ||
+        (engine->program.userData != WdfRequestGetFileObject(request))) {
+        TraceError(DBG_IO, "no dma program registered on this file");
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+    size_t required = sizeof(XDMA_PROGRAM_RESULT);
+    if (engine->dir == C2H) {
+        required += engine->program.length;
+    }
+    if (outputLength < required) {
+        TraceError(DBG_IO, "Error: output length is %llu but must be at least %llu",
+                   outputLength, required);
+        return STATUS_BUFFER_TOO_SMALL;
     }
 
-    // copy the user irq events from our internal buffer to the WdfMemory
-    status = WdfMemoryCopyFromBuffer(outputMem, 0, &eventValue, bufSize);
+    // collect a finished transfer right away, otherwise wait for HandleProgramDone()
+    NTSTATUS status = STATUS_SUCCESS;
+    BOOLEAN collect = FALSE;
+    WdfSpinLockAcquire(ctx->eventLock);
+    if (InterlockedCompareExchange(&engine->program.state, XDMA_PROGRAM_COLLECT,
+                                   XDMA_PROGRAM_DONE) == XDMA_PROGRAM_DONE) {
+        collect = TRUE;
+    } else {
+        status = WdfRequestForwardToIoQueue(request, ctx->programQueue);
+    }
+    WdfSpinLockRelease(ctx->eventLock);
+
     if (!NT_SUCCESS(status)) {
-        TraceError(DBG_IO, "WdfMemoryCopyFromBuffer failed: %!STATUS!", status);
-        goto Exit;
+        TraceError(DBG_IO, "WdfRequestForwardToIoQueue failed: %!STATUS!", status);
+        return status;
+    }
+    if (collect) {
+        CompleteProgramRequest(request, engine);
+    }
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS IoctlRegisterProgram(IN DeviceContext* ctx, IN WDFREQUEST request,
+                                     IN XDMA_ENGINE* engine, IN size_t inputLength) {
+
+    XDMA_EVENT_PROGRAM* program = NULL;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(request, sizeof(XDMA_EVENT_PROGRAM),
+                                                    (PVOID*)&program, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+    if ((program->eventId >= XDMA_MAX_USER_IRQ) || (program->length == 0) ||
+        (program->length > XDMA_PROGRAM_MAX_LENGTH)) {
+        TraceError(DBG_IO, "invalid dma program: event=%u, length=%llu",
+                   program->eventId, program->length);
+        return STATUS_INVALID_PARAMETER;
+    }
+    if ((engine->dir == H2C) && (inputLength < sizeof(XDMA_EVENT_PROGRAM) + program->length)) {
+        TraceError(DBG_IO, "Error: input length is %llu but payload needs %llu bytes",
+                   inputLength, sizeof(XDMA_EVENT_PROGRAM) + program->length);
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+    if ((engine->type != EngineType_MM) || engine->poll) {
+        TraceError(DBG_IO, "dma programs need a memory mapped engine in interrupt mode");
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    // reserve the user event - the DPC ignores the engine until the program is armed below
+    WdfSpinLockAcquire(ctx->eventLock);
+    if (ctx->programEngine[program->eventId] == NULL) {
+        ctx->programEngine[program->eventId] = engine;
+    } else {
+        status = STATUS_DEVICE_BUSY;
+    }
+    WdfSpinLockRelease(ctx->eventLock);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "event_%u already triggers a dma program", program->eventId);
+        return status;
     }
 
-    WdfRequestCompleteWithInformation(request, status, bufSize);
-    TraceInfo(DBG_IO, "user events returned is 0x%08X", eventValue);
+    status = EngineProgramSetup(engine, (LONGLONG)program->deviceAddress, (size_t)program->length,
+                                program + 1, HandleProgramDone, WdfRequestGetFileObject(request));
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "EngineProgramSetup failed: %!STATUS!", status);
+        WdfSpinLockAcquire(ctx->eventLock);
+        ctx->programEngine[program->eventId] = NULL;
+        WdfSpinLockRelease(ctx->eventLock);
+        return status;
+    }
 
-Exit:
-    TraceVerbose(DBG_IO, "user EP=0x%08X", eventValue);
+    TraceInfo(DBG_IO, "%s_%u program armed on event_%u, address=0x%llx, length=%llu",
+              DirectionToString(engine->dir), engine->channel, program->eventId,
+              program->deviceAddress, program->length);
     return status;
 }
 
-VOID HandleUserEvent(ULONG eventId, void* userData) {
+static VOID UnregisterProgram(IN DeviceContext* ctx, IN XDMA_ENGINE* engine) {
 
-    ASSERTMSG("userData=NULL!", userData != NULL);
-    KEVENT* event = (KEVENT*)userData;
+    // stop further triggers, then let an in-flight transfer drain
+    WdfSpinLockAcquire(ctx->eventLock);
+    for (UINT i = 0; i < XDMA_MAX_USER_IRQ; ++i) {
+        if (ctx->programEngine[i] == engine) {
+            ctx->programEngine[i] = NULL;
+        }
+    }
+    WdfSpinLockRelease(ctx->eventLock);
 
-    TraceInfo(DBG_IO, "event_%u signaling completion", eventId);
-    KePulseEvent(event, IO_NO_INCREMENT, FALSE);
+    EngineProgramTeardown(engine);
+    TraceInfo(DBG_IO, "%s_%u program removed", DirectionToString(engine->dir), engine->channel);
+}
+
+VOID EvtIoDeviceControlEngine(IN WDFQUEUE wdfQueue, IN WDFREQUEST request, IN size_t OutputBufferLength,
+                              IN size_t InputBufferLength, IN ULONG IoControlCode)
+// control requests forwarded to the sequential engine queue - no transfer is in flight here
+{
+    UNREFERENCED_PARAMETER(OutputBufferLength);
+
+    PQUEUE_CONTEXT queue = GetQueueContext(wdfQueue);
+    NTSTATUS status = STATUS_NOT_SUPPORTED;
+
+    switch (IoControlCode) {
+    case IOCTL_XDMA_PROGRAM_REGISTER:
+        status = IoctlRegisterProgram(GetDeviceContext(WdfIoQueueGetDevice(wdfQueue)), request,
+                                      queue->engine, InputBufferLength);
+        break;
+    default:
+        TraceError(DBG_IO, "Unknown IOCTL code!");
+        break;
+    }
+
+    WdfRequestComplete(request, status);
 }
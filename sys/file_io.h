@@ -29,6 +29,7 @@ typedef enum {
     DEVNODE_TYPE_BYPASS,
     DEVNODE_TYPE_H2C,
     DEVNODE_TYPE_C2H,
+    DEVNODE_TYPE_QUEUE,
     ID_DEVNODE_UNKNOWN = 255,
 } DEVNODE_TYPE;
 
@@ -39,8 +40,14 @@ typedef struct _FILE_CONTEXT {
         void* bar;              // USER / CONTROL / BYPASS
         XDMA_EVENT* event;      // EVENTS
         XDMA_ENGINE* engine;    // H2C / C2H
+        struct SHARED_QUEUE_T* sharedQueue; // QUEUE
     } u;
     WDFQUEUE queue;
+    PMDL userMdl;               // mapping into the calling process (USER / BYPASS / EVENTS / QUEUE)
+    PVOID userAddr;
+    PEPROCESS userProcess;      // process owning the mapping, referenced
+    ULONG mapFlags;             // XDMA_MAP_* of the BAR mapping
+    WDFWAITLOCK mapLock;        // serializes the mapping ioctls of handles sharing the file
 
 } FILE_CONTEXT, *PFILE_CONTEXT;
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(FILE_CONTEXT, GetFileContext)
@@ -51,9 +58,22 @@ typedef struct _QUEUE_CONTEXT {
 } QUEUE_CONTEXT, *PQUEUE_CONTEXT;
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(QUEUE_CONTEXT, GetQueueContext)
 
+// Context of a pending user event read
+typedef struct _EVENT_WAIT_CONTEXT {
+    ULONG mask; // bit mask of user events the request waits on
+} EVENT_WAIT_CONTEXT, *PEVENT_WAIT_CONTEXT;
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(EVENT_WAIT_CONTEXT, GetEventWaitContext)
+
+// Context of a read/write request while the i/o trace capture is running
+typedef struct _REQUEST_TRACE_CONTEXT {
+    LONGLONG arrival; // performance counter value when the request entered the driver
+} REQUEST_TRACE_CONTEXT, *PREQUEST_TRACE_CONTEXT;
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(REQUEST_TRACE_CONTEXT, GetRequestTraceContext)
+
 EVT_WDF_DEVICE_FILE_CREATE          EvtDeviceFileCreate;
 EVT_WDF_FILE_CLOSE                  EvtFileClose;
 EVT_WDF_FILE_CLEANUP                EvtFileCleanup;
+EVT_WDF_IO_IN_CALLER_CONTEXT        EvtIoInCallerContext;
 EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL  EvtIoDeviceControl;
 EVT_WDF_IO_QUEUE_IO_READ			EvtIoRead;
 EVT_WDF_IO_QUEUE_IO_WRITE			EvtIoWrite;
@@ -61,6 +81,19 @@ EVT_WDF_IO_QUEUE_IO_WRITE			EvtIoWrite;
 EVT_WDF_IO_QUEUE_IO_READ    EvtIoReadDma;
 EVT_WDF_IO_QUEUE_IO_WRITE   EvtIoWriteDma;
 EVT_WDF_IO_QUEUE_IO_READ    EvtIoReadEngineRing;
+EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL EvtIoDeviceControlEngine;
+
+// Takes over a mapping made into the calling process, undone by EvtFileCleanup()
+VOID FileSetUserMapping(IN PFILE_CONTEXT file, IN PMDL mdl, IN PVOID userAddr);
+
+NTSTATUS EvtReadUserEvent(IN DeviceContext* ctx, IN WDFREQUEST request, IN size_t length);
+VOID HandleUserEvent(ULONG eventId, void* userData);
 
-NTSTATUS EvtReadUserEvent(WDFREQUEST request, size_t length);
-VOID HandleUserEvent(ULONG eventId, void* userData);
\ No newline at end of file
+// Executes one register operation. XDMA_REG_BAR_SELF selects fileBar. A POLL waits at most
+// pollBudgetUs, which is reduced by the time waited.
+NTSTATUS ExecuteRegOp(IN PXDMA_DEVICE xdma, IN ULONG fileBar, IN OUT XDMA_REG_OP* op,
+                      IN OUT ULONG* pollBudgetUs);
+// Returns the subset of mask for which occurrences are waiting to be returned to user-space
+ULONG PendingUserEvents(IN DeviceContext* ctx, IN ULONG mask);
+// Moves the occurrence counters selected by mask into info. Must hold ctx->eventLock.
+ULONG ConsumeUserEvents(IN DeviceContext* ctx, IN ULONG mask, OUT XDMA_EVENT_INFO* info);
\ No newline at end of file
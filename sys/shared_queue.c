@@ -0,0 +1,601 @@
+/*
+* XDMA Shared Submission/Completion Queues
+* ===============================
+*
+* Copyright 2017 Xilinx Inc.
+* Copyright 2010-2012 Sidebranch
+* Copyright 2010-2012 Leon Woestenberg <leon@sidebranch.com>
+*
+* Maintainer:
+* -----------
+* Alexander Hornburg <alexander.hornburg@xilinx.com>
+*
+* Submission flow:
+* ----------------
+* IOCTL_XDMA_QUEUE_ENTER -> SharedQueueEnter() --> SubmitEntry()
+*                                                |--> NOP / REG            // completed inline, no POLL
+*                                                |--> H2C / C2H            // engine fifo -> StartEngine()
+*                                                |--> EVENT_WAIT           // parked until ServiceQueueEvents()
+* engine DPC -> SharedQueueDmaDone()             // completion posted, next fifo entry started
+* user DPC   -> SharedQueueServiceEvents()       // completion posted for fired events
+*/
+
+// ========================= include dependencies =================================================
+
+#include "shared_queue.h"
+
+#include "trace.h"
+#ifdef DBG
+// The trace message header (.tmh) file must be included in a source file before any WPP macro
+// calls and after defining a WPP_CONTROL_GUIDS macro (defined in trace.h). see trace.h
+#include "shared_queue.tmh"
+#endif
+
+// ========================= declarations =========================================================
+
+#define SHARED_QUEUE_RING_MASK  (XDMA_QUEUE_DEPTH - 1)
+
+static VOID SharedQueueDmaDone(IN XDMA_ENGINE* engine, IN void* userData);
+
+// ========================= slot and ring helpers - q->lock held =================================
+
+static LONG SlotAlloc(IN PSHARED_QUEUE q) {
+    LONG i = q->freeSlots;
+    if (i != SHARED_QUEUE_NO_SLOT) {
+        q->freeSlots = q->slots[i].next;
+        q->slots[i].next = SHARED_QUEUE_NO_SLOT;
+    }
+    return i;
+}
+
+static VOID SlotFree(IN PSHARED_QUEUE q, IN LONG i) {
+    q->slots[i].next = q->freeSlots;
+    q->freeSlots = i;
+}
+
+static VOID PostCompletion(IN PSHARED_QUEUE q, IN UINT64 userData, IN NTSTATUS status,
+                           IN UINT32 result) {
+    // admission control in SharedQueueEnter() guarantees a free completion slot
+    XDMA_QUEUE_CQE* cqe = &q->cq[q->cqTail & SHARED_QUEUE_RING_MASK];
+    cqe->userData = userData;
+    cqe->status = status;
+    cqe->result = result;
+    MemoryBarrier(); // entry must be visible before the index
+    q->cqTail++;
+    q->header->cqTail = q->cqTail;
+}
+
+static LONG EnginePop(IN PSHARED_QUEUE q, IN DirToDev dir, IN ULONG ch) {
+    LONG i = q->engineHead[dir][ch];
+    if (i != SHARED_QUEUE_NO_SLOT) {
+        q->engineHead[dir][ch] = q->slots[i].next;
+        if (q->engineHead[dir][ch] == SHARED_QUEUE_NO_SLOT) {
+            q->engineTail[dir][ch] = SHARED_QUEUE_NO_SLOT;
+        }
+    }
+    return i;
+}
+
+static BOOLEAN EnginePush(IN PSHARED_QUEUE q, IN DirToDev dir, IN ULONG ch, IN LONG i) {
+    BOOLEAN wasEmpty = (q->engineHead[dir][ch] == SHARED_QUEUE_NO_SLOT);
+    q->slots[i].next = SHARED_QUEUE_NO_SLOT;
+    if (wasEmpty) {
+        q->engineHead[dir][ch] = i;
+    } else {
+        q->slots[q->engineTail[dir][ch]].next = i;
+    }
+    q->engineTail[dir][ch] = i;
+    return wasEmpty;
+}
+
+static ULONG EngineBit(IN DirToDev dir, IN ULONG ch) {
+    return (dir == H2C) ? XDMA_QUEUE_ENGINE_H2C(ch) : XDMA_QUEUE_ENGINE_C2H(ch);
+}
+
+// ========================= engine handling ======================================================
+
+static VOID StartEngine(IN PSHARED_QUEUE q, IN DirToDev dir, IN ULONG ch)
+// start the head of the engine fifo, submissions which fail to start are completed right away
+{
+    XDMA_ENGINE* engine = &(q->ctx->xdma.engines[ch][dir]);
+    ULONG descIndex = dir * XDMA_MAX_NUM_CHANNELS + ch;
+    DMA_DESCRIPTOR* desc = (DMA_DESCRIPTOR*)WdfCommonBufferGetAlignedVirtualAddress(q->descBuffer) +
+        descIndex;
+    PHYSICAL_ADDRESS descLA = WdfCommonBufferGetAlignedLogicalAddress(q->descBuffer);
+    descLA.QuadPart += descIndex * sizeof(DMA_DESCRIPTOR);
+
+    while (q->engineHead[dir][ch] != SHARED_QUEUE_NO_SLOT) {
+        LONG i = q->engineHead[dir][ch];
+        XDMA_QUEUE_SQE* sqe = &(q->slots[i].sqe);
+        NTSTATUS status = STATUS_CANCELLED;
+        if (!q->closing) {
+            PHYSICAL_ADDRESS hostLA;
+            hostLA.QuadPart = q->dataLA.QuadPart + sqe->dataOffset;
+            status = EngineDirectTransfer(engine, desc, descLA, hostLA, (LONGLONG)sqe->address,
+                                          sqe->length, SharedQueueDmaDone, q);
+            if (NT_SUCCESS(status)) {
+                return; // completed by SharedQueueDmaDone()
+            }
+            TraceError(DBG_IO, "EngineDirectTransfer failed: %!STATUS!", status);
+            PostCompletion(q, sqe->userData, status, 0);
+        }
+        EnginePop(q, dir, ch);
+        SlotFree(q, i);
+        q->inflight--;
+    }
+}
+
+static BOOLEAN CompleteWaiter(IN PSHARED_QUEUE q, IN NTSTATUS status)
+// complete one IOCTL_XDMA_QUEUE_ENTER of this queue which waits for completions
+{
+    WDFREQUEST found = NULL;
+    WDFREQUEST request = NULL;
+    if (!NT_SUCCESS(WdfIoQueueFindRequest(q->ctx->queueWaitQueue, NULL, q->fileObject, NULL,
+                                          &found))) {
+        return FALSE;
+    }
+    NTSTATUS retrieveStatus = WdfIoQueueRetrieveFoundRequest(q->ctx->queueWaitQueue, found, &request);
+    WdfObjectDereference(found);
+    if (NT_SUCCESS(retrieveStatus)) {
+        WdfRequestCompleteWithInformation(request, status, NT_SUCCESS(status) ? sizeof(UINT32) : 0);
+    }
+    return TRUE;
+}
+
+static VOID WakeWaiter(IN PSHARED_QUEUE q) {
+    CompleteWaiter(q, STATUS_SUCCESS);
+}
+
+static VOID SharedQueueDmaDone(IN XDMA_ENGINE* engine, IN void* userData) {
+
+    PSHARED_QUEUE q = (PSHARED_QUEUE)userData;
+    DirToDev dir = engine->dir;
+    ULONG ch = engine->channel;
+
+    InterlockedIncrement(&q->callbacks);
+    WdfSpinLockAcquire(q->lock);
+    LONG i = EnginePop(q, dir, ch);
+    if (i != SHARED_QUEUE_NO_SLOT) {
+        XDMA_QUEUE_SQE* sqe = &(q->slots[i].sqe);
+        NTSTATUS status = engine->direct.status;
+        PostCompletion(q, sqe->userData, status, NT_SUCCESS(status) ? sqe->length : 0);
+        SlotFree(q, i);
+        q->inflight--;
+    }
+    StartEngine(q, dir, ch);
+    WdfSpinLockRelease(q->lock);
+
+    WakeWaiter(q);
+    InterlockedDecrement(&q->callbacks);
+}
+
+static NTSTATUS ClaimEngine(IN DeviceContext* ctx, IN PSHARED_QUEUE q, IN DirToDev dir, IN ULONG ch)
+// take the engine away from the regular request flow
+{
+    XDMA_ENGINE* engine = &(ctx->xdma.engines[ch][dir]);
+    if ((engine->enabled == FALSE) || engine->poll ||
+        ((engine->type == EngineType_ST) && (dir == C2H))) {
+        TraceError(DBG_IO, "%s_%u cannot be used by a shared queue", DirectionToString(dir), ch);
+        return STATUS_NOT_SUPPORTED;
+    }
+    if (InterlockedCompareExchangePointer((PVOID*)&ctx->queueOwner[dir][ch], q, NULL) != NULL) {
+        TraceError(DBG_IO, "%s_%u already claimed by a shared queue", DirectionToString(dir), ch);
+        return STATUS_DEVICE_BUSY;
+    }
+
+    // waits for the request in flight, new requests stay queued until the engine is released
+    WdfIoQueueStopSynchronously(ctx->engineQueue[dir][ch]);
+    q->engineMask |= EngineBit(dir, ch);
+
+    if (engine->program.state != XDMA_PROGRAM_NONE) {
+        TraceError(DBG_IO, "%s_%u has a user event dma program", DirectionToString(dir), ch);
+        return STATUS_DEVICE_BUSY;
+    }
+    EngineEnableInterrupt(engine);
+    return STATUS_SUCCESS;
+}
+
+static VOID ReleaseEngines(IN DeviceContext* ctx, IN PSHARED_QUEUE q) {
+    for (UINT dir = H2C; dir < 2; dir++) { // 0=H2C, 1=C2H
+        for (ULONG ch = 0; ch < XDMA_MAX_NUM_CHANNELS; ch++) {
+            if (q->engineMask & EngineBit((DirToDev)dir, ch)) {
+                ctx->queueOwner[dir][ch] = NULL;
+                WdfIoQueueStart(ctx->engineQueue[dir][ch]);
+            }
+        }
+    }
+    q->engineMask = 0;
+}
+
+// ========================= event waits ==========================================================
+
+static BOOLEAN ServiceQueueEvents(IN DeviceContext* ctx, IN PSHARED_QUEUE q)
+// post completions for parked event waits with outstanding occurrences. ctx->eventLock held.
+{
+    BOOLEAN posted = FALSE;
+    WdfSpinLockAcquire(q->lock);
+    LONG* link = &(q->waitSlots);
+    while (*link != SHARED_QUEUE_NO_SLOT) {
+        LONG i = *link;
+        XDMA_QUEUE_SQE* sqe = &(q->slots[i].sqe);
+        if (PendingUserEvents(ctx, sqe->index) == 0) {
+            link = &(q->slots[i].next);
+            continue;
+        }
+        XDMA_EVENT_INFO info;
+        ConsumeUserEvents(ctx, sqe->index, &info);
+        PostCompletion(q, sqe->userData, STATUS_SUCCESS, info.mask);
+        *link = q->slots[i].next;
+        SlotFree(q, i);
+        q->inflight--;
+        posted = TRUE;
+    }
+    WdfSpinLockRelease(q->lock);
+    return posted;
+}
+
+VOID SharedQueueServiceEvents(IN DeviceContext* ctx) {
+    if (IsListEmpty(&ctx->sharedQueues)) {
+        return;
+    }
+    WdfSpinLockAcquire(ctx->eventLock);
+    for (PLIST_ENTRY entry = ctx->sharedQueues.Flink; entry != &ctx->sharedQueues;
+         entry = entry->Flink) {
+        PSHARED_QUEUE q = CONTAINING_RECORD(entry, SHARED_QUEUE, link);
+        if (ServiceQueueEvents(ctx, q)) {
+            WakeWaiter(q);
+        }
+    }
+    WdfSpinLockRelease(ctx->eventLock);
+}
+
+// ========================= submission processing ================================================
+
+static BOOLEAN SubmitEntry(IN PSHARED_QUEUE q, IN XDMA_QUEUE_SQE* sqe)
+// process one submission, returns TRUE if it was parked as event wait. q->lock held.
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    LONG i;
+
+    switch (sqe->opcode) {
+    case XDMA_QUEUE_OP_NOP:
+        PostCompletion(q, sqe->userData, STATUS_SUCCESS, 0);
+        break;
+    case XDMA_QUEUE_OP_REG:
+    {
+        if (sqe->regOp == XDMA_REG_OP_POLL) {
+            // submissions are processed under q->lock at DISPATCH_LEVEL, use IOCTL_XDMA_REG_BATCH
+            TraceError(DBG_IO, "register poll not supported on the shared queue");
+            PostCompletion(q, sqe->userData, STATUS_NOT_SUPPORTED, 0);
+            break;
+        }
+        XDMA_REG_OP op = { 0 };
+        op.op = sqe->regOp;
+        op.bar = sqe->index;
+        op.offset = sqe->address;
+        op.data = sqe->data;
+        op.mask = sqe->mask;
+        // no device file BAR - XDMA_REG_BAR_SELF fails validation
+        ULONG pollBudgetUs = 0;
+        status = ExecuteRegOp(&(q->ctx->xdma), q->ctx->xdma.numBars, &op, &pollBudgetUs);
+        PostCompletion(q, sqe->userData, status, op.result);
+        break;
+    }
+    case XDMA_QUEUE_OP_H2C:
+    case XDMA_QUEUE_OP_C2H:
+    {
+        DirToDev dir = (sqe->opcode == XDMA_QUEUE_OP_H2C) ? H2C : C2H;
+        if ((sqe->index >= XDMA_MAX_NUM_CHANNELS) ||
+            !(q->engineMask & EngineBit(dir, sqe->index)) || (sqe->length == 0) ||
+            (sqe->length > XDMA_QUEUE_DATA_SIZE) ||
+            (sqe->dataOffset > XDMA_QUEUE_DATA_SIZE - sqe->length)) {
+            TraceError(DBG_IO, "invalid dma submission: op=%u, channel=%u, offset=%u, length=%u",
+                       sqe->opcode, sqe->index, sqe->dataOffset, sqe->length);
+            PostCompletion(q, sqe->userData, STATUS_INVALID_PARAMETER, 0);
+            break;
+        }
+        i = SlotAlloc(q);
+        q->slots[i].sqe = *sqe;
+        q->inflight++;
+        if (EnginePush(q, dir, sqe->index, i)) { // engine idle - start right away
+            StartEngine(q, dir, sqe->index);
+        }
+        break;
+    }
+    case XDMA_QUEUE_OP_EVENT_WAIT:
+        if ((sqe->index & (BIT_N(XDMA_MAX_USER_IRQ) - 1)) == 0) {
+            PostCompletion(q, sqe->userData, STATUS_INVALID_PARAMETER, 0);
+            break;
+        }
+        i = SlotAlloc(q);
+        q->slots[i].sqe = *sqe;
+        q->slots[i].sqe.index &= BIT_N(XDMA_MAX_USER_IRQ) - 1;
+        q->slots[i].next = q->waitSlots;
+        q->waitSlots = i;
+        q->inflight++;
+        return TRUE;
+    default:
+        TraceError(DBG_IO, "unknown submission opcode %u", sqe->opcode);
+        PostCompletion(q, sqe->userData, STATUS_INVALID_PARAMETER, 0);
+        break;
+    }
+    return FALSE;
+}
+
+NTSTATUS SharedQueueEnter(IN WDFREQUEST request, IN DeviceContext* ctx, IN PFILE_CONTEXT file) {
+
+    PSHARED_QUEUE q = file->u.sharedQueue;
+    if (q == NULL) {
+        TraceError(DBG_IO, "shared queue not set up");
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    UINT32* flags = NULL;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(request, sizeof(UINT32), (PVOID*)&flags, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+    UINT32* consumed = NULL;
+    status = WdfRequestRetrieveOutputBuffer(request, sizeof(UINT32), (PVOID*)&consumed, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+    const UINT32 enterFlags = *flags;
+
+    // consume submissions while a completion slot is guaranteed for each of them
+    UINT32 count = 0;
+    BOOLEAN parkedEvents = FALSE;
+    WdfSpinLockAcquire(q->lock);
+    const UINT32 cqTailBefore = q->cqTail;
+    const UINT32 sqTail = q->header->sqTail;
+    MemoryBarrier(); // read entries only after observing the index
+    while ((q->sqHead != sqTail) &&
+           (q->inflight + (q->cqTail - q->header->cqHead) < XDMA_QUEUE_DEPTH)) {
+        XDMA_QUEUE_SQE sqe = q->sq[q->sqHead & SHARED_QUEUE_RING_MASK]; // copy - user may modify
+        q->sqHead++;
+        count++;
+        parkedEvents |= SubmitEntry(q, &sqe);
+    }
+    q->header->sqHead = q->sqHead;
+    BOOLEAN posted = (q->cqTail != cqTailBefore);
+    WdfSpinLockRelease(q->lock);
+
+    if (parkedEvents) { // events may have fired before
+        WdfSpinLockAcquire(ctx->eventLock);
+        posted |= ServiceQueueEvents(ctx, q);
+        WdfSpinLockRelease(ctx->eventLock);
+    }
+    if (posted) {
+        WakeWaiter(q);
+    }
+    *consumed = count;
+
+    if (enterFlags & XDMA_QUEUE_ENTER_WAIT) {
+        BOOLEAN parked = FALSE;
+        WdfSpinLockAcquire(q->lock);
+        if (q->cqTail == q->header->cqHead) { // nothing to reap - wait for the next completion
+            status = WdfRequestForwardToIoQueue(request, ctx->queueWaitQueue);
+            parked = NT_SUCCESS(status);
+        }
+        WdfSpinLockRelease(q->lock);
+        if (!NT_SUCCESS(status)) {
+            TraceError(DBG_IO, "WdfRequestForwardToIoQueue failed: %!STATUS!", status);
+            return status;
+        }
+        if (parked) {
+            return STATUS_SUCCESS;
+        }
+    }
+
+    WdfRequestCompleteWithInformation(request, STATUS_SUCCESS, sizeof(UINT32));
+    return STATUS_SUCCESS;
+}
+
+// ========================= setup and teardown ===================================================
+
+static VOID FreeSharedQueue(IN DeviceContext* ctx, IN PSHARED_QUEUE q) {
+    ReleaseEngines(ctx, q);
+    if (q->descBuffer != NULL) {
+        WdfObjectDelete(q->descBuffer);
+        q->descBuffer = NULL;
+    }
+    if (q->buffer != NULL) {
+        WdfObjectDelete(q->buffer);
+        q->buffer = NULL;
+    }
+}
+
+NTSTATUS SharedQueueSetup(IN WDFREQUEST request, IN DeviceContext* ctx, IN PFILE_CONTEXT file) {
+
+    PAGED_CODE();
+
+    if (file->devType != DEVNODE_TYPE_QUEUE) {
+        TraceError(DBG_IO, "shared queues only supported on the queue device");
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+    if (file->u.sharedQueue != NULL) {
+        TraceError(DBG_IO, "shared queue already set up on this file");
+        return STATUS_DEVICE_BUSY;
+    }
+
+    UINT32* engineMask = NULL;
+    NTSTATUS status = WdfRequestRetrieveInputBuffer(request, sizeof(UINT32), (PVOID*)&engineMask,
+                                                    NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveInputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+    XDMA_BAR_MAPPING* mapping = NULL;
+    status = WdfRequestRetrieveOutputBuffer(request, sizeof(XDMA_BAR_MAPPING), (PVOID*)&mapping, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfRequestRetrieveOutputBuffer failed: %!STATUS!", status);
+        return status;
+    }
+    if (*engineMask & ~(XDMA_QUEUE_ENGINE_C2H(XDMA_MAX_NUM_CHANNELS) - 1)) {
+        TraceError(DBG_IO, "invalid engine mask 0x%08x", *engineMask);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    // kernel state lives as long as the file object
+    WDFFILEOBJECT fileObject = WdfRequestGetFileObject(request);
+    WDF_OBJECT_ATTRIBUTES attribs;
+    WDF_OBJECT_ATTRIBUTES_INIT(&attribs);
+    attribs.ParentObject = fileObject;
+    WDFMEMORY memory;
+    PSHARED_QUEUE q = NULL;
+    status = WdfMemoryCreate(&attribs, NonPagedPoolNx, 0, sizeof(SHARED_QUEUE), &memory, (PVOID*)&q);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfMemoryCreate failed: %!STATUS!", status);
+        return status;
+    }
+    RtlZeroMemory(q, sizeof(SHARED_QUEUE));
+    q->ctx = ctx;
+    q->fileObject = fileObject;
+    q->waitSlots = SHARED_QUEUE_NO_SLOT;
+    q->freeSlots = SHARED_QUEUE_NO_SLOT;
+    for (LONG i = XDMA_QUEUE_DEPTH - 1; i >= 0; --i) {
+        SlotFree(q, i);
+    }
+    for (UINT dir = H2C; dir < 2; dir++) { // 0=H2C, 1=C2H
+        for (ULONG ch = 0; ch < XDMA_MAX_NUM_CHANNELS; ch++) {
+            q->engineHead[dir][ch] = SHARED_QUEUE_NO_SLOT;
+            q->engineTail[dir][ch] = SHARED_QUEUE_NO_SLOT;
+        }
+    }
+    status = WdfSpinLockCreate(&attribs, &q->lock);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfSpinLockCreate failed: %!STATUS!", status);
+        return status;
+    }
+
+    // rings and data area - physically contiguous, so dma needs no scatter/gather mapping
+    status = WdfCommonBufferCreate(ctx->xdma.dmaEnabler, XDMA_QUEUE_SIZE, WDF_NO_OBJECT_ATTRIBUTES,
+                                   &q->buffer);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfCommonBufferCreate failed: %!STATUS!", status);
+        goto ErrExit;
+    }
+    PUCHAR bufferVA = (PUCHAR)WdfCommonBufferGetAlignedVirtualAddress(q->buffer);
+    RtlZeroMemory(bufferVA, XDMA_QUEUE_SIZE);
+    q->header = (XDMA_QUEUE_HEADER*)bufferVA;
+    q->sq = (XDMA_QUEUE_SQE*)(bufferVA + XDMA_QUEUE_SQ_OFFSET);
+    q->cq = (XDMA_QUEUE_CQE*)(bufferVA + XDMA_QUEUE_CQ_OFFSET);
+    q->dataLA = WdfCommonBufferGetAlignedLogicalAddress(q->buffer);
+    q->dataLA.QuadPart += XDMA_QUEUE_DATA_OFFSET;
+
+    // descriptors must not be reachable from user-space
+    status = WdfCommonBufferCreate(ctx->xdma.dmaEnabler, PAGE_SIZE, WDF_NO_OBJECT_ATTRIBUTES,
+                                   &q->descBuffer);
+    if (!NT_SUCCESS(status)) {
+        TraceError(DBG_IO, "WdfCommonBufferCreate failed: %!STATUS!", status);
+        goto ErrExit;
+    }
+    RtlZeroMemory(WdfCommonBufferGetAlignedVirtualAddress(q->descBuffer), PAGE_SIZE);
+
+    for (UINT dir = H2C; dir < 2; dir++) { // 0=H2C, 1=C2H
+        for (ULONG ch = 0; ch < XDMA_MAX_NUM_CHANNELS; ch++) {
+            if (*engineMask & EngineBit((DirToDev)dir, ch)) {
+                status = ClaimEngine(ctx, q, (DirToDev)dir, ch);
+                if (!NT_SUCCESS(status)) {
+                    goto ErrExit;
+                }
+            }
+        }
+    }
+
+    PMDL mdl = IoAllocateMdl(bufferVA, XDMA_QUEUE_SIZE, FALSE, FALSE, NULL);
+    if (mdl == NULL) {
+        TraceError(DBG_IO, "IoAllocateMdl failed!");
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto ErrExit;
+    }
+    MmBuildMdlForNonPagedPool(mdl);
+    PVOID userAddr = NULL;
+    __try {
+        userAddr = MmMapLockedPagesSpecifyCache(mdl, UserMode, MmCached, NULL, FALSE,
+                                                NormalPagePriority | MdlMappingNoExecute);
+    } __except (EXCEPTION_EXECUTE_HANDLER) {
+        userAddr = NULL;
+    }
+    if (userAddr == NULL) {
+        TraceError(DBG_IO, "MmMapLockedPagesSpecifyCache failed!");
+        IoFreeMdl(mdl);
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto ErrExit;
+    }
+    FileSetUserMapping(file, mdl, userAddr);
+    file->u.sharedQueue = q;
+
+    WdfSpinLockAcquire(ctx->eventLock);
+    InsertTailList(&ctx->sharedQueues, &q->link);
+    WdfSpinLockRelease(ctx->eventLock);
+
+    mapping->address = (UINT64)userAddr;
+    mapping->length = XDMA_QUEUE_SIZE;
+    TraceInfo(DBG_IO, "shared queue mapped at user address 0x%p, engines=0x%08x",
+              userAddr, q->engineMask);
+    return status;
+
+ErrExit:
+    FreeSharedQueue(ctx, q);
+    return status;
+}
+
+VOID SharedQueueTeardown(IN DeviceContext* ctx, IN PFILE_CONTEXT file) {
+
+    PAGED_CODE();
+
+    PSHARED_QUEUE q = file->u.sharedQueue;
+    if (q == NULL) {
+        return;
+    }
+
+    // no more event completions
+    WdfSpinLockAcquire(ctx->eventLock);
+    RemoveEntryList(&q->link);
+    WdfSpinLockRelease(ctx->eventLock);
+
+    // let in-flight dma drain, queued submissions are dropped
+    WdfSpinLockAcquire(q->lock);
+    q->closing = TRUE;
+    WdfSpinLockRelease(q->lock);
+
+    LARGE_INTEGER delay;
+    delay.QuadPart = -10 * 1000; // 1ms
+    for (ULONG retries = 0; ; ++retries) {
+        BOOLEAN busy = FALSE;
+        WdfSpinLockAcquire(q->lock);
+        for (UINT dir = H2C; dir < 2; dir++) { // 0=H2C, 1=C2H
+            for (ULONG ch = 0; ch < XDMA_MAX_NUM_CHANNELS; ch++) {
+                busy |= (q->engineHead[dir][ch] != SHARED_QUEUE_NO_SLOT);
+            }
+        }
+        WdfSpinLockRelease(q->lock);
+        if (!busy && (q->callbacks == 0)) {
+            break;
+        }
+        if (retries >= 1000) { // dma did not finish within ~1s
+            TraceError(DBG_IO, "shared queue dma timed out, stopping engines");
+            for (UINT dir = H2C; dir < 2; dir++) { // 0=H2C, 1=C2H
+                for (ULONG ch = 0; ch < XDMA_MAX_NUM_CHANNELS; ch++) {
+                    if (q->engineMask & EngineBit((DirToDev)dir, ch)) {
+                        XDMA_ENGINE* engine = &(ctx->xdma.engines[ch][dir]);
+                        EngineStop(engine);
+                        InterlockedExchange(&engine->direct.busy, FALSE);
+                    }
+                }
+            }
+            break;
+        }
+        KeDelayExecutionThread(KernelMode, FALSE, &delay);
+    }
+
+    while (CompleteWaiter(q, STATUS_CANCELLED)) {
+        ; // no completion will arrive anymore
+    }
+    FreeSharedQueue(ctx, q);
+    file->u.sharedQueue = NULL;
+    TraceInfo(DBG_IO, "shared queue removed");
+}
@@ -0,0 +1,81 @@
+/*
+* XDMA Shared Submission/Completion Queues
+* ===============================
+*
+* Copyright 2017 Xilinx Inc.
+* Copyright 2010-2012 Sidebranch
+* Copyright 2010-2012 Leon Woestenberg <leon@sidebranch.com>
+*
+* Maintainer:
+* -----------
+* Alexander Hornburg <alexander.hornburg@xilinx.com>
+*
+* Description:
+* ------------
+* Kernel side of the rings described in xdma_queue.h. Submissions are consumed on the doorbell
+* IOCTL, completions are posted from the engine and user interrupt DPCs without a WDF request per
+* operation.
+*/
+
+#pragma once
+
+// ========================= include dependencies =================================================
+
+#include "driver.h"
+#include "file_io.h"
+
+// ========================= declarations =========================================================
+
+#define SHARED_QUEUE_NO_SLOT (-1)
+
+/// Kernel copy of a submission which has not completed yet
+typedef struct SHARED_QUEUE_SLOT_T {
+    XDMA_QUEUE_SQE sqe;
+    LONG next; // next slot in the same list, SHARED_QUEUE_NO_SLOT terminates
+} SHARED_QUEUE_SLOT;
+
+/// Kernel state of one shared queue, owned by an open queue device file
+typedef struct SHARED_QUEUE_T {
+    LIST_ENTRY link;                // entry in DeviceContext::sharedQueues, protected by eventLock
+    DeviceContext* ctx;
+    WDFFILEOBJECT fileObject;
+
+    // memory shared with the owning process
+    WDFCOMMONBUFFER buffer;
+    XDMA_QUEUE_HEADER* header;
+    XDMA_QUEUE_SQE* sq;
+    XDMA_QUEUE_CQE* cq;
+    PHYSICAL_ADDRESS dataLA;
+
+    // kernel-only descriptors, one per claimed engine
+    WDFCOMMONBUFFER descBuffer;
+    ULONG engineMask;               // XDMA_QUEUE_ENGINE_* bits of the claimed engines
+
+    // everything below is protected by lock
+    WDFSPINLOCK lock;
+    SHARED_QUEUE_SLOT slots[XDMA_QUEUE_DEPTH];
+    LONG freeSlots;                 // list of unused slots
+    LONG waitSlots;                 // list of parked event waits
+    LONG engineHead[2][XDMA_MAX_NUM_CHANNELS]; // fifo of dma submissions per engine
+    LONG engineTail[2][XDMA_MAX_NUM_CHANNELS];
+    ULONG inflight;                 // consumed submissions without completion
+    UINT32 sqHead;                  // kernel copy of header->sqHead
+    UINT32 cqTail;                  // kernel copy of header->cqTail
+    BOOLEAN closing;                // no further dma is started
+
+    volatile LONG callbacks;        // dma completion callbacks currently running
+} SHARED_QUEUE, *PSHARED_QUEUE;
+
+/// Allocate the rings, claim the requested engines and map the rings into the calling process.
+/// Must be called in the caller's context at PASSIVE_LEVEL.
+NTSTATUS SharedQueueSetup(IN WDFREQUEST request, IN DeviceContext* ctx, IN PFILE_CONTEXT file);
+
+/// Doorbell - consume all new submissions
+NTSTATUS SharedQueueEnter(IN WDFREQUEST request, IN DeviceContext* ctx, IN PFILE_CONTEXT file);
+
+/// Complete parked event waits of all shared queues. Called from the user interrupt DPC.
+VOID SharedQueueServiceEvents(IN DeviceContext* ctx);
+
+/// Drain in-flight dma, release the claimed engines and free the rings. PASSIVE_LEVEL only.
+/// The user mapping must have been removed before.
+VOID SharedQueueTeardown(IN DeviceContext* ctx, IN PFILE_CONTEXT file);